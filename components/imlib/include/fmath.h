@@ -17,7 +17,14 @@ float fast_cbrtf(float d);
 float fast_log(float x);
 float fast_log2(float x);
 float fast_powf(float a, float b);
-void fast_get_min_max(float *data, size_t data_len, float *p_min, float *p_max);
+void fast_get_min_max(const float *data, size_t data_len, float *p_min, float *p_max);
+void fast_get_min_max_i16(const int16_t *data, size_t data_len, int16_t *p_min, int16_t *p_max);
+
+// Array variants, written so that the compiler can vectorise them. out must not overlap the inputs.
+void fast_atan2f_n(const float *y, const float *x, float *out, size_t n);
+void fast_expf_n(const float *x, float *out, size_t n);
+void fast_log2_n(const float *x, float *out, size_t n);
+void fast_powf_n(const float *a, float b, float *out, size_t n);
 
 // Fast square root function
 static inline float fast_sqrtf(float x)
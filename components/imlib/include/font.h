@@ -2,6 +2,10 @@
 #define __FONT_H__
 
 #include <stdint.h>
+#include <stdbool.h>
+
+#define FONT_GLYPH_MAX_W 16
+#define FONT_GLYPH_MAX_H 16
 
 typedef struct
 {
@@ -10,8 +14,71 @@ typedef struct
     uint8_t *data;
 } glyph_t;
 
+/**
+ * Pre-rasterised glyph, see glyph_cache_get().
+ */
+typedef struct
+{
+    int16_t x_off;   // Offset of the bitmap from the centre of the glyph box.
+    int16_t y_off;
+    uint16_t w;      // Bitmap size after scaling and rotation.
+    uint16_t h;
+    uint16_t stride; // Bitmap row length in uint32_t words.
+    uint8_t bpp;     // 1, or 8 for the coverage (0 - 255) of anti-aliased glyphs.
+    uint8_t glyph_w; // Unscaled glyph size.
+    uint8_t glyph_h;
+    int8_t ink_x0;   // First/last inked column and row of the unscaled glyph, -1 if blank.
+    int8_t ink_x1;
+    int8_t ink_y0;
+    int8_t ink_y1;
+    uint32_t rows[]; // 1 bpp least significant bit first like PIXFORMAT_BINARY, or a byte per pixel.
+} glyph_bitmap_t;
+
+#define FONT_STORE_GLYPH_SIZE 32 // Bytes per 16x16 glyph in the font store.
+
 extern const unsigned char font_ascii_8x16[];
-extern const uint8_t unicode_font16x16_start[] asm("_binary_unicode_font16x16_bin_start");
-extern const uint8_t unicode_font16x16_end[] asm("_binary_unicode_font16x16_bin_end");
+// Sparse store of the used 16x16 glyphs, generated at build time by tools/font_pack.py.
+extern const uint8_t unicode_font_store_start[] asm("_binary_unicode_font_store_bin_start");
+extern const uint8_t unicode_font_store_end[] asm("_binary_unicode_font_store_bin_end");
+
+/**
+ * Rotate an offset clockwise (in image coordinates) by a multiple of 90 degrees.
+ */
+static inline void glyph_rotate(int rotation, int x, int y, int *rx, int *ry)
+{
+    switch (rotation & 3)
+    {
+        case 1:
+            {
+                *rx = -y;
+                *ry = x;
+                break;
+            }
+        case 2:
+            {
+                *rx = -x;
+                *ry = -y;
+                break;
+            }
+        case 3:
+            {
+                *rx = y;
+                *ry = -x;
+                break;
+            }
+        default:
+            {
+                *rx = x;
+                *ry = y;
+                break;
+            }
+    }
+}
+
+bool font_store_get(uint32_t unicode, uint8_t glyph[FONT_STORE_GLYPH_SIZE]);
+const glyph_bitmap_t *glyph_cache_get(uint32_t unicode, float scale, int rotation, bool hmirror, bool vflip, bool antialias);
+void glyph_cache_lock(void);
+void glyph_cache_unlock(void);
+void glyph_cache_clear(void);
 
 #endif // __FONT_H__
@@ -299,7 +299,7 @@ extern "C"
         COLOR_RGB888_TO_V(r, g, b);                                                                                                                                                                                                                                                                        \
     })
 
-    extern const int8_t lab_table[196608 / 2];
+    extern int8_t *lab_table; // Generated by imlib_lab_table_init(), NULL until then.
 
 #ifdef IMLIB_ENABLE_LAB_LUT
     #define COLOR_RGB565_TO_L(pixel) lab_table[((pixel >> 1) * 3) + 0]
@@ -311,6 +311,12 @@ extern "C"
     #define COLOR_RGB565_TO_B(pixel) imlib_rgb565_to_b(pixel)
 #endif
 
+    bool imlib_lab_table_init(void);
+    int8_t imlib_rgb565_to_l(uint16_t pixel);
+    int8_t imlib_rgb565_to_a(uint16_t pixel);
+    int8_t imlib_rgb565_to_b(uint16_t pixel);
+    uint16_t imlib_yuv_to_rgb(uint8_t y, int8_t u, int8_t v);
+
 #define COLOR_LAB_TO_RGB565(l, a, b) imlib_lab_to_rgb(l, a, b)
 #define COLOR_YUV_TO_RGB565(y, u, v) imlib_yuv_to_rgb((y) + 128, u, v)
 
@@ -467,6 +473,12 @@ PIXFORMAT_JPEG:
             uint8_t *pixels;
             uint8_t *data;
         };
+
+        struct imlib_dirty *dirty; // Optional damage tracking, see imlib_dirty_enable().
+        const rectangle_t *clip;   // Optional drawing clip, NULL draws to the whole image.
+        bool antialias;            // Blend the edges of lines, circles, ellipses and scaled text by their coverage.
+        int32_t stride;            // Optional bytes from one row to the next, 0 if the rows are packed.
+        point_t origin;            // Position of a view in the image it looks into, see imlib_image_view().
     } image_t;
 
 #define IMAGE_BINARY_LINE_LEN(image) (((image)->w + UINT32_T_MASK) >> UINT32_T_SHIFT)
@@ -478,12 +490,19 @@ PIXFORMAT_JPEG:
 #define IMAGE_RGB565_LINE_LEN(image) ((image)->w)
 #define IMAGE_RGB565_LINE_LEN_BYTES(image) (IMAGE_RGB565_LINE_LEN(image) * sizeof(uint16_t))
 
+// Bytes from one row to the next. A stride must be a multiple of the pixel size, or of 4 for BINARY.
+#define IMAGE_STRIDE_OR_PACKED(image, packed) (((image)->stride > 0) ? (image)->stride : (int32_t) (packed))
+#define IMAGE_BINARY_STRIDE(image) IMAGE_STRIDE_OR_PACKED(image, IMAGE_BINARY_LINE_LEN_BYTES(image))
+#define IMAGE_GRAYSCALE_STRIDE(image) IMAGE_STRIDE_OR_PACKED(image, IMAGE_GRAYSCALE_LINE_LEN_BYTES(image))
+#define IMAGE_RGB565_STRIDE(image) IMAGE_STRIDE_OR_PACKED(image, IMAGE_RGB565_LINE_LEN_BYTES(image))
+#define IMAGE_STRIDE(image) IMAGE_STRIDE_OR_PACKED(image, ((image)->pixfmt == PIXFORMAT_BINARY) ? IMAGE_BINARY_LINE_LEN_BYTES(image) : ((image)->w * (image)->bpp))
+
 #define IMAGE_GET_BINARY_PIXEL(image, x, y)                                                                                                                                                                                                                                                                \
     ({                                                                                                                                                                                                                                                                                                     \
         __typeof__(image) _image = (image);                                                                                                                                                                                                                                                                \
         __typeof__(x) _x = (x);                                                                                                                                                                                                                                                                            \
         __typeof__(y) _y = (y);                                                                                                                                                                                                                                                                            \
-        (((uint32_t *) _image->data)[(((_image->w + UINT32_T_MASK) >> UINT32_T_SHIFT) * _y) + (_x >> UINT32_T_SHIFT)] >> (_x & UINT32_T_MASK)) & 1;                                                                                                                                                        \
+        (((uint32_t *) (_image->data + (IMAGE_BINARY_STRIDE(_image) * _y)))[_x >> UINT32_T_SHIFT] >> (_x & UINT32_T_MASK)) & 1;                                                                                                                                                                            \
     })
 
 #define IMAGE_PUT_BINARY_PIXEL(image, x, y, v)                                                                                                                                                                                                                                                             \
@@ -492,9 +511,10 @@ PIXFORMAT_JPEG:
         __typeof__(x) _x = (x);                                                                                                                                                                                                                                                                            \
         __typeof__(y) _y = (y);                                                                                                                                                                                                                                                                            \
         __typeof__(v) _v = (v);                                                                                                                                                                                                                                                                            \
-        size_t _i = (((_image->w + UINT32_T_MASK) >> UINT32_T_SHIFT) * _y) + (_x >> UINT32_T_SHIFT);                                                                                                                                                                                                       \
+        uint32_t *_row = (uint32_t *) (_image->data + (IMAGE_BINARY_STRIDE(_image) * _y));                                                                                                                                                                                                                 \
+        size_t _i = _x >> UINT32_T_SHIFT;                                                                                                                                                                                                                                                                  \
         size_t _j = _x & UINT32_T_MASK;                                                                                                                                                                                                                                                                    \
-        ((uint32_t *) _image->data)[_i] = (((uint32_t *) _image->data)[_i] & (~(1 << _j))) | ((_v & 1) << _j);                                                                                                                                                                                             \
+        _row[_i] = (_row[_i] & (~(1 << _j))) | ((_v & 1) << _j);                                                                                                                                                                                                                                           \
     })
 
 #define IMAGE_CLEAR_BINARY_PIXEL(image, x, y)                                                                                                                                                                                                                                                              \
@@ -502,7 +522,7 @@ PIXFORMAT_JPEG:
         __typeof__(image) _image = (image);                                                                                                                                                                                                                                                                \
         __typeof__(x) _x = (x);                                                                                                                                                                                                                                                                            \
         __typeof__(y) _y = (y);                                                                                                                                                                                                                                                                            \
-        ((uint32_t *) _image->data)[(((_image->w + UINT32_T_MASK) >> UINT32_T_SHIFT) * _y) + (_x >> UINT32_T_SHIFT)] &= ~(1 << (_x & UINT32_T_MASK));                                                                                                                                                      \
+        ((uint32_t *) (_image->data + (IMAGE_BINARY_STRIDE(_image) * _y)))[_x >> UINT32_T_SHIFT] &= ~(1 << (_x & UINT32_T_MASK));                                                                                                                                                                          \
     })
 
 #define IMAGE_SET_BINARY_PIXEL(image, x, y)                                                                                                                                                                                                                                                                \
@@ -510,7 +530,7 @@ PIXFORMAT_JPEG:
         __typeof__(image) _image = (image);                                                                                                                                                                                                                                                                \
         __typeof__(x) _x = (x);                                                                                                                                                                                                                                                                            \
         __typeof__(y) _y = (y);                                                                                                                                                                                                                                                                            \
-        ((uint32_t *) _image->data)[(((_image->w + UINT32_T_MASK) >> UINT32_T_SHIFT) * _y) + (_x >> UINT32_T_SHIFT)] |= 1 << (_x & UINT32_T_MASK);                                                                                                                                                         \
+        ((uint32_t *) (_image->data + (IMAGE_BINARY_STRIDE(_image) * _y)))[_x >> UINT32_T_SHIFT] |= 1 << (_x & UINT32_T_MASK);                                                                                                                                                                             \
     })
 
 #define IMAGE_GET_GRAYSCALE_PIXEL(image, x, y)                                                                                                                                                                                                                                                             \
@@ -518,7 +538,7 @@ PIXFORMAT_JPEG:
         __typeof__(image) _image = (image);                                                                                                                                                                                                                                                                \
         __typeof__(x) _x = (x);                                                                                                                                                                                                                                                                            \
         __typeof__(y) _y = (y);                                                                                                                                                                                                                                                                            \
-        ((uint8_t *) _image->data)[(_image->w * _y) + _x];                                                                                                                                                                                                                                                 \
+        ((uint8_t *) (_image->data + (IMAGE_GRAYSCALE_STRIDE(_image) * _y)))[_x];                                                                                                                                                                                                                          \
     })
 
 #define IMAGE_PUT_GRAYSCALE_PIXEL(image, x, y, v)                                                                                                                                                                                                                                                          \
@@ -527,7 +547,7 @@ PIXFORMAT_JPEG:
         __typeof__(x) _x = (x);                                                                                                                                                                                                                                                                            \
         __typeof__(y) _y = (y);                                                                                                                                                                                                                                                                            \
         __typeof__(v) _v = (v);                                                                                                                                                                                                                                                                            \
-        ((uint8_t *) _image->data)[(_image->w * _y) + _x] = _v;                                                                                                                                                                                                                                            \
+        ((uint8_t *) (_image->data + (IMAGE_GRAYSCALE_STRIDE(_image) * _y)))[_x] = _v;                                                                                                                                                                                                                     \
     })
 
 #define IMAGE_GET_RGB565_PIXEL(image, x, y)                                                                                                                                                                                                                                                                \
@@ -535,7 +555,7 @@ PIXFORMAT_JPEG:
         __typeof__(image) _image = (image);                                                                                                                                                                                                                                                                \
         __typeof__(x) _x = (x);                                                                                                                                                                                                                                                                            \
         __typeof__(y) _y = (y);                                                                                                                                                                                                                                                                            \
-        ((uint16_t *) _image->data)[(_image->w * _y) + _x];                                                                                                                                                                                                                                                \
+        ((uint16_t *) (_image->data + (IMAGE_RGB565_STRIDE(_image) * _y)))[_x];                                                                                                                                                                                                                            \
     })
 
 #define IMAGE_PUT_RGB565_PIXEL(image, x, y, v)                                                                                                                                                                                                                                                             \
@@ -544,7 +564,7 @@ PIXFORMAT_JPEG:
         __typeof__(x) _x = (x);                                                                                                                                                                                                                                                                            \
         __typeof__(y) _y = (y);                                                                                                                                                                                                                                                                            \
         __typeof__(v) _v = (v);                                                                                                                                                                                                                                                                            \
-        ((uint16_t *) _image->data)[(_image->w * _y) + _x] = _v;                                                                                                                                                                                                                                           \
+        ((uint16_t *) (_image->data + (IMAGE_RGB565_STRIDE(_image) * _y)))[_x] = _v;                                                                                                                                                                                                                       \
     })
 
 #define IMAGE_GET_YUV_PIXEL(image, x, y)                                                                                                                                                                                                                                                                   \
@@ -552,7 +572,7 @@ PIXFORMAT_JPEG:
         __typeof__(image) _image = (image);                                                                                                                                                                                                                                                                \
         __typeof__(x) _x = (x);                                                                                                                                                                                                                                                                            \
         __typeof__(y) _y = (y);                                                                                                                                                                                                                                                                            \
-        ((uint16_t *) _image->data)[(_image->w * _y) + _x];                                                                                                                                                                                                                                                \
+        ((uint16_t *) (_image->data + (IMAGE_RGB565_STRIDE(_image) * _y)))[_x];                                                                                                                                                                                                                            \
     })
 
 #define IMAGE_PUT_YUV_PIXEL(image, x, y, v)                                                                                                                                                                                                                                                                \
@@ -561,7 +581,7 @@ PIXFORMAT_JPEG:
         __typeof__(x) _x = (x);                                                                                                                                                                                                                                                                            \
         __typeof__(y) _y = (y);                                                                                                                                                                                                                                                                            \
         __typeof__(v) _v = (v);                                                                                                                                                                                                                                                                            \
-        ((uint16_t *) _image->data)[(_image->w * _y) + _x] = _v;                                                                                                                                                                                                                                           \
+        ((uint16_t *) (_image->data + (IMAGE_RGB565_STRIDE(_image) * _y)))[_x] = _v;                                                                                                                                                                                                                       \
     })
 
 #define IMAGE_GET_BAYER_PIXEL(image, x, y)                                                                                                                                                                                                                                                                 \
@@ -569,7 +589,7 @@ PIXFORMAT_JPEG:
         __typeof__(image) _image = (image);                                                                                                                                                                                                                                                                \
         __typeof__(x) _x = (x);                                                                                                                                                                                                                                                                            \
         __typeof__(y) _y = (y);                                                                                                                                                                                                                                                                            \
-        ((uint8_t *) _image->data)[(_image->w * _y) + _x];                                                                                                                                                                                                                                                 \
+        ((uint8_t *) (_image->data + (IMAGE_GRAYSCALE_STRIDE(_image) * _y)))[_x];                                                                                                                                                                                                                          \
     })
 
 #define IMAGE_PUT_BAYER_PIXEL(image, x, y, v)                                                                                                                                                                                                                                                              \
@@ -578,7 +598,7 @@ PIXFORMAT_JPEG:
         __typeof__(x) _x = (x);                                                                                                                                                                                                                                                                            \
         __typeof__(y) _y = (y);                                                                                                                                                                                                                                                                            \
         __typeof__(v) _v = (v);                                                                                                                                                                                                                                                                            \
-        ((uint8_t *) _image->data)[(_image->w * _y) + _x] = _v;                                                                                                                                                                                                                                            \
+        ((uint8_t *) (_image->data + (IMAGE_GRAYSCALE_STRIDE(_image) * _y)))[_x] = _v;                                                                                                                                                                                                                     \
     })
 
     // Fast Stuff //
@@ -587,7 +607,7 @@ PIXFORMAT_JPEG:
     ({                                                                                                                                                                                                                                                                                                     \
         __typeof__(image) _image = (image);                                                                                                                                                                                                                                                                \
         __typeof__(y) _y = (y);                                                                                                                                                                                                                                                                            \
-        ((uint32_t *) _image->data) + (((_image->w + UINT32_T_MASK) >> UINT32_T_SHIFT) * _y);                                                                                                                                                                                                              \
+        (uint32_t *) (_image->data + (IMAGE_BINARY_STRIDE(_image) * _y));                                                                                                                                                                                                                                  \
     })
 
 #define IMAGE_GET_BINARY_PIXEL_FAST(row_ptr, x)                                                                                                                                                                                                                                                            \
@@ -625,7 +645,7 @@ PIXFORMAT_JPEG:
     ({                                                                                                                                                                                                                                                                                                     \
         __typeof__(image) _image = (image);                                                                                                                                                                                                                                                                \
         __typeof__(y) _y = (y);                                                                                                                                                                                                                                                                            \
-        ((uint8_t *) _image->data) + (_image->w * _y);                                                                                                                                                                                                                                                     \
+        (uint8_t *) (_image->data + (IMAGE_GRAYSCALE_STRIDE(_image) * _y));                                                                                                                                                                                                                                \
     })
 
 #define IMAGE_GET_GRAYSCALE_PIXEL_FAST(row_ptr, x)                                                                                                                                                                                                                                                         \
@@ -647,7 +667,7 @@ PIXFORMAT_JPEG:
     ({                                                                                                                                                                                                                                                                                                     \
         __typeof__(image) _image = (image);                                                                                                                                                                                                                                                                \
         __typeof__(y) _y = (y);                                                                                                                                                                                                                                                                            \
-        ((uint16_t *) _image->data) + (_image->w * _y);                                                                                                                                                                                                                                                    \
+        (uint16_t *) (_image->data + (IMAGE_RGB565_STRIDE(_image) * _y));                                                                                                                                                                                                                                  \
     })
 
 #define IMAGE_GET_RGB565_PIXEL_FAST(row_ptr, x)                                                                                                                                                                                                                                                            \
@@ -669,14 +689,14 @@ PIXFORMAT_JPEG:
     ({                                                                                                                                                                                                                                                                                                     \
         __typeof__(image) _image = (image);                                                                                                                                                                                                                                                                \
         __typeof__(y) _y = (y);                                                                                                                                                                                                                                                                            \
-        ((uint8_t *) _image->data) + (_image->w * _y);                                                                                                                                                                                                                                                     \
+        (uint8_t *) (_image->data + (IMAGE_GRAYSCALE_STRIDE(_image) * _y));                                                                                                                                                                                                                                \
     })
 
 #define IMAGE_COMPUTE_YUV_PIXEL_ROW_PTR(image, y)                                                                                                                                                                                                                                                          \
     ({                                                                                                                                                                                                                                                                                                     \
         __typeof__(image) _image = (image);                                                                                                                                                                                                                                                                \
         __typeof__(y) _y = (y);                                                                                                                                                                                                                                                                            \
-        ((uint16_t *) _image->data) + (_image->w * _y);                                                                                                                                                                                                                                                    \
+        (uint16_t *) (_image->data + (IMAGE_RGB565_STRIDE(_image) * _y));                                                                                                                                                                                                                                  \
     })
 
     typedef enum {
@@ -726,19 +746,243 @@ PIXFORMAT_JPEG:
         FRAMESIZE_WQXGA2, // 2592x1944
     } framesize_t;
 
+#define IMLIB_CACHE_LINE_SIZE 128            // L2 cache line of the ESP32-P4, allocated rows are padded to it.
+#define IMLIB_IMAGE_INTERNAL_MAX (32 * 1024) // Largest image that IMLIB_ALLOC_AUTO puts into internal SRAM.
+
+    // Where imlib_image_alloc() should put the pixels. The other memory is used if that fails.
+    typedef enum {
+        IMLIB_ALLOC_AUTO,     // Internal SRAM up to IMLIB_IMAGE_INTERNAL_MAX bytes, SPIRAM above.
+        IMLIB_ALLOC_INTERNAL, // Internal SRAM, for small images that are accessed a lot.
+        IMLIB_ALLOC_SPIRAM,   // SPIRAM, for frame buffers and large images.
+    } imlib_alloc_hint_t;
+
+    bool imlib_image_alloc(image_t *img, int w, int h, pixformat_t pixfmt, imlib_alloc_hint_t hint);
+    void imlib_image_free(image_t *img);
+    image_t imlib_image_view(const image_t *parent, const rectangle_t *r);
+
     //=======================================================================================
     // draw functions
     //=======================================================================================
     int imlib_get_pixel(image_t *img, int x, int y);
     int imlib_get_pixel_fast(image_t *img, const void *row_ptr, int x);
     void imlib_set_pixel(image_t *img, int x, int y, int p);
+    void imlib_blend_pixel(image_t *img, int x, int y, int c, int alpha);
+    void imlib_draw_hline(image_t *img, int x0, int x1, int y, int c);
+    void imlib_draw_vline(image_t *img, int x, int y0, int y1, int c);
+    typedef enum imlib_line_cap
+    {
+        IMLIB_LINE_CAP_BUTT,   // Ends at the end points.
+        IMLIB_LINE_CAP_SQUARE, // Extends half the width beyond the end points.
+        IMLIB_LINE_CAP_ROUND,  // Half a disc around the end points, joins polylines seamlessly.
+    } imlib_line_cap_t;
+
     void imlib_draw_line(image_t *img, int x0, int y0, int x1, int y1, int c, int thickness);
+    void imlib_draw_capped_line(image_t *img, int x0, int y0, int x1, int y1, int c, int thickness, imlib_line_cap_t cap);
     void imlib_draw_arrow(image_t *img, int x0, int y0, int x1, int y1, int c, int th, int size);
     void imlib_draw_rectangle(image_t *img, int rx, int ry, int rw, int rh, int c, int thickness, bool fill);
+    void imlib_draw_rounded_rectangle(image_t *img, int rx, int ry, int rw, int rh, int radius, int c, int thickness, bool fill);
+
+    typedef enum imlib_fill_rule
+    {
+        IMLIB_FILL_EVEN_ODD, // Inside where a ray to the outside crosses an odd number of edges.
+        IMLIB_FILL_NON_ZERO, // Inside where the edges wind around a non zero number of times.
+    } imlib_fill_rule_t;
+
+    bool imlib_fill_polygon(image_t *img, const point_t *points, int count, int c, imlib_fill_rule_t rule);
+    void imlib_draw_polygon(image_t *img, const point_t *points, int count, int c, int thickness);
     void imlib_draw_circle(image_t *img, int cx, int cy, int r, int c, int thickness, bool fill);
     void imlib_draw_ellipse(image_t *img, int cx, int cy, int rx, int ry, int rotation, int c, int thickness, bool fill);
     void imlib_draw_string(image_t *img, int x_off, int y_off, const char *str, int c, float scale, int x_spacing, int y_spacing, bool mono_space, int char_rotation, bool char_hmirror, bool char_vflip, int string_rotation, bool string_hmirror, bool string_hflip);
 
+    //=======================================================================================
+    // Dirty Rectangle Stuff
+    //=======================================================================================
+#define IMLIB_DIRTY_MAX_RECTS 16     // Rectangles kept before the cheapest pair is merged.
+#define IMLIB_DIRTY_MERGE_SLACK 1024 // Wasted pixels accepted to merge two rectangles instead of flushing both.
+
+    typedef struct imlib_dirty
+    {
+        int count;
+        rectangle_t rects[IMLIB_DIRTY_MAX_RECTS];
+    } imlib_dirty_t;
+
+    void imlib_dirty_enable(image_t *img, imlib_dirty_t *dirty);
+    void imlib_dirty_disable(image_t *img);
+    void imlib_dirty_add(image_t *img, int x, int y, int w, int h);
+    void imlib_dirty_add_all(image_t *img);
+    int imlib_dirty_flush(image_t *img, rectangle_t *rects, int max_rects);
+
+    //=======================================================================================
+    // Display List Stuff
+    //=======================================================================================
+#define IMLIB_DLIST_TILE_BYTES (128 * 1024) // Framebuffer bytes per tile, half of the 256 KB L2 cache.
+
+    typedef struct imlib_dlist
+    {
+        struct imlib_dlist_cmd *cmds;
+        int count;
+        int capacity;
+        char *text; // Copies of the recorded strings.
+        size_t text_len;
+        size_t text_capacity;
+    } imlib_dlist_t;
+
+    void imlib_dlist_init(imlib_dlist_t *list);
+    void imlib_dlist_free(imlib_dlist_t *list);
+    void imlib_dlist_clear(imlib_dlist_t *list);
+    bool imlib_dlist_line(imlib_dlist_t *list, int x0, int y0, int x1, int y1, int c, int thickness);
+    bool imlib_dlist_rectangle(imlib_dlist_t *list, int rx, int ry, int rw, int rh, int c, int thickness, bool fill);
+    bool imlib_dlist_circle(imlib_dlist_t *list, int cx, int cy, int r, int c, int thickness, bool fill);
+    bool imlib_dlist_ellipse(imlib_dlist_t *list, int cx, int cy, int rx, int ry, int rotation, int c, int thickness, bool fill);
+    bool imlib_dlist_string(imlib_dlist_t *list, int x_off, int y_off, const char *str, int c, float scale, int x_spacing, int y_spacing, bool mono_space, int char_rotation, bool char_hmirror, bool char_vflip, int string_rotation, bool string_hmirror, bool string_vflip);
+    int imlib_dlist_tile_rows(const image_t *img);
+    void imlib_dlist_execute(const imlib_dlist_t *list, image_t *img);
+
+    // Tile binning, shared by the serial and the parallel executor.
+    typedef struct imlib_dlist_bins
+    {
+        int tile_rows;
+        int tiles;
+        int *start; // Offset in cmds of the first command of every tile, plus the end.
+        int *cmds;  // Command indices of all tiles, in recording order within a tile.
+    } imlib_dlist_bins_t;
+
+    bool imlib_dlist_bin(const imlib_dlist_t *list, const image_t *img, imlib_dlist_bins_t *bins);
+    void imlib_dlist_bins_free(imlib_dlist_bins_t *bins);
+    void imlib_dlist_execute_tile(const imlib_dlist_t *list, const imlib_dlist_bins_t *bins, image_t *img, int tile);
+    void imlib_dlist_execute_parallel(const imlib_dlist_t *list, image_t *img, int threads);
+
+    //=======================================================================================
+    // Parallel Stuff
+    //=======================================================================================
+#define IMLIB_PARALLEL_MIN_PIXELS (64 * 1024) // Smallest output worth splitting over the cores.
+
+    // Processes the rows [y0, y1) of a band, returns false on failure.
+    typedef bool (*imlib_band_fn_t)(void *ctx, int y0, int y1);
+
+    bool imlib_parallel_bands(int rows, int threads, imlib_band_fn_t fn, void *ctx);
+
+    //=======================================================================================
+    // Conversion Stuff
+    //=======================================================================================
+    bool imlib_convert_supported(pixformat_t src_pixfmt, pixformat_t dst_pixfmt);
+    bool imlib_convert_strided(const void *src, int src_stride, pixformat_t src_pixfmt, void *dst, int dst_stride, pixformat_t dst_pixfmt, int w, int h);
+    bool imlib_convert(const image_t *src, image_t *dst);
+
+    //=======================================================================================
+    // Binary Stuff
+    //=======================================================================================
+    bool imlib_binary_threshold(const image_t *src, image_t *dst, const color_thresholds_list_lnk_data_t *thresholds, int count, bool invert);
+    bool imlib_binary_and(image_t *img, const image_t *other);
+    bool imlib_binary_or(image_t *img, const image_t *other);
+    bool imlib_binary_xor(image_t *img, const image_t *other);
+    bool imlib_binary_not(image_t *img);
+    bool imlib_binary_erode(image_t *img, int ksize);
+    bool imlib_binary_dilate(image_t *img, int ksize);
+    bool imlib_binary_open(image_t *img, int ksize);
+    bool imlib_binary_close(image_t *img, int ksize);
+    int imlib_binary_count(const image_t *img, const rectangle_t *roi);
+    void imlib_binary_count_rows(const image_t *img, int *counts);
+
+    //=======================================================================================
+    // JPEG Stuff
+    //=======================================================================================
+#define IMLIB_JPEG_SCALED_SIZE(size, scale) (((size) + (1 << (scale)) - 1) >> (scale))
+
+    // Reads up to len bytes into buf, returns the number of bytes read and 0 at the end of the data.
+    typedef int (*imlib_jpeg_read_t)(void *ctx, uint8_t *buf, int len);
+
+    typedef struct imlib_jpeg_dec
+    {
+        int w; // Full size of the image, set by imlib_jpeg_dec_init().
+        int h;
+        struct imlib_jpeg_state *state;
+    } imlib_jpeg_dec_t;
+
+    bool imlib_jpeg_dec_init(imlib_jpeg_dec_t *dec, imlib_jpeg_read_t read, void *ctx);
+    bool imlib_jpeg_dec_run(imlib_jpeg_dec_t *dec, image_t *dst, int scale);
+    void imlib_jpeg_dec_free(imlib_jpeg_dec_t *dec);
+
+    // Writes len bytes from buf, returns the number of bytes written.
+    typedef int (*imlib_jpeg_write_t)(void *ctx, const uint8_t *buf, int len);
+
+    bool imlib_jpeg_encode(const image_t *src, int quality, imlib_jpeg_write_t write, void *ctx);
+
+    //=======================================================================================
+    // Resize Stuff
+    //=======================================================================================
+    typedef enum {
+        IMLIB_RESIZE_NEAREST,  // Nearest source pixel.
+        IMLIB_RESIZE_BILINEAR, // Bilinear interpolation of the 4 nearest source pixels.
+        IMLIB_RESIZE_AREA,     // Average of the source pixels covered by the output pixel, downscaling only.
+    } imlib_resize_t;
+
+    bool imlib_resize(const image_t *src, image_t *dst, imlib_resize_t mode);
+    bool imlib_rotate(const image_t *src, image_t *dst, int rotation, bool hmirror, bool vflip);
+
+    //=======================================================================================
+    // Statistics Stuff
+    //=======================================================================================
+    typedef struct imlib_channel_stats
+    {
+        float mean;
+        float stdev;
+        int min;
+        int max;
+        int median;
+        int lq; // Lower quartile.
+        int uq; // Upper quartile.
+        int mode;
+    } imlib_channel_stats_t;
+
+    typedef struct imlib_statistics
+    {
+        int channels;                   // 1 for Y, 3 for L, A and B.
+        uint32_t count;                 // Pixels counted.
+        int bin_min[3];                 // Value of the first bin of each channel.
+        uint32_t bins[3][256];          // Histogram of each channel, bins[c][v - bin_min[c]].
+        imlib_channel_stats_t stats[3]; // Summary of each channel.
+    } imlib_statistics_t;
+
+    bool imlib_get_statistics(const image_t *img, const rectangle_t *roi, imlib_statistics_t *stats);
+    int imlib_statistics_percentile(const imlib_statistics_t *stats, int channel, float percentile);
+
+    //=======================================================================================
+    // Blob Stuff
+    //=======================================================================================
+    typedef struct imlib_blob
+    {
+        rectangle_t rect;   // Bounding box.
+        float cx, cy;       // Centroid.
+        uint32_t pixels;    // Pixel count.
+        float rotation;     // Clockwise angle of the major axis from the x axis, 0 - pi radians.
+        int64_t moments[5]; // Sums of x, y, x * x, y * y and x * y over the pixels, for merging.
+    } imlib_blob_t;
+
+    int imlib_find_blobs(const image_t *img, const rectangle_t *roi, const color_thresholds_list_lnk_data_t *thresholds, int count, bool invert, int pixels_threshold, int area_threshold, int margin, imlib_blob_t *blobs, int max_blobs);
+
+    //=======================================================================================
+    // Detection Stuff
+    //=======================================================================================
+    int imlib_nms(bounding_box_lnk_data_t *boxes, int count, float min_score, float iou_threshold, bool per_label);
+    bool imlib_draw_boxes(image_t *img, const bounding_box_lnk_data_t *boxes, int count, int c, int thickness, const char *const *labels, const int *colors, int label_count, int threads);
+
+    //=======================================================================================
+    // Filter Stuff
+    //=======================================================================================
+    typedef struct imlib_integral
+    {
+        int w, h;
+        uint32_t *data; // (w + 1) x (h + 1) sums, the first row and column are zero.
+    } imlib_integral_t;
+
+    bool imlib_integral_build(const image_t *src, imlib_integral_t *sum);
+    void imlib_integral_free(imlib_integral_t *sum);
+    uint32_t imlib_integral_sum(const imlib_integral_t *sum, int x, int y, int w, int h);
+    bool imlib_box_blur(const image_t *src, image_t *dst, int ksize);
+    bool imlib_gaussian_blur(const image_t *src, image_t *dst, int ksize, float sigma);
+    bool imlib_gradient(const image_t *src, image_t *mag, image_t *angle, bool scharr);
+
     // void imlib_draw_char_8x16(image_t *fb, int32_t start_x, int32_t start_y, uint8_t ch, uint32_t color);
     // void imlib_draw_char_16x16(image_t *fb, int32_t start_x, int32_t start_y, uint32_t code, uint32_t color);
     // void imlib_draw_string(image_t *fb, uint16_t x, uint16_t y, const char *str, uint32_t color);
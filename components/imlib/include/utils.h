@@ -13,6 +13,9 @@ extern "C"
 #endif
 
     int image_jpg_read(image_t **img_out, char *path);
+    int image_jpg_read_scaled(image_t **img_out, const char *path, int scale);
+    void image_jpg_free(image_t *img);
+    int image_jpg_write(const image_t *img, const char *path, int quality);
 
     int utf8_to_unicode(const char *utf8_in, uint64_t *unicode_out);
 
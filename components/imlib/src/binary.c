@@ -0,0 +1,510 @@
+/*****************************************************************************
+ binary
+
+ Operations that produce or work on PIXFORMAT_BINARY masks. Binary rows are
+ packed 32 pixels to a word, LSB first, and everything here works on whole
+ words. The padding bits after the last pixel of a row are always left clear.
+
+ Thresholding first folds the whole threshold list into a membership bitmap
+ with one bit per possible source value (2 for binary, 256 for grayscale and
+ 32768 for RGB565, which has the same resolution as the LAB table), so the
+ per pixel work is a single table lookup whatever the number of thresholds.
+
+*****************************************************************************/
+#include "imlib.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define BINARY_RGB565_KEYS 32768 // RGB565 values with the lowest blue bit dropped, as in the LAB table.
+
+typedef enum
+{
+    BINARY_OP_AND,
+    BINARY_OP_OR,
+    BINARY_OP_XOR,
+    BINARY_OP_NOT,
+} binary_op_t;
+
+/**
+ * Mask of the bits of the last word of a row that hold pixels.
+ */
+static inline uint32_t binary_tail_mask(int w)
+{
+    return (w & UINT32_T_MASK) ? ((1u << (w & UINT32_T_MASK)) - 1) : 0xFFFFFFFF;
+}
+
+static inline uint32_t binary_lut_get(const uint32_t *lut, uint32_t key)
+{
+    return (lut[key >> UINT32_T_SHIFT] >> (key & UINT32_T_MASK)) & 1;
+}
+
+/**
+ * Fill the membership bitmap, a key is set when any threshold matches it.
+ * @param keys: number of bits in lut, all of them are written.
+ */
+static void binary_lut_build(uint32_t *lut, int keys, uint32_t pixfmt, const color_thresholds_list_lnk_data_t *thresholds, int count, bool invert)
+{
+    bool have_table = (pixfmt == PIXFORMAT_RGB565) && imlib_lab_table_init();
+
+    for (int key = 0; key < keys; key += 32)
+    {
+        uint32_t word = 0;
+        for (int i = 0; i < 32; i++)
+        {
+            int l, a = 0, b = 0;
+            if (pixfmt == PIXFORMAT_RGB565)
+            {
+                if (have_table)
+                {
+                    l = (uint8_t) lab_table[((key + i) * 3) + 0];
+                    a = lab_table[((key + i) * 3) + 1];
+                    b = lab_table[((key + i) * 3) + 2];
+                }
+                else
+                {
+                    l = (uint8_t) imlib_rgb565_to_l((key + i) << 1);
+                    a = imlib_rgb565_to_a((key + i) << 1);
+                    b = imlib_rgb565_to_b((key + i) << 1);
+                }
+            }
+            else
+            {
+                l = key + i;
+            }
+
+            for (int t = 0; t < count; t++)
+            {
+                const color_thresholds_list_lnk_data_t *th = &thresholds[t];
+                bool in = (th->LMin <= l) && (l <= th->LMax);
+                if (pixfmt == PIXFORMAT_RGB565)
+                {
+                    in = in && (th->AMin <= a) && (a <= th->AMax) && (th->BMin <= b) && (b <= th->BMax);
+                }
+
+                if (in ^ invert)
+                {
+                    word |= 1u << i;
+                    break;
+                }
+            }
+        }
+        lut[key >> UINT32_T_SHIFT] = word;
+    }
+}
+
+/**
+ * Threshold a whole image into a binary mask. A pixel is set when it is inside any of the
+ * thresholds (outside, with invert). RGB565 pixels are compared in LAB, the other formats
+ * only use LMin and LMax, with binary pixels being 0 or 1 as in COLOR_THRESHOLD_BINARY.
+ * @param src: binary, grayscale or RGB565 source.
+ * @param dst: binary image of the same size as src.
+ * @param thresholds: list of count thresholds.
+ * @return: false if the formats or sizes are not supported or the bitmap could not be allocated.
+ */
+bool imlib_binary_threshold(const image_t *src, image_t *dst, const color_thresholds_list_lnk_data_t *thresholds, int count, bool invert)
+{
+    if ((dst->pixfmt != PIXFORMAT_BINARY) || (dst->w != src->w) || (dst->h != src->h))
+    {
+        return false;
+    }
+
+    int keys;
+    switch (src->pixfmt)
+    {
+        case PIXFORMAT_BINARY:
+            {
+                keys = 32;
+                break;
+            }
+        case PIXFORMAT_GRAYSCALE:
+            {
+                keys = 256;
+                break;
+            }
+        case PIXFORMAT_RGB565:
+            {
+                keys = BINARY_RGB565_KEYS;
+                break;
+            }
+        default:
+            {
+                return false;
+            }
+    }
+
+    uint32_t *lut = (uint32_t *) malloc(keys / 8);
+    if (lut == NULL)
+    {
+        return false;
+    }
+
+    binary_lut_build(lut, keys, src->pixfmt, thresholds, count, invert);
+
+    for (int y = 0; y < src->h; y++)
+    {
+        uint32_t *d = IMAGE_COMPUTE_BINARY_PIXEL_ROW_PTR(dst, y);
+
+        for (int x = 0; x < src->w; x += 32)
+        {
+            int n = IM_MIN(src->w - x, 32);
+            uint32_t word = 0;
+            switch (src->pixfmt)
+            {
+                case PIXFORMAT_BINARY:
+                    {
+                        // Both possible values map a bit to itself or to its complement.
+                        uint32_t s = IMAGE_COMPUTE_BINARY_PIXEL_ROW_PTR(src, y)[x >> UINT32_T_SHIFT];
+                        word = (-binary_lut_get(lut, 1) & s) | (-binary_lut_get(lut, 0) & ~s);
+                        word &= (n == 32) ? 0xFFFFFFFF : ((1u << n) - 1);
+                        break;
+                    }
+                case PIXFORMAT_GRAYSCALE:
+                    {
+                        const uint8_t *s = IMAGE_COMPUTE_GRAYSCALE_PIXEL_ROW_PTR(src, y) + x;
+                        for (int i = 0; i < n; i++)
+                        {
+                            word |= binary_lut_get(lut, s[i]) << i;
+                        }
+                        break;
+                    }
+                default:
+                    {
+                        const uint16_t *s = IMAGE_COMPUTE_RGB565_PIXEL_ROW_PTR(src, y) + x;
+                        for (int i = 0; i < n; i++)
+                        {
+                            word |= binary_lut_get(lut, s[i] >> 1) << i;
+                        }
+                        break;
+                    }
+            }
+            d[x >> UINT32_T_SHIFT] = (n == 32) ? word : ((d[x >> UINT32_T_SHIFT] & ~binary_tail_mask(n)) | word);
+        }
+    }
+
+    free(lut);
+    imlib_dirty_add_all(dst);
+    return true;
+}
+
+static bool binary_logic(image_t *img, const image_t *other, binary_op_t op)
+{
+    if ((img->pixfmt != PIXFORMAT_BINARY) || ((other != NULL) && ((other->pixfmt != PIXFORMAT_BINARY) || (other->w != img->w) || (other->h != img->h))))
+    {
+        return false;
+    }
+
+    int words = IMAGE_BINARY_LINE_LEN(img);
+    uint32_t tail = binary_tail_mask(img->w);
+
+    for (int y = 0; y < img->h; y++)
+    {
+        uint32_t *d = IMAGE_COMPUTE_BINARY_PIXEL_ROW_PTR(img, y);
+        const uint32_t *s = (other != NULL) ? IMAGE_COMPUTE_BINARY_PIXEL_ROW_PTR(other, y) : NULL;
+        uint32_t keep = d[words - 1] & ~tail; // Bits past the last pixel, they can belong to the parent of a view.
+
+        switch (op)
+        {
+            case BINARY_OP_AND:
+                {
+                    for (int i = 0; i < words; i++)
+                    {
+                        d[i] &= s[i];
+                    }
+                    break;
+                }
+            case BINARY_OP_OR:
+                {
+                    for (int i = 0; i < words; i++)
+                    {
+                        d[i] |= s[i];
+                    }
+                    break;
+                }
+            case BINARY_OP_XOR:
+                {
+                    for (int i = 0; i < words; i++)
+                    {
+                        d[i] ^= s[i];
+                    }
+                    break;
+                }
+            case BINARY_OP_NOT:
+                {
+                    for (int i = 0; i < words; i++)
+                    {
+                        d[i] = ~d[i];
+                    }
+                    break;
+                }
+        }
+        d[words - 1] = (d[words - 1] & tail) | keep;
+    }
+
+    imlib_dirty_add_all(img);
+    return true;
+}
+
+/**
+ * img = img AND other, a word at a time.
+ * @param other: binary image of the same size as img.
+ * @return: false if either image is not binary or the sizes differ.
+ */
+bool imlib_binary_and(image_t *img, const image_t *other)
+{
+    return binary_logic(img, other, BINARY_OP_AND);
+}
+
+/**
+ * img = img OR other, see imlib_binary_and().
+ */
+bool imlib_binary_or(image_t *img, const image_t *other)
+{
+    return binary_logic(img, other, BINARY_OP_OR);
+}
+
+/**
+ * img = img XOR other, see imlib_binary_and().
+ */
+bool imlib_binary_xor(image_t *img, const image_t *other)
+{
+    return binary_logic(img, other, BINARY_OP_XOR);
+}
+
+/**
+ * Invert every pixel of a binary image.
+ */
+bool imlib_binary_not(image_t *img)
+{
+    return binary_logic(img, NULL, BINARY_OP_NOT);
+}
+
+/**
+ * Shift a packed row by d pixels: bit x of dst is bit (x + d) of src, bits from outside the row are fill.
+ */
+static void binary_row_shift(uint32_t *dst, const uint32_t *src, int words, int d, uint32_t fill)
+{
+    int ws = abs(d) >> UINT32_T_SHIFT;
+    int bs = abs(d) & UINT32_T_MASK;
+
+    for (int i = 0; i < words; i++)
+    {
+        if (d >= 0)
+        {
+            int j = i + ws;
+            uint32_t lo = (j < words) ? src[j] : fill;
+            uint32_t hi = ((j + 1) < words) ? src[j + 1] : fill;
+            dst[i] = bs ? ((lo >> bs) | (hi << (32 - bs))) : lo;
+        }
+        else
+        {
+            int j = i - ws;
+            uint32_t hi = (j >= 0) ? src[j] : fill;
+            uint32_t lo = ((j - 1) >= 0) ? src[j - 1] : fill;
+            dst[i] = bs ? ((hi << bs) | (lo >> (32 - bs))) : hi;
+        }
+    }
+}
+
+/**
+ * Combine every pixel of a packed row with the k pixels after it (dir 1) or before it (dir -1).
+ * The window length is doubled every pass, so this takes log2(k + 1) + 1 passes.
+ * @param fill: identity of the operation, 0 for OR and all ones for AND.
+ */
+static void binary_row_window(uint32_t *row, uint32_t *tmp, int words, int k, int dir, uint32_t fill)
+{
+    int len = 1;
+    while (len <= k)
+    {
+        int step = IM_MIN(len, (k + 1) - len);
+        binary_row_shift(tmp, row, words, dir * step, fill);
+        for (int i = 0; i < words; i++)
+        {
+            row[i] = fill ? (row[i] & tmp[i]) : (row[i] | tmp[i]);
+        }
+        len += step;
+    }
+}
+
+/**
+ * Square structuring element of size (2 * ksize + 1), separated into a horizontal pass that
+ * works on whole words and a vertical pass that combines whole rows. Pixels outside the image
+ * do not take part, so erosion does not eat into the image from its borders.
+ */
+static bool binary_morph(image_t *img, int ksize, bool erode)
+{
+    if (img->pixfmt != PIXFORMAT_BINARY)
+    {
+        return false;
+    }
+
+    if ((ksize <= 0) || (img->w <= 0) || (img->h <= 0))
+    {
+        return true;
+    }
+
+    int words = IMAGE_BINARY_LINE_LEN(img);
+    int ring_rows = IM_MIN((2 * ksize) + 1, img->h);
+    uint32_t fill = erode ? 0xFFFFFFFF : 0;
+    uint32_t tail = binary_tail_mask(img->w);
+
+    // Horizontally filtered rows y - ksize ... y + ksize, plus a row of scratch.
+    uint32_t *ring = (uint32_t *) malloc((ring_rows + 1) * words * sizeof(uint32_t));
+    if (ring == NULL)
+    {
+        return false;
+    }
+    uint32_t *tmp = ring + (ring_rows * words);
+
+    int next = 0; // Next row to filter horizontally.
+    for (int y = 0; y < img->h; y++)
+    {
+        int last = IM_MIN(y + ksize, img->h - 1);
+        for (; next <= last; next++)
+        {
+            uint32_t *r = ring + ((next % ring_rows) * words);
+            memcpy(r, IMAGE_COMPUTE_BINARY_PIXEL_ROW_PTR(img, next), words * sizeof(uint32_t));
+            r[words - 1] = (r[words - 1] & tail) | (fill & ~tail);
+            binary_row_window(r, tmp, words, ksize, 1, fill);
+            binary_row_window(r, tmp, words, ksize, -1, fill);
+        }
+
+        // Row y is not read again, the rows still needed are all in the ring.
+        uint32_t *d = IMAGE_COMPUTE_BINARY_PIXEL_ROW_PTR(img, y);
+        uint32_t keep = d[words - 1] & ~tail;
+        int first = IM_MAX(y - ksize, 0);
+        memcpy(d, ring + ((first % ring_rows) * words), words * sizeof(uint32_t));
+        for (int r = first + 1; r <= last; r++)
+        {
+            const uint32_t *s = ring + ((r % ring_rows) * words);
+            if (erode)
+            {
+                for (int i = 0; i < words; i++)
+                {
+                    d[i] &= s[i];
+                }
+            }
+            else
+            {
+                for (int i = 0; i < words; i++)
+                {
+                    d[i] |= s[i];
+                }
+            }
+        }
+        d[words - 1] = (d[words - 1] & tail) | keep;
+    }
+
+    free(ring);
+    imlib_dirty_add_all(img);
+    return true;
+}
+
+/**
+ * Erode a binary image in place: a pixel stays set only if all pixels within ksize of it are set.
+ * @param ksize: half size of the square kernel, 1 is a 3x3 kernel.
+ * @return: false if img is not binary or there is not enough memory.
+ */
+bool imlib_binary_erode(image_t *img, int ksize)
+{
+    return binary_morph(img, ksize, true);
+}
+
+/**
+ * Dilate a binary image in place: a pixel is set if any pixel within ksize of it is set.
+ * @param ksize: half size of the square kernel, 1 is a 3x3 kernel.
+ * @return: false if img is not binary or there is not enough memory.
+ */
+bool imlib_binary_dilate(image_t *img, int ksize)
+{
+    return binary_morph(img, ksize, false);
+}
+
+/**
+ * Erode then dilate, removes set specks smaller than the kernel.
+ */
+bool imlib_binary_open(image_t *img, int ksize)
+{
+    return binary_morph(img, ksize, true) && binary_morph(img, ksize, false);
+}
+
+/**
+ * Dilate then erode, fills clear holes smaller than the kernel.
+ */
+bool imlib_binary_close(image_t *img, int ksize)
+{
+    return binary_morph(img, ksize, false) && binary_morph(img, ksize, true);
+}
+
+/**
+ * Count the set pixels in a region of a binary image.
+ * @param roi: region to count in, clipped to the image. NULL counts the whole image.
+ */
+int imlib_binary_count(const image_t *img, const rectangle_t *roi)
+{
+    int x0 = 0, y0 = 0, x1 = img->w, y1 = img->h;
+    if (roi != NULL)
+    {
+        x0 = IM_MAX(roi->x, 0);
+        y0 = IM_MAX(roi->y, 0);
+        x1 = IM_MIN(roi->x + roi->w, img->w);
+        y1 = IM_MIN(roi->y + roi->h, img->h);
+    }
+
+    if ((x0 >= x1) || (y0 >= y1))
+    {
+        return 0;
+    }
+
+    int w0 = x0 >> UINT32_T_SHIFT;
+    int w1 = (x1 - 1) >> UINT32_T_SHIFT;
+    uint32_t first_mask = 0xFFFFFFFF << (x0 & UINT32_T_MASK);
+    uint32_t last_mask = binary_tail_mask(x1);
+    if (w0 == w1)
+    {
+        first_mask &= last_mask;
+    }
+
+    int count = 0;
+    for (int y = y0; y < y1; y++)
+    {
+        const uint32_t *s = IMAGE_COMPUTE_BINARY_PIXEL_ROW_PTR(img, y);
+        count += __builtin_popcount(s[w0] & first_mask);
+        if (w0 != w1)
+        {
+            for (int i = w0 + 1; i < w1; i++)
+            {
+                count += __builtin_popcount(s[i]);
+            }
+            count += __builtin_popcount(s[w1] & last_mask);
+        }
+    }
+
+    return count;
+}
+
+/**
+ * Count the set pixels of every row of a binary image.
+ * @param counts: img->h counts, one per row.
+ */
+void imlib_binary_count_rows(const image_t *img, int *counts)
+{
+    if (img->w <= 0)
+    {
+        memset(counts, 0, IM_MAX(img->h, 0) * sizeof(int));
+        return;
+    }
+
+    int words = IMAGE_BINARY_LINE_LEN(img);
+    uint32_t tail = binary_tail_mask(img->w);
+
+    for (int y = 0; y < img->h; y++)
+    {
+        const uint32_t *s = IMAGE_COMPUTE_BINARY_PIXEL_ROW_PTR(img, y);
+        int count = 0;
+        for (int i = 0; i < (words - 1); i++)
+        {
+            count += __builtin_popcount(s[i]);
+        }
+        counts[y] = count + __builtin_popcount(s[words - 1] & tail);
+    }
+}
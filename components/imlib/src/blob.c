@@ -0,0 +1,440 @@
+/*****************************************************************************
+ blob
+
+ Connected components of the pixels that match a list of color thresholds.
+ The region is thresholded into a binary mask with the membership table of
+ imlib_binary_threshold(), then every mask row is run length encoded, 32
+ pixels at a time, and its runs are joined to the touching (8-connected)
+ runs of the row above with a union-find. A component carries the sums of
+ its pixel moments, so the work after thresholding is linear in the number
+ of runs rather than the number of pixels. Only the runs of two rows are
+ kept, and a component is finished as soon as a row does not extend it, so
+ the labels never outnumber the runs of two rows.
+
+*****************************************************************************/
+#include "imlib.h"
+#include "fmath.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct blob_run
+{
+    int x0, x1; // Pixels [x0, x1) of the row.
+    int label;
+} blob_run_t;
+
+typedef struct blob_node
+{
+    int parent;
+    int last_y; // Last mask row with a run of the component, only valid for roots.
+    // In image coordinates.
+    int min_x, max_x, min_y, max_y;
+    uint32_t pixels;
+    int64_t sum_x, sum_y, sum_xx, sum_yy, sum_xy;
+} blob_node_t;
+
+typedef struct blob_state
+{
+    blob_node_t *nodes;
+    int *free_list; // Unused labels.
+    int free_count;
+    int *merged; // Labels that stopped being roots in the current row.
+    int merged_count;
+    imlib_blob_t *blobs;
+    int max_blobs;
+    int count;
+    int pixels_threshold;
+    int area_threshold;
+} blob_state_t;
+
+static int blob_find(blob_node_t *nodes, int label)
+{
+    while (nodes[label].parent != label)
+    {
+        nodes[label].parent = nodes[nodes[label].parent].parent;
+        label = nodes[label].parent;
+    }
+    return label;
+}
+
+static int blob_new(blob_state_t *s, int y)
+{
+    int label = s->free_list[--s->free_count];
+    blob_node_t *n = &s->nodes[label];
+    memset(n, 0, sizeof(*n));
+    n->parent = label;
+    n->last_y = y;
+    n->min_x = n->min_y = INT32_MAX;
+    n->max_x = n->max_y = -1;
+    return label;
+}
+
+/**
+ * Add the pixels [x0, x1) of row y, in image coordinates, to a component.
+ */
+static void blob_add_run(blob_node_t *n, int x0, int x1, int y)
+{
+    int64_t count = x1 - x0;
+    int64_t sum_x = (count * (x0 + x1 - 1)) / 2;
+    // Sum of x * x over [x0, x1) from the sums of squares up to x1 - 1 and x0 - 1.
+    int64_t a = x0 - 1, b = x1 - 1;
+    int64_t sum_xx = ((b * (b + 1) * ((2 * b) + 1)) - (a * (a + 1) * ((2 * a) + 1))) / 6;
+
+    n->pixels += count;
+    n->sum_x += sum_x;
+    n->sum_y += count * y;
+    n->sum_xx += sum_xx;
+    n->sum_yy += count * y * y;
+    n->sum_xy += sum_x * y;
+    n->min_x = IM_MIN(n->min_x, x0);
+    n->max_x = IM_MAX(n->max_x, x1 - 1);
+    n->min_y = IM_MIN(n->min_y, y);
+    n->max_y = IM_MAX(n->max_y, y);
+}
+
+static void blob_merge_node(blob_node_t *dst, const blob_node_t *src)
+{
+    dst->pixels += src->pixels;
+    dst->sum_x += src->sum_x;
+    dst->sum_y += src->sum_y;
+    dst->sum_xx += src->sum_xx;
+    dst->sum_yy += src->sum_yy;
+    dst->sum_xy += src->sum_xy;
+    dst->min_x = IM_MIN(dst->min_x, src->min_x);
+    dst->max_x = IM_MAX(dst->max_x, src->max_x);
+    dst->min_y = IM_MIN(dst->min_y, src->min_y);
+    dst->max_y = IM_MAX(dst->max_y, src->max_y);
+    dst->last_y = IM_MAX(dst->last_y, src->last_y);
+}
+
+static int blob_union(blob_state_t *s, int a, int b)
+{
+    a = blob_find(s->nodes, a);
+    b = blob_find(s->nodes, b);
+    if (a != b)
+    {
+        blob_merge_node(&s->nodes[a], &s->nodes[b]);
+        s->nodes[b].parent = a;
+        s->merged[s->merged_count++] = b;
+    }
+    return a;
+}
+
+/**
+ * Fill in the centroid and orientation of a blob from the moment sums of its pixels.
+ */
+static void blob_from_node(const blob_node_t *n, imlib_blob_t *blob)
+{
+    // Central moments are taken in double: sum_x * sum_x overflows int64 on large blobs, and in float
+    // the sums of squares cancel out. The raw sums stay below 2^53, so they convert exactly.
+    int64_t count = n->pixels;
+    double mean_x = (double) n->sum_x / count;
+    double mean_y = (double) n->sum_y / count;
+    float mxx = (float) ((double) n->sum_xx - (n->sum_x * mean_x));
+    float myy = (float) ((double) n->sum_yy - (n->sum_y * mean_y));
+    float mxy = (float) ((double) n->sum_xy - (n->sum_x * mean_y));
+
+    blob->rect.x = n->min_x;
+    blob->rect.y = n->min_y;
+    blob->rect.w = n->max_x - n->min_x + 1;
+    blob->rect.h = n->max_y - n->min_y + 1;
+    blob->cx = (float) n->sum_x / count;
+    blob->cy = (float) n->sum_y / count;
+    blob->pixels = n->pixels;
+    // Clockwise angle of the major axis as y points down. fast_atan2f() returns 0 - 2 pi, so this is 0 - pi.
+    blob->rotation = ((mxy == 0.0f) && (mxx == myy)) ? 0.0f : (fast_atan2f(2.0f * mxy, mxx - myy) * 0.5f);
+    blob->moments[0] = n->sum_x;
+    blob->moments[1] = n->sum_y;
+    blob->moments[2] = n->sum_xx;
+    blob->moments[3] = n->sum_yy;
+    blob->moments[4] = n->sum_xy;
+}
+
+static bool blob_passes(const blob_state_t *s, const imlib_blob_t *blob)
+{
+    return (blob->pixels >= (uint32_t) s->pixels_threshold) && ((blob->rect.w * blob->rect.h) >= s->area_threshold);
+}
+
+/**
+ * Add a finished blob to the output. When the output is full the blob replaces the smallest
+ * one if it has more pixels, so the result is the largest max_blobs blobs.
+ */
+static void blob_emit(blob_state_t *s, const blob_node_t *n)
+{
+    imlib_blob_t blob;
+    blob_from_node(n, &blob);
+
+    if (!blob_passes(s, &blob))
+    {
+        return;
+    }
+
+    if (s->count < s->max_blobs)
+    {
+        s->blobs[s->count++] = blob;
+        return;
+    }
+
+    int smallest = 0;
+    for (int i = 1; i < s->count; i++)
+    {
+        smallest = (s->blobs[i].pixels < s->blobs[smallest].pixels) ? i : smallest;
+    }
+
+    if ((s->count > 0) && (blob.pixels > s->blobs[smallest].pixels))
+    {
+        s->blobs[smallest] = blob;
+    }
+}
+
+/**
+ * Run length encode a mask row.
+ * @return: number of runs written to runs, all with label -1.
+ */
+static int blob_row_runs(const uint32_t *row, int w, blob_run_t *runs)
+{
+    int n = 0;
+    int words = (w + UINT32_T_MASK) >> UINT32_T_SHIFT;
+    bool open = false;
+
+    for (int i = 0; i < words; i++)
+    {
+        uint32_t word = row[i];
+        int base = i << UINT32_T_SHIFT;
+        if ((i == (words - 1)) && (w & UINT32_T_MASK))
+        {
+            word &= (1u << (w & UINT32_T_MASK)) - 1;
+        }
+
+        // Find the edges of the word, flipping it after every one so that the next edge is the
+        // next set bit.
+        uint32_t bits = open ? ~word : word;
+        while (bits != 0)
+        {
+            int x = base + __builtin_ctz(bits);
+            if (!open)
+            {
+                runs[n].x0 = x;
+            }
+            else
+            {
+                runs[n].x1 = x;
+                runs[n++].label = -1;
+            }
+            open = !open;
+            // Look for the opposite edge above this one.
+            bits = ~bits & ~((2u << (x - base)) - 1);
+        }
+    }
+
+    if (open)
+    {
+        runs[n].x1 = w;
+        runs[n++].label = -1;
+    }
+
+    return n;
+}
+
+/**
+ * Merge blobs whose bounding boxes are within margin pixels of each other, until no two are.
+ */
+static int blob_merge_close(imlib_blob_t *blobs, int count, int margin)
+{
+    bool merged = true;
+    while (merged)
+    {
+        merged = false;
+        for (int i = 0; i < count; i++)
+        {
+            for (int j = i + 1; j < count; j++)
+            {
+                rectangle_t *a = &blobs[i].rect, *b = &blobs[j].rect;
+                // Gap between the boxes in pixels along each axis, negative when they overlap.
+                int gap_x = IM_MAX(a->x - (b->x + b->w), b->x - (a->x + a->w));
+                int gap_y = IM_MAX(a->y - (b->y + b->h), b->y - (a->y + a->h));
+                if (IM_MAX(gap_x, gap_y) > margin)
+                {
+                    continue;
+                }
+
+                // The moments are in image coordinates, so they simply add up.
+                blob_node_t n = {
+                    .min_x = IM_MIN(a->x, b->x),
+                    .max_x = IM_MAX(a->x + a->w, b->x + b->w) - 1,
+                    .min_y = IM_MIN(a->y, b->y),
+                    .max_y = IM_MAX(a->y + a->h, b->y + b->h) - 1,
+                    .pixels = blobs[i].pixels + blobs[j].pixels,
+                    .sum_x = blobs[i].moments[0] + blobs[j].moments[0],
+                    .sum_y = blobs[i].moments[1] + blobs[j].moments[1],
+                    .sum_xx = blobs[i].moments[2] + blobs[j].moments[2],
+                    .sum_yy = blobs[i].moments[3] + blobs[j].moments[3],
+                    .sum_xy = blobs[i].moments[4] + blobs[j].moments[4],
+                };
+                blob_from_node(&n, &blobs[i]);
+                blobs[j--] = blobs[--count];
+                merged = true;
+            }
+        }
+    }
+
+    return count;
+}
+
+/**
+ * Find the connected groups (8-connected) of pixels inside any of the thresholds.
+ * @param img: binary, grayscale or RGB565 image, thresholded as by imlib_binary_threshold().
+ * @param roi: region to search, clipped to the image. NULL for the whole image.
+ * @param pixels_threshold: blobs with fewer pixels are dropped.
+ * @param area_threshold: blobs with a smaller bounding box are dropped.
+ * @param margin: blobs with bounding boxes this close (0 for touching) are merged into one. A
+ *                negative margin turns merging off.
+ * @param blobs: output, in image coordinates. The moments are image coordinate sums too.
+ * @param max_blobs: size of blobs. If there are more, the ones with the most pixels are kept.
+ * @return: the number of blobs, -1 if the format is not supported or there is not enough memory.
+ *          Memory use is a mask of the region plus per column bookkeeping, whatever the content.
+ */
+int imlib_find_blobs(const image_t *img, const rectangle_t *roi, const color_thresholds_list_lnk_data_t *thresholds, int count, bool invert, int pixels_threshold, int area_threshold, int margin, imlib_blob_t *blobs, int max_blobs)
+{
+    if ((img->pixfmt != PIXFORMAT_BINARY) && (img->pixfmt != PIXFORMAT_GRAYSCALE) && (img->pixfmt != PIXFORMAT_RGB565))
+    {
+        return -1;
+    }
+
+    rectangle_t r = {0, 0, img->w, img->h};
+    if (roi != NULL)
+    {
+        int x0 = IM_MAX(roi->x, 0), y0 = IM_MAX(roi->y, 0);
+        int x1 = IM_MIN(roi->x + roi->w, img->w), y1 = IM_MIN(roi->y + roi->h, img->h);
+        r = (rectangle_t) {x0, y0, IM_MAX(x1 - x0, 0), IM_MAX(y1 - y0, 0)};
+    }
+
+    if ((r.w <= 0) || (r.h <= 0) || (max_blobs <= 0))
+    {
+        return 0;
+    }
+
+    // Binary views must start on a word, so the mask then starts up to 31 pixels early.
+    int skip = (img->pixfmt == PIXFORMAT_BINARY) ? (r.x & UINT32_T_MASK) : 0;
+    rectangle_t mr = {r.x - skip, r.y, r.w + skip, r.h};
+    image_t view = imlib_image_view(img, &mr);
+    image_t mask;
+    if (!imlib_image_alloc(&mask, mr.w, mr.h, PIXFORMAT_BINARY, IMLIB_ALLOC_AUTO))
+    {
+        return -1;
+    }
+
+    // A row has at most w / 2 + 1 runs, and every live label is referenced by a run of the
+    // previous or the current row, so two rows worth of labels are enough.
+    int max_runs = (mr.w / 2) + 1;
+    int max_labels = 2 * max_runs;
+    blob_run_t *runs = (blob_run_t *) malloc(2 * max_runs * sizeof(blob_run_t));
+    blob_node_t *nodes = (blob_node_t *) malloc(max_labels * sizeof(blob_node_t));
+    int *lists = (int *) malloc(2 * max_labels * sizeof(int));
+    if ((runs == NULL) || (nodes == NULL) || (lists == NULL) || !imlib_binary_threshold(&view, &mask, thresholds, count, invert))
+    {
+        free(runs);
+        free(nodes);
+        free(lists);
+        imlib_image_free(&mask);
+        return -1;
+    }
+
+    blob_state_t s = {
+        .nodes = nodes,
+        .free_list = lists,
+        .free_count = max_labels,
+        .merged = lists + max_labels,
+        .blobs = blobs,
+        .max_blobs = max_blobs,
+        .pixels_threshold = pixels_threshold,
+        .area_threshold = area_threshold,
+    };
+
+    for (int i = 0; i < max_labels; i++)
+    {
+        lists[i] = max_labels - 1 - i;
+    }
+
+    blob_run_t *prev = runs, *cur = runs + max_runs;
+    int prev_n = 0;
+
+    for (int y = 0; y <= mask.h; y++)
+    {
+        int cur_n = 0;
+        if (y < mask.h)
+        {
+            uint32_t *row = IMAGE_COMPUTE_BINARY_PIXEL_ROW_PTR(&mask, y);
+            if (skip)
+            {
+                // Pixels left of the region only exist because of the word alignment.
+                row[0] &= ~((1u << skip) - 1);
+            }
+            cur_n = blob_row_runs(row, mask.w, cur);
+        }
+
+        // Both rows are sorted, so one sweep finds all pairs of runs that touch, diagonals included.
+        s.merged_count = 0;
+        for (int i = 0, j = 0; i < cur_n; i++)
+        {
+            while ((j < prev_n) && (prev[j].x1 < cur[i].x0))
+            {
+                j++;
+            }
+
+            for (int k = j; (k < prev_n) && (prev[k].x0 <= cur[i].x1); k++)
+            {
+                cur[i].label = (cur[i].label < 0) ? blob_find(nodes, prev[k].label) : blob_union(&s, cur[i].label, prev[k].label);
+            }
+
+            if (cur[i].label < 0)
+            {
+                cur[i].label = blob_new(&s, y);
+            }
+            blob_node_t *n = &nodes[blob_find(nodes, cur[i].label)];
+            blob_add_run(n, mr.x + cur[i].x0, mr.x + cur[i].x1, mr.y + y);
+            n->last_y = y;
+        }
+
+        // Components of the previous row that this row did not extend are complete.
+        for (int k = 0; k < prev_n; k++)
+        {
+            int root = blob_find(nodes, prev[k].label);
+            if (nodes[root].last_y == (y - 1))
+            {
+                blob_emit(&s, &nodes[root]);
+                nodes[root].last_y = -2; // Emitted, its label is freed below.
+                s.merged[s.merged_count++] = root;
+            }
+        }
+
+        // Point the runs at their roots so the labels that were merged away can be reused.
+        for (int i = 0; i < cur_n; i++)
+        {
+            cur[i].label = blob_find(nodes, cur[i].label);
+        }
+
+        for (int i = 0; i < s.merged_count; i++)
+        {
+            s.free_list[s.free_count++] = s.merged[i];
+        }
+
+        blob_run_t *t = prev;
+        prev = cur;
+        cur = t;
+        prev_n = cur_n;
+    }
+
+    free(runs);
+    free(nodes);
+    free(lists);
+    imlib_image_free(&mask);
+
+    // Blobs are filtered before merging, merging only makes them larger.
+    if (margin >= 0)
+    {
+        s.count = blob_merge_close(blobs, s.count, margin);
+    }
+
+    return s.count;
+}
@@ -0,0 +1,667 @@
+/*****************************************************************************
+ convert
+
+ Bulk pixel format conversion. Every conversion runs a row at a time. The
+ common pairs have their own branch free kernels, the other pairs decode the
+ source row to RGB888 and encode that into the destination format.
+
+*****************************************************************************/
+#include "imlib.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef void (*convert_row_t)(const void *restrict src, void *restrict dst, int w);
+
+static inline int convert_clamp8(int v)
+{
+    return (v < 0) ? 0 : ((v > 255) ? 255 : v);
+}
+
+/**
+ * Convert a YUV value to RGB565.
+ * @param y: luma, 0 - 255.
+ * @param u, v: signed chroma, -128 - 127.
+ */
+uint16_t imlib_yuv_to_rgb(uint8_t y, int8_t u, int8_t v)
+{
+    int r = convert_clamp8(y + ((91881 * v) >> 16));
+    int g = convert_clamp8(y - (((22554 * u) + (46802 * v)) >> 16));
+    int b = convert_clamp8(y + ((116130 * u) >> 16));
+    return COLOR_R8_G8_B8_TO_RGB565(r, g, b);
+}
+
+static inline uint16_t convert_y_to_rgb565(uint32_t y)
+{
+    return ((y >> 3) * 0x0801) + ((y << 3) & 0x7E0);
+}
+
+//=======================================================================================
+// Direct kernels
+//=======================================================================================
+
+// COLOR_RGB565_TO_Y() split into the terms of the high and the low byte of the pixel, they are
+// exact because the 8-bit expansion of G only depends on its top bits. Constant, so that the
+// kernels can run on several threads without initialising them, see tools/y_tables.py.
+static const uint16_t y_table_hi[256] = {
+    0, 2400, 4875, 7275, 9750, 12150, 14625, 17025, 304, 2704, 5179, 7579, 10054, 12454, 14929, 17329,
+    608, 3008, 5483, 7883, 10358, 12758, 15233, 17633, 912, 3312, 5787, 8187, 10662, 13062, 15537, 17937,
+    1254, 3654, 6129, 8529, 11004, 13404, 15879, 18279, 1558, 3958, 6433, 8833, 11308, 13708, 16183, 18583,
+    1862, 4262, 6737, 9137, 11612, 14012, 16487, 18887, 2166, 4566, 7041, 9441, 11916, 14316, 16791, 19191,
+    2508, 4908, 7383, 9783, 12258, 14658, 17133, 19533, 2812, 5212, 7687, 10087, 12562, 14962, 17437, 19837,
+    3116, 5516, 7991, 10391, 12866, 15266, 17741, 20141, 3420, 5820, 8295, 10695, 13170, 15570, 18045, 20445,
+    3762, 6162, 8637, 11037, 13512, 15912, 18387, 20787, 4066, 6466, 8941, 11341, 13816, 16216, 18691, 21091,
+    4370, 6770, 9245, 11645, 14120, 16520, 18995, 21395, 4674, 7074, 9549, 11949, 14424, 16824, 19299, 21699,
+    5016, 7416, 9891, 12291, 14766, 17166, 19641, 22041, 5320, 7720, 10195, 12595, 15070, 17470, 19945, 22345,
+    5624, 8024, 10499, 12899, 15374, 17774, 20249, 22649, 5928, 8328, 10803, 13203, 15678, 18078, 20553, 22953,
+    6270, 8670, 11145, 13545, 16020, 18420, 20895, 23295, 6574, 8974, 11449, 13849, 16324, 18724, 21199, 23599,
+    6878, 9278, 11753, 14153, 16628, 19028, 21503, 23903, 7182, 9582, 12057, 14457, 16932, 19332, 21807, 24207,
+    7524, 9924, 12399, 14799, 17274, 19674, 22149, 24549, 7828, 10228, 12703, 15103, 17578, 19978, 22453, 24853,
+    8132, 10532, 13007, 15407, 17882, 20282, 22757, 25157, 8436, 10836, 13311, 15711, 18186, 20586, 23061, 25461,
+    8778, 11178, 13653, 16053, 18528, 20928, 23403, 25803, 9082, 11482, 13957, 16357, 18832, 21232, 23707, 26107,
+    9386, 11786, 14261, 16661, 19136, 21536, 24011, 26411, 9690, 12090, 14565, 16965, 19440, 21840, 24315, 26715,
+};
+
+static const uint16_t y_table_lo[256] = {
+    0, 120, 240, 360, 495, 615, 735, 855, 990, 1110, 1230, 1350, 1485, 1605, 1725, 1845,
+    1980, 2100, 2220, 2340, 2475, 2595, 2715, 2835, 2970, 3090, 3210, 3330, 3465, 3585, 3705, 3825,
+    300, 420, 540, 660, 795, 915, 1035, 1155, 1290, 1410, 1530, 1650, 1785, 1905, 2025, 2145,
+    2280, 2400, 2520, 2640, 2775, 2895, 3015, 3135, 3270, 3390, 3510, 3630, 3765, 3885, 4005, 4125,
+    600, 720, 840, 960, 1095, 1215, 1335, 1455, 1590, 1710, 1830, 1950, 2085, 2205, 2325, 2445,
+    2580, 2700, 2820, 2940, 3075, 3195, 3315, 3435, 3570, 3690, 3810, 3930, 4065, 4185, 4305, 4425,
+    900, 1020, 1140, 1260, 1395, 1515, 1635, 1755, 1890, 2010, 2130, 2250, 2385, 2505, 2625, 2745,
+    2880, 3000, 3120, 3240, 3375, 3495, 3615, 3735, 3870, 3990, 4110, 4230, 4365, 4485, 4605, 4725,
+    1200, 1320, 1440, 1560, 1695, 1815, 1935, 2055, 2190, 2310, 2430, 2550, 2685, 2805, 2925, 3045,
+    3180, 3300, 3420, 3540, 3675, 3795, 3915, 4035, 4170, 4290, 4410, 4530, 4665, 4785, 4905, 5025,
+    1500, 1620, 1740, 1860, 1995, 2115, 2235, 2355, 2490, 2610, 2730, 2850, 2985, 3105, 3225, 3345,
+    3480, 3600, 3720, 3840, 3975, 4095, 4215, 4335, 4470, 4590, 4710, 4830, 4965, 5085, 5205, 5325,
+    1800, 1920, 2040, 2160, 2295, 2415, 2535, 2655, 2790, 2910, 3030, 3150, 3285, 3405, 3525, 3645,
+    3780, 3900, 4020, 4140, 4275, 4395, 4515, 4635, 4770, 4890, 5010, 5130, 5265, 5385, 5505, 5625,
+    2100, 2220, 2340, 2460, 2595, 2715, 2835, 2955, 3090, 3210, 3330, 3450, 3585, 3705, 3825, 3945,
+    4080, 4200, 4320, 4440, 4575, 4695, 4815, 4935, 5070, 5190, 5310, 5430, 5565, 5685, 5805, 5925,
+};
+
+static void rgb565_to_grayscale(const void *restrict src, void *restrict dst, int w)
+{
+    const uint16_t *restrict s = (const uint16_t *) src;
+    uint8_t *restrict d = (uint8_t *) dst;
+
+    for (int x = 0; x < w; x++)
+    {
+        d[x] = (y_table_hi[s[x] >> 8] + y_table_lo[s[x] & 0xFF]) >> 7;
+    }
+}
+
+static void grayscale_to_rgb565(const void *restrict src, void *restrict dst, int w)
+{
+    const uint8_t *restrict s = (const uint8_t *) src;
+    uint16_t *restrict d = (uint16_t *) dst;
+
+    for (int x = 0; x < w; x++)
+    {
+        d[x] = convert_y_to_rgb565(s[x]);
+    }
+}
+
+static void rgb565_to_argb8(const void *restrict src, void *restrict dst, int w)
+{
+    const uint16_t *restrict s = (const uint16_t *) src;
+    uint32_t *restrict d = (uint32_t *) dst;
+
+    for (int x = 0; x < w; x++)
+    {
+        uint32_t p = s[x];
+        uint32_t r = (p >> 8) & 0xF8;
+        uint32_t g = (p >> 3) & 0xFC;
+        uint32_t b = (p << 3) & 0xF8;
+        d[x] = 0xFF000000 | ((r | (r >> 5)) << 16) | ((g | (g >> 6)) << 8) | (b | (b >> 5));
+    }
+}
+
+static void argb8_to_rgb565(const void *restrict src, void *restrict dst, int w)
+{
+    const uint32_t *restrict s = (const uint32_t *) src;
+    uint16_t *restrict d = (uint16_t *) dst;
+
+    for (int x = 0; x < w; x++)
+    {
+        uint32_t p = s[x];
+        d[x] = ((p >> 8) & 0xF800) | ((p >> 5) & 0x07E0) | ((p >> 3) & 0x001F);
+    }
+}
+
+/**
+ * Store the word of binary pixels x ... x + n - 1. A partial last word keeps its other bits,
+ * they can be pixels of the image around a view.
+ */
+static inline void convert_put_binary_word(uint32_t *d, int x, int n, uint32_t word)
+{
+    uint32_t mask = (n == 32) ? 0xFFFFFFFF : ((1u << n) - 1);
+    d[x >> UINT32_T_SHIFT] = (d[x >> UINT32_T_SHIFT] & ~mask) | word;
+}
+
+static void grayscale_to_binary(const void *restrict src, void *restrict dst, int w)
+{
+    const uint8_t *restrict s = (const uint8_t *) src;
+    uint32_t *restrict d = (uint32_t *) dst;
+
+    for (int x = 0; x < w; x += 32)
+    {
+        int n = IM_MIN(w - x, 32);
+        uint32_t word = 0;
+        for (int i = 0; i < n; i++)
+        {
+            word |= (uint32_t) COLOR_GRAYSCALE_TO_BINARY(s[x + i]) << i;
+        }
+        convert_put_binary_word(d, x, n, word);
+    }
+}
+
+static void binary_to_grayscale(const void *restrict src, void *restrict dst, int w)
+{
+    const uint32_t *restrict s = (const uint32_t *) src;
+    uint8_t *restrict d = (uint8_t *) dst;
+
+    for (int x = 0; x < w; x++)
+    {
+        d[x] = -((s[x >> UINT32_T_SHIFT] >> (x & UINT32_T_MASK)) & 1) & COLOR_GRAYSCALE_MAX;
+    }
+}
+
+static void yuv422_to_grayscale(const void *restrict src, void *restrict dst, int w)
+{
+    const uint16_t *restrict s = (const uint16_t *) src;
+    uint8_t *restrict d = (uint8_t *) dst;
+
+    for (int x = 0; x < w; x++)
+    {
+        d[x] = s[x];
+    }
+}
+
+/**
+ * Both pixels of a pair share the chroma, the even pixel carries U (V for YVU422) and the odd one
+ * the other component. The chroma terms are computed once per pair.
+ */
+static inline void yuv422_pair_to_rgb565(uint32_t p0, uint32_t p1, bool yvu, uint16_t *d)
+{
+    int u = (int) ((yvu ? p1 : p0) >> 8) - 128;
+    int v = (int) ((yvu ? p0 : p1) >> 8) - 128;
+    int r_off = (91881 * v) >> 16;
+    int g_off = ((22554 * u) + (46802 * v)) >> 16;
+    int b_off = (116130 * u) >> 16;
+
+    int y0 = p0 & 0xFF;
+    int y1 = p1 & 0xFF;
+    d[0] = COLOR_R8_G8_B8_TO_RGB565(convert_clamp8(y0 + r_off), convert_clamp8(y0 - g_off), convert_clamp8(y0 + b_off));
+    d[1] = COLOR_R8_G8_B8_TO_RGB565(convert_clamp8(y1 + r_off), convert_clamp8(y1 - g_off), convert_clamp8(y1 + b_off));
+}
+
+static inline void yuv422_row_to_rgb565(const uint16_t *restrict s, uint16_t *restrict d, int w, bool yvu)
+{
+    int x = 0;
+    for (; x < (w - 1); x += 2)
+    {
+        yuv422_pair_to_rgb565(s[x], s[x + 1], yvu, d + x);
+    }
+
+    if (x < w)
+    {
+        // An odd last pixel has no partner, treat its chroma as neutral for the missing component.
+        uint16_t pair[2];
+        yuv422_pair_to_rgb565(s[x], 0x8000, yvu, pair);
+        d[x] = pair[0];
+    }
+}
+
+static void yuv422_to_rgb565(const void *restrict src, void *restrict dst, int w)
+{
+    yuv422_row_to_rgb565((const uint16_t *) src, (uint16_t *) dst, w, false);
+}
+
+static void yvu422_to_rgb565(const void *restrict src, void *restrict dst, int w)
+{
+    yuv422_row_to_rgb565((const uint16_t *) src, (uint16_t *) dst, w, true);
+}
+
+//=======================================================================================
+// RGB888 decoders and encoders, for the pairs without a direct kernel
+//=======================================================================================
+
+static void binary_to_rgb888(const void *restrict src, void *restrict dst, int w)
+{
+    const uint32_t *restrict s = (const uint32_t *) src;
+    uint8_t *restrict d = (uint8_t *) dst;
+
+    for (int x = 0; x < w; x++)
+    {
+        uint8_t y = -((s[x >> UINT32_T_SHIFT] >> (x & UINT32_T_MASK)) & 1) & COLOR_GRAYSCALE_MAX;
+        d[(x * 3) + 0] = y;
+        d[(x * 3) + 1] = y;
+        d[(x * 3) + 2] = y;
+    }
+}
+
+static void grayscale_to_rgb888(const void *restrict src, void *restrict dst, int w)
+{
+    const uint8_t *restrict s = (const uint8_t *) src;
+    uint8_t *restrict d = (uint8_t *) dst;
+
+    for (int x = 0; x < w; x++)
+    {
+        d[(x * 3) + 0] = s[x];
+        d[(x * 3) + 1] = s[x];
+        d[(x * 3) + 2] = s[x];
+    }
+}
+
+static void rgb565_to_rgb888(const void *restrict src, void *restrict dst, int w)
+{
+    const uint16_t *restrict s = (const uint16_t *) src;
+    uint8_t *restrict d = (uint8_t *) dst;
+
+    for (int x = 0; x < w; x++)
+    {
+        uint32_t p = s[x];
+        uint32_t r = (p >> 8) & 0xF8;
+        uint32_t g = (p >> 3) & 0xFC;
+        uint32_t b = (p << 3) & 0xF8;
+        d[(x * 3) + 0] = r | (r >> 5);
+        d[(x * 3) + 1] = g | (g >> 6);
+        d[(x * 3) + 2] = b | (b >> 5);
+    }
+}
+
+static void argb8_to_rgb888(const void *restrict src, void *restrict dst, int w)
+{
+    const uint32_t *restrict s = (const uint32_t *) src;
+    uint8_t *restrict d = (uint8_t *) dst;
+
+    for (int x = 0; x < w; x++)
+    {
+        d[(x * 3) + 0] = s[x] >> 16;
+        d[(x * 3) + 1] = s[x] >> 8;
+        d[(x * 3) + 2] = s[x];
+    }
+}
+
+static inline void yuv422_row_to_rgb888(const uint16_t *restrict s, uint8_t *restrict d, int w, bool yvu)
+{
+    for (int x = 0; x < w; x++)
+    {
+        int pair = x & ~1;
+        uint32_t p0 = s[pair];
+        uint32_t p1 = ((pair + 1) < w) ? s[pair + 1] : 0x8000;
+        int u = (int) ((yvu ? p1 : p0) >> 8) - 128;
+        int v = (int) ((yvu ? p0 : p1) >> 8) - 128;
+        int y = s[x] & 0xFF;
+        d[(x * 3) + 0] = convert_clamp8(y + ((91881 * v) >> 16));
+        d[(x * 3) + 1] = convert_clamp8(y - (((22554 * u) + (46802 * v)) >> 16));
+        d[(x * 3) + 2] = convert_clamp8(y + ((116130 * u) >> 16));
+    }
+}
+
+static void yuv422_to_rgb888(const void *restrict src, void *restrict dst, int w)
+{
+    yuv422_row_to_rgb888((const uint16_t *) src, (uint8_t *) dst, w, false);
+}
+
+static void yvu422_to_rgb888(const void *restrict src, void *restrict dst, int w)
+{
+    yuv422_row_to_rgb888((const uint16_t *) src, (uint8_t *) dst, w, true);
+}
+
+/**
+ * Demosaic a row of a Bayer image by taking R and B from the 2x2 cell the pixel is in and
+ * averaging its two G samples.
+ * @param row: the row to convert.
+ * @param pair: the other row of the 2x2 cells, below row for even y and above it for odd y.
+ * @param y: row index, selects the colors of the row from the sub-format.
+ */
+static void bayer_to_rgb888(const uint8_t *restrict row, const uint8_t *restrict pair, int w, int y, int subfmt_id, uint8_t *restrict d)
+{
+    int pattern = subfmt_id & 3;
+    bool g_first = (pattern == SUBFORMAT_ID_GBRG) || (pattern == SUBFORMAT_ID_GRBG);
+    bool r_top = (pattern == SUBFORMAT_ID_RGGB) || (pattern == SUBFORMAT_ID_GRBG);
+    const uint8_t *top = (y & 1) ? pair : row;
+    const uint8_t *bottom = (y & 1) ? row : pair;
+
+    for (int x = 0; x < w; x++)
+    {
+        int cx = x & ~1;
+        int cx1 = IM_MIN(cx + 1, w - 1);
+        // The two samples on the diagonal of the cell are G, the other two are R and B.
+        uint8_t tl = top[cx], tr = top[cx1], bl = bottom[cx], br = bottom[cx1];
+        int g = g_first ? ((tl + br) >> 1) : ((tr + bl) >> 1);
+        uint8_t rb_top = g_first ? tr : tl;
+        uint8_t rb_bottom = g_first ? bl : br;
+        d[(x * 3) + 0] = r_top ? rb_top : rb_bottom;
+        d[(x * 3) + 1] = g;
+        d[(x * 3) + 2] = r_top ? rb_bottom : rb_top;
+    }
+}
+
+static void rgb888_to_binary(const void *restrict src, void *restrict dst, int w)
+{
+    const uint8_t *restrict s = (const uint8_t *) src;
+    uint32_t *restrict d = (uint32_t *) dst;
+
+    for (int x = 0; x < w; x += 32)
+    {
+        int n = IM_MIN(w - x, 32);
+        uint32_t word = 0;
+        for (int i = 0; i < n; i++)
+        {
+            const uint8_t *p = s + ((x + i) * 3);
+            word |= (uint32_t) COLOR_GRAYSCALE_TO_BINARY(COLOR_RGB888_TO_Y(p[0], p[1], p[2])) << i;
+        }
+        convert_put_binary_word(d, x, n, word);
+    }
+}
+
+static void rgb888_to_grayscale(const void *restrict src, void *restrict dst, int w)
+{
+    const uint8_t *restrict s = (const uint8_t *) src;
+    uint8_t *restrict d = (uint8_t *) dst;
+
+    for (int x = 0; x < w; x++)
+    {
+        d[x] = COLOR_RGB888_TO_Y(s[(x * 3) + 0], s[(x * 3) + 1], s[(x * 3) + 2]);
+    }
+}
+
+static void rgb888_to_rgb565(const void *restrict src, void *restrict dst, int w)
+{
+    const uint8_t *restrict s = (const uint8_t *) src;
+    uint16_t *restrict d = (uint16_t *) dst;
+
+    for (int x = 0; x < w; x++)
+    {
+        d[x] = COLOR_R8_G8_B8_TO_RGB565(s[(x * 3) + 0], s[(x * 3) + 1], s[(x * 3) + 2]);
+    }
+}
+
+static void rgb888_to_argb8(const void *restrict src, void *restrict dst, int w)
+{
+    const uint8_t *restrict s = (const uint8_t *) src;
+    uint32_t *restrict d = (uint32_t *) dst;
+
+    for (int x = 0; x < w; x++)
+    {
+        d[x] = 0xFF000000 | (s[(x * 3) + 0] << 16) | (s[(x * 3) + 1] << 8) | s[(x * 3) + 2];
+    }
+}
+
+static inline void rgb888_row_to_yuv422(const uint8_t *restrict s, uint16_t *restrict d, int w, bool yvu)
+{
+    for (int x = 0; x < w; x += 2)
+    {
+        // Chroma of a pair is taken from the average of its two pixels.
+        const uint8_t *p0 = s + (x * 3);
+        const uint8_t *p1 = ((x + 1) < w) ? (p0 + 3) : p0;
+        int r = (p0[0] + p1[0]) >> 1;
+        int g = (p0[1] + p1[1]) >> 1;
+        int b = (p0[2] + p1[2]) >> 1;
+        uint32_t u = (COLOR_RGB888_TO_U(r, g, b) + 128) & 0xFF;
+        uint32_t v = (COLOR_RGB888_TO_V(r, g, b) + 128) & 0xFF;
+
+        d[x] = ((yvu ? v : u) << 8) | COLOR_RGB888_TO_Y(p0[0], p0[1], p0[2]);
+        if ((x + 1) < w)
+        {
+            d[x + 1] = ((yvu ? u : v) << 8) | COLOR_RGB888_TO_Y(p1[0], p1[1], p1[2]);
+        }
+    }
+}
+
+static void rgb888_to_yuv422(const void *restrict src, void *restrict dst, int w)
+{
+    rgb888_row_to_yuv422((const uint8_t *) src, (uint16_t *) dst, w, false);
+}
+
+static void rgb888_to_yvu422(const void *restrict src, void *restrict dst, int w)
+{
+    rgb888_row_to_yuv422((const uint8_t *) src, (uint16_t *) dst, w, true);
+}
+
+//=======================================================================================
+// Dispatch
+//=======================================================================================
+
+typedef struct
+{
+    uint32_t src;
+    uint32_t dst;
+    convert_row_t row;
+} convert_kernel_t;
+
+static const convert_kernel_t convert_kernels[] = {
+    {PIXFORMAT_RGB565, PIXFORMAT_GRAYSCALE, rgb565_to_grayscale},
+    {PIXFORMAT_GRAYSCALE, PIXFORMAT_RGB565, grayscale_to_rgb565},
+    {PIXFORMAT_RGB565, PIXFORMAT_ARGB8, rgb565_to_argb8},
+    {PIXFORMAT_ARGB8, PIXFORMAT_RGB565, argb8_to_rgb565},
+    {PIXFORMAT_GRAYSCALE, PIXFORMAT_BINARY, grayscale_to_binary},
+    {PIXFORMAT_BINARY, PIXFORMAT_GRAYSCALE, binary_to_grayscale},
+    {PIXFORMAT_YUV422, PIXFORMAT_GRAYSCALE, yuv422_to_grayscale},
+    {PIXFORMAT_YVU422, PIXFORMAT_GRAYSCALE, yuv422_to_grayscale},
+    {PIXFORMAT_YUV422, PIXFORMAT_RGB565, yuv422_to_rgb565},
+    {PIXFORMAT_YVU422, PIXFORMAT_RGB565, yvu422_to_rgb565},
+};
+
+static convert_row_t convert_get_decoder(uint32_t pixfmt)
+{
+    switch (pixfmt)
+    {
+        case PIXFORMAT_BINARY:
+            {
+                return binary_to_rgb888;
+            }
+        case PIXFORMAT_GRAYSCALE:
+            {
+                return grayscale_to_rgb888;
+            }
+        case PIXFORMAT_RGB565:
+            {
+                return rgb565_to_rgb888;
+            }
+        case PIXFORMAT_ARGB8:
+            {
+                return argb8_to_rgb888;
+            }
+        case PIXFORMAT_YUV422:
+            {
+                return yuv422_to_rgb888;
+            }
+        case PIXFORMAT_YVU422:
+            {
+                return yvu422_to_rgb888;
+            }
+        default:
+            {
+                return NULL;
+            }
+    }
+}
+
+static convert_row_t convert_get_encoder(uint32_t pixfmt)
+{
+    switch (pixfmt)
+    {
+        case PIXFORMAT_BINARY:
+            {
+                return rgb888_to_binary;
+            }
+        case PIXFORMAT_GRAYSCALE:
+            {
+                return rgb888_to_grayscale;
+            }
+        case PIXFORMAT_RGB565:
+            {
+                return rgb888_to_rgb565;
+            }
+        case PIXFORMAT_ARGB8:
+            {
+                return rgb888_to_argb8;
+            }
+        case PIXFORMAT_YUV422:
+            {
+                return rgb888_to_yuv422;
+            }
+        case PIXFORMAT_YVU422:
+            {
+                return rgb888_to_yvu422;
+            }
+        default:
+            {
+                return NULL;
+            }
+    }
+}
+
+static bool convert_is_bayer(uint32_t pixfmt)
+{
+    switch (pixfmt)
+    {
+        case PIXFORMAT_BAYER_ANY:
+            {
+                return true;
+            }
+        default:
+            {
+                return false;
+            }
+    }
+}
+
+/**
+ * Get the number of bytes in a tightly packed row of an image.
+ */
+static int convert_line_bytes(uint32_t pixfmt, int w)
+{
+    if (pixfmt == PIXFORMAT_BINARY)
+    {
+        return ((w + UINT32_T_MASK) >> UINT32_T_SHIFT) * sizeof(uint32_t);
+    }
+
+    return w * (pixfmt & 0xFF);
+}
+
+/**
+ * Check if imlib_convert() supports a pair of pixel formats.
+ */
+bool imlib_convert_supported(pixformat_t src_pixfmt, pixformat_t dst_pixfmt)
+{
+    if (convert_get_encoder(dst_pixfmt) == NULL)
+    {
+        return false;
+    }
+
+    return (src_pixfmt == dst_pixfmt) || convert_is_bayer(src_pixfmt) || (convert_get_decoder(src_pixfmt) != NULL);
+}
+
+/**
+ * Convert pixels between buffers with arbitrary row strides.
+ * Sources can be BINARY, GRAYSCALE, RGB565, ARGB8, YUV422/YVU422 or any BAYER format, destinations
+ * any of these except BAYER.
+ * @param src, src_stride: first source row and the bytes between rows, 0 for tightly packed rows.
+ * @param dst, dst_stride: first destination row and the bytes between rows, 0 for tightly packed rows.
+ * @param w, h: size of the area to convert, in pixels.
+ * @return: false if the pair of formats is not supported or the row buffer could not be allocated.
+ */
+bool imlib_convert_strided(const void *src, int src_stride, pixformat_t src_pixfmt, void *dst, int dst_stride, pixformat_t dst_pixfmt, int w, int h)
+{
+    if (!imlib_convert_supported(src_pixfmt, dst_pixfmt))
+    {
+        return false;
+    }
+
+    if ((w <= 0) || (h <= 0))
+    {
+        return true;
+    }
+
+    src_stride = src_stride ? src_stride : convert_line_bytes(src_pixfmt, w);
+    dst_stride = dst_stride ? dst_stride : convert_line_bytes(dst_pixfmt, w);
+    const uint8_t *s = (const uint8_t *) src;
+    uint8_t *d = (uint8_t *) dst;
+
+    if (src_pixfmt == dst_pixfmt)
+    {
+        // A partial last binary word is merged instead of copied.
+        int partial = (dst_pixfmt == PIXFORMAT_BINARY) ? (w & UINT32_T_MASK) : 0;
+        int line_bytes = convert_line_bytes(src_pixfmt, w) - (partial ? sizeof(uint32_t) : 0);
+        for (int y = 0; y < h; y++)
+        {
+            memcpy(d + (y * dst_stride), s + (y * src_stride), line_bytes);
+            if (partial)
+            {
+                int x = w - partial;
+                uint32_t word = ((const uint32_t *) (s + (y * src_stride)))[x >> UINT32_T_SHIFT];
+                convert_put_binary_word((uint32_t *) (d + (y * dst_stride)), x, partial, word & ((1u << partial) - 1));
+            }
+        }
+        return true;
+    }
+
+    for (size_t i = 0; i < (sizeof(convert_kernels) / sizeof(convert_kernels[0])); i++)
+    {
+        if ((convert_kernels[i].src == src_pixfmt) && (convert_kernels[i].dst == dst_pixfmt))
+        {
+            for (int y = 0; y < h; y++)
+            {
+                convert_kernels[i].row(s + (y * src_stride), d + (y * dst_stride), w);
+            }
+            return true;
+        }
+    }
+
+    uint8_t *rgb888 = (uint8_t *) malloc(w * 3);
+    if (rgb888 == NULL)
+    {
+        return false;
+    }
+
+    convert_row_t decode = convert_get_decoder(src_pixfmt);
+    convert_row_t encode = convert_get_encoder(dst_pixfmt);
+
+    for (int y = 0; y < h; y++)
+    {
+        const uint8_t *row = s + (y * src_stride);
+        if (decode != NULL)
+        {
+            decode(row, rgb888, w);
+        }
+        else
+        {
+            // Bayer rows are demosaiced together with the other row of their 2x2 cells.
+            int pair_y = ((y ^ 1) < h) ? (y ^ 1) : y;
+            bayer_to_rgb888(row, s + (pair_y * src_stride), w, y, (src_pixfmt >> 8) & 0xFF, rgb888);
+        }
+
+        encode(rgb888, d + (y * dst_stride), w);
+    }
+
+    free(rgb888);
+    return true;
+}
+
+/**
+ * Convert an image into another format. Both images must have the same size and dst must have
+ * its buffer allocated for its format.
+ * @param src: source image.
+ * @param dst: destination image, its pixfmt selects the output format.
+ * @return: false if the sizes differ or the pair of formats is not supported.
+ */
+bool imlib_convert(const image_t *src, image_t *dst)
+{
+    if ((src->w != dst->w) || (src->h != dst->h))
+    {
+        return false;
+    }
+
+    if (!imlib_convert_strided(src->data, src->stride, src->pixfmt, dst->data, dst->stride, dst->pixfmt, src->w, src->h))
+    {
+        return false;
+    }
+
+    imlib_dirty_add_all(dst);
+    return true;
+}
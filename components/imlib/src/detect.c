@@ -0,0 +1,270 @@
+/*****************************************************************************
+ detect
+
+ Post-processing of object detector output. Non-maximum suppression visits
+ the candidates from the highest score down and keeps a box unless it
+ overlaps a kept box too much. The kept boxes are registered in a uniform
+ grid, so a candidate is only compared with the kept boxes near it instead
+ of all of them. The survivors are drawn through a display list so that
+ all boxes and labels are rendered in a single pass over the frame tiles.
+
+*****************************************************************************/
+#include "imlib.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DETECT_GRID_MAX 64 // Cells along the longer side of the grid, at most.
+#define DETECT_LABEL_LEN 32
+
+typedef struct detect_grid
+{
+    int x, y;   // Top left of the grid.
+    int cell;   // Cell size in pixels.
+    int w, h;   // Size in cells.
+    int *head;  // First entry of every cell, -1 if empty.
+    int *next;  // Next entry of the same cell.
+    int *box;   // Kept box of an entry.
+    int entries;
+    int capacity;
+} detect_grid_t;
+
+static int detect_score_compare(const void *a, const void *b)
+{
+    float sa = ((const bounding_box_lnk_data_t *) a)->score;
+    float sb = ((const bounding_box_lnk_data_t *) b)->score;
+    return (sa < sb) - (sa > sb);
+}
+
+/**
+ * Get the range of grid cells a rectangle overlaps, clamped to the grid.
+ */
+static void detect_cells(const detect_grid_t *g, const rectangle_t *r, int *x0, int *y0, int *x1, int *y1)
+{
+    *x0 = IM_MAX((r->x - g->x) / g->cell, 0);
+    *y0 = IM_MAX((r->y - g->y) / g->cell, 0);
+    *x1 = IM_MIN((r->x + r->w - 1 - g->x) / g->cell, g->w - 1);
+    *y1 = IM_MIN((r->y + r->h - 1 - g->y) / g->cell, g->h - 1);
+}
+
+static bool detect_grid_insert(detect_grid_t *g, int cell, int box)
+{
+    if (g->entries == g->capacity)
+    {
+        int capacity = g->capacity * 2;
+        int *next = (int *) realloc(g->next, capacity * sizeof(int));
+        if (next == NULL)
+        {
+            return false;
+        }
+        g->next = next;
+
+        int *boxes = (int *) realloc(g->box, capacity * sizeof(int));
+        if (boxes == NULL)
+        {
+            return false;
+        }
+        g->box = boxes;
+        g->capacity = capacity;
+    }
+
+    g->box[g->entries] = box;
+    g->next[g->entries] = g->head[cell];
+    g->head[cell] = g->entries++;
+    return true;
+}
+
+/**
+ * Register a kept box in the cells [x0, x1] x [y0, y1].
+ */
+static bool detect_grid_add(detect_grid_t *g, int box, int x0, int y0, int x1, int y1)
+{
+    for (int cy = y0; cy <= y1; cy++)
+    {
+        for (int cx = x0; cx <= x1; cx++)
+        {
+            if (!detect_grid_insert(g, (cy * g->w) + cx, box))
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * Check whether the intersection over union of two rectangles is above a threshold.
+ */
+static inline bool detect_overlaps(const rectangle_t *a, const rectangle_t *b, float iou_threshold)
+{
+    int w = IM_MIN(a->x + a->w, b->x + b->w) - IM_MAX(a->x, b->x);
+    int h = IM_MIN(a->y + a->h, b->y + b->h) - IM_MAX(a->y, b->y);
+    if ((w <= 0) || (h <= 0))
+    {
+        return false;
+    }
+
+    int32_t inter = w * h;
+    int32_t uni = (a->w * a->h) + (b->w * b->h) - inter;
+    return inter > (iou_threshold * uni);
+}
+
+/**
+ * Non-maximum suppression of detector candidates, in place.
+ * @param boxes: candidates. On return the survivors are at the start, highest score first.
+ * @param count: number of candidates.
+ * @param min_score: candidates with a lower score, or an empty rectangle, are dropped first.
+ * @param iou_threshold: a candidate is dropped when its intersection over union with a
+ *                       box that has a higher score and is kept is above this.
+ * @param per_label: only suppress boxes with the same label_index.
+ * @return: the number of survivors, -1 if there is not enough memory.
+ */
+int imlib_nms(bounding_box_lnk_data_t *boxes, int count, float min_score, float iou_threshold, bool per_label)
+{
+    int n = 0;
+    int64_t size_sum = 0;
+    int x0 = INT32_MAX, y0 = INT32_MAX, x1 = INT32_MIN, y1 = INT32_MIN;
+
+    for (int i = 0; i < count; i++)
+    {
+        const rectangle_t *r = &boxes[i].rect;
+        if ((boxes[i].score >= min_score) && (r->w > 0) && (r->h > 0))
+        {
+            size_sum += r->w + r->h;
+            x0 = IM_MIN(x0, (int) r->x);
+            y0 = IM_MIN(y0, (int) r->y);
+            x1 = IM_MAX(x1, r->x + r->w);
+            y1 = IM_MAX(y1, r->y + r->h);
+            boxes[n++] = boxes[i];
+        }
+    }
+
+    if (n <= 1)
+    {
+        return n;
+    }
+
+    qsort(boxes, n, sizeof(bounding_box_lnk_data_t), detect_score_compare);
+
+    // Cells of about the average box size keep the number of cells per box small. A grid of
+    // at most DETECT_GRID_MAX cells a side bounds the memory when the boxes are spread out.
+    detect_grid_t g = {
+        .x = x0,
+        .y = y0,
+        .cell = IM_MAX((int) (size_sum / (2 * n)), (IM_MAX(x1 - x0, y1 - y0) + DETECT_GRID_MAX - 1) / DETECT_GRID_MAX),
+        .capacity = 4 * n,
+    };
+    g.cell = IM_MAX(g.cell, 1);
+    g.w = ((x1 - x0) / g.cell) + 1;
+    g.h = ((y1 - y0) / g.cell) + 1;
+    g.head = (int *) malloc(g.w * g.h * sizeof(int));
+    g.next = (int *) malloc(g.capacity * sizeof(int));
+    g.box = (int *) malloc(g.capacity * sizeof(int));
+    // Last candidate compared with every kept box, a box in several cells is only compared once.
+    int *stamp = (int *) malloc(n * sizeof(int));
+
+    int kept = -1;
+    if ((g.head != NULL) && (g.next != NULL) && (g.box != NULL) && (stamp != NULL))
+    {
+        memset(g.head, 0xFF, g.w * g.h * sizeof(int));
+        kept = 0;
+
+        for (int i = 0; i < n; i++)
+        {
+            bounding_box_lnk_data_t *b = &boxes[i];
+            int cx0, cy0, cx1, cy1;
+            detect_cells(&g, &b->rect, &cx0, &cy0, &cx1, &cy1);
+
+            bool suppressed = false;
+            for (int cy = cy0; (cy <= cy1) && !suppressed; cy++)
+            {
+                for (int cx = cx0; (cx <= cx1) && !suppressed; cx++)
+                {
+                    for (int e = g.head[(cy * g.w) + cx]; e >= 0; e = g.next[e])
+                    {
+                        int k = g.box[e];
+                        if (stamp[k] == i)
+                        {
+                            continue;
+                        }
+                        stamp[k] = i;
+
+                        if ((!per_label || (boxes[k].label_index == b->label_index)) && detect_overlaps(&boxes[k].rect, &b->rect, iou_threshold))
+                        {
+                            suppressed = true;
+                            break;
+                        }
+                    }
+                }
+            }
+
+            if (suppressed)
+            {
+                continue;
+            }
+
+            // Kept boxes are compacted in place, every index below i has been visited already.
+            boxes[kept] = *b;
+            stamp[kept] = i;
+            if (!detect_grid_add(&g, kept, cx0, cy0, cx1, cy1))
+            {
+                kept = -1;
+                break;
+            }
+            kept++;
+        }
+    }
+
+    free(g.head);
+    free(g.next);
+    free(g.box);
+    free(stamp);
+    return kept;
+}
+
+/**
+ * Draw detection boxes with their label and score above them. Everything is recorded into a
+ * display list first and drawn tile by tile, see imlib_dlist_execute_parallel().
+ * @param c: color of boxes without an entry in colors.
+ * @param labels: name of every label_index, or NULL. Boxes without a name show their index.
+ * @param colors: color of every label_index, or NULL.
+ * @param label_count: number of entries in labels and colors.
+ * @param threads: number of threads to draw with, 1 or less draws on the calling thread only.
+ * @return: false if there was not enough memory to record the boxes, nothing is drawn then.
+ */
+bool imlib_draw_boxes(image_t *img, const bounding_box_lnk_data_t *boxes, int count, int c, int thickness, const char *const *labels, const int *colors, int label_count, int threads)
+{
+    imlib_dlist_t list;
+    imlib_dlist_init(&list);
+    bool ok = true;
+
+    for (int i = 0; (i < count) && ok; i++)
+    {
+        const bounding_box_lnk_data_t *b = &boxes[i];
+        bool known = (b->label_index >= 0) && (b->label_index < label_count);
+        int color = (known && (colors != NULL)) ? colors[b->label_index] : c;
+
+        char text[DETECT_LABEL_LEN];
+        if (known && (labels != NULL))
+        {
+            snprintf(text, sizeof(text), "%s %d%%", labels[b->label_index], (int) ((b->score * 100.0f) + 0.5f));
+        }
+        else
+        {
+            snprintf(text, sizeof(text), "#%d %d%%", b->label_index, (int) ((b->score * 100.0f) + 0.5f));
+        }
+
+        // The label goes above the box, or inside it at the top of the image.
+        int text_y = (b->rect.y >= 16) ? (b->rect.y - 16) : b->rect.y;
+        ok = imlib_dlist_rectangle(&list, b->rect.x, b->rect.y, b->rect.w, b->rect.h, color, thickness, false) &&
+             imlib_dlist_string(&list, b->rect.x, text_y, text, color, 1.0f, 0, 0, true, 0, false, false, 0, false, false);
+    }
+
+    if (ok)
+    {
+        imlib_dlist_execute_parallel(&list, img, threads);
+    }
+
+    imlib_dlist_free(&list);
+    return ok;
+}
@@ -0,0 +1,166 @@
+/*****************************************************************************
+ dirty
+
+ Damage tracking for image_t. Draw primitives union their clipped bounding
+ box into a short list of rectangles so that only changed areas have to be
+ pushed to the panel.
+
+*****************************************************************************/
+#include "imlib.h"
+#include <string.h>
+
+static inline int dirty_area(const rectangle_t *r)
+{
+    return r->w * r->h;
+}
+
+static inline rectangle_t dirty_union(const rectangle_t *a, const rectangle_t *b)
+{
+    int x0 = IM_MIN(a->x, b->x);
+    int y0 = IM_MIN(a->y, b->y);
+    int x1 = IM_MAX(a->x + a->w, b->x + b->w);
+    int y1 = IM_MAX(a->y + a->h, b->y + b->h);
+    rectangle_t r = {x0, y0, x1 - x0, y1 - y0};
+    return r;
+}
+
+/**
+ * Pixels wasted by replacing a and b with their union. Negative when they overlap.
+ */
+static inline int dirty_merge_cost(const rectangle_t *a, const rectangle_t *b)
+{
+    rectangle_t u = dirty_union(a, b);
+    return dirty_area(&u) - dirty_area(a) - dirty_area(b);
+}
+
+static void dirty_remove(imlib_dirty_t *dirty, int i)
+{
+    dirty->rects[i] = dirty->rects[--dirty->count];
+}
+
+/**
+ * Merge the cheapest pair of rectangles until at most max_count remain.
+ */
+static void dirty_reduce(imlib_dirty_t *dirty, int max_count)
+{
+    while (dirty->count > IM_MAX(max_count, 1))
+    {
+        int best_i = 0, best_j = 1;
+        int best_cost = dirty_merge_cost(&dirty->rects[0], &dirty->rects[1]);
+
+        for (int i = 0; i < dirty->count; i++)
+        {
+            for (int j = i + 1; j < dirty->count; j++)
+            {
+                int cost = dirty_merge_cost(&dirty->rects[i], &dirty->rects[j]);
+                if (cost < best_cost)
+                {
+                    best_cost = cost;
+                    best_i = i;
+                    best_j = j;
+                }
+            }
+        }
+
+        dirty->rects[best_i] = dirty_union(&dirty->rects[best_i], &dirty->rects[best_j]);
+        dirty_remove(dirty, best_j);
+    }
+}
+
+/**
+ * Start tracking the areas of an image changed by the imlib draw functions.
+ * @param img: image to track.
+ * @param dirty: caller owned tracking state, must outlive the tracking.
+ */
+void imlib_dirty_enable(image_t *img, imlib_dirty_t *dirty)
+{
+    memset(dirty, 0, sizeof(imlib_dirty_t));
+    img->dirty = dirty;
+}
+
+/**
+ * Stop tracking changes to an image.
+ */
+void imlib_dirty_disable(image_t *img)
+{
+    img->dirty = NULL;
+}
+
+/**
+ * Mark a rectangle of the image as changed. Does nothing if tracking is not enabled.
+ * @param img: target image.
+ * @param x, y, w, h: changed area in image coordinates, it is clipped to the image.
+ */
+void imlib_dirty_add(image_t *img, int x, int y, int w, int h)
+{
+    imlib_dirty_t *dirty = img->dirty;
+    if (dirty == NULL)
+    {
+        return;
+    }
+
+    int x0 = IM_MAX(x, 0);
+    int y0 = IM_MAX(y, 0);
+    int x1 = IM_MIN(x + w, img->w);
+    int y1 = IM_MIN(y + h, img->h);
+    if ((x0 >= x1) || (y0 >= y1))
+    {
+        return;
+    }
+
+    // A view shares the tracking of its parent, so its damage is recorded in parent coordinates.
+    rectangle_t r = {x0 + img->origin.x, y0 + img->origin.y, x1 - x0, y1 - y0};
+
+    // Absorb every rectangle that is cheap to merge with, the union may then reach further ones.
+    for (int i = 0; i < dirty->count;)
+    {
+        if (dirty_merge_cost(&dirty->rects[i], &r) <= IMLIB_DIRTY_MERGE_SLACK)
+        {
+            r = dirty_union(&dirty->rects[i], &r);
+            dirty_remove(dirty, i);
+            i = 0;
+        }
+        else
+        {
+            i++;
+        }
+    }
+
+    if (dirty->count == IMLIB_DIRTY_MAX_RECTS)
+    {
+        dirty_reduce(dirty, IMLIB_DIRTY_MAX_RECTS - 1);
+    }
+
+    dirty->rects[dirty->count++] = r;
+}
+
+/**
+ * Mark the whole image as changed.
+ */
+void imlib_dirty_add_all(image_t *img)
+{
+    imlib_dirty_add(img, 0, 0, img->w, img->h);
+}
+
+/**
+ * Get the changed areas of the image and reset the tracking.
+ * @param img: tracked image.
+ * @param rects: output rectangles, they do not overlap more than the merge heuristics allow.
+ * @param max_rects: size of rects, the list is merged down to fit.
+ * @return: number of rectangles written, 0 if nothing changed or tracking is not enabled.
+ */
+int imlib_dirty_flush(image_t *img, rectangle_t *rects, int max_rects)
+{
+    imlib_dirty_t *dirty = img->dirty;
+    if ((dirty == NULL) || (max_rects <= 0))
+    {
+        return 0;
+    }
+
+    dirty_reduce(dirty, max_rects);
+
+    int count = dirty->count;
+    memcpy(rects, dirty->rects, count * sizeof(rectangle_t));
+    dirty->count = 0;
+    return count;
+}
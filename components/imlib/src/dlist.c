@@ -0,0 +1,498 @@
+/*****************************************************************************
+ dlist
+
+ Deferred draw commands. Commands are recorded with their bounding box, binned
+ into horizontal tiles of the target image and then rasterised one tile at a
+ time through img->clip, so the framebuffer rows being drawn stay in the L2
+ cache instead of being streamed from PSRAM once per primitive.
+
+*****************************************************************************/
+#include "imlib.h"
+#include <stdlib.h>
+#include <string.h>
+#include "fmath.h"
+#include "font.h"
+
+typedef enum
+{
+    IMLIB_DLIST_LINE,
+    IMLIB_DLIST_RECTANGLE,
+    IMLIB_DLIST_CIRCLE,
+    IMLIB_DLIST_ELLIPSE,
+    IMLIB_DLIST_STRING,
+} imlib_dlist_op_t;
+
+typedef struct imlib_dlist_cmd
+{
+    imlib_dlist_op_t op;
+    int c;
+    int y0, y1; // Conservative vertical extent [y0, y1) of the pixels the command can touch.
+    union
+    {
+        struct
+        {
+            int x0, y0, x1, y1, thickness;
+        } line;
+        struct
+        {
+            int x, y, w, h, thickness;
+            bool fill;
+        } rect;
+        struct
+        {
+            int cx, cy, r, thickness;
+            bool fill;
+        } circle;
+        struct
+        {
+            int cx, cy, rx, ry, rotation, thickness;
+            bool fill;
+        } ellipse;
+        struct
+        {
+            int x_off, y_off;
+            size_t text; // Offset of the string in list->text.
+            float scale;
+            int x_spacing, y_spacing;
+            bool mono_space;
+            int char_rotation;
+            bool char_hmirror, char_vflip;
+            int string_rotation;
+            bool string_hmirror, string_vflip;
+        } string;
+    };
+} imlib_dlist_cmd_t;
+
+/**
+ * Reserve a command slot at the end of the list.
+ * @return: the new command, NULL if the list could not grow.
+ */
+static imlib_dlist_cmd_t *dlist_push(imlib_dlist_t *list, imlib_dlist_op_t op, int c, int y0, int y1)
+{
+    if (list->count == list->capacity)
+    {
+        int capacity = list->capacity ? (list->capacity * 2) : 64;
+        imlib_dlist_cmd_t *cmds = (imlib_dlist_cmd_t *) realloc(list->cmds, capacity * sizeof(imlib_dlist_cmd_t));
+        if (cmds == NULL)
+        {
+            return NULL;
+        }
+
+        list->cmds = cmds;
+        list->capacity = capacity;
+    }
+
+    imlib_dlist_cmd_t *cmd = &list->cmds[list->count++];
+    cmd->op = op;
+    cmd->c = c;
+    cmd->y0 = y0;
+    cmd->y1 = y1;
+    return cmd;
+}
+
+/**
+ * Copy a string into the text buffer of the list.
+ * @return: offset of the copy, or -1 if the buffer could not grow.
+ */
+static long dlist_push_text(imlib_dlist_t *list, const char *str)
+{
+    size_t len = strlen(str) + 1;
+    if ((list->text_len + len) > list->text_capacity)
+    {
+        size_t capacity = IM_MAX(list->text_capacity * 2, list->text_len + len + 256);
+        char *text = (char *) realloc(list->text, capacity);
+        if (text == NULL)
+        {
+            return -1;
+        }
+
+        list->text = text;
+        list->text_capacity = capacity;
+    }
+
+    size_t offset = list->text_len;
+    memcpy(list->text + offset, str, len);
+    list->text_len += len;
+    return offset;
+}
+
+/**
+ * Initialise an empty display list.
+ */
+void imlib_dlist_init(imlib_dlist_t *list)
+{
+    memset(list, 0, sizeof(imlib_dlist_t));
+}
+
+/**
+ * Free the memory of a display list, it is left empty and can be reused.
+ */
+void imlib_dlist_free(imlib_dlist_t *list)
+{
+    free(list->cmds);
+    free(list->text);
+    imlib_dlist_init(list);
+}
+
+/**
+ * Remove all recorded commands but keep the memory for the next frame.
+ */
+void imlib_dlist_clear(imlib_dlist_t *list)
+{
+    list->count = 0;
+    list->text_len = 0;
+}
+
+/**
+ * Record imlib_draw_line().
+ * @return: false if the list ran out of memory, the command is then dropped.
+ */
+bool imlib_dlist_line(imlib_dlist_t *list, int x0, int y0, int x1, int y1, int c, int thickness)
+{
+    // Same bound as the dirty area of imlib_draw_line().
+    int pad = (IM_MAX(thickness, 1) / 2) + 2;
+    imlib_dlist_cmd_t *cmd = dlist_push(list, IMLIB_DLIST_LINE, c, IM_MIN(y0, y1) - pad, IM_MAX(y0, y1) + pad + 1);
+    if (cmd == NULL)
+    {
+        return false;
+    }
+
+    cmd->line.x0 = x0;
+    cmd->line.y0 = y0;
+    cmd->line.x1 = x1;
+    cmd->line.y1 = y1;
+    cmd->line.thickness = thickness;
+    return true;
+}
+
+/**
+ * Record imlib_draw_rectangle().
+ * @return: false if the list ran out of memory, the command is then dropped.
+ */
+bool imlib_dlist_rectangle(imlib_dlist_t *list, int rx, int ry, int rw, int rh, int c, int thickness, bool fill)
+{
+    int pad = fill ? 0 : IM_MAX(thickness, 0);
+    imlib_dlist_cmd_t *cmd = dlist_push(list, IMLIB_DLIST_RECTANGLE, c, ry - pad, ry + rh + pad);
+    if (cmd == NULL)
+    {
+        return false;
+    }
+
+    cmd->rect.x = rx;
+    cmd->rect.y = ry;
+    cmd->rect.w = rw;
+    cmd->rect.h = rh;
+    cmd->rect.thickness = thickness;
+    cmd->rect.fill = fill;
+    return true;
+}
+
+/**
+ * Record imlib_draw_circle().
+ * @return: false if the list ran out of memory, the command is then dropped.
+ */
+bool imlib_dlist_circle(imlib_dlist_t *list, int cx, int cy, int r, int c, int thickness, bool fill)
+{
+    int r_bound = IM_MAX(r, 0) + (IM_MAX(thickness, 0) / 2) + 1;
+    imlib_dlist_cmd_t *cmd = dlist_push(list, IMLIB_DLIST_CIRCLE, c, cy - r_bound, cy + r_bound + 1);
+    if (cmd == NULL)
+    {
+        return false;
+    }
+
+    cmd->circle.cx = cx;
+    cmd->circle.cy = cy;
+    cmd->circle.r = r;
+    cmd->circle.thickness = thickness;
+    cmd->circle.fill = fill;
+    return true;
+}
+
+/**
+ * Record imlib_draw_ellipse().
+ * @return: false if the list ran out of memory, the command is then dropped.
+ */
+bool imlib_dlist_ellipse(imlib_dlist_t *list, int cx, int cy, int rx, int ry, int rotation, int c, int thickness, bool fill)
+{
+    // Same bound as the dirty area of imlib_draw_ellipse(), the outer edge at any rotation.
+    int r_bound = IM_MAX(rx, ry) + (IM_MAX(thickness, 0) / 2) + 1;
+    imlib_dlist_cmd_t *cmd = dlist_push(list, IMLIB_DLIST_ELLIPSE, c, cy - r_bound, cy + r_bound + 1);
+    if (cmd == NULL)
+    {
+        return false;
+    }
+
+    cmd->ellipse.cx = cx;
+    cmd->ellipse.cy = cy;
+    cmd->ellipse.rx = rx;
+    cmd->ellipse.ry = ry;
+    cmd->ellipse.rotation = rotation;
+    cmd->ellipse.thickness = thickness;
+    cmd->ellipse.fill = fill;
+    return true;
+}
+
+/**
+ * Record imlib_draw_string(). The string is copied, so it does not have to outlive the call.
+ * @return: false if the list ran out of memory, the command is then dropped.
+ */
+bool imlib_dlist_string(imlib_dlist_t *list, int x_off, int y_off, const char *str, int c, float scale, int x_spacing, int y_spacing, bool mono_space, int char_rotation, bool char_hmirror, bool char_vflip, int string_rotation, bool string_hmirror, bool string_vflip)
+{
+    // Glyphs are at most 16 pixels and advance by at most 17 scaled pixels plus the spacing. An upright
+    // or upside down string stays within a glyph height or two of y_off, otherwise the string runs
+    // vertically from its origin.
+    int glyph = fast_ceilf(FONT_GLYPH_MAX_H * scale) + 2;
+    int r_bound = glyph * 2;
+    if (((string_rotation / 90) % 2) != 0)
+    {
+        r_bound += strlen(str) * (fast_ceilf(17 * scale) + abs(x_spacing));
+    }
+
+    long text = dlist_push_text(list, str);
+    if (text < 0)
+    {
+        return false;
+    }
+
+    imlib_dlist_cmd_t *cmd = dlist_push(list, IMLIB_DLIST_STRING, c, y_off - r_bound, y_off + r_bound + 1);
+    if (cmd == NULL)
+    {
+        list->text_len = text;
+        return false;
+    }
+
+    cmd->string.x_off = x_off;
+    cmd->string.y_off = y_off;
+    cmd->string.text = text;
+    cmd->string.scale = scale;
+    cmd->string.x_spacing = x_spacing;
+    cmd->string.y_spacing = y_spacing;
+    cmd->string.mono_space = mono_space;
+    cmd->string.char_rotation = char_rotation;
+    cmd->string.char_hmirror = char_hmirror;
+    cmd->string.char_vflip = char_vflip;
+    cmd->string.string_rotation = string_rotation;
+    cmd->string.string_hmirror = string_hmirror;
+    cmd->string.string_vflip = string_vflip;
+    return true;
+}
+
+static void dlist_run(const imlib_dlist_t *list, const imlib_dlist_cmd_t *cmd, image_t *img)
+{
+    switch (cmd->op)
+    {
+        case IMLIB_DLIST_LINE:
+            {
+                imlib_draw_line(img, cmd->line.x0, cmd->line.y0, cmd->line.x1, cmd->line.y1, cmd->c, cmd->line.thickness);
+                break;
+            }
+        case IMLIB_DLIST_RECTANGLE:
+            {
+                imlib_draw_rectangle(img, cmd->rect.x, cmd->rect.y, cmd->rect.w, cmd->rect.h, cmd->c, cmd->rect.thickness, cmd->rect.fill);
+                break;
+            }
+        case IMLIB_DLIST_CIRCLE:
+            {
+                imlib_draw_circle(img, cmd->circle.cx, cmd->circle.cy, cmd->circle.r, cmd->c, cmd->circle.thickness, cmd->circle.fill);
+                break;
+            }
+        case IMLIB_DLIST_ELLIPSE:
+            {
+                imlib_draw_ellipse(img, cmd->ellipse.cx, cmd->ellipse.cy, cmd->ellipse.rx, cmd->ellipse.ry, cmd->ellipse.rotation, cmd->c, cmd->ellipse.thickness, cmd->ellipse.fill);
+                break;
+            }
+        case IMLIB_DLIST_STRING:
+            {
+                imlib_draw_string(img, cmd->string.x_off, cmd->string.y_off, list->text + cmd->string.text, cmd->c, cmd->string.scale, cmd->string.x_spacing, cmd->string.y_spacing, cmd->string.mono_space, cmd->string.char_rotation, cmd->string.char_hmirror, cmd->string.char_vflip, cmd->string.string_rotation, cmd->string.string_hmirror, cmd->string.string_vflip);
+                break;
+            }
+    }
+}
+
+/**
+ * Get the number of image rows in one tile, so that a tile fills IMLIB_DLIST_TILE_BYTES.
+ */
+int imlib_dlist_tile_rows(const image_t *img)
+{
+    int line_bytes;
+    switch (img->pixfmt)
+    {
+        case PIXFORMAT_BINARY:
+            {
+                line_bytes = IMAGE_BINARY_STRIDE(img);
+                break;
+            }
+        case PIXFORMAT_GRAYSCALE:
+            {
+                line_bytes = IMAGE_GRAYSCALE_STRIDE(img);
+                break;
+            }
+        default:
+            {
+                line_bytes = IMAGE_RGB565_STRIDE(img);
+                break;
+            }
+    }
+
+    return IM_MAX(IMLIB_DLIST_TILE_BYTES / IM_MAX(line_bytes, 1), 1);
+}
+
+/**
+ * Get the tiles [t0, t1] a command has to be drawn in.
+ * @return: false if the command is entirely above or below the image.
+ */
+static bool dlist_tile_range(const imlib_dlist_cmd_t *cmd, const image_t *img, int tile_rows, int *t0, int *t1)
+{
+    int y0 = IM_MAX(cmd->y0, 0);
+    int y1 = IM_MIN(cmd->y1, img->h);
+    if (y0 >= y1)
+    {
+        return false;
+    }
+
+    *t0 = y0 / tile_rows;
+    *t1 = (y1 - 1) / tile_rows;
+    return true;
+}
+
+static void dlist_run_all(const imlib_dlist_t *list, image_t *img)
+{
+    for (int i = 0; i < list->count; i++)
+    {
+        dlist_run(list, &list->cmds[i], img);
+    }
+}
+
+/**
+ * Bin the recorded commands by the tiles of an image: count, prefix sum, then scatter the command
+ * indices so that every tile lists its commands in recording order.
+ * @param list: recorded commands.
+ * @param img: target image, only its size and format are used.
+ * @param bins: output, release with imlib_dlist_bins_free().
+ * @return: false if there was not enough memory.
+ */
+bool imlib_dlist_bin(const imlib_dlist_t *list, const image_t *img, imlib_dlist_bins_t *bins)
+{
+    bins->tile_rows = imlib_dlist_tile_rows(img);
+    bins->tiles = (IM_MAX(img->h, 0) + bins->tile_rows - 1) / bins->tile_rows;
+    bins->cmds = NULL;
+    bins->start = (int *) calloc(bins->tiles + 1, sizeof(int));
+    if (bins->start == NULL)
+    {
+        return false;
+    }
+
+    int total = 0;
+    for (int i = 0; i < list->count; i++)
+    {
+        int t0, t1;
+        if (dlist_tile_range(&list->cmds[i], img, bins->tile_rows, &t0, &t1))
+        {
+            for (int t = t0; t <= t1; t++)
+            {
+                bins->start[t + 1]++;
+            }
+            total += t1 - t0 + 1;
+        }
+    }
+
+    // Command indices of all bins followed by the fill cursor of every bin.
+    bins->cmds = (int *) malloc((total + bins->tiles + 1) * sizeof(int));
+    if (bins->cmds == NULL)
+    {
+        imlib_dlist_bins_free(bins);
+        return false;
+    }
+
+    int *fill = bins->cmds + total;
+    for (int t = 0; t < bins->tiles; t++)
+    {
+        bins->start[t + 1] += bins->start[t];
+        fill[t] = bins->start[t];
+    }
+
+    for (int i = 0; i < list->count; i++)
+    {
+        int t0, t1;
+        if (dlist_tile_range(&list->cmds[i], img, bins->tile_rows, &t0, &t1))
+        {
+            for (int t = t0; t <= t1; t++)
+            {
+                bins->cmds[fill[t]++] = i;
+            }
+        }
+    }
+
+    return true;
+}
+
+void imlib_dlist_bins_free(imlib_dlist_bins_t *bins)
+{
+    free(bins->cmds);
+    free(bins->start);
+    bins->cmds = NULL;
+    bins->start = NULL;
+}
+
+/**
+ * Draw the commands of one tile, clipped to the tile and to any existing img->clip.
+ * Tiles do not share pixels, so different tiles can be drawn concurrently into copies of the
+ * image_t that only differ in their clip and dirty fields.
+ */
+void imlib_dlist_execute_tile(const imlib_dlist_t *list, const imlib_dlist_bins_t *bins, image_t *img, int tile)
+{
+    if (bins->start[tile] == bins->start[tile + 1])
+    {
+        return;
+    }
+
+    const rectangle_t *user_clip = img->clip;
+    int x0 = user_clip ? IM_MAX(user_clip->x, 0) : 0;
+    int x1 = user_clip ? IM_MIN(user_clip->x + user_clip->w, img->w) : img->w;
+    int y0 = IM_MAX(tile * bins->tile_rows, user_clip ? user_clip->y : 0);
+    int y1 = IM_MIN(IM_MIN((tile + 1) * bins->tile_rows, img->h), user_clip ? (user_clip->y + user_clip->h) : img->h);
+    if ((x0 >= x1) || (y0 >= y1))
+    {
+        return;
+    }
+
+    rectangle_t clip = {x0, y0, x1 - x0, y1 - y0};
+    img->clip = &clip;
+
+    for (int i = bins->start[tile]; i < bins->start[tile + 1]; i++)
+    {
+        dlist_run(list, &list->cmds[bins->cmds[i]], img);
+    }
+
+    img->clip = user_clip;
+}
+
+/**
+ * Draw all recorded commands into an image, tile by tile. Within a tile commands are drawn in the
+ * order they were recorded, so the result matches calling the imlib_draw_* functions directly.
+ * The list is not cleared.
+ * @param list: recorded commands.
+ * @param img: target image, an existing img->clip is respected.
+ */
+void imlib_dlist_execute(const imlib_dlist_t *list, image_t *img)
+{
+    if ((list->count == 0) || (img->w <= 0) || (img->h <= 0))
+    {
+        return;
+    }
+
+    imlib_dlist_bins_t bins;
+    if (!imlib_dlist_bin(list, img, &bins))
+    {
+        // Not enough memory to bin, draw straight through.
+        dlist_run_all(list, img);
+        return;
+    }
+
+    for (int t = 0; t < bins.tiles; t++)
+    {
+        imlib_dlist_execute_tile(list, &bins, img, t);
+    }
+
+    imlib_dlist_bins_free(&bins);
+}
@@ -8,8 +8,9 @@
 #include "imlib.h"
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#include "utils.h"
+#include <limits.h>
 #include "font.h"
 #include "fmath.h"
 
@@ -66,14 +67,49 @@ inline int imlib_get_pixel_fast(image_t *img, const void *row_ptr, int x)
     }
 }
 
+#define IMLIB_IN_IMAGE(img, x, y) ((0 <= (x)) && ((x) < (img)->w) && (0 <= (y)) && ((y) < (img)->h))
+
+/**
+ * Get the drawable area of the image, [x0, x1) x [y0, y1). This is the whole image, narrowed to
+ * img->clip when one is set.
+ */
+static inline void imlib_get_clip(const image_t *img, int *x0, int *y0, int *x1, int *y1)
+{
+    const rectangle_t *r = img->clip;
+    if (r == NULL)
+    {
+        *x0 = 0;
+        *y0 = 0;
+        *x1 = img->w;
+        *y1 = img->h;
+        return;
+    }
+
+    *x0 = IM_MAX(r->x, 0);
+    *y0 = IM_MAX(r->y, 0);
+    *x1 = IM_MIN(r->x + r->w, img->w);
+    *y1 = IM_MIN(r->y + r->h, img->h);
+}
+
+/**
+ * Check if a pixel is inside the drawable area of the image.
+ */
+static inline bool imlib_in_clip(const image_t *img, int x, int y)
+{
+    const rectangle_t *r = img->clip;
+    return IMLIB_IN_IMAGE(img, x, y) && ((r == NULL) || ((r->x <= x) && (x < (r->x + r->w)) && (r->y <= y) && (y < (r->y + r->h))));
+}
+
 // Set pixel (handles boundary check and image type check).
 /**
  * Set the value of the specified pixel of the image
  */
 void imlib_set_pixel(image_t *img, int x, int y, int p)
 {
-    if ((0 <= x) && (x < img->w) && (0 <= y) && (y < img->h))
+    if (imlib_in_clip(img, x, y))
     {
+        imlib_dirty_add(img, x, y, 1, 1);
+
         switch (img->pixfmt)
         {
             case PIXFORMAT_BINARY:
@@ -99,89 +135,353 @@ void imlib_set_pixel(image_t *img, int x, int y, int p)
     }
 }
 
-// https://stackoverflow.com/questions/1201200/fast-algorithm-for-drawing-filled-circles
+//=======================================================================================
+// Format specialised writers
+//=======================================================================================
+
 /**
- * Fill a circular area
- * @param img: target image.
- * @param cx, cy: center coordinates of the circle.
- * @param r0, r1: radius range of the circle.
- * @param c: fill color.
+ * Pixel and span writers for one pixel format. Primitives resolve the table once with
+ * imlib_get_draw_ops() so their inner loops do not switch on img->pixfmt per pixel.
  */
-static void point_fill(image_t *img, int cx, int cy, int r0, int r1, int c)
+typedef struct imlib_draw_ops
+{
+    // Bounds checked pixel write.
+    void (*set_pixel)(image_t *img, int x, int y, int c);
+    // Blend c over the pixel x of an already clipped row, alpha is the weight of c (0 - 256).
+    void (*blend_pixel)(void *row_ptr, int x, int alpha, int c);
+    // Write the pixels [x0, x1] of an already clipped row.
+    void (*fill_span)(void *row_ptr, int x0, int x1, int c);
+    // Write the pixels [y0, y1] of an already clipped column.
+    void (*fill_column)(image_t *img, int x, int y0, int y1, int c);
+} imlib_draw_ops_t;
+
+
+static void binary_set_pixel(image_t *img, int x, int y, int c)
 {
-    for (int y = r0; y <= r1; y++)
+    if (imlib_in_clip(img, x, y))
     {
-        for (int x = r0; x <= r1; x++)
-        {
-            if (((x * x) + (y * y)) <= (r0 * r0))
-            {
-                imlib_set_pixel(img, cx + x, cy + y, c);
-            }
-        }
+        IMAGE_PUT_BINARY_PIXEL(img, x, y, c);
+    }
+}
+
+static void binary_blend_pixel(void *row_ptr, int x, int alpha, int c)
+{
+    // Rounds to whichever of the pixel and c has more weight, the pixel on a tie.
+    if (alpha > 128)
+    {
+        IMAGE_PUT_BINARY_PIXEL_FAST((uint32_t *) row_ptr, x, c ? 1 : 0);
     }
 }
 
 /**
- * Set the color of a single pixel in the image, supporting anti-aliasing effect.
- * @param img: target image, type image_t, contains image width, height, pixel format and other information.
- * @param x, y: the pixel position to be set.
- * @param err: blending coefficient, ranging from 0 to 255, indicating the proportion of the new color c. A larger err value indicates that the original color occupies a larger proportion.
- * @param c: new color value, its specific meaning varies with the pixel format.
+ * Fill the pixels [x0, x1] of a binary row, a whole 32 pixel word at a time.
  */
-static void imlib_set_pixel_aa(image_t *img, int x, int y, int err, int c)
+static void binary_fill_span(void *row_ptr, int x0, int x1, int c)
 {
-    if (!((0 <= x) && (x < img->w) && (0 <= y) && (y < img->h)))
+    uint32_t *ptr = (uint32_t *) row_ptr;
+    int i0 = x0 >> UINT32_T_SHIFT;
+    int i1 = x1 >> UINT32_T_SHIFT;
+    uint32_t m0 = 0xFFFFFFFFU << (x0 & UINT32_T_MASK);
+    uint32_t m1 = 0xFFFFFFFFU >> (UINT32_T_MASK - (x1 & UINT32_T_MASK));
+    uint32_t v = (c & 1) ? 0xFFFFFFFFU : 0;
+
+    if (i0 == i1)
     {
+        m0 &= m1;
+        ptr[i0] = (ptr[i0] & ~m0) | (v & m0);
         return;
     }
 
+    ptr[i0] = (ptr[i0] & ~m0) | (v & m0);
+    for (int i = i0 + 1; i < i1; i++)
+    {
+        ptr[i] = v;
+    }
+    ptr[i1] = (ptr[i1] & ~m1) | (v & m1);
+}
+
+static void binary_fill_column(image_t *img, int x, int y0, int y1, int c)
+{
+    uint32_t *ptr = IMAGE_COMPUTE_BINARY_PIXEL_ROW_PTR(img, y0);
+    for (int y = y0, stride = IMAGE_BINARY_STRIDE(img) / sizeof(uint32_t); y <= y1; y++, ptr += stride)
+    {
+        IMAGE_PUT_BINARY_PIXEL_FAST(ptr, x, c);
+    }
+}
+
+static void grayscale_set_pixel(image_t *img, int x, int y, int c)
+{
+    if (imlib_in_clip(img, x, y))
+    {
+        IMAGE_PUT_GRAYSCALE_PIXEL(img, x, y, c);
+    }
+}
+
+static void grayscale_blend_pixel(void *row_ptr, int x, int alpha, int c)
+{
+    uint8_t *ptr = ((uint8_t *) row_ptr) + x;
+    *ptr += (((c & 0xFF) - *ptr) * alpha) >> 8;
+}
+
+static void grayscale_fill_span(void *row_ptr, int x0, int x1, int c)
+{
+    memset(((uint8_t *) row_ptr) + x0, c, x1 - x0 + 1);
+}
+
+static void grayscale_fill_column(image_t *img, int x, int y0, int y1, int c)
+{
+    uint8_t *ptr = IMAGE_COMPUTE_GRAYSCALE_PIXEL_ROW_PTR(img, y0) + x;
+    for (int y = y0, stride = IMAGE_GRAYSCALE_STRIDE(img); y <= y1; y++, ptr += stride)
+    {
+        *ptr = c;
+    }
+}
+
+static void rgb565_set_pixel(image_t *img, int x, int y, int c)
+{
+    if (imlib_in_clip(img, x, y))
+    {
+        IMAGE_PUT_RGB565_PIXEL(img, x, y, c);
+    }
+}
+
+/**
+ * Blend all three channels with one multiply. Spreading the pixel over 32 bits as 00000GGGGGG00000
+ * RRRRR000000BBBBB leaves at least 5 clear bits above every channel, room for a 5 bit weight.
+ */
+static void rgb565_blend_pixel(void *row_ptr, int x, int alpha, int c)
+{
+    uint16_t *ptr = ((uint16_t *) row_ptr) + x;
+    uint32_t fg = (c & 0xFFFF) * 0x00010001U;
+    uint32_t bg = *ptr * 0x00010001U;
+    fg &= 0x07E0F81FU;
+    bg &= 0x07E0F81FU;
+    bg = (bg + (((fg - bg) * ((alpha + 4) >> 3)) >> 5)) & 0x07E0F81FU;
+    *ptr = bg | (bg >> 16);
+}
+
+/**
+ * Fill the pixels [x0, x1] of an RGB565 row using 32-bit stores of a doubled pixel pattern.
+ */
+static void rgb565_fill_span(void *row_ptr, int x0, int x1, int c)
+{
+    uint16_t *ptr = ((uint16_t *) row_ptr) + x0;
+    int n = x1 - x0 + 1;
+
+    if (((uintptr_t) ptr & 2) && n)
+    {
+        *ptr++ = c;
+        n--;
+    }
+
+    uint32_t pattern = (c & 0xFFFF) * 0x00010001U;
+    uint32_t *ptr32 = (uint32_t *) ptr;
+    for (; n >= 8; n -= 8, ptr32 += 4)
+    {
+        ptr32[0] = pattern;
+        ptr32[1] = pattern;
+        ptr32[2] = pattern;
+        ptr32[3] = pattern;
+    }
+
+    for (; n >= 2; n -= 2)
+    {
+        *ptr32++ = pattern;
+    }
+
+    if (n)
+    {
+        *((uint16_t *) ptr32) = c;
+    }
+}
+
+static void rgb565_fill_column(image_t *img, int x, int y0, int y1, int c)
+{
+    uint16_t *ptr = IMAGE_COMPUTE_RGB565_PIXEL_ROW_PTR(img, y0) + x;
+    for (int y = y0, stride = IMAGE_RGB565_STRIDE(img) / sizeof(uint16_t); y <= y1; y++, ptr += stride)
+    {
+        *ptr = c;
+    }
+}
+
+static void null_set_pixel(image_t *img, int x, int y, int c)
+{
+}
+
+static void null_blend_pixel(void *row_ptr, int x, int alpha, int c)
+{
+}
+
+static void null_fill_span(void *row_ptr, int x0, int x1, int c)
+{
+}
+
+static void null_fill_column(image_t *img, int x, int y0, int y1, int c)
+{
+}
+
+static const imlib_draw_ops_t binary_draw_ops = {binary_set_pixel, binary_blend_pixel, binary_fill_span, binary_fill_column};
+static const imlib_draw_ops_t grayscale_draw_ops = {grayscale_set_pixel, grayscale_blend_pixel, grayscale_fill_span, grayscale_fill_column};
+static const imlib_draw_ops_t rgb565_draw_ops = {rgb565_set_pixel, rgb565_blend_pixel, rgb565_fill_span, rgb565_fill_column};
+static const imlib_draw_ops_t null_draw_ops = {null_set_pixel, null_blend_pixel, null_fill_span, null_fill_column};
+
+/**
+ * Get the writers for the pixel format of the image. Unsupported formats get writers that draw nothing.
+ */
+static const imlib_draw_ops_t *imlib_get_draw_ops(const image_t *img)
+{
     switch (img->pixfmt)
     {
         case PIXFORMAT_BINARY:
             {
-                uint32_t *ptr = IMAGE_COMPUTE_BINARY_PIXEL_ROW_PTR(img, y);
-                int old_c = IMAGE_GET_BINARY_PIXEL_FAST(ptr, x) * 255;
-                int new_c = (((old_c * err) + ((c ? 255 : 0) * (256 - err))) >> 8) > 127;
-                IMAGE_PUT_BINARY_PIXEL_FAST(ptr, x, new_c);
-                break;
+                return &binary_draw_ops;
             }
         case PIXFORMAT_GRAYSCALE:
             {
-                uint8_t *ptr = IMAGE_COMPUTE_GRAYSCALE_PIXEL_ROW_PTR(img, y);
-                int old_c = IMAGE_GET_GRAYSCALE_PIXEL_FAST(ptr, x);
-                int new_c = ((old_c * err) + ((c & 0xff) * (256 - err))) >> 8;
-                IMAGE_PUT_GRAYSCALE_PIXEL_FAST(ptr, x, new_c);
-                break;
+                return &grayscale_draw_ops;
             }
         case PIXFORMAT_RGB565:
             {
-                uint16_t *ptr = IMAGE_COMPUTE_RGB565_PIXEL_ROW_PTR(img, y);
-                int old_c = IMAGE_GET_RGB565_PIXEL_FAST(ptr, x);
-                int old_c_r5 = COLOR_RGB565_TO_R5(old_c);
-                int old_c_g6 = COLOR_RGB565_TO_G6(old_c);
-                int old_c_b5 = COLOR_RGB565_TO_B5(old_c);
-                int c_r5 = COLOR_RGB565_TO_R5(c);
-                int c_g6 = COLOR_RGB565_TO_G6(c);
-                int c_b5 = COLOR_RGB565_TO_B5(c);
-                int new_c_r5 = ((old_c_r5 * err) + (c_r5 * (256 - err))) >> 8;
-                int new_c_g6 = ((old_c_g6 * err) + (c_g6 * (256 - err))) >> 8;
-                int new_c_b5 = ((old_c_b5 * err) + (c_b5 * (256 - err))) >> 8;
-                int new_c = COLOR_R5_G6_B5_TO_RGB565(new_c_r5, new_c_g6, new_c_b5);
-                IMAGE_PUT_RGB565_PIXEL_FAST(ptr, x, new_c);
-                break;
+                return &rgb565_draw_ops;
             }
         default:
             {
-                break;
+                return &null_draw_ops;
             }
     }
 }
 
+/**
+ * Bounds checked blend, err is the weight of the old pixel (0 - 256).
+ */
+static inline void imlib_set_pixel_aa(const imlib_draw_ops_t *ops, image_t *img, int x, int y, int err, int c)
+{
+    if (imlib_in_clip(img, x, y))
+    {
+        ops->blend_pixel(imlib_compute_row_ptr(img, y), x, 256 - err, c);
+    }
+}
+
+/**
+ * Blend a color over a pixel of the image.
+ * @param alpha: weight of c, 0 keeps the pixel and 256 replaces it.
+ */
+void imlib_blend_pixel(image_t *img, int x, int y, int c, int alpha)
+{
+    if (imlib_in_clip(img, x, y) && (alpha > 0))
+    {
+        imlib_dirty_add(img, x, y, 1, 1);
+        imlib_get_draw_ops(img)->blend_pixel(imlib_compute_row_ptr(img, y), x, IM_MIN(alpha, 256), c);
+    }
+}
+
+/**
+ * Draw a pixel of an already clipped row that an anti-aliased shape covers by cov (0 - 256).
+ */
+static inline void imlib_plot_coverage(const imlib_draw_ops_t *ops, void *row_ptr, int x, int cov, int c)
+{
+    if (cov >= 256)
+    {
+        ops->fill_span(row_ptr, x, x, c);
+    }
+    else if (cov > 0)
+    {
+        ops->blend_pixel(row_ptr, x, cov, c);
+    }
+}
+
+/**
+ * Fill a rectangle. The rectangle is clipped once and then filled a row span at a time.
+ * @param ops: writers for the pixel format of img.
+ * @param img: target image.
+ * @param rx, ry: top left corner of the rectangle.
+ * @param rw, rh: width and height of the rectangle.
+ * @param c: fill color.
+ */
+static void imlib_fill_rect(const imlib_draw_ops_t *ops, image_t *img, int rx, int ry, int rw, int rh, int c)
+{
+    int clip_x0, clip_y0, clip_x1, clip_y1;
+    imlib_get_clip(img, &clip_x0, &clip_y0, &clip_x1, &clip_y1);
+
+    int x0 = IM_MAX(rx, clip_x0);
+    int y0 = IM_MAX(ry, clip_y0);
+    int x1 = IM_MIN(rx + rw, clip_x1) - 1;
+    int y1 = IM_MIN(ry + rh, clip_y1) - 1;
+
+    if ((x0 > x1) || (y0 > y1))
+    {
+        return;
+    }
+
+    imlib_dirty_add(img, x0, y0, x1 - x0 + 1, y1 - y0 + 1);
+
+    for (int y = y0; y <= y1; y++)
+    {
+        ops->fill_span(imlib_compute_row_ptr(img, y), x0, x1, c);
+    }
+}
+
+static void xLine(const imlib_draw_ops_t *ops, image_t *img, int x1, int x2, int y, int c)
+{
+    int clip_x0, clip_y0, clip_x1, clip_y1;
+    imlib_get_clip(img, &clip_x0, &clip_y0, &clip_x1, &clip_y1);
+
+    if ((y < clip_y0) || (y >= clip_y1))
+    {
+        return;
+    }
+
+    x1 = IM_MAX(x1, clip_x0);
+    x2 = IM_MIN(x2, clip_x1 - 1);
+
+    if (x1 <= x2)
+    {
+        ops->fill_span(imlib_compute_row_ptr(img, y), x1, x2, c);
+    }
+}
+
+static void yLine(const imlib_draw_ops_t *ops, image_t *img, int x, int y1, int y2, int c)
+{
+    int clip_x0, clip_y0, clip_x1, clip_y1;
+    imlib_get_clip(img, &clip_x0, &clip_y0, &clip_x1, &clip_y1);
+
+    if ((x < clip_x0) || (x >= clip_x1))
+    {
+        return;
+    }
+
+    y1 = IM_MAX(y1, clip_y0);
+    y2 = IM_MIN(y2, clip_y1 - 1);
+
+    if (y1 <= y2)
+    {
+        ops->fill_column(img, x, y1, y2, c);
+    }
+}
+
+/**
+ * Draw a horizontal line from (x0, y) to (x1, y) inclusive, clipped to the image.
+ */
+void imlib_draw_hline(image_t *img, int x0, int x1, int y, int c)
+{
+    imlib_dirty_add(img, x0, y, x1 - x0 + 1, 1);
+    xLine(imlib_get_draw_ops(img), img, x0, x1, y, c);
+}
+
+/**
+ * Draw a vertical line from (x, y0) to (x, y1) inclusive, clipped to the image.
+ */
+void imlib_draw_vline(image_t *img, int x, int y0, int y1, int c)
+{
+    imlib_dirty_add(img, x, y0, 1, y1 - y0 + 1);
+    yLine(imlib_get_draw_ops(img), img, x, y0, y1, c);
+}
+
 // https://gist.github.com/randvoorhies/807ce6e20840ab5314eb7c547899de68#file-bresenham-js-L381
 /**
  * Draw a line
  */
-static void imlib_draw_thin_line(image_t *img, int x0, int y0, int x1, int y1, int c)
+static void imlib_draw_thin_line(const imlib_draw_ops_t *ops, image_t *img, int x0, int y0, int x1, int y1, int c)
 {
     const int dx = abs(x1 - x0);
     const int sx = x0 < x1 ? 1 : -1;
@@ -191,10 +491,19 @@ static void imlib_draw_thin_line(image_t *img, int x0, int y0, int x1, int y1, i
     int e2, x2; // error value e_xy
     int ed = dx + dy == 0 ? 1 : fast_floorf(fast_sqrtf(dx * dx + dy * dy));
 
+    int clip_x0, clip_y0, clip_x1, clip_y1;
+    imlib_get_clip(img, &clip_x0, &clip_y0, &clip_x1, &clip_y1);
+
     for (;;)
     {
+        // Rows only move towards y1, nothing is left to draw once the clip has been passed.
+        if ((sy > 0) ? (y0 >= clip_y1) : (y0 < clip_y0))
+        {
+            break;
+        }
+
         // pixel loop
-        imlib_set_pixel_aa(img, x0, y0, 256 * abs(err - dx + dy) / ed, c);
+        imlib_set_pixel_aa(ops, img, x0, y0, 256 * abs(err - dx + dy) / ed, c);
         e2 = err;
         x2 = x0;
         if (2 * e2 >= -dx)
@@ -206,7 +515,7 @@ static void imlib_draw_thin_line(image_t *img, int x0, int y0, int x1, int y1, i
             }
             if (e2 + dy < ed)
             {
-                imlib_set_pixel_aa(img, x0, y0 + sy, 256 * (e2 + dy) / ed, c);
+                imlib_set_pixel_aa(ops, img, x0, y0 + sy, 256 * (e2 + dy) / ed, c);
             }
             err -= dy;
             x0 += sx;
@@ -220,7 +529,7 @@ static void imlib_draw_thin_line(image_t *img, int x0, int y0, int x1, int y1, i
             }
             if (dx - e2 < ed)
             {
-                imlib_set_pixel_aa(img, x2 + sx, y0, 256 * (dx - e2) / ed, c);
+                imlib_set_pixel_aa(ops, img, x2 + sx, y0, 256 * (dx - e2) / ed, c);
             }
             err += dx;
             y0 += sy;
@@ -228,165 +537,1077 @@ static void imlib_draw_thin_line(image_t *img, int x0, int y0, int x1, int y1, i
     }
 }
 
-// https://gist.github.com/randvoorhies/807ce6e20840ab5314eb7c547899de68#file-bresenham-js-L813
 /**
- * Draw a line
+ * Integer square root, rounded down.
+ */
+static uint32_t imlib_isqrt(uint64_t v)
+{
+    uint64_t root = 0;
+    for (uint64_t bit = UINT64_C(1) << 62; bit != 0; bit >>= 2)
+    {
+        if (v >= (root + bit))
+        {
+            v -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else
+        {
+            root >>= 1;
+        }
+    }
+    return root;
+}
+
+#define LINE_SAMPLE_BIAS (1.0f / 256.0f) // Pixels are sampled just off their centre, so that edges through a centre cover it on one side only.
+#define LINE_NO_LIMIT 1.0e9f
+
+/**
+ * Narrow [lo, hi] to the x where min <= (a * x) + b <= max.
+ */
+static inline void line_limit(float a, float b, float min, float max, float *lo, float *hi)
+{
+    if (fast_fabsf(a) < 1.0e-6f)
+    {
+        if ((b < min) || (b > max))
+        {
+            *lo = LINE_NO_LIMIT;
+        }
+        return;
+    }
+
+    float t0 = (min - b) / a;
+    float t1 = (max - b) / a;
+    *lo = IM_MAX(*lo, IM_MIN(t0, t1));
+    *hi = IM_MIN(*hi, IM_MAX(t0, t1));
+}
+
+/**
+ * Widen [lo, hi] by the x inside a disc, at height dy from its centre at cx.
+ */
+static inline void line_disc(float cx, float dy, float r, float *lo, float *hi)
+{
+    float r_squared = (r * r) - (dy * dy);
+    if (r_squared >= 0.0f)
+    {
+        float half = fast_sqrtf(r_squared);
+        bool empty = *lo > *hi;
+        *lo = empty ? (cx - half) : IM_MIN(*lo, cx - half);
+        *hi = empty ? (cx + half) : IM_MAX(*hi, cx + half);
+    }
+}
+
+/**
+ * Fill a line of width th as one convex shape: a rectangle along the line, extended at the ends
+ * for butt and square caps or with a disc on each end point for round caps. Every row of the
+ * shape is a single span, so every pixel is written exactly once.
+ */
+static void imlib_draw_wide_line(const imlib_draw_ops_t *ops, image_t *img, int x0, int y0, int x1, int y1, int c, int th, imlib_line_cap_t cap)
+{
+    float dx = x1 - x0, dy = y1 - y0;
+    float len = fast_sqrtf((dx * dx) + (dy * dy));
+    float hw = th * 0.5f;
+    float ux = (len > 0.0f) ? (dx / len) : 1.0f;
+    float uy = (len > 0.0f) ? (dy / len) : 0.0f;
+
+    // Butt ends cover the end point pixels, square ends reach half the width beyond the end points.
+    float ext = (cap == IMLIB_LINE_CAP_SQUARE) ? hw : ((cap == IMLIB_LINE_CAP_ROUND) ? 0.0f : 0.5f);
+    if ((len == 0.0f) && (cap == IMLIB_LINE_CAP_BUTT))
+    {
+        ext = hw;
+    }
+
+    int clip_x0, clip_y0, clip_x1, clip_y1;
+    imlib_get_clip(img, &clip_x0, &clip_y0, &clip_x1, &clip_y1);
+
+    int reach = fast_ceilf(hw + ext) + 1;
+    int row0 = IM_MAX(IM_MIN(y0, y1) - reach, clip_y0);
+    int row1 = IM_MIN(IM_MAX(y0, y1) + reach, clip_y1 - 1);
+
+    for (int y = row0; y <= row1; y++)
+    {
+        // Coordinates relative to (x0, y0), at the sample point of the pixels of the row.
+        float py = (y - y0) + LINE_SAMPLE_BIAS;
+        float lo = -LINE_NO_LIMIT, hi = LINE_NO_LIMIT;
+        line_limit(ux, py * uy, -ext, len + ext, &lo, &hi);
+        line_limit(-uy, py * ux, -hw, hw, &lo, &hi);
+
+        if (cap == IMLIB_LINE_CAP_ROUND)
+        {
+            // The shape is convex, so the union of the pieces on a row is still one span.
+            line_disc(0.0f, py, hw, &lo, &hi);
+            line_disc(dx, py - dy, hw, &lo, &hi);
+        }
+
+        lo = IM_MAX(lo - LINE_SAMPLE_BIAS + x0, (float) (clip_x0 - 1));
+        hi = IM_MIN(hi - LINE_SAMPLE_BIAS + x0, (float) clip_x1);
+        int span_x0 = IM_MAX(fast_ceilf(lo), clip_x0);
+        int span_x1 = IM_MIN(fast_floorf(hi), clip_x1 - 1);
+        if (span_x0 <= span_x1)
+        {
+            ops->fill_span(imlib_compute_row_ptr(img, y), span_x0, span_x1, c);
+        }
+    }
+}
+
+#define AA_BITS 16 // Fraction bits of the anti-aliased geometry.
+#define AA_ONE (1 << AA_BITS)
+#define AA_HALF (1 << (AA_BITS - 1))
+#define LINE_AA_MAX_SPAN 16384 // Longer lines are clipped first, which keeps their squared length within 32 bits.
+
+static inline int64_t aa_floor(int64_t v)
+{
+    return v >> AA_BITS;
+}
+
+static inline int64_t aa_ceil(int64_t v)
+{
+    return -((-v) >> AA_BITS);
+}
+
+/**
+ * Coverage (0 - 256) of a pixel whose centre is inside an edge by the given distance, negative if
+ * it is outside. The edge is taken as straight across the pixel, so the coverage ramps from the
+ * centre half a pixel outside the edge to half a pixel inside.
+ */
+static inline int aa_coverage(int64_t inside)
+{
+    int64_t cov = (inside + AA_HALF) >> (AA_BITS - 8);
+    return (cov <= 0) ? 0 : ((cov >= 256) ? 256 : (int) cov);
+}
+
+/**
+ * Anti-aliased version of imlib_draw_wide_line(), for any width. Like Wu's line, the major axis u
+ * is walked one pixel at a time and the line crosses every step in a run of pixels along the
+ * minor axis v. The run and the distance of its pixels from the centre line are in fixed point,
+ * so the coverage of a pixel is its distance from the sides, and within a few pixels of an end
+ * point also its distance along the line from the cap. Pixels fully inside are filled as one run.
+ */
+static void imlib_draw_line_aa(const imlib_draw_ops_t *ops, image_t *img, int x0, int y0, int x1, int y1, int c, int th, imlib_line_cap_t cap)
+{
+    int clip_x0, clip_y0, clip_x1, clip_y1;
+    imlib_get_clip(img, &clip_x0, &clip_y0, &clip_x1, &clip_y1);
+
+    if ((abs(x1 - x0) > LINE_AA_MAX_SPAN) || (abs(y1 - y0) > LINE_AA_MAX_SPAN))
+    {
+        int pad = th + 2;
+        line_t line = {x0, y0, x1, y1};
+        if (!lb_clip_line(&line, clip_x0 - pad, clip_y0 - pad, clip_x1 - clip_x0 + (2 * pad), clip_y1 - clip_y0 + (2 * pad)))
+        {
+            return;
+        }
+        x0 = line.x1;
+        y0 = line.y1;
+        x1 = line.x2;
+        y1 = line.y2;
+    }
+
+    bool steep = abs(y1 - y0) > abs(x1 - x0);
+    int u0 = steep ? y0 : x0, v0 = steep ? x0 : y0;
+    int u1 = steep ? y1 : x1, v1 = steep ? x1 : y1;
+    if (u0 > u1)
+    {
+        int t = u0;
+        u0 = u1;
+        u1 = t;
+        t = v0;
+        v0 = v1;
+        v1 = t;
+    }
+
+    int64_t du = u1 - u0, dv = v1 - v0;
+    int64_t len = imlib_isqrt(((du * du) + (dv * dv)) << (2 * AA_BITS));
+    int64_t ux = (len > 0) ? ((du * AA_ONE * AA_ONE) / len) : AA_ONE;
+    int64_t uy = (len > 0) ? ((dv * AA_ONE * AA_ONE) / len) : 0;
+    int64_t slope = (du > 0) ? ((dv * (INT64_C(1) << 32)) / du) : 0; // Minor axis step per major step, 32 fraction bits.
+
+    // Butt ends cover the end point pixels, square ends reach half the width beyond the end points.
+    int64_t hw = (int64_t) th << (AA_BITS - 1);
+    int64_t ext = (cap == IMLIB_LINE_CAP_SQUARE) ? hw : ((cap == IMLIB_LINE_CAP_ROUND) ? 0 : AA_HALF);
+    if ((len == 0) && (cap == IMLIB_LINE_CAP_BUTT))
+    {
+        ext = hw;
+    }
+
+    // Pixels up to run_v from the centre line along v are touched, up to solid_v they are covered.
+    int64_t run_v = ((hw + AA_HALF) << AA_BITS) / ux;
+    int64_t solid_v = (hw > AA_HALF) ? (((hw - AA_HALF) << AA_BITS) / ux) : -1;
+
+    // The caps cannot reach more than reach steps beyond the end points, and steps further than
+    // that from both end points are only limited by the sides.
+    int reach = (int) (((hw + ext) * 3) >> (AA_BITS + 1)) + 2;
+    int clip_u0 = steep ? clip_y0 : clip_x0, clip_u1 = steep ? clip_y1 : clip_x1;
+    int clip_v0 = steep ? clip_x0 : clip_y0, clip_v1 = steep ? clip_x1 : clip_y1;
+
+    for (int u = IM_MAX(u0 - reach, clip_u0), u_end = IM_MIN(u1 + reach, clip_u1 - 1); u <= u_end; u++)
+    {
+        int64_t vc = ((int64_t) v0 * AA_ONE) + ((slope * (u - u0)) >> (32 - AA_BITS));
+        int lo = IM_MAX(aa_ceil(vc - run_v), (int64_t) clip_v0);
+        int hi = IM_MIN(aa_floor(vc + run_v), (int64_t) (clip_v1 - 1));
+        bool in_cap = (u < (u0 + reach)) || (u > (u1 - reach));
+        void *row_ptr = steep ? imlib_compute_row_ptr(img, u) : NULL;
+
+        int solid_lo = hi + 1, solid_hi = hi;
+        if (!in_cap && (solid_v >= 0))
+        {
+            solid_lo = IM_MAX(aa_ceil(vc - solid_v), (int64_t) lo);
+            solid_hi = IM_MIN(aa_floor(vc + solid_v), (int64_t) hi);
+        }
+
+        for (int v = lo; v <= hi; v++)
+        {
+            if ((v == solid_lo) && (solid_lo <= solid_hi))
+            {
+                if (steep)
+                {
+                    ops->fill_span(row_ptr, solid_lo, solid_hi, c);
+                }
+                else
+                {
+                    ops->fill_column(img, u, solid_lo, solid_hi, c);
+                }
+                v = solid_hi;
+                continue;
+            }
+
+            // Signed distance from the centre line, and along it from (u0, v0).
+            int64_t d = ((((int64_t) v << AA_BITS) - vc) * ux) >> AA_BITS;
+            int cov = aa_coverage(hw - llabs(d));
+            if (in_cap && (cov > 0))
+            {
+                int64_t t = (((int64_t) (u - u0) * ux) + ((int64_t) (v - v0) * uy));
+                if (cap != IMLIB_LINE_CAP_ROUND)
+                {
+                    cov = (cov * aa_coverage(t + ext) * aa_coverage(len + ext - t)) >> 16;
+                }
+                else if ((t < 0) || (t > len))
+                {
+                    int64_t te = (t < 0) ? t : (t - len);
+                    cov = aa_coverage(hw - imlib_isqrt((uint64_t) ((d * d) + (te * te))));
+                }
+            }
+
+            if (cov > 0)
+            {
+                int x = steep ? v : u;
+                imlib_plot_coverage(ops, steep ? row_ptr : imlib_compute_row_ptr(img, v), x, cov, c);
+            }
+        }
+    }
+}
+
+/**
+ * Draw a line th pixels wide with the given end caps. Lines of width 1 or less are thin
+ * anti-aliased lines, which have no caps.
+ */
+void imlib_draw_capped_line(image_t *img, int x0, int y0, int x1, int y1, int c, int th, imlib_line_cap_t cap)
+{
+    if (th <= 1)
+    {
+        imlib_draw_line(img, x0, y0, x1, y1, c, th);
+        return;
+    }
+
+    // Square ends reach out diagonally at the corners.
+    int pad = ((cap == IMLIB_LINE_CAP_SQUARE) ? ((th * 3) / 4) : (th / 2)) + 2;
+    imlib_dirty_add(img, IM_MIN(x0, x1) - pad, IM_MIN(y0, y1) - pad, abs(x1 - x0) + 1 + (2 * pad), abs(y1 - y0) + 1 + (2 * pad));
+
+    if (img->antialias)
+    {
+        imlib_draw_line_aa(imlib_get_draw_ops(img), img, x0, y0, x1, y1, c, th, cap);
+    }
+    else
+    {
+        imlib_draw_wide_line(imlib_get_draw_ops(img), img, x0, y0, x1, y1, c, th, cap);
+    }
+}
+
+/**
+ * Draw a line. Lines wider than one pixel have butt ends, see imlib_draw_capped_line().
+ */
+void imlib_draw_line(image_t *img, int x0, int y0, int x1, int y1, int c, int th)
+{
+    if (th > 1)
+    {
+        imlib_draw_capped_line(img, x0, y0, x1, y1, c, th, IMLIB_LINE_CAP_BUTT);
+        return;
+    }
+
+    if (img->antialias)
+    {
+        imlib_dirty_add(img, IM_MIN(x0, x1) - 2, IM_MIN(y0, y1) - 2, abs(x1 - x0) + 5, abs(y1 - y0) + 5);
+        imlib_draw_line_aa(imlib_get_draw_ops(img), img, x0, y0, x1, y1, c, 1, IMLIB_LINE_CAP_BUTT);
+        return;
+    }
+
+    line_t line = {x0, y0, x1, y1};
+    if (!lb_clip_line(&line, 0, 0, img->w, img->h))
+    {
+        return;
+    }
+
+    imlib_dirty_add(img, IM_MIN(line.x1, line.x2) - 1, IM_MIN(line.y1, line.y2) - 1, abs(line.x2 - line.x1) + 3, abs(line.y2 - line.y1) + 3);
+    imlib_draw_thin_line(imlib_get_draw_ops(img), img, line.x1, line.y1, line.x2, line.y2, c);
+}
+
+/**
+ * Draw a line
+ */
+void imlib_draw_arrow(image_t *img, int x0, int y0, int x1, int y1, int c, int th, int size)
+{
+    int dx = (x1 - x0);
+    int dy = (y1 - y0);
+    float length = fast_sqrtf((dx * dx) + (dy * dy));
+
+    float ux = IM_DIV(dx, length);
+    float uy = IM_DIV(dy, length);
+    float vx = -uy;
+    float vy = ux;
+
+    int a0x = fast_roundf(x1 - (size * ux) + (size * vx * 0.5));
+    int a0y = fast_roundf(y1 - (size * uy) + (size * vy * 0.5));
+    int a1x = fast_roundf(x1 - (size * ux) - (size * vx * 0.5));
+    int a1y = fast_roundf(y1 - (size * uy) - (size * vy * 0.5));
+
+    imlib_draw_line(img, x0, y0, x1, y1, c, th);
+    imlib_draw_line(img, x1, y1, a0x, a0y, c, th);
+    imlib_draw_line(img, x1, y1, a1x, a1y, c, th);
+}
+
+/**
+ * Draw a rectangle
+ */
+void imlib_draw_rectangle(image_t *img, int rx, int ry, int rw, int rh, int c, int thickness, bool fill)
+{
+    const imlib_draw_ops_t *ops = imlib_get_draw_ops(img);
+
+    if (fill)
+    {
+        imlib_fill_rect(ops, img, rx, ry, rw, rh, c);
+    }
+    else if (thickness > 0)
+    {
+        int thickness0 = (thickness - 0) / 2;
+        int thickness1 = (thickness - 1) / 2;
+        int band = thickness0 + thickness1 + 1;
+
+        // Top and bottom bands span the full outer width, left and right bands the full outer height.
+        imlib_fill_rect(ops, img, rx - thickness0, ry - thickness0, rw + thickness0 + thickness1, band, c);
+        imlib_fill_rect(ops, img, rx - thickness0, ry + rh - 1 - thickness0, rw + thickness0 + thickness1, band, c);
+        imlib_fill_rect(ops, img, rx - thickness0, ry - thickness0, band, rh + thickness0 + thickness1, c);
+        imlib_fill_rect(ops, img, rx + rw - 1 - thickness0, ry - thickness0, band, rh + thickness0 + thickness1, c);
+    }
+}
+
+/**
+ * Get the span of a rounded rectangle on a row.
+ * @return: false if the row does not cross the rectangle.
+ */
+static bool rounded_rect_span(int rx, int ry, int rw, int rh, int r, int y, int *x0, int *x1)
+{
+    if ((y < ry) || (y >= (ry + rh)))
+    {
+        return false;
+    }
+
+    // Corner rows are inset to the first pixel whose centre is inside the corner circle.
+    int k = IM_MIN(y - ry, ry + rh - 1 - y);
+    int inset = 0;
+    if (k < r)
+    {
+        float dy = r - k - 0.5f;
+        inset = IM_MAX(fast_ceilf(r - 0.5f - fast_sqrtf((r * r) - (dy * dy))), 0);
+    }
+
+    *x0 = rx + inset;
+    *x1 = rx + rw - 1 - inset;
+    return *x0 <= *x1;
+}
+
+/**
+ * Draw a rectangle with rounded corners, a row span at a time. The outline is placed like the
+ * outline of imlib_draw_rectangle(), every pixel is written once.
+ * @param radius: corner radius, limited to half the width and height.
+ */
+void imlib_draw_rounded_rectangle(image_t *img, int rx, int ry, int rw, int rh, int radius, int c, int thickness, bool fill)
+{
+    const imlib_draw_ops_t *ops = imlib_get_draw_ops(img);
+    if ((rw <= 0) || (rh <= 0) || (!fill && (thickness <= 0)))
+    {
+        return;
+    }
+
+    // Outer and inner outline edges, the inner rectangle is empty when filling.
+    int t0 = fill ? 0 : (thickness / 2);
+    int t1 = fill ? 0 : ((thickness - 1) / 2);
+    int ox = rx - t0, oy = ry - t0, ow = rw + t0 + t1, oh = rh + t0 + t1;
+    int ix = rx + t1 + 1, iy = ry + t1 + 1, iw = rw - t0 - t1 - 2, ih = rh - t0 - t1 - 2;
+    int outer_r = IM_MIN((radius > 0) ? (radius + t0) : 0, IM_MIN(ow, oh) / 2);
+    int inner_r = IM_MIN(IM_MAX(radius - t1 - 1, 0), IM_MAX(IM_MIN(iw, ih), 0) / 2);
+    if (fill)
+    {
+        iw = ih = 0;
+    }
+
+    int clip_x0, clip_y0, clip_x1, clip_y1;
+    imlib_get_clip(img, &clip_x0, &clip_y0, &clip_x1, &clip_y1);
+    imlib_dirty_add(img, ox, oy, ow, oh);
+
+    for (int y = IM_MAX(oy, clip_y0); y < IM_MIN(oy + oh, clip_y1); y++)
+    {
+        int x0, x1, hole_x0, hole_x1;
+        if (!rounded_rect_span(ox, oy, ow, oh, outer_r, y, &x0, &x1))
+        {
+            continue;
+        }
+
+        void *row_ptr = imlib_compute_row_ptr(img, y);
+        if ((iw > 0) && (ih > 0) && rounded_rect_span(ix, iy, iw, ih, inner_r, y, &hole_x0, &hole_x1))
+        {
+            // Left and right of the hole.
+            int l0 = IM_MAX(x0, clip_x0), l1 = IM_MIN(hole_x0 - 1, clip_x1 - 1);
+            int r0 = IM_MAX(hole_x1 + 1, clip_x0), r1 = IM_MIN(x1, clip_x1 - 1);
+            if (l0 <= l1)
+            {
+                ops->fill_span(row_ptr, l0, l1, c);
+            }
+            if (r0 <= r1)
+            {
+                ops->fill_span(row_ptr, r0, r1, c);
+            }
+        }
+        else
+        {
+            x0 = IM_MAX(x0, clip_x0);
+            x1 = IM_MIN(x1, clip_x1 - 1);
+            if (x0 <= x1)
+            {
+                ops->fill_span(row_ptr, x0, x1, c);
+            }
+        }
+    }
+}
+
+#define POLYGON_STACK_EDGES 32 // Polygons with up to this many edges need no heap memory.
+
+/**
+ * Polygon edge, stepped a row at a time. Its crossing of a row is the exact rational
+ * xi + (xf / den), kept with integers so that edges shared by two polygons split the pixels
+ * the same way whatever the order of the vertices.
+ */
+typedef struct polygon_edge
+{
+    int y0, y1;   // Rows [y0, y1) the edge crosses.
+    int xi, xf;   // Crossing of the current row, 0 <= xf < den.
+    int step_i;   // Crossing step per row.
+    int step_f;
+    int den;
+    int winding;  // +1 for edges going down, -1 for edges going up.
+    int px;       // First pixel right of the crossing.
+} polygon_edge_t;
+
+static int polygon_edge_compare(const void *a, const void *b)
+{
+    return ((const polygon_edge_t *) a)->y0 - ((const polygon_edge_t *) b)->y0;
+}
+
+/**
+ * Floor division of a by b > 0, the remainder goes to *rem.
+ */
+static inline int64_t polygon_floor_div(int64_t a, int64_t b, int64_t *rem)
+{
+    int64_t q = a / b;
+    int64_t r = a - (q * b);
+    if (r < 0)
+    {
+        q--;
+        r += b;
+    }
+    *rem = r;
+    return q;
+}
+
+/**
+ * Set up an edge at its first row at or below y_start. Pixels are sampled at their centre.
+ * @return: false if the edge is horizontal or entirely above y_start.
+ */
+static bool polygon_edge_init(polygon_edge_t *e, const point_t *a, const point_t *b, int y_start)
+{
+    if (a->y == b->y)
+    {
+        return false;
+    }
+
+    e->winding = (a->y < b->y) ? 1 : -1;
+    const point_t *top = (a->y < b->y) ? a : b;
+    const point_t *bottom = (a->y < b->y) ? b : a;
+    e->y0 = IM_MAX(top->y, y_start);
+    e->y1 = bottom->y;
+    if (e->y0 >= e->y1)
+    {
+        return false;
+    }
+
+    // The crossing of row y is at y + 0.5, x = top.x + (2 (y - top.y) + 1) dx / (2 dy).
+    int dx = bottom->x - top->x, dy = bottom->y - top->y;
+    int64_t rem;
+    e->den = 2 * dy;
+    e->xi = top->x + polygon_floor_div((int64_t) ((2 * (e->y0 - top->y)) + 1) * dx, e->den, &rem);
+    e->xf = rem;
+    e->step_i = polygon_floor_div(2 * dx, e->den, &rem);
+    e->step_f = rem;
+    return true;
+}
+
+/**
+ * First pixel whose centre is at or right of the crossing.
+ */
+static inline int polygon_edge_pixel(const polygon_edge_t *e)
+{
+    return e->xi + ((2 * e->xf) > e->den);
+}
+
+/**
+ * Fill a polygon, convex or not, with an active edge table. Every row is filled with one span
+ * per run of pixels inside the polygon, every pixel is written once. A pixel is inside when its
+ * centre is, so the rectangle polygon (x, y) - (x + w, y + h) fills the same pixels as
+ * imlib_draw_rectangle() with w and h. Rows and spans are clipped to the image or its clip.
+ * @param points: vertices, the last one connects back to the first.
+ * @param rule: which regions of a self intersecting polygon are inside.
+ * @return: false if there was not enough memory for the edges, nothing is drawn then.
+ */
+bool imlib_fill_polygon(image_t *img, const point_t *points, int count, int c, imlib_fill_rule_t rule)
+{
+    if (count < 3)
+    {
+        return true;
+    }
+
+    const imlib_draw_ops_t *ops = imlib_get_draw_ops(img);
+    int clip_x0, clip_y0, clip_x1, clip_y1;
+    imlib_get_clip(img, &clip_x0, &clip_y0, &clip_x1, &clip_y1);
+
+    polygon_edge_t stack_edges[POLYGON_STACK_EDGES];
+    polygon_edge_t *stack_active[POLYGON_STACK_EDGES];
+    polygon_edge_t *edges = stack_edges;
+    polygon_edge_t **active = stack_active;
+    if (count > POLYGON_STACK_EDGES)
+    {
+        edges = (polygon_edge_t *) malloc(count * sizeof(polygon_edge_t));
+        active = (polygon_edge_t **) malloc(count * sizeof(polygon_edge_t *));
+        if ((edges == NULL) || (active == NULL))
+        {
+            free(edges);
+            free(active);
+            return false;
+        }
+    }
+
+    int n = 0;
+    int x_min = INT_MAX, x_max = INT_MIN, y_max = INT_MIN;
+    for (int i = 0; i < count; i++)
+    {
+        const point_t *a = &points[i], *b = &points[(i + 1) % count];
+        x_min = IM_MIN(x_min, (int) a->x);
+        x_max = IM_MAX(x_max, (int) a->x);
+        y_max = IM_MAX(y_max, (int) a->y);
+        n += polygon_edge_init(&edges[n], a, b, clip_y0);
+    }
+
+    qsort(edges, n, sizeof(polygon_edge_t), polygon_edge_compare);
+    if (n > 0)
+    {
+        imlib_dirty_add(img, x_min, edges[0].y0, x_max - x_min + 1, y_max - edges[0].y0 + 1);
+    }
+
+    int next = 0, active_n = 0;
+    for (int y = (n > 0) ? edges[0].y0 : clip_y1; (y < clip_y1) && ((next < n) || (active_n > 0)); y++)
+    {
+        // Drop the edges that ended, step the others and add the edges starting on this row.
+        int kept = 0;
+        for (int i = 0; i < active_n; i++)
+        {
+            polygon_edge_t *e = active[i];
+            if (y < e->y1)
+            {
+                e->xi += e->step_i;
+                e->xf += e->step_f;
+                if (e->xf >= e->den)
+                {
+                    e->xi++;
+                    e->xf -= e->den;
+                }
+                e->px = polygon_edge_pixel(e);
+                active[kept++] = e;
+            }
+        }
+        active_n = kept;
+
+        for (; (next < n) && (edges[next].y0 == y); next++)
+        {
+            edges[next].px = polygon_edge_pixel(&edges[next]);
+            active[active_n++] = &edges[next];
+        }
+
+        // The crossings barely move between rows, so an insertion sort is close to linear.
+        for (int i = 1; i < active_n; i++)
+        {
+            polygon_edge_t *e = active[i];
+            int j = i - 1;
+            for (; (j >= 0) && (active[j]->px > e->px); j--)
+            {
+                active[j + 1] = active[j];
+            }
+            active[j + 1] = e;
+        }
+
+        void *row_ptr = imlib_compute_row_ptr(img, y);
+        int winding = 0;
+        for (int i = 0; i < active_n; i++)
+        {
+            bool was_inside = winding != 0;
+            winding = (rule == IMLIB_FILL_EVEN_ODD) ? (winding ^ 1) : (winding + active[i]->winding);
+            bool inside = winding != 0;
+
+            if (!was_inside && inside)
+            {
+                // A span starts, it ends where the winding drops back to zero.
+                int j = i + 1;
+                int w = winding;
+                for (; j < active_n; j++)
+                {
+                    w = (rule == IMLIB_FILL_EVEN_ODD) ? (w ^ 1) : (w + active[j]->winding);
+                    if (w == 0)
+                    {
+                        break;
+                    }
+                }
+
+                int x0 = IM_MAX(active[i]->px, clip_x0);
+                int x1 = IM_MIN(((j < active_n) ? active[j]->px : active[active_n - 1]->px) - 1, clip_x1 - 1);
+                if (x0 <= x1)
+                {
+                    ops->fill_span(row_ptr, x0, x1, c);
+                }
+
+                winding = 0;
+                i = j;
+            }
+        }
+    }
+
+    if (edges != stack_edges)
+    {
+        free(edges);
+        free(active);
+    }
+
+    return true;
+}
+
+/**
+ * Draw the outline of a closed polygon. Wide outlines have round joins.
+ */
+void imlib_draw_polygon(image_t *img, const point_t *points, int count, int c, int thickness)
+{
+    for (int i = 0; i < count; i++)
+    {
+        const point_t *a = &points[i], *b = &points[(i + 1) % count];
+        imlib_draw_capped_line(img, a->x, a->y, b->x, b->y, c, thickness, IMLIB_LINE_CAP_ROUND);
+    }
+}
+
+#define ELLIPSE_TRIG_BITS 14 // Precision of the sine table.
+#define ELLIPSE_MAX_AXIS (1 << 24) // Largest semi-axis of imlib_draw_ellipse().
+#define ELLIPSE_INT_MAX_AXIS 2048  // Largest semi-axis evaluated on integers, which keeps F within 64 bits.
+
+// sin() of 0 - 90 degrees.
+static const int16_t ellipse_sin_table[91] = {
+    0, 286, 572, 857, 1143, 1428, 1713, 1997, 2280, 2563,
+    2845, 3126, 3406, 3686, 3964, 4240, 4516, 4790, 5063, 5334,
+    5604, 5872, 6138, 6402, 6664, 6924, 7182, 7438, 7692, 7943,
+    8192, 8438, 8682, 8923, 9162, 9397, 9630, 9860, 10087, 10311,
+    10531, 10749, 10963, 11174, 11381, 11585, 11786, 11982, 12176, 12365,
+    12551, 12733, 12911, 13085, 13255, 13421, 13583, 13741, 13894, 14044,
+    14189, 14330, 14466, 14598, 14726, 14849, 14968, 15082, 15191, 15296,
+    15396, 15491, 15582, 15668, 15749, 15826, 15897, 15964, 16026, 16083,
+    16135, 16182, 16225, 16262, 16294, 16322, 16344, 16362, 16374, 16382,
+    16384,
+};
+
+/**
+ * Midpoint rasteriser of an ellipse rotated clockwise by theta about its centre pixel. A point
+ * at (x, y) from the centre is inside when F = A x^2 + 2 H x y + C y^2 - a^2 b^2 <= 0, with
+ * A = a^2 sin^2 + b^2 cos^2, H = (b^2 - a^2) sin cos and C = a^2 cos^2 + b^2 sin^2. Like the
+ * midpoint circle, the semi-axes reach half a pixel past the radius, so F is evaluated in half
+ * pixels to stay on integers. Row y is centred on x = -H y / A, which is tracked without
+ * divisions, and its ends are walked from the ends of the row above by the sign of F.
+ *
+ * F no longer fits 64 bits for semi-axes above ELLIPSE_INT_MAX_AXIS. Such wide ellipses are
+ * evaluated in double precision instead, on the rotated coordinates u = X cos + Y sin and
+ * v = Y cos - X sin where F = b^2 u^2 + a^2 v^2 - a^2 b^2 does not cancel, and the ends of a
+ * row are solved for directly. Only the rows that are drawn are visited either way.
+ */
+typedef struct ellipse
+{
+    int64_t a, h, c, k; // A, H, C and a^2 b^2, scaled to keep F within 64 bits.
+    int64_t den;        // 2 A, the centre is floor(num / den).
+    int64_t num_step;   // -2 H, the change of num from one row to the next.
+    int64_t centre, rem; // Centre pixel and num - centre * den of the current row.
+    int x0, x1;         // Ends of the last span, where the next row starts walking.
+    int rows;           // The ellipse covers rows -rows to rows.
+    int y;              // Last row.
+    bool wide;          // Evaluated in double precision, with the fields below.
+    double wa, wb;      // Semi-axes in half pixels.
+    double ws, wc;      // sin and cos of the rotation.
+    double wcoef_a, wcoef_h; // A and H for the unit sine and cosine.
+} ellipse_t;
+
+static inline int64_t ellipse_floor_div(int64_t a, int64_t b)
+{
+    int64_t q = a / b;
+    return (((a % b) != 0) && (a < 0)) ? (q - 1) : q;
+}
+
+/**
+ * @param a, b: semi-axes in half pixels.
+ * @param rotation: 0 - 179 degrees.
+ */
+static void ellipse_init(ellipse_t *e, int a, int b, int rotation)
+{
+    int64_t s = (rotation <= 90) ? ellipse_sin_table[rotation] : ellipse_sin_table[180 - rotation];
+    int64_t c = (rotation <= 90) ? ellipse_sin_table[90 - rotation] : -ellipse_sin_table[rotation - 90];
+
+    // Half pixels, the bracket of an anti-aliased edge reaches one more.
+    e->wide = IM_MAX(a, b) > ((2 * ELLIPSE_INT_MAX_AXIS) + 2);
+    if (e->wide)
+    {
+        double norm = sqrt((double) ((s * s) + (c * c)));
+        e->wa = a;
+        e->wb = b;
+        e->ws = s / norm;
+        e->wc = c / norm;
+        e->wcoef_a = (e->wa * e->wa * e->ws * e->ws) + (e->wb * e->wb * e->wc * e->wc);
+        e->wcoef_h = ((e->wb * e->wb) - (e->wa * e->wa)) * e->ws * e->wc;
+        e->rows = (int) (sqrt(e->wcoef_a) / 2);
+        return;
+    }
+
+    int64_t a2 = (int64_t) a * a, b2 = (int64_t) b * b;
+    int64_t coef_a = (a2 * s * s) + (b2 * c * c);
+    int64_t coef_c = (a2 * c * c) + (b2 * s * s);
+
+    // Keeping the coefficients below 2^31 bounds F by 2^59 over a 2^13 half pixel range, the
+    // shift is at most 22. The rounded sine and cosine are not quite a unit vector, a^2 b^2 is
+    // scaled by their actual squared length, in two halves to stay within 64 bits.
+    int shift = 0;
+    while ((IM_MAX(coef_a, coef_c) >> shift) >= (INT64_C(1) << 31))
+    {
+        shift++;
+    }
+
+    int64_t norm = (s * s) + (c * c);
+    int64_t ab2 = a2 * b2;
+    e->a = coef_a >> shift;
+    e->h = ((b2 - a2) * s * c) >> shift;
+    e->c = coef_c >> shift;
+    e->k = (((ab2 >> 24) * norm) << (24 - shift)) + (((ab2 & 0xFFFFFF) * norm) >> shift);
+    e->den = 2 * e->a;
+    e->num_step = -2 * e->h;
+    e->rows = imlib_isqrt(coef_a) >> (ELLIPSE_TRIG_BITS + 1);
+    e->y = INT_MIN;
+}
+
+/**
+ * F at pixel x of a row, with X = 2 x and Y = 2 y: (A X + 2 H Y) X + C Y^2 - a^2 b^2.
+ * @param hy: 2 H Y of the row.
+ * @param cy: C Y^2 - a^2 b^2 of the row.
+ */
+static inline int64_t ellipse_f(const ellipse_t *e, int x, int64_t hy, int64_t cy)
+{
+    return (((e->a * 2 * x) + hy) * 2 * x) + cy;
+}
+
+/**
+ * ellipse_span() of a wide ellipse. F on the row is a quadratic in X whose discriminant reduces to
+ * a^2 b^2 (A - Y^2), so its roots are (-H Y +- a b sqrt(A - Y^2)) / A.
+ */
+static bool ellipse_span_wide(const ellipse_t *e, int y, int *x0, int *x1)
+{
+    double wy = 2.0 * y;
+    double d = e->wcoef_a - (wy * wy);
+    if (d < 0)
+    {
+        return false;
+    }
+
+    double mid = -e->wcoef_h * wy, half = e->wa * e->wb * sqrt(d);
+    int left = (int) ceil((mid - half) / (2 * e->wcoef_a));
+    int right = (int) floor((mid + half) / (2 * e->wcoef_a));
+    if (left > right)
+    {
+        return false;
+    }
+
+    *x0 = left;
+    *x1 = right;
+    return true;
+}
+
+/**
+ * Get the pixels of the ellipse on row y from its centre. Rows are cheapest one after another.
+ * @return: false if the row does not cross the ellipse.
  */
-void imlib_draw_line(image_t *img, int x0, int y0, int x1, int y1, int c, int th)
+static bool ellipse_span(ellipse_t *e, int y, int *x0, int *x1)
 {
-    line_t line = {x0, y0, x1, y1};
-    if (!lb_clip_line(&line, 0, 0, img->w, img->h))
+    if (e->wide)
     {
-        return;
+        return ellipse_span_wide(e, y, x0, x1);
     }
 
-    x0 = line.x1;
-    y0 = line.y1;
-    x1 = line.x2;
-    y1 = line.y2;
+    // num = A - 2 H y, the nearest pixel to the centre is floor(num / 2 A).
+    if (y == (e->y + 1))
+    {
+        e->rem += e->num_step;
+        int64_t carry = ellipse_floor_div(e->rem, e->den);
+        e->centre += carry;
+        e->rem -= carry * e->den;
+    }
+    else
+    {
+        int64_t num = e->a + (e->num_step * y);
+        e->centre = ellipse_floor_div(num, e->den);
+        e->rem = num - (e->centre * e->den);
+        e->x0 = e->x1 = e->centre;
+    }
+    e->y = y;
 
-    // plot an anti-aliased line of width th pixel
-    const int ex = abs(x1 - x0);
-    const int sx = x0 < x1 ? 1 : -1;
-    const int ey = abs(y1 - y0);
-    const int sy = y0 < y1 ? 1 : -1;
-    int e2 = fast_floorf(fast_sqrtf(ex * ex + ey * ey)); // length
+    int64_t hy = 4 * e->h * y;
+    int64_t cy = (4 * e->c * y * y) - e->k;
 
-    if (th <= 1 || e2 == 0)
+    int centre = e->centre;
+    if (ellipse_f(e, centre, hy, cy) > 0)
     {
-        return imlib_draw_thin_line(img, x0, y0, x1, y1, c); // assert
+        e->x0 = e->x1 = centre;
+        return false;
     }
 
-    int dx = ex * 256 / e2;
-    int dy = ey * 256 / e2;
-    th = 256 * (th - 1); // scale values
+    int left = IM_MIN(e->x0, centre);
+    if (ellipse_f(e, left, hy, cy) <= 0)
+    {
+        while (ellipse_f(e, left - 1, hy, cy) <= 0)
+        {
+            left--;
+        }
+    }
+    else
+    {
+        while (ellipse_f(e, left, hy, cy) > 0)
+        {
+            left++;
+        }
+    }
 
-    if (dx < dy)
+    int right = IM_MAX(e->x1, centre);
+    if (ellipse_f(e, right, hy, cy) <= 0)
     {
-        // steep line
-        x1 = (e2 + th / 2) / dy;    // start offset
-        int err = x1 * dy - th / 2; // shift error value to offset width
-        for (x0 -= x1 * sx;; y0 += sy)
+        while (ellipse_f(e, right + 1, hy, cy) <= 0)
         {
-            x1 = x0;
-            imlib_set_pixel_aa(img, x1, y0, err, c); // aliasing pre-pixel
-            for (e2 = dy - err - th; e2 + dy < 256; e2 += dy)
-            {
-                x1 += sx;
-                imlib_set_pixel(img, x1, y0, c);         // pixel on the line
-            }
-            imlib_set_pixel_aa(img, x1 + sx, y0, e2, c); // aliasing post-pixel
-            if (y0 == y1)
-            {
-                break;
-            }
-            err += dx; // y-step
-            if (err > 256)
-            {
-                err -= dy;
-                x0 += sx;
-            } // x-step
+            right++;
         }
     }
     else
     {
-        // flat line
-        y1 = (e2 + th / 2) / dx;    // start offset
-        int err = y1 * dx - th / 2; // shift error value to offset width
-        for (y0 -= y1 * sy;; x0 += sx)
+        while (ellipse_f(e, right, hy, cy) > 0)
         {
-            y1 = y0;
-            imlib_set_pixel_aa(img, x0, y1, err, c); // aliasing pre-pixel
-            for (e2 = dx - err - th; e2 + dx < 256; e2 += dx)
-            {
-                y1 += sy;
-                imlib_set_pixel(img, x0, y1, c);         // pixel on the line
-            }
-            imlib_set_pixel_aa(img, x0, y1 + sy, e2, c); // aliasing post-pixel
-            if (x0 == x1)
-            {
-                break;
-            }
-            err += dy; // x-step
-            if (err > 256)
-            {
-                err -= dx;
-                y0 += sy;
-            } // y-step
+            right--;
         }
     }
+
+    *x0 = e->x0 = left;
+    *x1 = e->x1 = right;
+    return true;
 }
 
 /**
- * Draw a line
+ * Coverage of the pixel at (x, y) from the centre by the ellipse, 0 - 256. F over the length of
+ * its gradient is the distance of the pixel centre from the edge, to first order, and the pixel
+ * is covered by half a pixel minus that distance. The gradient length is max(M, 7/8 M + 1/2 m)
+ * of its larger and smaller component, within 3% of the Euclidean length.
  */
-void imlib_draw_arrow(image_t *img, int x0, int y0, int x1, int y1, int c, int th, int size)
+static int ellipse_coverage(const ellipse_t *e, int x, int y)
 {
-    int dx = (x1 - x0);
-    int dy = (y1 - y0);
-    float length = fast_sqrtf((dx * dx) + (dy * dy));
-
-    float ux = IM_DIV(dx, length);
-    float uy = IM_DIV(dy, length);
-    float vx = -uy;
-    float vy = ux;
-
-    int a0x = fast_roundf(x1 - (size * ux) + (size * vx * 0.5));
-    int a0y = fast_roundf(y1 - (size * uy) + (size * vy * 0.5));
-    int a1x = fast_roundf(x1 - (size * ux) - (size * vx * 0.5));
-    int a1y = fast_roundf(y1 - (size * uy) - (size * vy * 0.5));
+    if (e->wide)
+    {
+        // Half the gradient of F, which has the same length in u, v as in X, Y.
+        double u = (e->wc * 2 * x) + (e->ws * 2 * y);
+        double v = (e->wc * 2 * y) - (e->ws * 2 * x);
+        double a2 = e->wa * e->wa, b2 = e->wb * e->wb;
+        double f = (b2 * u * u) + (a2 * v * v) - (a2 * b2);
+        double g = sqrt((b2 * b2 * u * u) + (a2 * a2 * v * v));
+        double cov = (g > 0) ? (128 - ((64 * f) / g)) : ((f <= 0) ? 256 : 0);
+        return (int) IM_MAX(IM_MIN(cov, 256.0), 0.0);
+    }
 
-    imlib_draw_line(img, x0, y0, x1, y1, c, th);
-    imlib_draw_line(img, x1, y1, a0x, a0y, c, th);
-    imlib_draw_line(img, x1, y1, a1x, a1y, c, th);
-}
+    int64_t gx = (e->a * 2 * x) + (e->h * 2 * y);
+    int64_t gy = (e->h * 2 * x) + (e->c * 2 * y);
+    int64_t f = (gx * 2 * x) + (gy * 2 * y) - e->k;
 
-static void xLine(image_t *img, int x1, int x2, int y, int c)
-{
-    while (x1 <= x2)
+    uint64_t big = IM_MAX(llabs(gx), llabs(gy));
+    uint64_t small = IM_MIN(llabs(gx), llabs(gy));
+    uint64_t g = IM_MAX(big, ((big * 7) >> 3) + (small >> 1));
+    if (g == 0)
     {
-        imlib_set_pixel(img, x1++, y, c);
+        return (f <= 0) ? 256 : 0;
     }
-}
 
-static void yLine(image_t *img, int x, int y1, int y2, int c)
-{
-    while (y1 <= y2)
+    // The distance in pixels is F / 4 G, G is brought down to 15 bits to divide in 32 bits.
+    int shift = IM_MAX(0, 49 - __builtin_clzll(g));
+    int64_t fs = f >> shift, gs = g >> shift;
+    if (fs >= (2 * gs))
     {
-        imlib_set_pixel(img, x, y1++, c);
+        return 0;
     }
+    if (fs <= (-2 * gs))
+    {
+        return 256;
+    }
+    return 128 - (int) ((int32_t) (fs * 64) / (int32_t) gs);
 }
 
 /**
- * Draw a rectangle
+ * Fill the ring between two ellipses rotated by the same angle about (cx, cy), or the whole outer
+ * ellipse if the inner one is empty.
+ * @param outer_a, outer_b: semi-axes of the outer ellipse in half pixels.
+ * @param inner_a, inner_b: semi-axes of the inner ellipse in half pixels, 0 for no hole.
+ * @param rotation: 0 - 179 degrees.
  */
-void imlib_draw_rectangle(image_t *img, int rx, int ry, int rw, int rh, int c, int thickness, bool fill)
+static void imlib_draw_conic(const imlib_draw_ops_t *ops, image_t *img, int cx, int cy, int outer_a, int outer_b, int inner_a, int inner_b, int rotation, int c)
 {
-    if (fill)
+    bool hole = (inner_a > 0) && (inner_b > 0);
+    ellipse_t outer, inner;
+    ellipse_init(&outer, outer_a, outer_b, rotation);
+    if (hole)
+    {
+        ellipse_init(&inner, inner_a, inner_b, rotation);
+    }
+
+    int clip_x0, clip_y0, clip_x1, clip_y1;
+    imlib_get_clip(img, &clip_x0, &clip_y0, &clip_x1, &clip_y1);
+
+    for (int y = IM_MAX(cy - outer.rows, clip_y0); y <= IM_MIN(cy + outer.rows, clip_y1 - 1); y++)
     {
-        for (int y = ry, yy = ry + rh; y < yy; y++)
+        int x0, x1, hole_x0, hole_x1;
+        if (!ellipse_span(&outer, y - cy, &x0, &x1))
+        {
+            continue;
+        }
+
+        // Up to two spans, left and right of the hole.
+        void *row_ptr = imlib_compute_row_ptr(img, y);
+        int spans[2][2] = {{x0, x1}, {0, -1}};
+        if (hole && ellipse_span(&inner, y - cy, &hole_x0, &hole_x1))
         {
-            for (int x = rx, xx = rx + rw; x < xx; x++)
+            spans[0][1] = hole_x0 - 1;
+            spans[1][0] = hole_x1 + 1;
+            spans[1][1] = x1;
+        }
+
+        for (int i = 0; i < 2; i++)
+        {
+            int span_x0 = IM_MAX(cx + spans[i][0], clip_x0);
+            int span_x1 = IM_MIN(cx + spans[i][1], clip_x1 - 1);
+            if ((spans[i][0] <= spans[i][1]) && (span_x0 <= span_x1))
             {
-                imlib_set_pixel(img, x, y, c);
+                ops->fill_span(row_ptr, span_x0, span_x1, c);
             }
         }
     }
-    else if (thickness > 0)
+}
+
+/**
+ * Anti-aliased imlib_draw_conic(). Every edge is walked twice more, half a pixel inside and
+ * outside, which brackets the pixels it crosses. Pixels inside both brackets are filled, the
+ * inner hole is skipped and only the pixels in between have their coverage computed.
+ */
+static void imlib_draw_conic_aa(const imlib_draw_ops_t *ops, image_t *img, int cx, int cy, int outer_a, int outer_b, int inner_a, int inner_b, int rotation, int c)
+{
+    bool solid = (outer_a > 1) && (outer_b > 1);
+    bool hole = (inner_a > 0) && (inner_b > 0);
+    bool hole_solid = hole && (inner_a > 1) && (inner_b > 1);
+    ellipse_t outer, outer_out, outer_in, inner, inner_out, inner_in;
+    ellipse_init(&outer, outer_a, outer_b, rotation);
+    ellipse_init(&outer_out, outer_a + 1, outer_b + 1, rotation);
+    if (solid)
     {
-        int thickness0 = (thickness - 0) / 2;
-        int thickness1 = (thickness - 1) / 2;
+        ellipse_init(&outer_in, outer_a - 1, outer_b - 1, rotation);
+    }
+    if (hole)
+    {
+        ellipse_init(&inner, inner_a, inner_b, rotation);
+        ellipse_init(&inner_out, inner_a + 1, inner_b + 1, rotation);
+    }
+    if (hole_solid)
+    {
+        ellipse_init(&inner_in, inner_a - 1, inner_b - 1, rotation);
+    }
 
-        for (int i = rx - thickness0, j = rx + rw + thickness1, k = ry + rh - 1; i < j; i++)
+    int clip_x0, clip_y0, clip_x1, clip_y1;
+    imlib_get_clip(img, &clip_x0, &clip_y0, &clip_x1, &clip_y1);
+
+    for (int y = IM_MAX(cy - outer_out.rows, clip_y0); y <= IM_MIN(cy + outer_out.rows, clip_y1 - 1); y++)
+    {
+        int dy = y - cy;
+        int x0, x1;
+        if (!ellipse_span(&outer_out, dy, &x0, &x1))
+        {
+            continue;
+        }
+
+        // Spans left empty (1, 0) when their ellipse misses the row.
+        int solid_x0 = 1, solid_x1 = 0, hole_x0 = 1, hole_x1 = 0, skip_x0 = 1, skip_x1 = 0;
+        if (solid)
+        {
+            ellipse_span(&outer_in, dy, &solid_x0, &solid_x1);
+        }
+        if (hole)
+        {
+            ellipse_span(&inner_out, dy, &hole_x0, &hole_x1);
+        }
+        if (hole_solid)
         {
-            yLine(img, i, ry - thickness0, ry + thickness1, c);
-            yLine(img, i, k - thickness0, k + thickness1, c);
+            ellipse_span(&inner_in, dy, &skip_x0, &skip_x1);
         }
 
-        for (int i = ry - thickness0, j = ry + rh + thickness1, k = rx + rw - 1; i < j; i++)
+        void *row_ptr = imlib_compute_row_ptr(img, y);
+        int x_end = IM_MIN(cx + x1, clip_x1 - 1);
+        for (int x = IM_MAX(cx + x0, clip_x0); x <= x_end; )
         {
-            xLine(img, rx - thickness0, rx + thickness1, i, c);
-            xLine(img, k - thickness0, k + thickness1, i, c);
+            int dx = x - cx;
+            bool in_solid = (solid_x0 <= dx) && (dx <= solid_x1);
+            bool in_hole = (hole_x0 <= dx) && (dx <= hole_x1);
+
+            if (in_solid && !in_hole)
+            {
+                // Covered up to the hole or the inner edge of the border.
+                int run = ((dx < hole_x0) && (hole_x0 <= hole_x1)) ? IM_MIN(solid_x1, hole_x0 - 1) : solid_x1;
+                run = IM_MIN(cx + run, x_end);
+                ops->fill_span(row_ptr, x, run, c);
+                x = run + 1;
+            }
+            else if ((skip_x0 <= dx) && (dx <= skip_x1))
+            {
+                x = cx + skip_x1 + 1;
+            }
+            else
+            {
+                int cov = in_solid ? 256 : ellipse_coverage(&outer, dx, dy);
+                if (in_hole)
+                {
+                    cov -= ellipse_coverage(&inner, dx, dy);
+                }
+                imlib_plot_coverage(ops, row_ptr, x, cov, c);
+                x++;
+            }
         }
     }
 }
@@ -395,7 +1616,7 @@ void imlib_draw_rectangle(image_t *img, int rx, int ry, int rw, int rh, int c, i
 /**
  * Draw circle
  */
-static void imlib_draw_circle_thin(image_t *img, int cx, int cy, int r, int c, bool fill)
+static void imlib_draw_circle_thin(const imlib_draw_ops_t *ops, image_t *img, int cx, int cy, int r, int c, bool fill)
 {
     int x = r;
     int y = 0;             // II. quadrant from bottom left to top right
@@ -404,16 +1625,16 @@ static void imlib_draw_circle_thin(image_t *img, int cx, int cy, int r, int c, b
     for (;;)
     {
         int i = 256 * abs(err + (2 * (x + y)) - 2) / r; // get blend value of pixel
-        imlib_set_pixel_aa(img, cx + x, cy - y, i, c);  // I. Quadrant
-        imlib_set_pixel_aa(img, cx + y, cy + x, i, c);  // II. Quadrant
-        imlib_set_pixel_aa(img, cx - x, cy + y, i, c);  // III. Quadrant
-        imlib_set_pixel_aa(img, cx - y, cy - x, i, c);  // IV. Quadrant
+        imlib_set_pixel_aa(ops, img, cx + x, cy - y, i, c);   // I. Quadrant
+        imlib_set_pixel_aa(ops, img, cx + y, cy + x, i, c);   // II. Quadrant
+        imlib_set_pixel_aa(ops, img, cx - x, cy + y, i, c);   // III. Quadrant
+        imlib_set_pixel_aa(ops, img, cx - y, cy - x, i, c);   // IV. Quadrant
         if (fill)
         {
-            xLine(img, cx, cx + x - 1, cy - y, c);
-            yLine(img, cx + y, cy, cy + x - 1, c);
-            xLine(img, cx - x + 1, cx, cy + y, c);
-            yLine(img, cx - y, cy - x + 1, cy, c);
+            xLine(ops, img, cx, cx + x - 1, cy - y, c);
+            yLine(ops, img, cx + y, cy, cy + x - 1, c);
+            xLine(ops, img, cx - x + 1, cx, cy + y, c);
+            yLine(ops, img, cx - y, cy - x + 1, cy, c);
         }
         if (x == 0)
         {
@@ -427,10 +1648,10 @@ static void imlib_draw_circle_thin(image_t *img, int cx, int cy, int r, int c, b
             i = 256 * (err + (2 * x) - 1) / r; // outward pixel
             if (i < 256)
             {
-                imlib_set_pixel_aa(img, cx + x, cy - y + 1, i, c);
-                imlib_set_pixel_aa(img, cx + y - 1, cy + x, i, c);
-                imlib_set_pixel_aa(img, cx - x, cy + y - 1, i, c);
-                imlib_set_pixel_aa(img, cx - y + 1, cy - x, i, c);
+                imlib_set_pixel_aa(ops, img, cx + x, cy - y + 1, i, c);
+                imlib_set_pixel_aa(ops, img, cx + y - 1, cy + x, i, c);
+                imlib_set_pixel_aa(ops, img, cx - x, cy + y - 1, i, c);
+                imlib_set_pixel_aa(ops, img, cx - y + 1, cy - x, i, c);
             }
             err -= (--x * 2) - 1;
         }
@@ -442,10 +1663,10 @@ static void imlib_draw_circle_thin(image_t *img, int cx, int cy, int r, int c, b
                 i = 256 * (1 - (2 * y) - e2) / r; // inward pixel
                 if (i < 256)
                 {
-                    imlib_set_pixel_aa(img, cx + x2, cy - y, i, c);
-                    imlib_set_pixel_aa(img, cx + y, cy + x2, i, c);
-                    imlib_set_pixel_aa(img, cx - x2, cy + y, i, c);
-                    imlib_set_pixel_aa(img, cx - y, cy - x2, i, c);
+                    imlib_set_pixel_aa(ops, img, cx + x2, cy - y, i, c);
+                    imlib_set_pixel_aa(ops, img, cx + y, cy + x2, i, c);
+                    imlib_set_pixel_aa(ops, img, cx - x2, cy + y, i, c);
+                    imlib_set_pixel_aa(ops, img, cx - y, cy - x2, i, c);
                 }
             }
             err -= (--y * 2) - 1;
@@ -459,9 +1680,24 @@ static void imlib_draw_circle_thin(image_t *img, int cx, int cy, int r, int c, b
  */
 void imlib_draw_circle(image_t *img, int cx, int cy, int r, int c, int thickness, bool fill)
 {
+    const imlib_draw_ops_t *ops = imlib_get_draw_ops(img);
+
+    // Anti-aliased circles are rings of coverage between the outer and inner edge, like ellipses.
+    if (img->antialias && (r >= 0) && (fill || (thickness > 0)) && ((r + (IM_MAX(thickness, 0) / 2)) < ELLIPSE_MAX_AXIS))
+    {
+        int thickness0 = IM_MAX(thickness, 0) / 2;
+        int thickness1 = fill ? r : ((thickness - 1) / 2);
+        int inner = ((r - thickness1) >= 1) ? ((2 * (r - thickness1)) - 1) : 0;
+        int r_dirty = r + thickness0 + 1;
+        imlib_dirty_add(img, cx - r_dirty, cy - r_dirty, (2 * r_dirty) + 1, (2 * r_dirty) + 1);
+        imlib_draw_conic_aa(ops, img, cx, cy, (2 * (r + thickness0)) + 1, (2 * (r + thickness0)) + 1, inner, inner, 0, c);
+        return;
+    }
+
     if ((r == 0) && (fill || (thickness > 0)))
     {
-        imlib_set_pixel(img, cx, cy, c);
+        imlib_dirty_add(img, cx, cy, 1, 1);
+        ops->set_pixel(img, cx, cy, c);
     }
 
     if ((r <= 0) || ((!fill) && (thickness <= 0)))
@@ -469,9 +1705,13 @@ void imlib_draw_circle(image_t *img, int cx, int cy, int r, int c, int thickness
         return;
     }
 
+    // Outer edge plus its anti-aliased pixels.
+    int r_dirty = r + (IM_MAX(thickness, 0) / 2) + 1;
+    imlib_dirty_add(img, cx - r_dirty, cy - r_dirty, (2 * r_dirty) + 1, (2 * r_dirty) + 1);
+
     if (thickness == 1 || fill)
     {
-        imlib_draw_circle_thin(img, cx, cy, r + (IM_MAX(thickness, 0) / 2), c, fill);
+        imlib_draw_circle_thin(ops, img, cx, cy, r + (IM_MAX(thickness, 0) / 2), c, fill);
     }
     else
     {
@@ -487,14 +1727,14 @@ void imlib_draw_circle(image_t *img, int cx, int cy, int r, int c, int thickness
 
         while (xo >= y)
         {
-            xLine(img, cx + xi, cx + xo, cy + y, c);
-            yLine(img, cx + y, cy + xi, cy + xo, c);
-            xLine(img, cx - xo, cx - xi, cy + y, c);
-            yLine(img, cx - y, cy + xi, cy + xo, c);
-            xLine(img, cx - xo, cx - xi, cy - y, c);
-            yLine(img, cx - y, cy - xo, cy - xi, c);
-            xLine(img, cx + xi, cx + xo, cy - y, c);
-            yLine(img, cx + y, cy - xo, cy - xi, c);
+            xLine(ops, img, cx + xi, cx + xo, cy + y, c);
+            yLine(ops, img, cx + y, cy + xi, cy + xo, c);
+            xLine(ops, img, cx - xo, cx - xi, cy + y, c);
+            yLine(ops, img, cx - y, cy + xi, cy + xo, c);
+            xLine(ops, img, cx - xo, cx - xi, cy - y, c);
+            yLine(ops, img, cx - y, cy - xo, cy - xi, c);
+            xLine(ops, img, cx + xi, cx + xo, cy - y, c);
+            yLine(ops, img, cx + y, cy - xo, cy - xi, c);
 
             y++;
 
@@ -527,172 +1767,167 @@ void imlib_draw_circle(image_t *img, int cx, int cy, int r, int c, int thickness
         }
 
         // Anti-alias the outer and inner edges.
-        imlib_draw_circle_thin(img, cx, cy, r + thickness0, c, false);
-        imlib_draw_circle_thin(img, cx, cy, xi_tmp, c, false);
+        imlib_draw_circle_thin(ops, img, cx, cy, r + thickness0, c, false);
+        imlib_draw_circle_thin(ops, img, cx, cy, xi_tmp, c, false);
     }
 }
 
-// https://scratch.mit.edu/projects/50039326/
-// Effect https://scratch.mit.edu/projects/50039326/editor/
 /**
- * Draw a pixel with a distortion effect. Its design can be used to achieve a certain tilt or perspective effect.
- * @param img: target image for drawing.
- * @param x0 and y0: base point coordinates.
- * @param dx and dy: offset relative to the base point (x0, y0) to determine the drawing position.
- * @param shear_dx and shear_dy: tilt parameters to control the intensity and direction of the deformation.
- * @param r0 and r1: define the radius range of the fill area to control the size of the drawing area.
- * @param c: color value for filling the area.
+ * Draw an ellipse
+ * @param img: The target image on which the drawing operation will be performed.
+ * @param cx and cy: The coordinates of the center of the ellipse.
+ * @param rx and ry: The horizontal and vertical radii of the ellipse, up to 2^24. The edges of
+ *                   ellipses wider than 2048 are computed in double precision, which is slower.
+ * @param rotation: The clockwise rotation angle of the ellipse in degrees.
+ * @param c: The color value of the ellipse.
+ * @param thickness: The thickness of the ellipse border, placed like the border of imlib_draw_circle().
+ * @param fill: A boolean value indicating whether to fill the ellipse.
  */
-static void scratch_draw_pixel(image_t *img, int x0, int y0, int dx, int dy, float shear_dx, float shear_dy, int r0, int r1, int c)
-{
-    point_fill(img, x0 + dx, y0 + dy + fast_floorf((dx * shear_dy) / shear_dx), r0, r1, c);
-}
-
-// https://scratch.mit.edu/projects/50039326/
-static void scratch_draw_line(image_t *img, int x0, int y0, int dx, int dy0, int dy1, float shear_dx, float shear_dy, int c)
+void imlib_draw_ellipse(image_t *img, int cx, int cy, int rx, int ry, int rotation, int c, int thickness, bool fill)
 {
-    int y = y0 + fast_floorf((dx * shear_dy) / shear_dx);
-    yLine(img, x0 + dx, y + dy0, y + dy1, c);
-}
+    const imlib_draw_ops_t *ops = imlib_get_draw_ops(img);
+    if ((rx <= 0) || (ry <= 0) || (rx > ELLIPSE_MAX_AXIS) || (ry > ELLIPSE_MAX_AXIS) || (!fill && (thickness <= 0)))
+    {
+        return;
+    }
 
-// https://scratch.mit.edu/projects/50039326/
-static void scratch_draw_sheared_ellipse(image_t *img, int x0, int y0, int width, int height, bool filled, float shear_dx, float shear_dy, int c, int thickness)
-{
-    int thickness0 = (thickness - 0) / 2;
-    int thickness1 = (thickness - 1) / 2;
-    if (((thickness > 0) || filled) && (shear_dx != 0))
+    int r = rotation % 180;
+    if (r < 0)
     {
-        int a_squared = width * width;
-        int four_a_squared = a_squared * 4;
-        int b_squared = height * height;
-        int four_b_squared = b_squared * 4;
+        r += 180;
+    }
 
-        int x = 0;
-        int y = height;
-        int sigma = (2 * b_squared) + (a_squared * (1 - (2 * height)));
+    // The border is the outer ellipse without the inner one, which is empty when filling.
+    int thickness0 = fill ? 0 : (thickness / 2);
+    int thickness1 = fill ? 0 : ((thickness - 1) / 2);
+    int outer_x = IM_MIN(rx + thickness0, ELLIPSE_MAX_AXIS), outer_y = IM_MIN(ry + thickness0, ELLIPSE_MAX_AXIS);
+    int inner_x = rx - thickness1, inner_y = ry - thickness1;
+    bool hole = !fill && (inner_x > 0) && (inner_y > 0);
+    inner_x = hole ? ((2 * inner_x) - 1) : 0;
+    inner_y = hole ? ((2 * inner_y) - 1) : 0;
 
-        while ((b_squared * x) <= (a_squared * y))
-        {
-            if (filled)
-            {
-                scratch_draw_line(img, x0, y0, x, -y, y, shear_dx, shear_dy, c);
-                scratch_draw_line(img, x0, y0, -x, -y, y, shear_dx, shear_dy, c);
-            }
-            else
-            {
-                scratch_draw_pixel(img, x0, y0, x, y, shear_dx, shear_dy, -thickness0, thickness1, c);
-                scratch_draw_pixel(img, x0, y0, -x, y, shear_dx, shear_dy, -thickness0, thickness1, c);
-                scratch_draw_pixel(img, x0, y0, x, -y, shear_dx, shear_dy, -thickness0, thickness1, c);
-                scratch_draw_pixel(img, x0, y0, -x, -y, shear_dx, shear_dy, -thickness0, thickness1, c);
-            }
+    int r_dirty = IM_MAX(outer_x, outer_y) + 1;
+    imlib_dirty_add(img, cx - r_dirty, cy - r_dirty, (2 * r_dirty) + 1, (2 * r_dirty) + 1);
 
-            if (sigma >= 0)
-            {
-                sigma += four_a_squared * (1 - y);
-                y -= 1;
-            }
+    if (img->antialias)
+    {
+        imlib_draw_conic_aa(ops, img, cx, cy, (2 * outer_x) + 1, (2 * outer_y) + 1, inner_x, inner_y, r, c);
+    }
+    else
+    {
+        imlib_draw_conic(ops, img, cx, cy, (2 * outer_x) + 1, (2 * outer_y) + 1, inner_x, inner_y, r, c);
+    }
+}
 
-            sigma += b_squared * ((4 * x) + 6);
-            x += 1;
-        }
+/**
+ * Decode one UTF-8 character.
+ * @param str: input string, must not be at its terminator.
+ * @param unicode: decoded code point, 0 for a malformed sequence.
+ * @return: number of bytes consumed, at least 1.
+ */
+static int imlib_utf8_decode(const char *str, uint32_t *unicode)
+{
+    const uint8_t *s = (const uint8_t *) str;
+    int len = (s[0] < 0x80) ? 1 : (s[0] < 0xC0) ? 0 : (s[0] < 0xE0) ? 2 : (s[0] < 0xF0) ? 3 : (s[0] < 0xF8) ? 4 : 0;
+    uint32_t cp = (len == 1) ? s[0] : (s[0] & (0x7F >> len));
 
-        x = width;
-        y = 0;
-        sigma = (2 * a_squared) + (b_squared * (1 - (2 * width)));
+    if (len == 0)
+    {
+        *unicode = 0;
+        return 1;
+    }
 
-        while ((a_squared * y) <= (b_squared * x))
+    for (int i = 1; i < len; i++)
+    {
+        if ((s[i] & 0xC0) != 0x80)
         {
-            if (filled)
-            {
-                scratch_draw_line(img, x0, y0, x, -y, y, shear_dx, shear_dy, c);
-                scratch_draw_line(img, x0, y0, -x, -y, y, shear_dx, shear_dy, c);
-            }
-            else
-            {
-                scratch_draw_pixel(img, x0, y0, x, y, shear_dx, shear_dy, -thickness0, thickness1, c);
-                scratch_draw_pixel(img, x0, y0, -x, y, shear_dx, shear_dy, -thickness0, thickness1, c);
-                scratch_draw_pixel(img, x0, y0, x, -y, shear_dx, shear_dy, -thickness0, thickness1, c);
-                scratch_draw_pixel(img, x0, y0, -x, -y, shear_dx, shear_dy, -thickness0, thickness1, c);
-            }
-
-            if (sigma >= 0)
-            {
-                sigma += four_b_squared * (1 - x);
-                x -= 1;
-            }
-
-            sigma += a_squared * ((4 * y) + 6);
-            y += 1;
+            *unicode = 0;
+            return i;
         }
+        cp = (cp << 6) | (s[i] & 0x3F);
     }
+
+    *unicode = cp;
+    return len;
 }
 
-// https://scratch.mit.edu/projects/50039326/
-static void scratch_draw_rotated_ellipse(image_t *img, int x, int y, int x_axis, int y_axis, int rotation, bool filled, int c, int thickness)
+/**
+ * Find the first pixel at or after x in a 1 bpp row that is set (or clear).
+ * @return: the pixel index, or w if there is none.
+ */
+static inline int imlib_bitmap_find(const uint32_t *row, int x, int w, bool set)
 {
-    if ((x_axis > 0) && (y_axis > 0))
+    while (x < w)
     {
-        if ((x_axis == y_axis) || (rotation == 0))
-        {
-            scratch_draw_sheared_ellipse(img, x, y, x_axis / 2, y_axis / 2, filled, 1, 0, c, thickness);
-        }
-        else if (rotation == 90)
-        {
-            scratch_draw_sheared_ellipse(img, x, y, y_axis / 2, x_axis / 2, filled, 1, 0, c, thickness);
-        }
-        else
+        uint32_t word = row[x >> UINT32_T_SHIFT];
+        word = (set ? word : ~word) >> (x & UINT32_T_MASK);
+        if (word)
         {
-            // Avoid rotations above 90.
-            if (rotation > 90)
-            {
-                rotation -= 90;
-                int temp = x_axis;
-                x_axis = y_axis;
-                y_axis = temp;
-            }
-
-            // Avoid rotations above 45.
-            if (rotation > 45)
-            {
-                rotation -= 90;
-                int temp = x_axis;
-                x_axis = y_axis;
-                y_axis = temp;
-            }
-
-            float theta = fast_atanf(IM_DIV(y_axis, x_axis) * (-tanf(IM_DEG2RAD(rotation))));
-            float shear_dx = (x_axis * cosf(theta) * cosf(IM_DEG2RAD(rotation))) - (y_axis * sinf(theta) * sinf(IM_DEG2RAD(rotation)));
-            float shear_dy = (x_axis * cosf(theta) * sinf(IM_DEG2RAD(rotation))) + (y_axis * sinf(theta) * cosf(IM_DEG2RAD(rotation)));
-            float shear_x_axis = fast_fabsf(shear_dx);
-            float shear_y_axis = IM_DIV((y_axis * x_axis), shear_x_axis);
-            scratch_draw_sheared_ellipse(img, x, y, fast_floorf(shear_x_axis / 2), fast_floorf(shear_y_axis / 2), filled, shear_dx, shear_dy, c, thickness);
+            return IM_MIN(x + __builtin_ctz(word), w);
         }
+        x = (x | UINT32_T_MASK) + 1;
     }
+
+    return w;
 }
 
 /**
- * Draw an ellipse
- * @param img: The target image on which the drawing operation will be performed.
- * @param cx and cy: The coordinates of the center of the ellipse.
- * @param rx and ry: The horizontal and vertical radii of the ellipse.
- * @param rotation: The rotation angle of the ellipse in degrees.
- * @param c: The color value of the ellipse.
- * @param thickness: The thickness of the ellipse border.
- * @param fill: A boolean value indicating whether to fill the ellipse.
+ * Draw the set pixels of a glyph bitmap as clipped horizontal spans. Anti-aliased glyphs fill
+ * their fully covered runs and blend the rest by coverage.
+ * @param x_off, y_off: image position of the top left corner of the bitmap.
  */
-void imlib_draw_ellipse(image_t *img, int cx, int cy, int rx, int ry, int rotation, int c, int thickness, bool fill)
+static void imlib_draw_glyph(const imlib_draw_ops_t *ops, image_t *img, int x_off, int y_off, const glyph_bitmap_t *g, int c)
 {
-    int r = rotation % 180;
-    if (r < 0)
+    int clip_x0, clip_y0, clip_x1, clip_y1;
+    imlib_get_clip(img, &clip_x0, &clip_y0, &clip_x1, &clip_y1);
+
+    int y0 = IM_MAX(y_off, clip_y0);
+    int y1 = IM_MIN(y_off + g->h, clip_y1);
+    int x_min = IM_MAX(clip_x0 - x_off, 0);
+    int x_max = IM_MIN(clip_x1 - x_off, g->w);
+
+    for (int y = y0; y < y1; y++)
     {
-        r += 180;
-    }
+        const uint32_t *row = g->rows + ((y - y_off) * g->stride);
+        void *row_ptr = imlib_compute_row_ptr(img, y);
+
+        if (g->bpp == 8)
+        {
+            const uint8_t *cov = (const uint8_t *) row;
+            for (int x = x_min; x < x_max; x++)
+            {
+                if (cov[x] == 255)
+                {
+                    int end = x + 1;
+                    while ((end < x_max) && (cov[end] == 255))
+                    {
+                        end++;
+                    }
+                    ops->fill_span(row_ptr, x_off + x, x_off + end - 1, c);
+                    x = end - 1;
+                }
+                else if (cov[x])
+                {
+                    ops->blend_pixel(row_ptr, x_off + x, cov[x] + (cov[x] >> 7), c);
+                }
+            }
+            continue;
+        }
 
-    scratch_draw_rotated_ellipse(img, cx, cy, rx * 2, ry * 2, r, fill, c, thickness);
+        for (int x = imlib_bitmap_find(row, x_min, x_max, true); x < x_max;)
+        {
+            int end = imlib_bitmap_find(row, x, x_max, false);
+            ops->fill_span(row_ptr, x_off + x, x_off + end - 1, c);
+            x = imlib_bitmap_find(row, end, x_max, true);
+        }
+    }
 }
 
 /**
  * Draw a string, supporting multiple font attributes, such as character rotation, mirroring, scaling, etc.
+ * Glyphs are rasterised once per (character, scale, rotation, mirror) into the glyph cache and then
+ * blitted a row span at a time. Anti-aliased images blend the edges of glyphs at fractional scales,
+ * integer scales have no partly covered pixels.
  * @param img: target image.
  * @param x_off and y_off: starting position for drawing the string.
  * @param str: the string to be drawn.
@@ -705,19 +1940,10 @@ void imlib_draw_ellipse(image_t *img, int cx, int cy, int rx, int ry, int rotati
  * @param string_rotation: rotation angle of single character and whole string. 0, 90, 180, 360, etc.
  * @param string_hmirror and string_vflip: string horizontal mirror and vertical flip.
  */
-typedef struct
-{
-    uint16_t w;
-    uint16_t h;
-    uint8_t *data;
-} font_t;
-
-font_t gfont;
-
-// 8x16
-// 16x16 displayed in two parts
 void imlib_draw_string(image_t *img, int x_off, int y_off, const char *str, int c, float scale, int x_spacing, int y_spacing, bool mono_space, int char_rotation, bool char_hmirror, bool char_vflip, int string_rotation, bool string_hmirror, bool string_vflip)
 {
+    const imlib_draw_ops_t *ops = imlib_get_draw_ops(img);
+
     char_rotation %= 360;
     if (char_rotation < 0)
     {
@@ -735,217 +1961,77 @@ void imlib_draw_string(image_t *img, int x_off, int y_off, const char *str, int
     bool char_swap_w_h = (char_rotation == 90) || (char_rotation == 270);
     bool char_upsidedown = (char_rotation == 180) || (char_rotation == 270);
 
-    /* Set font */
-    if (gfont.data == NULL)
-    {
-        gfont.w = 16;
-        gfont.h = 16;
-        gfont.data = font_ascii_8x16;
-    }
+    // Character and string rotations are both quarter turns, so each glyph is cached with their sum
+    // and only its centre has to be rotated about the string origin.
+    int glyph_rotation = (char_rotation + string_rotation) / 90;
+    int string_quarter = string_rotation / 90;
 
     if (string_hmirror)
     {
-        x_off -= fast_floorf(gfont.w * scale) - 1;
+        x_off -= fast_floorf(FONT_GLYPH_MAX_W * scale) - 1;
     }
     if (string_vflip)
     {
-        y_off -= fast_floorf(gfont.h * scale) - 1;
+        y_off -= fast_floorf(FONT_GLYPH_MAX_H * scale) - 1;
     }
 
-    int org_x_off = x_off;
-    int org_y_off = y_off;
-    const int anchor = x_off;
+    bool antialias = img->antialias && (scale != fast_floorf(scale));
+    const int org_x_off = x_off;
+    const int org_y_off = y_off;
+    int dirty_x0 = INT_MAX, dirty_y0 = INT_MAX, dirty_x1 = INT_MIN, dirty_y1 = INT_MIN;
 
-    // for (char ch, last = '\0'; (ch = *str); str++, last = ch) {
-
-    uint64_t unicode = 0;
-    uint8_t bytes = 0;
-    char ch = 0;
-    glyph_t *g = (glyph_t *) malloc(sizeof(glyph_t));
     while (*str)
     {
-        bytes = utf8_to_unicode(str, &unicode);
+        uint32_t unicode;
+        str += imlib_utf8_decode(str, &unicode);
 
-        /* Get single character data */
-        if (bytes == 1)
-        { // Latin range uses 8x16 dot matrix characters
-            ch = unicode;
-            g->w = 8;
-            g->h = 16;
-            g->data = font_ascii_8x16 + (unicode - 0x20) * 16;
-        }
-        else if (bytes == 3)
+        // The bitmap belongs to the cache, hold the lock until this glyph is done with it.
+        glyph_cache_lock();
+        const glyph_bitmap_t *g = glyph_cache_get(unicode, scale, glyph_rotation, char_hmirror, char_vflip, antialias);
+        if (g == NULL)
         {
-            g->w = 16;
-            g->h = 16;
-            g->data = unicode_font16x16_start + unicode * 32;
-            // printf("unicode: %llx\n", unicode);
-            // continue;
+            glyph_cache_unlock();
+            continue;
         }
 
-        // if ((last == '\r') && (ch == '\n')) {
-        //     // handle "\r\n" strings
-        //     continue;
-        // }
-
-        // if ((ch == '\n') || (ch == '\r')) {
-        //     // handle '\n' or '\r' strings
-        //     x_off = anchor;
-        //     y_off += (string_vflip ? -1 : +1) * (fast_floorf((char_swap_w_h ? gfont.w : gfont.h) * scale) +
-        //     y_spacing); // newline height == space height continue;
-        // }
-
-        // if ((ch < ' ') || (ch > '~')) {
-        //     // handle unknown characters
-        //     continue;
-        // }
-
-        // if (!mono_space) {
-        //     // Find the first pixel set and offset to that.
-        //     bool exit = false;
-
-        //     if (!char_swap_w_h) {
-        //         for (int x = 0, xx = g->w; x < xx; x++) {
-        //             for (int y = 0, yy = g->h; y < yy; y++) {
-        //                 if (g->data[(char_upsidedown ^ char_vflip) ? (g->h - 1 - y) : y] &
-        //                     (1 << ((char_upsidedown ^ char_hmirror ^ string_hmirror) ? x : (g->w - 1 - x)))) {
-        //                     x_off += (string_hmirror ? +1 : -1) * fast_floorf(x * scale);
-        //                     exit = true;
-        //                     break;
-        //                 }
-        //             }
-
-        //             if (exit) {
-        //                 break;
-        //             }
-        //         }
-        //     } else {
-        //         for (int y = g->h - 1; y >= 0; y--) {
-        //             for (int x = 0, xx = g->w; x < xx; x++) {
-        //                 if (g->data[(char_upsidedown ^ char_vflip) ? (g->h - 1 - y) : y] &
-        //                     (1 << ((char_upsidedown ^ char_hmirror ^ string_hmirror) ? x : (g->w - 1 - x)))) {
-        //                     x_off += (string_hmirror ? +1 : -1) * fast_floorf((g->h - 1 - y) * scale);
-        //                     exit = true;
-        //                     break;
-        //                 }
-        //             }
-
-        //             if (exit) {
-        //                 break;
-        //             }
-        //         }
-        //     }
-        // }
-
-        if (bytes == 1)
+        int xx = fast_floorf(g->glyph_w * scale);
+        int yy = fast_floorf(g->glyph_h * scale);
+        int cx, cy;
+        glyph_rotate(string_quarter, x_off + (xx / 2) - org_x_off, y_off + (yy / 2) - org_y_off, &cx, &cy);
+        int gx = org_x_off + cx + g->x_off;
+        int gy = org_y_off + cy + g->y_off;
+        imlib_draw_glyph(ops, img, gx, gy, g, c);
+        dirty_x0 = IM_MIN(dirty_x0, gx);
+        dirty_y0 = IM_MIN(dirty_y0, gy);
+        dirty_x1 = IM_MAX(dirty_x1, gx + g->w);
+        dirty_y1 = IM_MAX(dirty_y1, gy + g->h);
+
+        if (mono_space)
         {
-            for (int y = 0, yy = fast_floorf(g->h * scale); y < yy; y++)
-            {
-                for (int x = 0, xx = fast_floorf(g->w * scale); x < xx; x++)
-                {
-                    if (g->data[fast_floorf(y / scale)] & (1 << (g->w - 1 - fast_floorf(x / scale))))
-                    {
-                        int16_t x_tmp = x_off + (char_hmirror ? (xx - x - 1) : x);
-                        int16_t y_tmp = y_off + (char_vflip ? (yy - y - 1) : y);
-                        point_rotate(x_tmp, y_tmp, IM_DEG2RAD(char_rotation), x_off + (xx / 2), y_off + (yy / 2), &x_tmp, &y_tmp);
-                        point_rotate(x_tmp, y_tmp, IM_DEG2RAD(string_rotation), org_x_off, org_y_off, &x_tmp, &y_tmp);
-                        imlib_set_pixel(img, x_tmp, y_tmp, c);
-                    }
-                }
-            }
+            x_off += (string_hmirror ? -1 : +1) * (fast_floorf((char_swap_w_h ? g->glyph_h : g->glyph_w) * scale) + x_spacing);
         }
-        else if (bytes == 3)
+        else if (g->ink_x0 < 0)
         {
-            uint8_t mask = 0;
-            uint8_t font_data[32];
-            memcpy(font_data, &unicode_font16x16_start[unicode * 32], 32);
-            for (int y = 0, yy = fast_floorf(g->h * scale); y < yy; y++)
-            {
-                for (int x = 0, xx = fast_floorf(g->w * scale); x < xx; x++)
-                {
-                    if (x < (int) (xx / 2.0))
-                    {
-                        if (font_data[fast_floorf(y / scale)] & (1 << ((int) (g->w / 2.0) - 1 - fast_floorf(x / scale))))
-                        {
-                            int16_t x_tmp = x_off + (char_hmirror ? (xx - x - 1) : x);
-                            int16_t y_tmp = y_off + (char_vflip ? (yy - y - 1) : y);
-                            point_rotate(x_tmp, y_tmp, IM_DEG2RAD(char_rotation), x_off + (xx / 2), y_off + (yy / 2), &x_tmp, &y_tmp);
-                            point_rotate(x_tmp, y_tmp, IM_DEG2RAD(string_rotation), org_x_off, org_y_off, &x_tmp, &y_tmp);
-                            imlib_set_pixel(img, x_tmp, y_tmp, c);
-                        }
-                    }
-                    else
-                    {
-                        if (font_data[fast_floorf(y / scale) + 16] & (1 << (g->w - 1 - fast_floorf(x / scale))))
-                        {
-                            int16_t x_tmp = x_off + (char_hmirror ? (xx - x - 1) : x);
-                            int16_t y_tmp = y_off + (char_vflip ? (yy - y - 1) : y);
-                            point_rotate(x_tmp, y_tmp, IM_DEG2RAD(char_rotation), x_off + (xx / 2), y_off + (yy / 2), &x_tmp, &y_tmp);
-                            point_rotate(x_tmp, y_tmp, IM_DEG2RAD(string_rotation), org_x_off, org_y_off, &x_tmp, &y_tmp);
-                            imlib_set_pixel(img, x_tmp, y_tmp, c);
-                        }
-                    }
-                }
-            }
+            x_off += (string_hmirror ? -1 : +1) * fast_floorf(scale * 3); // space char
         }
-
-        if (mono_space)
+        else if (!char_swap_w_h)
         {
-            x_off += (string_hmirror ? -1 : +1) * (fast_floorf((char_swap_w_h ? g->h : g->w) * scale) + x_spacing);
+            // Offset to the last pixel set.
+            int x = (char_upsidedown ^ char_hmirror ^ string_hmirror) ? (g->glyph_w - 1 - g->ink_x0) : g->ink_x1;
+            x_off += (string_hmirror ? -1 : +1) * (fast_floorf((x + 2) * scale) + x_spacing);
         }
         else
         {
-            // Find the last pixel set and offset to that.
-            bool exit = false;
-
-            if (!char_swap_w_h)
-            {
-                for (int x = g->w - 1; x >= 0; x--)
-                {
-                    for (int y = g->h - 1; y >= 0; y--)
-                    {
-                        if (g->data[(char_upsidedown ^ char_vflip) ? (g->h - 1 - y) : y] & (1 << ((char_upsidedown ^ char_hmirror ^ string_hmirror) ? x : (g->w - 1 - x))))
-                        {
-                            x_off += (string_hmirror ? -1 : +1) * (fast_floorf((x + 2) * scale) + x_spacing);
-                            exit = true;
-                            break;
-                        }
-                    }
-
-                    if (exit)
-                    {
-                        break;
-                    }
-                }
-            }
-            else
-            {
-                for (int y = 0, yy = g->h; y < yy; y++)
-                {
-                    for (int x = g->w - 1; x >= 0; x--)
-                    {
-                        if (g->data[(char_upsidedown ^ char_vflip) ? (g->h - 1 - y) : y] & (1 << ((char_upsidedown ^ char_hmirror ^ string_hmirror) ? x : (g->w - 1 - x))))
-                        {
-                            x_off += (string_hmirror ? -1 : +1) * (fast_floorf(((g->h - 1 - y) + 2) * scale) + x_spacing);
-                            exit = true;
-                            break;
-                        }
-                    }
-
-                    if (exit)
-                    {
-                        break;
-                    }
-                }
-            }
-
-            if (!exit)
-            {
-                x_off += (string_hmirror ? -1 : +1) * fast_floorf(scale * 3); // space char
-            }
+            int y = (char_upsidedown ^ char_vflip) ? g->ink_y1 : (g->glyph_h - 1 - g->ink_y0);
+            x_off += (string_hmirror ? -1 : +1) * (fast_floorf((y + 2) * scale) + x_spacing);
         }
 
-        str += bytes;
+        glyph_cache_unlock();
+    }
+
+    if (dirty_x0 < dirty_x1)
+    {
+        imlib_dirty_add(img, dirty_x0, dirty_y0, dirty_x1 - dirty_x0, dirty_y1 - dirty_y0);
     }
 }
 
@@ -0,0 +1,532 @@
+/*****************************************************************************
+ filter
+
+ Integral images, box and Gaussian blurs and Sobel/Scharr gradients of
+ GRAYSCALE and RGB565 images.
+
+ The blurs are separable and run as a row pipeline: every source row is
+ filtered horizontally once into a ring buffer holding the rows the
+ vertical kernel needs, and an output row is written as soon as its last
+ input row is in the ring. Only ksize rows are buffered, the output may be
+ the source image itself, and each pass works on rows that are already in
+ cache. The box blur keeps running sums in both directions so that its
+ cost does not depend on the kernel size. RGB565 is filtered as 8-bit R, G
+ and B.
+
+*****************************************************************************/
+#include "imlib.h"
+#include "fmath.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_heap_caps.h"
+
+#define FILTER_GAUSS_BITS 14 // Precision of the Gaussian weights, they add up to 1 << FILTER_GAUSS_BITS per axis.
+#define FILTER_ROW_BITS 8    // Fraction bits of the horizontally blurred rows, so they still fit 16 bits.
+#define FILTER_BOX_MAX 63    // Largest kernel, the reciprocal division of the box blur is exact up to 63 x 63.
+
+typedef struct filter_ctx
+{
+    const image_t *src;
+    image_t *dst;
+    int channels;
+    int r;                 // Kernel radius, the kernel is 2 * r + 1 wide.
+    const uint16_t *gauss; // Weights of the Gaussian, NULL for the box blur.
+    uint64_t box_inv;      // Reciprocal of the box area.
+} filter_ctx_t;
+
+//=======================================================================================
+// Integral Image
+//=======================================================================================
+/**
+ * Build the integral image of GRAYSCALE pixels or RGB565 luminance. The sums are 32-bit and
+ * may wrap on very large images, box sums of up to 16 million pixels are still exact.
+ * @param sum: allocated here, free it with imlib_integral_free().
+ * @return: false if the format is not supported or there is not enough memory.
+ */
+bool imlib_integral_build(const image_t *src, imlib_integral_t *sum)
+{
+    memset(sum, 0, sizeof(imlib_integral_t));
+    if ((src->pixfmt != PIXFORMAT_GRAYSCALE) && (src->pixfmt != PIXFORMAT_RGB565))
+    {
+        return false;
+    }
+
+    // A zero first row and column so that box sums need no edge cases.
+    int w = src->w + 1;
+    uint32_t *data = (uint32_t *) heap_caps_malloc(w * (src->h + 1) * sizeof(uint32_t), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (data == NULL)
+    {
+        data = (uint32_t *) malloc(w * (src->h + 1) * sizeof(uint32_t));
+        if (data == NULL)
+        {
+            return false;
+        }
+    }
+
+    memset(data, 0, w * sizeof(uint32_t));
+    for (int y = 0; y < src->h; y++)
+    {
+        const uint32_t *above = data + (y * w);
+        uint32_t *row = data + ((y + 1) * w);
+        uint32_t acc = 0;
+        row[0] = 0;
+
+        if (src->pixfmt == PIXFORMAT_GRAYSCALE)
+        {
+            const uint8_t *s = IMAGE_COMPUTE_GRAYSCALE_PIXEL_ROW_PTR(src, y);
+            for (int x = 0; x < src->w; x++)
+            {
+                acc += s[x];
+                row[x + 1] = above[x + 1] + acc;
+            }
+        }
+        else
+        {
+            const uint16_t *s = IMAGE_COMPUTE_RGB565_PIXEL_ROW_PTR(src, y);
+            for (int x = 0; x < src->w; x++)
+            {
+                int p = s[x];
+                acc += COLOR_RGB565_TO_Y(p);
+                row[x + 1] = above[x + 1] + acc;
+            }
+        }
+    }
+
+    sum->w = src->w;
+    sum->h = src->h;
+    sum->data = data;
+    return true;
+}
+
+void imlib_integral_free(imlib_integral_t *sum)
+{
+    heap_caps_free(sum->data);
+    sum->data = NULL;
+}
+
+/**
+ * Sum of the pixels of a rectangle, which must lie inside the image, from four lookups.
+ */
+uint32_t imlib_integral_sum(const imlib_integral_t *sum, int x, int y, int w, int h)
+{
+    int stride = sum->w + 1;
+    const uint32_t *top = sum->data + (y * stride) + x;
+    const uint32_t *bottom = top + (h * stride);
+    return bottom[w] - bottom[0] - top[w] + top[0];
+}
+
+//=======================================================================================
+// Row Pipeline
+//=======================================================================================
+/**
+ * Unpack source row y into one row per channel, padded by r replicated pixels on both sides.
+ */
+static void filter_unpack(const filter_ctx_t *c, int y, uint8_t *pad)
+{
+    const image_t *src = c->src;
+    int w = src->w, r = c->r, n = w + (2 * r);
+
+    if (src->pixfmt == PIXFORMAT_GRAYSCALE)
+    {
+        memcpy(pad + r, IMAGE_COMPUTE_GRAYSCALE_PIXEL_ROW_PTR(src, y), w);
+    }
+    else
+    {
+        const uint16_t *s = IMAGE_COMPUTE_RGB565_PIXEL_ROW_PTR(src, y);
+        for (int x = 0; x < w; x++)
+        {
+            int p = s[x];
+            pad[r + x] = COLOR_RGB565_TO_R8(p);
+            pad[n + r + x] = COLOR_RGB565_TO_G8(p);
+            pad[(2 * n) + r + x] = COLOR_RGB565_TO_B8(p);
+        }
+    }
+
+    for (int ch = 0; ch < c->channels; ch++)
+    {
+        uint8_t *p = pad + (ch * n);
+        memset(p, p[r], r);
+        memset(p + r + w, p[r + w - 1], r);
+    }
+}
+
+/**
+ * Filter the padded channel rows horizontally into h, channel after channel.
+ */
+static void filter_row(const filter_ctx_t *c, const uint8_t *pad, uint16_t *restrict h)
+{
+    int w = c->src->w, r = c->r, n = w + (2 * r), k = (2 * r) + 1;
+
+    for (int ch = 0; ch < c->channels; ch++, pad += n, h += w)
+    {
+        if (c->gauss == NULL)
+        {
+            // Running sum over the window.
+            uint32_t acc = 0;
+            for (int i = 0; i < k; i++)
+            {
+                acc += pad[i];
+            }
+
+            for (int x = 0; x < w; x++)
+            {
+                h[x] = acc;
+                acc += pad[x + k] - pad[x];
+            }
+        }
+        else
+        {
+            // The kernel is symmetric, so mirrored taps share a multiplication.
+            const uint16_t *g = c->gauss;
+            for (int x = 0; x < w; x++)
+            {
+                const uint8_t *p = pad + x;
+                uint32_t acc = (1 << (FILTER_GAUSS_BITS - FILTER_ROW_BITS - 1)) + (g[r] * p[r]);
+                for (int i = 0; i < r; i++)
+                {
+                    acc += g[i] * (p[i] + p[k - 1 - i]);
+                }
+                h[x] = acc >> (FILTER_GAUSS_BITS - FILTER_ROW_BITS);
+            }
+        }
+    }
+}
+
+/**
+ * Write the channel values of a row to the destination.
+ */
+static void filter_pack(const filter_ctx_t *c, int y, const uint8_t *v)
+{
+    image_t *dst = c->dst;
+    int w = dst->w;
+
+    if (dst->pixfmt == PIXFORMAT_GRAYSCALE)
+    {
+        memcpy(IMAGE_COMPUTE_GRAYSCALE_PIXEL_ROW_PTR(dst, y), v, w);
+    }
+    else
+    {
+        uint16_t *d = IMAGE_COMPUTE_RGB565_PIXEL_ROW_PTR(dst, y);
+        for (int x = 0; x < w; x++)
+        {
+            d[x] = COLOR_R8_G8_B8_TO_RGB565(v[x], v[w + x], v[(2 * w) + x]);
+        }
+    }
+}
+
+static bool filter_band(void *ctx, int y0, int y1)
+{
+    const filter_ctx_t *c = (const filter_ctx_t *) ctx;
+    int w = c->src->w, h = c->src->h, r = c->r, k = (2 * r) + 1;
+    int n = w * c->channels;
+
+    // The padded source row, the vertical sums, the ring of k horizontally filtered rows and
+    // the output row.
+    size_t pad_size = (((w + (2 * r)) * c->channels) + 3) & ~3;
+    uint8_t *pad = (uint8_t *) malloc(pad_size + (k * n * sizeof(uint16_t)) + (n * sizeof(uint32_t)) + n);
+    if (pad == NULL)
+    {
+        return false;
+    }
+    uint32_t *sum = (uint32_t *) (pad + pad_size);
+    uint16_t *ring = (uint16_t *) (sum + n);
+    uint8_t *out = (uint8_t *) (ring + (k * n));
+
+    // Row v of the ring holds source row y0 - r + v, clamped, at slot v % k.
+    for (int v = 0; v < (k - 1); v++)
+    {
+        filter_unpack(c, IM_MIN(IM_MAX(y0 - r + v, 0), h - 1), pad);
+        filter_row(c, pad, ring + (v * n));
+    }
+
+    if (c->gauss == NULL)
+    {
+        memset(sum, 0, n * sizeof(uint32_t));
+        for (int v = 0; v < (k - 1); v++)
+        {
+            for (int i = 0; i < n; i++)
+            {
+                sum[i] += ring[(v * n) + i];
+            }
+        }
+    }
+
+    for (int y = y0; y < y1; y++)
+    {
+        // Bring in the last row of the window of output row y.
+        int v = y - y0 + k - 1;
+        uint16_t *row = ring + ((v % k) * n);
+        filter_unpack(c, IM_MIN(y + r, h - 1), pad);
+        filter_row(c, pad, row);
+
+        if (c->gauss == NULL)
+        {
+            for (int i = 0; i < n; i++)
+            {
+                sum[i] += row[i];
+                out[i] = ((sum[i] + (k * k / 2)) * c->box_inv) >> 32;
+            }
+
+            // The first row of the window leaves it for the next output row.
+            const uint16_t *first = ring + (((v + 1) % k) * n);
+            for (int i = 0; i < n; i++)
+            {
+                sum[i] -= first[i];
+            }
+        }
+        else
+        {
+            // Accumulate whole rows, top and bottom row of the window first and the centre last.
+            const uint16_t *g = c->gauss;
+            memset(sum, 0, n * sizeof(uint32_t));
+            for (int j = 0; j < r; j++)
+            {
+                const uint16_t *a = ring + (((y - y0 + j) % k) * n);
+                const uint16_t *b = ring + (((y - y0 + k - 1 - j) % k) * n);
+                for (int i = 0; i < n; i++)
+                {
+                    sum[i] += g[j] * (a[i] + b[i]);
+                }
+            }
+
+            const uint16_t *m = ring + (((y - y0 + r) % k) * n);
+            uint32_t round = 1 << (FILTER_GAUSS_BITS + FILTER_ROW_BITS - 1);
+            for (int i = 0; i < n; i++)
+            {
+                out[i] = (sum[i] + round + (g[r] * m[i])) >> (FILTER_GAUSS_BITS + FILTER_ROW_BITS);
+            }
+        }
+
+        filter_pack(c, y, out);
+    }
+
+    free(pad);
+    return true;
+}
+
+/**
+ * Check the formats and run the pipeline. In place filtering has to run on one thread, as the
+ * bands need the unfiltered rows around them.
+ */
+static bool filter_run(filter_ctx_t *c)
+{
+    const image_t *src = c->src;
+    image_t *dst = c->dst;
+
+    if (((src->pixfmt != PIXFORMAT_GRAYSCALE) && (src->pixfmt != PIXFORMAT_RGB565)) || (dst->pixfmt != src->pixfmt) || (dst->w != src->w) || (dst->h != src->h))
+    {
+        return false;
+    }
+
+    if ((src->w <= 0) || (src->h <= 0))
+    {
+        return true;
+    }
+
+    c->channels = (src->pixfmt == PIXFORMAT_RGB565) ? 3 : 1;
+    bool in_place = src->data == dst->data;
+    int threads = (!in_place && ((src->w * src->h) >= IMLIB_PARALLEL_MIN_PIXELS)) ? 0 : 1;
+    bool ok = imlib_parallel_bands(src->h, threads, filter_band, c);
+
+    imlib_dirty_add_all(dst);
+    return ok;
+}
+
+//=======================================================================================
+// Blurs
+//=======================================================================================
+/**
+ * Average every pixel with its ksize x ksize neighbourhood, edges are replicated. The cost per
+ * pixel does not depend on ksize.
+ * @param src: GRAYSCALE or RGB565 image.
+ * @param dst: image of the same size and format, it may be src.
+ * @param ksize: odd kernel size, 1 to 63.
+ * @return: false if the formats, sizes or ksize are not supported or there is not enough memory.
+ */
+bool imlib_box_blur(const image_t *src, image_t *dst, int ksize)
+{
+    if (((ksize & 1) == 0) || (ksize > FILTER_BOX_MAX) || (ksize < 1))
+    {
+        return false;
+    }
+
+    filter_ctx_t c = {
+        .src = src,
+        .dst = dst,
+        .r = ksize / 2,
+        .box_inv = (UINT64_C(0xFFFFFFFF) / (ksize * ksize)) + 1,
+    };
+    return filter_run(&c);
+}
+
+/**
+ * Gaussian blur with a ksize x ksize kernel, edges are replicated. The weights are fixed point.
+ * @param src: GRAYSCALE or RGB565 image.
+ * @param dst: image of the same size and format, it may be src.
+ * @param ksize: odd kernel size, 1 to 63.
+ * @param sigma: standard deviation in pixels, 0 or less derives it from ksize like OpenCV.
+ * @return: false if the formats, sizes or ksize are not supported or there is not enough memory.
+ */
+bool imlib_gaussian_blur(const image_t *src, image_t *dst, int ksize, float sigma)
+{
+    if (((ksize & 1) == 0) || (ksize > FILTER_BOX_MAX) || (ksize < 1))
+    {
+        return false;
+    }
+
+    int r = ksize / 2;
+    if (sigma <= 0.0f)
+    {
+        sigma = (0.3f * (r - 1.0f)) + 0.8f;
+    }
+
+    float weights[FILTER_BOX_MAX], total = 0.0f;
+    for (int i = 0; i < ksize; i++)
+    {
+        weights[i] = expf(-((i - r) * (i - r)) / (2.0f * sigma * sigma));
+        total += weights[i];
+    }
+
+    // Quantise so that the weights add up to exactly one, the rounding error goes to the centre.
+    uint16_t gauss[FILTER_BOX_MAX];
+    int one = 1 << FILTER_GAUSS_BITS, acc = 0;
+    for (int i = 0; i < ksize; i++)
+    {
+        gauss[i] = fast_roundf((weights[i] * one) / total);
+        acc += gauss[i];
+    }
+    gauss[r] += one - acc;
+
+    filter_ctx_t c = {
+        .src = src,
+        .dst = dst,
+        .r = r,
+        .gauss = gauss,
+    };
+    return filter_run(&c);
+}
+
+//=======================================================================================
+// Gradients
+//=======================================================================================
+typedef struct gradient_ctx
+{
+    const image_t *src;
+    image_t *mag;
+    image_t *angle;
+    int side, centre; // Kernel weights across the derivative, 1 and 2 for Sobel, 3 and 10 for Scharr.
+    float scale;      // Makes a full 0 to 255 step a magnitude of 255.
+} gradient_ctx_t;
+
+/**
+ * Luminance of source row y, padded by one replicated pixel on both sides.
+ */
+static void gradient_unpack(const image_t *src, int y, uint8_t *pad)
+{
+    int w = src->w;
+    if (src->pixfmt == PIXFORMAT_GRAYSCALE)
+    {
+        memcpy(pad + 1, IMAGE_COMPUTE_GRAYSCALE_PIXEL_ROW_PTR(src, y), w);
+    }
+    else
+    {
+        const uint16_t *s = IMAGE_COMPUTE_RGB565_PIXEL_ROW_PTR(src, y);
+        for (int x = 0; x < w; x++)
+        {
+            int p = s[x];
+            pad[x + 1] = COLOR_RGB565_TO_Y(p);
+        }
+    }
+    pad[0] = pad[1];
+    pad[w + 1] = pad[w];
+}
+
+static bool gradient_band(void *ctx, int y0, int y1)
+{
+    const gradient_ctx_t *c = (const gradient_ctx_t *) ctx;
+    const image_t *src = c->src;
+    int w = src->w, h = src->h, n = w + 2;
+
+    uint8_t *rows = (uint8_t *) malloc(3 * n);
+    if (rows == NULL)
+    {
+        return false;
+    }
+
+    // Ring of the rows above, at and below the output row, source row v at slot v % 3.
+    gradient_unpack(src, IM_MAX(y0 - 1, 0), rows + (((y0 + 2) % 3) * n));
+    gradient_unpack(src, y0, rows + ((y0 % 3) * n));
+
+    for (int y = y0; y < y1; y++)
+    {
+        gradient_unpack(src, IM_MIN(y + 1, h - 1), rows + (((y + 1) % 3) * n));
+        const uint8_t *a = rows + (((y + 2) % 3) * n);
+        const uint8_t *b = rows + ((y % 3) * n);
+        const uint8_t *d = rows + (((y + 1) % 3) * n);
+        uint8_t *m = IMAGE_COMPUTE_GRAYSCALE_PIXEL_ROW_PTR(c->mag, y);
+        uint8_t *t = (c->angle != NULL) ? IMAGE_COMPUTE_GRAYSCALE_PIXEL_ROW_PTR(c->angle, y) : NULL;
+
+        for (int x = 0; x < w; x++)
+        {
+            int gx = (c->side * ((a[x + 2] - a[x]) + (d[x + 2] - d[x]))) + (c->centre * (b[x + 2] - b[x]));
+            int gy = (c->side * ((d[x] - a[x]) + (d[x + 2] - a[x + 2]))) + (c->centre * (d[x + 1] - a[x + 1]));
+            m[x] = IM_MIN((int) (fast_sqrtf((gx * gx) + (gy * gy)) * c->scale), COLOR_GRAYSCALE_MAX);
+            if (t != NULL)
+            {
+                t[x] = ((gx | gy) == 0) ? 0 : ((int) (fast_atan2f(gy, gx) * (256.0f / (2.0f * M_PI))) & 0xFF);
+            }
+        }
+    }
+
+    free(rows);
+    return true;
+}
+
+/**
+ * Sobel or Scharr gradient magnitude and direction of GRAYSCALE pixels or RGB565 luminance,
+ * edges are replicated.
+ * @param mag: GRAYSCALE image of the size of src, it may be src if src is GRAYSCALE. A step from
+ *             0 to 255 across the kernel gives 255, stronger gradients saturate.
+ * @param angle: GRAYSCALE image of the size of src, or NULL. Direction of the gradient in
+ *               1/256 turns clockwise from +x, as y points down. 0 where there is no gradient.
+ * @param scharr: use the Scharr kernel, which is more rotation invariant, instead of Sobel.
+ * @return: false if the formats or sizes are not supported or there is not enough memory.
+ */
+bool imlib_gradient(const image_t *src, image_t *mag, image_t *angle, bool scharr)
+{
+    if (((src->pixfmt != PIXFORMAT_GRAYSCALE) && (src->pixfmt != PIXFORMAT_RGB565)) || (mag->pixfmt != PIXFORMAT_GRAYSCALE) || (mag->w != src->w) || (mag->h != src->h))
+    {
+        return false;
+    }
+
+    if ((angle != NULL) && ((angle->pixfmt != PIXFORMAT_GRAYSCALE) || (angle->w != src->w) || (angle->h != src->h)))
+    {
+        return false;
+    }
+
+    if ((src->w <= 0) || (src->h <= 0))
+    {
+        return true;
+    }
+
+    gradient_ctx_t c = {
+        .src = src,
+        .mag = mag,
+        .angle = angle,
+        .side = scharr ? 3 : 1,
+        .centre = scharr ? 10 : 2,
+        .scale = scharr ? (1.0f / 16.0f) : (1.0f / 4.0f),
+    };
+
+    bool in_place = (src->data == mag->data) || ((angle != NULL) && (src->data == angle->data));
+    int threads = (!in_place && ((src->w * src->h) >= IMLIB_PARALLEL_MIN_PIXELS)) ? 0 : 1;
+    bool ok = imlib_parallel_bands(src->h, threads, gradient_band, &c);
+
+    imlib_dirty_add_all(mag);
+    if (angle != NULL)
+    {
+        imlib_dirty_add_all(angle);
+    }
+    return ok;
+}
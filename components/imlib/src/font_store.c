@@ -0,0 +1,123 @@
+/*****************************************************************************
+ font store
+
+ Lookup of 16x16 glyphs in the sparse font store built by
+ tools/font_pack.py. The store only holds the glyphs the application asked
+ for, PackBits compressed if that makes it smaller. A code point is found
+ with two table lookups, the block of its page and its glyph number within
+ the block, so a lookup costs the same whatever the number of glyphs.
+
+*****************************************************************************/
+#include "font.h"
+#include <string.h>
+
+#define FONT_STORE_HEADER 16
+#define FONT_STORE_ABSENT 0xFFFF
+#define FONT_STORE_COMPRESSED 0x01 // Header flag, the glyphs are found through an offset table.
+
+/**
+ * Read little endian values, the embedded store is not guaranteed to be aligned.
+ */
+static inline uint32_t font_store_u16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t font_store_u32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+/**
+ * Expand a PackBits compressed glyph.
+ * @return: false if the data does not expand to exactly one glyph.
+ */
+static bool font_store_unpack(const uint8_t *data, uint32_t size, uint8_t glyph[FONT_STORE_GLYPH_SIZE])
+{
+    uint32_t i = 0, n = 0;
+    while ((i < size) && (n < FONT_STORE_GLYPH_SIZE))
+    {
+        int count = (int8_t) data[i++];
+        if (count >= 0)
+        {
+            // count + 1 literal bytes.
+            if (((i + count + 1) > size) || ((n + count + 1) > FONT_STORE_GLYPH_SIZE))
+            {
+                return false;
+            }
+            memcpy(glyph + n, data + i, count + 1);
+            i += count + 1;
+            n += count + 1;
+        }
+        else
+        {
+            // One byte repeated 1 - count times.
+            if ((i >= size) || ((n + 1 - count) > FONT_STORE_GLYPH_SIZE))
+            {
+                return false;
+            }
+            memset(glyph + n, data[i++], 1 - count);
+            n += 1 - count;
+        }
+    }
+
+    return n == FONT_STORE_GLYPH_SIZE;
+}
+
+/**
+ * Get the 16x16 glyph of a code point, stored as the left 8 columns of all rows, then the right
+ * 8 columns.
+ * @return: false if the store has no glyph for the code point, the glyph is then blank.
+ */
+bool font_store_get(uint32_t unicode, uint8_t glyph[FONT_STORE_GLYPH_SIZE])
+{
+    const uint8_t *store = unicode_font_store_start;
+    size_t store_size = unicode_font_store_end - unicode_font_store_start;
+
+    if ((unicode > 0xFFFF) || (store_size < (FONT_STORE_HEADER + 512)) || (memcmp(store, "IMFS", 4) != 0))
+    {
+        return false;
+    }
+
+    bool compressed = store[5] & FONT_STORE_COMPRESSED;
+    uint32_t pages = font_store_u16(store + 6);
+    uint32_t glyphs = font_store_u32(store + 8);
+    const uint8_t *page_map = store + FONT_STORE_HEADER;
+    const uint8_t *blocks = page_map + (256 * 2);
+    const uint8_t *offsets = blocks + (pages * 256 * 2);
+    const uint8_t *data = compressed ? (offsets + ((glyphs + 1) * 4)) : offsets;
+
+    uint32_t page = font_store_u16(page_map + ((unicode >> 8) * 2));
+    if (page == FONT_STORE_ABSENT)
+    {
+        return false;
+    }
+
+    uint32_t number = font_store_u16(blocks + (((page * 256) + (unicode & 0xFF)) * 2));
+    if (number == FONT_STORE_ABSENT)
+    {
+        return false;
+    }
+
+    uint32_t start = number * FONT_STORE_GLYPH_SIZE;
+    uint32_t size = FONT_STORE_GLYPH_SIZE;
+    if (compressed)
+    {
+        start = font_store_u32(offsets + (number * 4));
+        size = font_store_u32(offsets + ((number + 1) * 4)) - start;
+    }
+
+    if ((data + start + size) > unicode_font_store_end)
+    {
+        return false;
+    }
+
+    // Glyphs that do not compress are stored as they are.
+    if (size == FONT_STORE_GLYPH_SIZE)
+    {
+        memcpy(glyph, data + start, FONT_STORE_GLYPH_SIZE);
+        return true;
+    }
+
+    return font_store_unpack(data + start, size, glyph);
+}
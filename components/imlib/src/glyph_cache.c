@@ -0,0 +1,352 @@
+/*****************************************************************************
+ glyph cache
+
+ Pre-rasterised (scaled, mirrored and rotated) glyph bitmaps so that
+ imlib_draw_string() only has to blit rows of pixels. Glyphs are 1-bpp, or
+ hold the coverage of every pixel when they are anti-aliased.
+
+*****************************************************************************/
+#include "font.h"
+#include "imlib.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "esp_heap_caps.h"
+#include "fmath.h"
+
+#define GLYPH_CACHE_SIZE 128 // Number of cached glyphs, must be a power of two.
+#define GLYPH_CACHE_WAYS 4   // Slots probed for a key before one is evicted.
+
+#define FONT_ASCII_FIRST 0x20
+#define FONT_ASCII_LAST 0x7F
+
+typedef struct
+{
+    uint32_t unicode;
+    float scale;
+    uint8_t rotation;
+    bool hmirror;
+    bool vflip;
+    bool antialias;
+} glyph_key_t;
+
+typedef struct
+{
+    glyph_key_t key;
+    uint32_t last_used;
+    glyph_bitmap_t *bitmap;
+} glyph_slot_t;
+
+static glyph_slot_t glyph_cache[GLYPH_CACHE_SIZE];
+static uint32_t glyph_cache_clock;
+static pthread_mutex_t glyph_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Decode the source glyph of a code point into 16 rows with the leftmost pixel in bit 15.
+ * @return: glyph width in pixels, 0 if the font has no glyph for the code point.
+ */
+static int font_get_glyph_rows(uint32_t unicode, uint16_t rows[FONT_GLYPH_MAX_H])
+{
+    if ((FONT_ASCII_FIRST <= unicode) && (unicode <= FONT_ASCII_LAST))
+    {
+        const unsigned char *data = font_ascii_8x16 + ((unicode - FONT_ASCII_FIRST) * 16);
+        for (int y = 0; y < 16; y++)
+        {
+            rows[y] = data[y] << 8;
+        }
+
+        return 8;
+    }
+
+    if ((0x80 <= unicode) && (unicode <= 0xFFFF))
+    {
+        // 16x16 glyphs are stored as the left 8 columns of all rows, then the right 8 columns.
+        // Code points that were not packed into the store are blank, like in the full font.
+        uint8_t data[FONT_STORE_GLYPH_SIZE];
+        if (!font_store_get(unicode, data))
+        {
+            memset(data, 0, sizeof(data));
+        }
+
+        for (int y = 0; y < 16; y++)
+        {
+            rows[y] = (data[y] << 8) | data[y + 16];
+        }
+
+        return 16;
+    }
+
+    return 0;
+}
+
+/**
+ * Rasterise the coverage of every pixel of a scaled glyph, the area of the pixel that is inked
+ * once scaled, as a byte per pixel. Source and output pixel edges are compared in 16 bit fixed
+ * point, every output pixel covers step by step of them.
+ * @param xx, yy: scaled glyph size before rotation.
+ * @param ox, oy: offset of the rotated bitmap from the glyph centre.
+ */
+static void glyph_rasterise_coverage(const glyph_key_t *key, const uint16_t rows[FONT_GLYPH_MAX_H], glyph_bitmap_t *bitmap, int xx, int yy, int ox, int oy)
+{
+    uint32_t step = fast_roundf(65536.0f / key->scale);
+    uint64_t area = (uint64_t) step * step;
+
+    for (int y = 0; y < yy; y++)
+    {
+        // Inked height of every source column within the output row.
+        uint32_t top = (key->vflip ? (yy - y - 1) : y) * step;
+        uint32_t bottom = top + step;
+        uint32_t col[FONT_GLYPH_MAX_W] = {0};
+        bool ink = false;
+        for (int sy = top >> 16; (sy < FONT_GLYPH_MAX_H) && ((uint32_t) sy << 16) < bottom; sy++)
+        {
+            uint32_t overlap = IM_MIN(bottom, (uint32_t) (sy + 1) << 16) - IM_MAX(top, (uint32_t) sy << 16);
+            for (int sx = 0; (sx < FONT_GLYPH_MAX_W) && rows[sy]; sx++)
+            {
+                if (rows[sy] & (0x8000 >> sx))
+                {
+                    col[sx] += overlap;
+                    ink = true;
+                }
+            }
+        }
+
+        if (!ink)
+        {
+            continue;
+        }
+
+        for (int x = 0; x < xx; x++)
+        {
+            uint32_t left = (key->hmirror ? (xx - x - 1) : x) * step;
+            uint32_t right = left + step;
+            uint64_t sum = 0;
+            for (int sx = left >> 16; (sx < FONT_GLYPH_MAX_W) && (((uint32_t) sx << 16) < right); sx++)
+            {
+                sum += (uint64_t) col[sx] * (IM_MIN(right, (uint32_t) (sx + 1) << 16) - IM_MAX(left, (uint32_t) sx << 16));
+            }
+
+            int cov = ((sum * 255) + (area / 2)) / area;
+            if (cov)
+            {
+                int rx, ry;
+                glyph_rotate(key->rotation, x - (xx / 2), y - (yy / 2), &rx, &ry);
+                ((uint8_t *) (bitmap->rows + ((ry - oy) * bitmap->stride)))[rx - ox] = cov;
+            }
+        }
+    }
+}
+
+/**
+ * Rasterise a glyph at the requested scale, mirror and rotation.
+ */
+static glyph_bitmap_t *glyph_rasterise(const glyph_key_t *key)
+{
+    uint16_t rows[FONT_GLYPH_MAX_H];
+    int gw = font_get_glyph_rows(key->unicode, rows);
+    int gh = FONT_GLYPH_MAX_H;
+    if (gw == 0)
+    {
+        return NULL;
+    }
+
+    int xx = fast_floorf(gw * key->scale);
+    int yy = fast_floorf(gh * key->scale);
+
+    // Offsets are relative to the glyph centre, which is what the rotation is about.
+    int x0, y0, x1, y1;
+    glyph_rotate(key->rotation, -(xx / 2), -(yy / 2), &x0, &y0);
+    glyph_rotate(key->rotation, xx - 1 - (xx / 2), yy - 1 - (yy / 2), &x1, &y1);
+    int ox = IM_MIN(x0, x1);
+    int oy = IM_MIN(y0, y1);
+    int w = abs(x1 - x0) + 1;
+    int h = abs(y1 - y0) + 1;
+    int stride = key->antialias ? ((w + 3) >> 2) : ((w + UINT32_T_MASK) >> UINT32_T_SHIFT);
+
+    if ((xx <= 0) || (yy <= 0))
+    {
+        w = h = stride = 0;
+    }
+
+    size_t size = sizeof(glyph_bitmap_t) + (stride * h * sizeof(uint32_t));
+    glyph_bitmap_t *bitmap = (glyph_bitmap_t *) heap_caps_calloc(1, size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (bitmap == NULL)
+    {
+        bitmap = (glyph_bitmap_t *) calloc(1, size);
+        if (bitmap == NULL)
+        {
+            return NULL;
+        }
+    }
+
+    bitmap->x_off = ox;
+    bitmap->y_off = oy;
+    bitmap->w = w;
+    bitmap->h = h;
+    bitmap->stride = stride;
+    bitmap->bpp = key->antialias ? 8 : 1;
+    bitmap->glyph_w = gw;
+    bitmap->glyph_h = gh;
+    bitmap->ink_x0 = bitmap->ink_x1 = bitmap->ink_y0 = bitmap->ink_y1 = -1;
+
+    uint16_t ink_cols = 0;
+    for (int y = 0; y < gh; y++)
+    {
+        if (rows[y])
+        {
+            if (bitmap->ink_y0 < 0)
+            {
+                bitmap->ink_y0 = y;
+            }
+            bitmap->ink_y1 = y;
+            ink_cols |= rows[y];
+        }
+    }
+
+    for (int x = 0; x < gw; x++)
+    {
+        if (ink_cols & (0x8000 >> x))
+        {
+            if (bitmap->ink_x0 < 0)
+            {
+                bitmap->ink_x0 = x;
+            }
+            bitmap->ink_x1 = x;
+        }
+    }
+
+    if (w == 0)
+    {
+        return bitmap;
+    }
+
+    if (key->antialias)
+    {
+        glyph_rasterise_coverage(key, rows, bitmap, xx, yy, ox, oy);
+        return bitmap;
+    }
+
+    // Output columns [col_start[sx], col_start[sx + 1]) before mirroring come from source column
+    // sx. Kept per source column so that the stack use does not grow with the scale.
+    int col_start[FONT_GLYPH_MAX_W + 1];
+    for (int sx = 0, x = 0; sx <= FONT_GLYPH_MAX_W; sx++)
+    {
+        while ((x < xx) && (fast_floorf(x / key->scale) < sx))
+        {
+            x++;
+        }
+        col_start[sx] = x;
+    }
+
+    for (int y = 0; y < yy; y++)
+    {
+        int sy = key->vflip ? (yy - y - 1) : y;
+        uint16_t src = rows[fast_floorf(sy / key->scale)];
+        if (src == 0)
+        {
+            continue;
+        }
+
+        for (int sx = 0; sx < gw; sx++)
+        {
+            if (!(src & (0x8000 >> sx)))
+            {
+                continue;
+            }
+
+            for (int p = col_start[sx]; p < col_start[sx + 1]; p++)
+            {
+                int rx, ry;
+                int x = key->hmirror ? (xx - p - 1) : p;
+                glyph_rotate(key->rotation, x - (xx / 2), y - (yy / 2), &rx, &ry);
+                rx -= ox;
+                ry -= oy;
+                bitmap->rows[(ry * stride) + (rx >> UINT32_T_SHIFT)] |= 1 << (rx & UINT32_T_MASK);
+            }
+        }
+    }
+
+    return bitmap;
+}
+
+static inline bool glyph_key_equal(const glyph_key_t *a, const glyph_key_t *b)
+{
+    return (a->unicode == b->unicode) && (a->scale == b->scale) && (a->rotation == b->rotation) && (a->hmirror == b->hmirror) && (a->vflip == b->vflip) && (a->antialias == b->antialias);
+}
+
+/**
+ * Get the cached bitmap of a glyph, rasterising it on a miss.
+ * @param unicode: code point of the character.
+ * @param scale: character scaling ratio.
+ * @param rotation: clockwise rotation in multiples of 90 degrees (0 - 3).
+ * @param hmirror, vflip: mirror the character before rotating it.
+ * @param antialias: rasterise the coverage of every pixel instead of a 1-bpp bitmap.
+ * @return: the glyph bitmap, valid until the next call, or NULL if the font has no such glyph.
+ * Callers that may run concurrently must hold glyph_cache_lock() while they use the bitmap.
+ */
+const glyph_bitmap_t *glyph_cache_get(uint32_t unicode, float scale, int rotation, bool hmirror, bool vflip, bool antialias)
+{
+    glyph_key_t key = {unicode, scale, rotation & 3, hmirror, vflip, antialias};
+    uint32_t scale_bits;
+    memcpy(&scale_bits, &scale, sizeof(scale_bits));
+
+    uint32_t hash = (unicode * 2654435761U) ^ (scale_bits * 40503U) ^ (antialias << 4) ^ (key.rotation << 2) ^ (hmirror << 1) ^ vflip;
+    uint32_t index = (hash ^ (hash >> 16)) & (GLYPH_CACHE_SIZE - 1);
+
+    glyph_slot_t *victim = NULL;
+    glyph_cache_clock++;
+
+    for (int i = 0; i < GLYPH_CACHE_WAYS; i++)
+    {
+        glyph_slot_t *slot = &glyph_cache[(index + i) & (GLYPH_CACHE_SIZE - 1)];
+        if (slot->bitmap && glyph_key_equal(&slot->key, &key))
+        {
+            slot->last_used = glyph_cache_clock;
+            return slot->bitmap;
+        }
+
+        if ((victim == NULL) || (victim->bitmap && ((slot->bitmap == NULL) || (slot->last_used < victim->last_used))))
+        {
+            victim = slot;
+        }
+    }
+
+    glyph_bitmap_t *bitmap = glyph_rasterise(&key);
+    if (bitmap == NULL)
+    {
+        return NULL;
+    }
+
+    heap_caps_free(victim->bitmap);
+    victim->key = key;
+    victim->last_used = glyph_cache_clock;
+    victim->bitmap = bitmap;
+    return bitmap;
+}
+
+/**
+ * Serialise access to the cache between threads drawing text at the same time.
+ */
+void glyph_cache_lock(void)
+{
+    pthread_mutex_lock(&glyph_cache_mutex);
+}
+
+void glyph_cache_unlock(void)
+{
+    pthread_mutex_unlock(&glyph_cache_mutex);
+}
+
+/**
+ * Free all cached glyph bitmaps.
+ */
+void glyph_cache_clear(void)
+{
+    glyph_cache_lock();
+    for (int i = 0; i < GLYPH_CACHE_SIZE; i++)
+    {
+        heap_caps_free(glyph_cache[i].bitmap);
+        glyph_cache[i].bitmap = NULL;
+    }
+    glyph_cache_unlock();
+}
@@ -0,0 +1,103 @@
+/*****************************************************************************
+ image
+
+ Allocation of image buffers and views into them. Rows are padded to whole
+ L2 cache lines and the buffer starts on one, so that no row shares a line
+ with the next and DMA and row kernels always work on aligned memory. Small
+ images go to internal SRAM, large ones to SPIRAM.
+
+ A view is an image_t that aliases a rectangle of another image through its
+ stride, so that it can be drawn into, converted or analysed without a copy.
+
+*****************************************************************************/
+#include "imlib.h"
+#include <string.h>
+#include "esp_heap_caps.h"
+
+/**
+ * Allocate the pixels of an image. The pixels are not cleared.
+ * @param img: image header to fill in, any previous buffer is not freed.
+ * @param w, h: size of the image in pixels.
+ * @param pixfmt: an uncompressed pixel format.
+ * @param hint: memory to prefer, the other memory is tried if that allocation fails.
+ * @return: false if the format is compressed or there is not enough memory.
+ */
+bool imlib_image_alloc(image_t *img, int w, int h, pixformat_t pixfmt, imlib_alloc_hint_t hint)
+{
+    memset(img, 0, sizeof(image_t));
+    img->w = w;
+    img->h = h;
+    img->pixfmt = pixfmt;
+
+    if ((w <= 0) || (h <= 0) || img->is_compressed || ((pixfmt != PIXFORMAT_BINARY) && (img->bpp == 0)))
+    {
+        return false;
+    }
+
+    int packed = (pixfmt == PIXFORMAT_BINARY) ? IMAGE_BINARY_LINE_LEN_BYTES(img) : (w * img->bpp);
+    img->stride = (packed + IMLIB_CACHE_LINE_SIZE - 1) & ~(IMLIB_CACHE_LINE_SIZE - 1);
+    size_t size = (size_t) img->stride * h;
+
+    uint32_t internal = MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT;
+    uint32_t spiram = MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT;
+    bool prefer_internal = (hint == IMLIB_ALLOC_INTERNAL) || ((hint == IMLIB_ALLOC_AUTO) && (size <= IMLIB_IMAGE_INTERNAL_MAX));
+
+    img->data = (uint8_t *) heap_caps_aligned_alloc(IMLIB_CACHE_LINE_SIZE, size, prefer_internal ? internal : spiram);
+    if (img->data == NULL)
+    {
+        img->data = (uint8_t *) heap_caps_aligned_alloc(IMLIB_CACHE_LINE_SIZE, size, prefer_internal ? spiram : internal);
+    }
+
+    return img->data != NULL;
+}
+
+/**
+ * Free the pixels of an image allocated by imlib_image_alloc(). The header itself is not freed.
+ */
+void imlib_image_free(image_t *img)
+{
+    heap_caps_free(img->data);
+    img->data = NULL;
+}
+
+/**
+ * Get an image that aliases a rectangle of another image, no pixels are copied. The view has its
+ * own coordinates, with 0, 0 at the corner of the rectangle, and draws, converts and is read like
+ * any image. Changes are recorded in the damage tracking of the parent, in parent coordinates.
+ * The clip of the parent is not inherited, its anti-aliasing is.
+ * @param parent: image to look into, its pixels must outlive the view. It can be a view itself.
+ * @param r: area of the view, clipped to the parent.
+ * @return: the view. It is empty, with NULL data, if the area is outside the parent, the format
+ *          is compressed, for BINARY if r->x is not a multiple of 32, or for YUV422 and YVU422
+ *          if r->x is odd.
+ */
+image_t imlib_image_view(const image_t *parent, const rectangle_t *r)
+{
+    image_t view;
+    memset(&view, 0, sizeof(image_t));
+    view.pixfmt = parent->pixfmt;
+
+    int x0 = IM_MAX(r->x, 0);
+    int y0 = IM_MAX(r->y, 0);
+    int x1 = IM_MIN(r->x + r->w, parent->w);
+    int y1 = IM_MIN(r->y + r->h, parent->h);
+    bool binary = parent->pixfmt == PIXFORMAT_BINARY;
+    bool yuv = (parent->pixfmt == PIXFORMAT_YUV422) || (parent->pixfmt == PIXFORMAT_YVU422);
+
+    // A binary row can only start at a word, image_t has no bit offset. A YUV row must start at
+    // the first pixel of a U/V pair, or the chroma of the view is swapped.
+    if ((x0 >= x1) || (y0 >= y1) || parent->is_compressed || (binary && (x0 & UINT32_T_MASK)) || (yuv && (x0 & 1)))
+    {
+        return view;
+    }
+
+    view.w = x1 - x0;
+    view.h = y1 - y0;
+    view.stride = IMAGE_STRIDE(parent);
+    view.data = parent->data + (y0 * view.stride) + (binary ? ((x0 >> UINT32_T_SHIFT) * sizeof(uint32_t)) : (x0 * parent->bpp));
+    view.dirty = parent->dirty;
+    view.antialias = parent->antialias;
+    view.origin.x = parent->origin.x + x0;
+    view.origin.y = parent->origin.y + y0;
+    return view;
+}
@@ -0,0 +1,1420 @@
+/*****************************************************************************
+ jpeg
+
+ Streaming baseline JPEG decoder and encoder.
+
+ The decoder pulls the compressed data through a small buffer from a read
+ callback, so the file never has to be in memory. Every MCU row is decoded
+ into a band of a few pixel rows and converted straight into the
+ destination image.
+
+ Scaled decoding (1/2, 1/4 and 1/8) happens in the DCT domain: the IDCT
+ basis is averaged over every S x S output pixel, so a block transforms
+ straight into its box filtered N x N pixels with less work than the full
+ IDCT. At 1/8 only the DC coefficient is left.
+
+ Supported: 8-bit baseline and extended Huffman (SOF0/SOF1) with 1 or 3
+ interleaved components, any power of two chroma subsampling up to 4x4 and
+ restart markers. Progressive and arithmetic coded files are rejected.
+
+ The encoder works through the image an MCU row at a time as well and hands
+ the compressed data to a write callback in small chunks.
+
+*****************************************************************************/
+#include "imlib.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define JPEG_BUF_SIZE 4096   // Bytes pulled from the read callback at a time.
+#define JPEG_FAST_BITS 9     // Huffman codes up to this length are decoded with one lookup.
+#define JPEG_COEF_MAX 4095   // Dequantised coefficients are clamped to this, so the IDCT cannot overflow.
+#define JPEG_IDCT_BITS 11    // Fixed point precision of the IDCT tables.
+#define JPEG_MAX_SAMPLING 4
+
+typedef struct jpeg_huff
+{
+    uint8_t fast_len[1 << JPEG_FAST_BITS]; // 0 if the code is longer than JPEG_FAST_BITS.
+    uint8_t fast_val[1 << JPEG_FAST_BITS];
+    int32_t maxcode[18]; // Largest code of every length, -1 if there is none.
+    int32_t delta[17];   // Index in vals of a code of every length, minus that code.
+    uint8_t vals[256];
+    bool defined;
+} jpeg_huff_t;
+
+typedef struct jpeg_comp
+{
+    int id;
+    int h, v;     // Sampling factors.
+    int hs, vs;   // log2 of the maximum sampling factors divided by these.
+    int sx, sy;   // Scale the blocks are decoded at, log2.
+    int ux, uy;   // Upsampling from the decoded blocks to the output, log2.
+    int tq;       // Quantisation table.
+    int td, ta;   // DC and AC Huffman tables.
+    int dc_pred;
+    uint8_t *pix; // Decoded blocks of one MCU, (h * N) x (v * N) pixels.
+} jpeg_comp_t;
+
+typedef struct imlib_jpeg_state
+{
+    imlib_jpeg_read_t read;
+    void *ctx;
+    uint8_t buf[JPEG_BUF_SIZE];
+    int buf_pos;
+    int buf_len;
+    bool eof;
+
+    uint32_t bits; // Entropy coded bits, MSB first.
+    int nbits;
+    int marker;    // Marker found in the entropy coded data, 0 if none.
+
+    uint16_t qt[4][64]; // In zigzag order.
+    jpeg_huff_t dc[4];
+    jpeg_huff_t ac[4];
+    jpeg_comp_t comp[3];
+    int ncomp;
+    int hmax, vmax;
+    int restart_interval;
+} imlib_jpeg_state_t;
+
+static const uint8_t jpeg_zigzag[64] = {
+    0,  1,  8,  16, 9,  2,  3,  10, 17, 24, 32, 25, 18, 11, 4,  5,  12, 19, 26, 33, 40, 48,
+    41, 34, 27, 20, 13, 6,  7,  14, 21, 28, 35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23,
+    30, 37, 44, 51, 58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+// IDCT basis 0.5 * C(u) * cos((2k + 1) * u * pi / 16), averaged over the pixels k of every output x.
+static int16_t jpeg_idct_table[4][8][8];
+static bool jpeg_idct_table_ready = false;
+
+static void jpeg_idct_table_init(void)
+{
+    if (jpeg_idct_table_ready)
+    {
+        return;
+    }
+
+    for (int s = 0; s < 4; s++)
+    {
+        for (int u = 0; u < 8; u++)
+        {
+            for (int x = 0; x < (8 >> s); x++)
+            {
+                double c = 0;
+                for (int k = x << s; k < ((x + 1) << s); k++)
+                {
+                    c += ((u == 0) ? M_SQRT1_2 : 1.0) * 0.5 * cos((((2 * k) + 1) * u * M_PI) / 16);
+                }
+                jpeg_idct_table[s][u][x] = (int16_t) lround((c / (1 << s)) * (1 << JPEG_IDCT_BITS));
+            }
+        }
+    }
+
+    jpeg_idct_table_ready = true;
+}
+
+static int jpeg_read_byte(imlib_jpeg_state_t *st)
+{
+    if (st->buf_pos == st->buf_len)
+    {
+        st->buf_pos = 0;
+        st->buf_len = st->eof ? 0 : st->read(st->ctx, st->buf, JPEG_BUF_SIZE);
+        if (st->buf_len <= 0)
+        {
+            st->buf_len = 0;
+            st->eof = true;
+            return -1;
+        }
+    }
+
+    return st->buf[st->buf_pos++];
+}
+
+static int jpeg_read_u16(imlib_jpeg_state_t *st)
+{
+    int hi = jpeg_read_byte(st);
+    int lo = jpeg_read_byte(st);
+    return ((hi < 0) || (lo < 0)) ? -1 : ((hi << 8) | lo);
+}
+
+static bool jpeg_skip(imlib_jpeg_state_t *st, int len)
+{
+    while (len-- > 0)
+    {
+        if (jpeg_read_byte(st) < 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Find the next marker, skipping anything in front of it.
+ * @return: marker code, -1 at the end of the stream.
+ */
+static int jpeg_next_marker(imlib_jpeg_state_t *st)
+{
+    int b;
+    do
+    {
+        while ((b = jpeg_read_byte(st)) != 0xFF)
+        {
+            if (b < 0)
+            {
+                return -1;
+            }
+        }
+
+        while ((b = jpeg_read_byte(st)) == 0xFF)
+        {
+        }
+    } while (b == 0);
+
+    return b;
+}
+
+//=======================================================================================
+// Headers
+//=======================================================================================
+static bool jpeg_parse_dqt(imlib_jpeg_state_t *st, int len)
+{
+    while (len > 0)
+    {
+        int pq_tq = jpeg_read_byte(st);
+        int precision = pq_tq >> 4;
+        int id = pq_tq & 0xF;
+        if ((pq_tq < 0) || (precision > 1) || (id > 3))
+        {
+            return false;
+        }
+
+        for (int i = 0; i < 64; i++)
+        {
+            int q = precision ? jpeg_read_u16(st) : jpeg_read_byte(st);
+            if (q < 0)
+            {
+                return false;
+            }
+            st->qt[id][i] = q;
+        }
+
+        len -= 1 + (64 << precision);
+    }
+
+    return len == 0;
+}
+
+static bool jpeg_parse_dht(imlib_jpeg_state_t *st, int len)
+{
+    while (len > 0)
+    {
+        int tc_th = jpeg_read_byte(st);
+        if ((tc_th < 0) || ((tc_th >> 4) > 1) || ((tc_th & 0xF) > 3))
+        {
+            return false;
+        }
+
+        jpeg_huff_t *huff = ((tc_th >> 4) ? st->ac : st->dc) + (tc_th & 0xF);
+        uint8_t counts[17];
+        int total = 0;
+        for (int l = 1; l <= 16; l++)
+        {
+            int c = jpeg_read_byte(st);
+            if (c < 0)
+            {
+                return false;
+            }
+            counts[l] = c;
+            total += c;
+        }
+
+        if (total > 256)
+        {
+            return false;
+        }
+
+        for (int i = 0; i < total; i++)
+        {
+            int v = jpeg_read_byte(st);
+            if (v < 0)
+            {
+                return false;
+            }
+            huff->vals[i] = v;
+        }
+
+        // Canonical codes: every length continues where the previous one ended, shifted left.
+        memset(huff->fast_len, 0, sizeof(huff->fast_len));
+        int code = 0, k = 0;
+        for (int l = 1; l <= 16; l++)
+        {
+            huff->delta[l] = k - code;
+            if ((code + counts[l]) > (1 << l))
+            {
+                return false;
+            }
+
+            for (int i = 0; i < counts[l]; i++, code++, k++)
+            {
+                if (l <= JPEG_FAST_BITS)
+                {
+                    int shift = JPEG_FAST_BITS - l;
+                    for (int j = 0; j < (1 << shift); j++)
+                    {
+                        huff->fast_len[(code << shift) + j] = l;
+                        huff->fast_val[(code << shift) + j] = huff->vals[k];
+                    }
+                }
+            }
+
+            huff->maxcode[l] = counts[l] ? (code - 1) : -1;
+            code <<= 1;
+        }
+        huff->maxcode[17] = INT32_MAX;
+        huff->defined = true;
+
+        len -= 17 + total;
+    }
+
+    return len == 0;
+}
+
+static bool jpeg_parse_sof(imlib_jpeg_state_t *st, imlib_jpeg_dec_t *dec)
+{
+    int precision = jpeg_read_byte(st);
+    dec->h = jpeg_read_u16(st);
+    dec->w = jpeg_read_u16(st);
+    st->ncomp = jpeg_read_byte(st);
+    if ((precision != 8) || (dec->h <= 0) || (dec->w <= 0) || ((st->ncomp != 1) && (st->ncomp != 3)))
+    {
+        return false;
+    }
+
+    st->hmax = st->vmax = 1;
+    for (int i = 0; i < st->ncomp; i++)
+    {
+        jpeg_comp_t *c = &st->comp[i];
+        c->id = jpeg_read_byte(st);
+        int hv = jpeg_read_byte(st);
+        c->tq = jpeg_read_byte(st);
+        c->h = hv >> 4;
+        c->v = hv & 0xF;
+        if ((hv < 0) || (c->tq < 0) || (c->tq > 3) || (c->h < 1) || (c->h > JPEG_MAX_SAMPLING) || (c->v < 1) || (c->v > JPEG_MAX_SAMPLING))
+        {
+            return false;
+        }
+        st->hmax = IM_MAX(st->hmax, c->h);
+        st->vmax = IM_MAX(st->vmax, c->v);
+    }
+
+    // A single component scan is not interleaved and has one block per MCU.
+    if (st->ncomp == 1)
+    {
+        st->comp[0].h = st->comp[0].v = st->hmax = st->vmax = 1;
+    }
+
+    for (int i = 0; i < st->ncomp; i++)
+    {
+        jpeg_comp_t *c = &st->comp[i];
+        int hr = st->hmax / c->h, vr = st->vmax / c->v;
+        if (((st->hmax % c->h) != 0) || ((st->vmax % c->v) != 0) || (hr & (hr - 1)) || (vr & (vr - 1)))
+        {
+            return false;
+        }
+        c->hs = __builtin_ctz(hr);
+        c->vs = __builtin_ctz(vr);
+    }
+
+    return true;
+}
+
+static bool jpeg_parse_sos(imlib_jpeg_state_t *st)
+{
+    int ns = jpeg_read_byte(st);
+    if (ns != st->ncomp)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < ns; i++)
+    {
+        int id = jpeg_read_byte(st);
+        int tables = jpeg_read_byte(st);
+        if ((id < 0) || (tables < 0) || (st->comp[i].id != id))
+        {
+            return false;
+        }
+
+        jpeg_comp_t *c = &st->comp[i];
+        c->td = tables >> 4;
+        c->ta = tables & 0xF;
+        if ((c->td > 3) || (c->ta > 3) || !st->dc[c->td].defined || !st->ac[c->ta].defined)
+        {
+            return false;
+        }
+    }
+
+    // Spectral selection and successive approximation, fixed for sequential files.
+    return jpeg_skip(st, 3);
+}
+
+/**
+ * Parse the headers of a JPEG stream up to the start of the image data.
+ * @param dec: decoder, dec->w and dec->h are the full size of the image on success.
+ * @param read: callback that reads up to len bytes into buf and returns how many it read, 0 at the end.
+ * @param ctx: passed to read.
+ * @return: false if the stream is not a supported JPEG or there is not enough memory.
+ */
+bool imlib_jpeg_dec_init(imlib_jpeg_dec_t *dec, imlib_jpeg_read_t read, void *ctx)
+{
+    dec->w = dec->h = 0;
+    dec->state = (imlib_jpeg_state_t *) calloc(1, sizeof(imlib_jpeg_state_t));
+    if (dec->state == NULL)
+    {
+        return false;
+    }
+
+    imlib_jpeg_state_t *st = dec->state;
+    st->read = read;
+    st->ctx = ctx;
+
+    if ((jpeg_read_byte(st) != 0xFF) || (jpeg_read_byte(st) != 0xD8))
+    {
+        imlib_jpeg_dec_free(dec);
+        return false;
+    }
+
+    bool have_sof = false;
+    for (;;)
+    {
+        int marker = jpeg_next_marker(st);
+        if ((marker < 0) || (marker == 0xD9))
+        {
+            break;
+        }
+
+        if ((marker == 0x01) || ((marker >= 0xD0) && (marker <= 0xD7)))
+        {
+            continue;
+        }
+
+        int len = jpeg_read_u16(st) - 2;
+        if (len < 0)
+        {
+            break;
+        }
+
+        bool ok;
+        switch (marker)
+        {
+            case 0xC0:
+            case 0xC1:
+                {
+                    ok = !have_sof && jpeg_parse_sof(st, dec);
+                    have_sof = true;
+                    break;
+                }
+            case 0xC4:
+                {
+                    ok = jpeg_parse_dht(st, len);
+                    break;
+                }
+            case 0xDB:
+                {
+                    ok = jpeg_parse_dqt(st, len);
+                    break;
+                }
+            case 0xDD:
+                {
+                    st->restart_interval = jpeg_read_u16(st);
+                    ok = st->restart_interval >= 0;
+                    break;
+                }
+            case 0xDA:
+                {
+                    if (have_sof && jpeg_parse_sos(st))
+                    {
+                        return true;
+                    }
+                    ok = false;
+                    break;
+                }
+            default:
+                {
+                    // Progressive, lossless and arithmetic coding are not supported, everything else is skipped.
+                    ok = ((marker & 0xF0) != 0xC0) || (marker == 0xC8) || (marker == 0xCC);
+                    ok = ok && jpeg_skip(st, len);
+                    break;
+                }
+        }
+
+        if (!ok)
+        {
+            break;
+        }
+    }
+
+    imlib_jpeg_dec_free(dec);
+    dec->w = dec->h = 0;
+    return false;
+}
+
+/**
+ * Free the decoder, safe to call more than once.
+ */
+void imlib_jpeg_dec_free(imlib_jpeg_dec_t *dec)
+{
+    if (dec->state != NULL)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            free(dec->state->comp[i].pix);
+        }
+        free(dec->state);
+        dec->state = NULL;
+    }
+}
+
+//=======================================================================================
+// Entropy decoding
+//=======================================================================================
+static void jpeg_fill_bits(imlib_jpeg_state_t *st)
+{
+    while (st->nbits <= 24)
+    {
+        int b = 0;
+        if (st->marker == 0)
+        {
+            b = jpeg_read_byte(st);
+            if (b == 0xFF)
+            {
+                int b2;
+                while ((b2 = jpeg_read_byte(st)) == 0xFF)
+                {
+                }
+
+                if (b2 != 0)
+                {
+                    // A marker ends the entropy coded segment, it is padded with zeros from here on.
+                    st->marker = (b2 < 0) ? 0xD9 : b2;
+                    b = 0;
+                }
+            }
+            else if (b < 0)
+            {
+                st->marker = 0xD9;
+                b = 0;
+            }
+        }
+
+        st->bits |= (uint32_t) b << (24 - st->nbits);
+        st->nbits += 8;
+    }
+}
+
+static inline int jpeg_get_bits(imlib_jpeg_state_t *st, int n)
+{
+    if (st->nbits < n)
+    {
+        jpeg_fill_bits(st);
+    }
+
+    int v = st->bits >> (32 - n);
+    st->bits <<= n;
+    st->nbits -= n;
+    return v;
+}
+
+/**
+ * Read an n bit magnitude category value and sign extend it.
+ */
+static inline int jpeg_receive_extend(imlib_jpeg_state_t *st, int n)
+{
+    if (n == 0)
+    {
+        return 0;
+    }
+
+    int v = jpeg_get_bits(st, n);
+    return (v < (1 << (n - 1))) ? (v - (1 << n) + 1) : v;
+}
+
+static inline int jpeg_decode_huff(imlib_jpeg_state_t *st, const jpeg_huff_t *huff)
+{
+    if (st->nbits < 16)
+    {
+        jpeg_fill_bits(st);
+    }
+
+    int peek = st->bits >> (32 - JPEG_FAST_BITS);
+    int len = huff->fast_len[peek];
+    if (len)
+    {
+        st->bits <<= len;
+        st->nbits -= len;
+        return huff->fast_val[peek];
+    }
+
+    for (len = JPEG_FAST_BITS + 1; len <= 16; len++)
+    {
+        int code = st->bits >> (32 - len);
+        if (code <= huff->maxcode[len])
+        {
+            st->bits <<= len;
+            st->nbits -= len;
+            return huff->vals[(code + huff->delta[len]) & 0xFF];
+        }
+    }
+
+    // Corrupt data, drop a bit so that decoding always makes progress.
+    st->bits <<= 1;
+    st->nbits -= 1;
+    return 0;
+}
+
+/**
+ * Skip to the restart marker that ends the current interval and reset the predictors.
+ */
+static void jpeg_restart(imlib_jpeg_state_t *st)
+{
+    st->bits = 0;
+    st->nbits = 0;
+
+    if (st->marker == 0)
+    {
+        int marker = jpeg_next_marker(st);
+        st->marker = (marker < 0) ? 0xD9 : marker;
+    }
+
+    // Past the end of the image the rest of the scan decodes as zeros.
+    if ((st->marker >= 0xD0) && (st->marker <= 0xD7))
+    {
+        st->marker = 0;
+    }
+
+    for (int i = 0; i < st->ncomp; i++)
+    {
+        st->comp[i].dc_pred = 0;
+    }
+}
+
+//=======================================================================================
+// Blocks
+//=======================================================================================
+/**
+ * Decode one 8x8 block and write it scaled down to (8 >> c->sx) x (8 >> c->sy) pixels.
+ * @param out, stride: top left output pixel and the bytes between output rows.
+ * @param output: false to only decode the block, without the IDCT.
+ */
+static void jpeg_decode_block(imlib_jpeg_state_t *st, jpeg_comp_t *c, uint8_t *out, int stride, bool output)
+{
+    const uint16_t *q = st->qt[c->tq];
+    const jpeg_huff_t *ac = &st->ac[c->ta];
+    int nx = 8 >> c->sx, ny = 8 >> c->sy;
+    int32_t coef[64];
+    uint32_t rows = 1; // Rows of coef that have a non zero coefficient.
+
+    int t = jpeg_decode_huff(st, &st->dc[c->td]);
+    c->dc_pred += jpeg_receive_extend(st, IM_MIN(t, 16));
+    coef[0] = IM_MAX(IM_MIN(c->dc_pred * q[0], JPEG_COEF_MAX), -JPEG_COEF_MAX);
+    bool dc_only = true;
+
+    if (output)
+    {
+        memset(coef + 1, 0, sizeof(coef) - sizeof(coef[0]));
+    }
+
+    for (int k = 1; k < 64;)
+    {
+        int rs = jpeg_decode_huff(st, ac);
+        int r = rs >> 4, s = rs & 0xF;
+        if (s == 0)
+        {
+            if (r != 15)
+            {
+                break; // End of block.
+            }
+            k += 16;
+            continue;
+        }
+
+        k += r;
+        int v = jpeg_receive_extend(st, s);
+        if (k > 63)
+        {
+            break;
+        }
+
+        int z = jpeg_zigzag[k];
+        if (output && v)
+        {
+            coef[z] = IM_MAX(IM_MIN(v * q[k], JPEG_COEF_MAX), -JPEG_COEF_MAX);
+            rows |= 1 << (z >> 3);
+            dc_only = false;
+        }
+        k++;
+    }
+
+    if (!output)
+    {
+        return;
+    }
+
+    if (dc_only || ((nx == 1) && (ny == 1)))
+    {
+        // Flat block, coef[0] / 8 with rounding.
+        int p = IM_MAX(IM_MIN(((coef[0] + ((coef[0] >= 0) ? 4 : -4)) / 8) + 128, 255), 0);
+        for (int y = 0; y < ny; y++)
+        {
+            memset(out + (y * stride), p, nx);
+        }
+        return;
+    }
+
+    // The even basis functions are symmetric and the odd ones antisymmetric around the
+    // middle of the block, so every pass computes two mirrored outputs at once.
+    const int16_t (*basis_x)[8] = jpeg_idct_table[c->sx];
+    const int16_t (*basis_y)[8] = jpeg_idct_table[c->sy];
+    int32_t tmp[8][8];
+
+    // Rows: tmp[v][x] = sum(coef[v][u] * basis_x[u][x]), kept with 3 fractional bits.
+    for (int v = 0; v < 8; v++)
+    {
+        if (!(rows & (1 << v)))
+        {
+            continue;
+        }
+
+        const int32_t *cv = coef + (v * 8);
+        for (int x = 0; x < ((nx + 1) / 2); x++)
+        {
+            int32_t even = (cv[0] * basis_x[0][x]) + (cv[2] * basis_x[2][x]) + (cv[4] * basis_x[4][x]) + (cv[6] * basis_x[6][x]);
+            int32_t odd = (cv[1] * basis_x[1][x]) + (cv[3] * basis_x[3][x]) + (cv[5] * basis_x[5][x]) + (cv[7] * basis_x[7][x]);
+            tmp[v][x] = (even + odd + (1 << (JPEG_IDCT_BITS - 4))) >> (JPEG_IDCT_BITS - 3);
+            tmp[v][nx - 1 - x] = (even - odd + (1 << (JPEG_IDCT_BITS - 4))) >> (JPEG_IDCT_BITS - 3);
+        }
+    }
+
+    // Columns: out[y][x] = sum(tmp[v][x] * basis_y[v][y]).
+    for (int y = 0; y < ((ny + 1) / 2); y++)
+    {
+        uint8_t *o0 = out + (y * stride);
+        uint8_t *o1 = out + ((ny - 1 - y) * stride);
+        for (int x = 0; x < nx; x++)
+        {
+            int32_t even = 0, odd = 0;
+            for (int v = 0; v < 8; v += 2)
+            {
+                if (rows & (1 << v))
+                {
+                    even += tmp[v][x] * basis_y[v][y];
+                }
+                if (rows & (2 << v))
+                {
+                    odd += tmp[v + 1][x] * basis_y[v + 1][y];
+                }
+            }
+            int p0 = ((even + odd + (1 << (JPEG_IDCT_BITS + 2))) >> (JPEG_IDCT_BITS + 3)) + 128;
+            int p1 = ((even - odd + (1 << (JPEG_IDCT_BITS + 2))) >> (JPEG_IDCT_BITS + 3)) + 128;
+            o0[x] = IM_MAX(IM_MIN(p0, 255), 0);
+            o1[x] = IM_MAX(IM_MIN(p1, 255), 0);
+        }
+    }
+}
+
+//=======================================================================================
+// Decoding
+//=======================================================================================
+/**
+ * Colour convert the pixels of the MCU at column mx into the band, upsampling the components
+ * that are still smaller than the output.
+ */
+static void jpeg_mcu_to_band(imlib_jpeg_state_t *st, int mcu_w, int mcu_h, bool gray, uint8_t *band, int band_w, int mx)
+{
+    const jpeg_comp_t *cy = &st->comp[0];
+    int stride_y = cy->h * (8 >> cy->sx);
+
+    if (gray)
+    {
+        uint8_t *b = band + (mx * mcu_w);
+        for (int y = 0; y < mcu_h; y++)
+        {
+            const uint8_t *py = cy->pix + ((y >> cy->uy) * stride_y);
+            for (int x = 0; x < mcu_w; x++)
+            {
+                b[(y * band_w) + x] = py[x >> cy->ux];
+            }
+        }
+        return;
+    }
+
+    const jpeg_comp_t *cb = &st->comp[1], *cr = &st->comp[2];
+    int stride_b = cb->h * (8 >> cb->sx), stride_r = cr->h * (8 >> cr->sx);
+    uint16_t *b = ((uint16_t *) band) + (mx * mcu_w);
+    for (int y = 0; y < mcu_h; y++)
+    {
+        const uint8_t *py = cy->pix + ((y >> cy->uy) * stride_y);
+        const uint8_t *pb = cb->pix + ((y >> cb->uy) * stride_b);
+        const uint8_t *pr = cr->pix + ((y >> cr->uy) * stride_r);
+        for (int x = 0; x < mcu_w; x++)
+        {
+            b[(y * band_w) + x] = imlib_yuv_to_rgb(py[x >> cy->ux], pb[x >> cb->ux] - 128, pr[x >> cr->ux] - 128);
+        }
+    }
+}
+
+/**
+ * Decode the image into dst, top left aligned. Pixels outside dst are dropped and parts of dst
+ * outside the image are left untouched. Only a band of one MCU row is buffered, every band is
+ * converted to dst->pixfmt and marked dirty as soon as it is decoded.
+ * @param dec: decoder set up by imlib_jpeg_dec_init(), it can only run once.
+ * @param dst: destination image, any format imlib_convert() can write.
+ * @param scale: 0 - 3, decode at 1 / (1 << scale) of the full size, see IMLIB_JPEG_SCALED_SIZE().
+ * @return: false if dst has an unsupported format, memory ran out or the stream ended early.
+ */
+bool imlib_jpeg_dec_run(imlib_jpeg_dec_t *dec, image_t *dst, int scale)
+{
+    imlib_jpeg_state_t *st = dec->state;
+    bool gray = (st != NULL) && ((st->ncomp == 1) || (dst->pixfmt == PIXFORMAT_GRAYSCALE));
+    pixformat_t band_pixfmt = gray ? PIXFORMAT_GRAYSCALE : PIXFORMAT_RGB565;
+    if ((st == NULL) || (scale < 0) || (scale > 3) || !imlib_convert_supported(band_pixfmt, dst->pixfmt))
+    {
+        return false;
+    }
+
+    jpeg_idct_table_init();
+
+    int mcus_x = (dec->w + (st->hmax * 8) - 1) / (st->hmax * 8);
+    int mcus_y = (dec->h + (st->vmax * 8) - 1) / (st->vmax * 8);
+    int out_w = IMLIB_JPEG_SCALED_SIZE(dec->w, scale);
+    int out_h = IMLIB_JPEG_SCALED_SIZE(dec->h, scale);
+    int band_h = (st->vmax * 8) >> scale;
+    int mcu_w = (st->hmax * 8) >> scale;
+    int band_w = mcus_x * mcu_w;
+    int copy_w = IM_MIN(out_w, dst->w);
+
+    uint8_t *band = (uint8_t *) malloc(band_w * band_h * (gray ? 1 : 2));
+    bool ok = band != NULL;
+    for (int i = 0; ok && (i < st->ncomp); i++)
+    {
+        // Subsampled components are scaled down less, so that they need less upsampling.
+        jpeg_comp_t *c = &st->comp[i];
+        c->sx = IM_MAX(scale - c->hs, 0);
+        c->sy = IM_MAX(scale - c->vs, 0);
+        c->ux = c->hs - (scale - c->sx);
+        c->uy = c->vs - (scale - c->sy);
+        c->pix = (uint8_t *) malloc(c->h * c->v * (8 >> c->sx) * (8 >> c->sy));
+        ok = c->pix != NULL;
+    }
+
+    int restarts_left = st->restart_interval;
+    for (int my = 0; ok && (my < mcus_y); my++)
+    {
+        for (int mx = 0; mx < mcus_x; mx++)
+        {
+            if (st->restart_interval)
+            {
+                if (restarts_left == 0)
+                {
+                    jpeg_restart(st);
+                    restarts_left = st->restart_interval;
+                }
+                restarts_left--;
+            }
+
+            for (int i = 0; i < st->ncomp; i++)
+            {
+                jpeg_comp_t *c = &st->comp[i];
+                int nx = 8 >> c->sx, ny = 8 >> c->sy;
+                bool output = !gray || (i == 0);
+                for (int by = 0; by < c->v; by++)
+                {
+                    for (int bx = 0; bx < c->h; bx++)
+                    {
+                        jpeg_decode_block(st, c, c->pix + (((by * ny) * c->h * nx) + (bx * nx)), c->h * nx, output);
+                    }
+                }
+            }
+
+            jpeg_mcu_to_band(st, mcu_w, band_h, gray, band, band_w, mx);
+        }
+
+        int y0 = my * band_h;
+        int rows = IM_MIN(IM_MIN(band_h, out_h - y0), dst->h - y0);
+        if (rows > 0)
+        {
+            int stride = IMAGE_STRIDE(dst);
+            ok = imlib_convert_strided(band, band_w * (gray ? 1 : 2), band_pixfmt, dst->data + (y0 * stride), stride, dst->pixfmt, copy_w, rows);
+            imlib_dirty_add(dst, 0, y0, copy_w, rows);
+        }
+
+        if (st->eof && (my < (mcus_y - 1)))
+        {
+            ok = false; // Truncated file.
+        }
+    }
+
+    free(band);
+    for (int i = 0; i < st->ncomp; i++)
+    {
+        free(st->comp[i].pix);
+        st->comp[i].pix = NULL;
+    }
+
+    return ok;
+}
+
+//=======================================================================================
+// Encoding
+//=======================================================================================
+#define JPEG_OUT_SIZE 4096 // Bytes of compressed data collected before each write.
+
+typedef struct jpeg_ehuff
+{
+    uint16_t code[256];
+    uint8_t size[256];
+} jpeg_ehuff_t;
+
+typedef struct jpeg_enc
+{
+    imlib_jpeg_write_t write;
+    void *ctx;
+    uint8_t out[JPEG_OUT_SIZE];
+    int out_len;
+    bool failed;
+
+    uint32_t bits; // Pending bits, the lowest nbits of them.
+    int nbits;
+
+    float fdtbl[2][64]; // Reciprocals of the scaled quantisation steps, in natural order.
+    uint8_t qt[2][64];  // In natural order.
+} jpeg_enc_t;
+
+// Quantisation tables of Annex K, for quality 50, in natural order.
+static const uint8_t jpeg_std_qt[2][64] = {
+    {
+        16, 11, 10, 16, 24,  40,  51,  61,  12, 12, 14, 19, 26,  58,  60,  55,  14, 13, 16, 24, 40,  57,  69,  56,  14, 17, 22, 29, 51,  87,  80,  62,
+        18, 22, 37, 56, 68,  109, 103, 77,  24, 35, 55, 64, 81,  104, 113, 92,  49, 64, 78, 87, 103, 121, 120, 101, 72, 92, 95, 98, 112, 100, 103, 99,
+    },
+    {
+        17, 18, 24, 47, 99, 99, 99, 99, 18, 21, 26, 66, 99, 99, 99, 99, 24, 26, 56, 99, 99, 99, 99, 99, 47, 66, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+    },
+};
+
+// Huffman tables of Annex K: code counts per length 1 - 16, then the symbols.
+static const uint8_t jpeg_std_dc_bits[2][16] = {
+    {0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0},
+    {0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0},
+};
+
+static const uint8_t jpeg_std_dc_vals[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+
+static const uint8_t jpeg_std_ac_bits[2][16] = {
+    {0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7D},
+    {0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77},
+};
+
+static const uint8_t jpeg_std_ac_vals[2][162] = {
+    {
+        0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07, 0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xA1, 0x08, 0x23, 0x42, 0xB1,
+        0xC1, 0x15, 0x52, 0xD1, 0xF0, 0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0A, 0x16, 0x17, 0x18, 0x19, 0x1A, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2A, 0x34, 0x35, 0x36, 0x37,
+        0x38, 0x39, 0x3A, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6A,
+        0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8A, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0xA2, 0xA3,
+        0xA4, 0xA5, 0xA6, 0xA7, 0xA8, 0xA9, 0xAA, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3, 0xC4, 0xC5, 0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xD2, 0xD3,
+        0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA, 0xE1, 0xE2, 0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xF1, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8, 0xF9, 0xFA,
+    },
+    {
+        0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71, 0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xA1, 0xB1, 0xC1,
+        0x09, 0x23, 0x33, 0x52, 0xF0, 0x15, 0x62, 0x72, 0xD1, 0x0A, 0x16, 0x24, 0x34, 0xE1, 0x25, 0xF1, 0x17, 0x18, 0x19, 0x1A, 0x26, 0x27, 0x28, 0x29, 0x2A, 0x35, 0x36,
+        0x37, 0x38, 0x39, 0x3A, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+        0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8A, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A,
+        0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7, 0xA8, 0xA9, 0xAA, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3, 0xC4, 0xC5, 0xC6, 0xC7, 0xC8, 0xC9, 0xCA,
+        0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA, 0xE2, 0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8, 0xF9, 0xFA,
+    },
+};
+
+// Code and length of every symbol of the fixed tables: DC luma, DC chroma, AC luma, AC chroma.
+static jpeg_ehuff_t jpeg_std_ehuff[4];
+static bool jpeg_std_ehuff_ready = false;
+
+static void jpeg_ehuff_build(jpeg_ehuff_t *huff, const uint8_t *bits, const uint8_t *vals)
+{
+    int code = 0, k = 0;
+    for (int l = 1; l <= 16; l++)
+    {
+        for (int i = 0; i < bits[l - 1]; i++, code++, k++)
+        {
+            huff->code[vals[k]] = code;
+            huff->size[vals[k]] = l;
+        }
+        code <<= 1;
+    }
+}
+
+static void jpeg_ehuff_init(void)
+{
+    if (jpeg_std_ehuff_ready)
+    {
+        return;
+    }
+
+    for (int i = 0; i < 2; i++)
+    {
+        jpeg_ehuff_build(&jpeg_std_ehuff[i], jpeg_std_dc_bits[i], jpeg_std_dc_vals);
+        jpeg_ehuff_build(&jpeg_std_ehuff[2 + i], jpeg_std_ac_bits[i], jpeg_std_ac_vals[i]);
+    }
+
+    jpeg_std_ehuff_ready = true;
+}
+
+static void jpeg_flush_out(jpeg_enc_t *enc)
+{
+    if ((enc->out_len > 0) && !enc->failed)
+    {
+        enc->failed = enc->write(enc->ctx, enc->out, enc->out_len) != enc->out_len;
+    }
+    enc->out_len = 0;
+}
+
+static inline void jpeg_put_byte(jpeg_enc_t *enc, uint8_t b)
+{
+    enc->out[enc->out_len++] = b;
+    if (enc->out_len == JPEG_OUT_SIZE)
+    {
+        jpeg_flush_out(enc);
+    }
+}
+
+static void jpeg_put_u16(jpeg_enc_t *enc, int v)
+{
+    jpeg_put_byte(enc, v >> 8);
+    jpeg_put_byte(enc, v & 0xFF);
+}
+
+/**
+ * Append the lowest size bits of code to the entropy coded data, stuffing a zero after every 0xFF.
+ */
+static inline void jpeg_put_bits(jpeg_enc_t *enc, uint32_t code, int size)
+{
+    enc->bits = (enc->bits << size) | (code & ((1u << size) - 1));
+    enc->nbits += size;
+
+    while (enc->nbits >= 8)
+    {
+        uint8_t b = enc->bits >> (enc->nbits - 8);
+        jpeg_put_byte(enc, b);
+        if (b == 0xFF)
+        {
+            jpeg_put_byte(enc, 0);
+        }
+        enc->nbits -= 8;
+    }
+}
+
+static void jpeg_write_headers(jpeg_enc_t *enc, const image_t *src, int ncomp, int h, int v)
+{
+    static const uint8_t jfif[] = {0xFF, 0xD8, 0xFF, 0xE0, 0x00, 0x10, 'J', 'F', 'I', 'F', 0x00, 0x01, 0x01, 0x00, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00};
+    for (size_t i = 0; i < sizeof(jfif); i++)
+    {
+        jpeg_put_byte(enc, jfif[i]);
+    }
+
+    int tables = (ncomp == 1) ? 1 : 2;
+    for (int t = 0; t < tables; t++)
+    {
+        jpeg_put_u16(enc, 0xFFDB);
+        jpeg_put_u16(enc, 2 + 65);
+        jpeg_put_byte(enc, t);
+        for (int k = 0; k < 64; k++)
+        {
+            jpeg_put_byte(enc, enc->qt[t][jpeg_zigzag[k]]);
+        }
+    }
+
+    jpeg_put_u16(enc, 0xFFC0);
+    jpeg_put_u16(enc, 8 + (3 * ncomp));
+    jpeg_put_byte(enc, 8);
+    jpeg_put_u16(enc, src->h);
+    jpeg_put_u16(enc, src->w);
+    jpeg_put_byte(enc, ncomp);
+    for (int i = 0; i < ncomp; i++)
+    {
+        jpeg_put_byte(enc, i + 1);
+        jpeg_put_byte(enc, (i == 0) ? ((h << 4) | v) : 0x11);
+        jpeg_put_byte(enc, (i == 0) ? 0 : 1);
+    }
+
+    for (int t = 0; t < tables; t++)
+    {
+        int dc_count = 0, ac_count = 0;
+        for (int l = 0; l < 16; l++)
+        {
+            dc_count += jpeg_std_dc_bits[t][l];
+            ac_count += jpeg_std_ac_bits[t][l];
+        }
+
+        jpeg_put_u16(enc, 0xFFC4);
+        jpeg_put_u16(enc, 2 + 17 + dc_count + 17 + ac_count);
+        jpeg_put_byte(enc, 0x00 | t);
+        for (int l = 0; l < 16; l++)
+        {
+            jpeg_put_byte(enc, jpeg_std_dc_bits[t][l]);
+        }
+        for (int i = 0; i < dc_count; i++)
+        {
+            jpeg_put_byte(enc, jpeg_std_dc_vals[i]);
+        }
+        jpeg_put_byte(enc, 0x10 | t);
+        for (int l = 0; l < 16; l++)
+        {
+            jpeg_put_byte(enc, jpeg_std_ac_bits[t][l]);
+        }
+        for (int i = 0; i < ac_count; i++)
+        {
+            jpeg_put_byte(enc, jpeg_std_ac_vals[t][i]);
+        }
+    }
+
+    jpeg_put_u16(enc, 0xFFDA);
+    jpeg_put_u16(enc, 6 + (2 * ncomp));
+    jpeg_put_byte(enc, ncomp);
+    for (int i = 0; i < ncomp; i++)
+    {
+        jpeg_put_byte(enc, i + 1);
+        jpeg_put_byte(enc, (i == 0) ? 0x00 : 0x11);
+    }
+    jpeg_put_byte(enc, 0);
+    jpeg_put_byte(enc, 63);
+    jpeg_put_byte(enc, 0);
+}
+
+/**
+ * Scale the standard tables to a quality, as libjpeg does, and fold the AAN DCT output scaling
+ * into their reciprocals.
+ */
+static void jpeg_set_quality(jpeg_enc_t *enc, int quality)
+{
+    static const float aan[8] = {1.0f, 1.387039845f, 1.306562965f, 1.175875602f, 1.0f, 0.785694958f, 0.541196100f, 0.275899379f};
+    quality = IM_MAX(IM_MIN(quality, 100), 1);
+    int scale = (quality < 50) ? (5000 / quality) : (200 - (quality * 2));
+
+    for (int t = 0; t < 2; t++)
+    {
+        for (int i = 0; i < 64; i++)
+        {
+            int q = ((jpeg_std_qt[t][i] * scale) + 50) / 100;
+            enc->qt[t][i] = IM_MAX(IM_MIN(q, 255), 1);
+            enc->fdtbl[t][i] = 1.0f / (enc->qt[t][i] * aan[i >> 3] * aan[i & 7] * 8.0f);
+        }
+    }
+}
+
+/**
+ * AAN forward DCT of 8 values, spaced step apart. The outputs are scaled by the aan[] factors.
+ */
+static inline void jpeg_fdct8(float *d, int step)
+{
+    float tmp0 = d[0 * step] + d[7 * step];
+    float tmp7 = d[0 * step] - d[7 * step];
+    float tmp1 = d[1 * step] + d[6 * step];
+    float tmp6 = d[1 * step] - d[6 * step];
+    float tmp2 = d[2 * step] + d[5 * step];
+    float tmp5 = d[2 * step] - d[5 * step];
+    float tmp3 = d[3 * step] + d[4 * step];
+    float tmp4 = d[3 * step] - d[4 * step];
+
+    // Even part.
+    float tmp10 = tmp0 + tmp3;
+    float tmp13 = tmp0 - tmp3;
+    float tmp11 = tmp1 + tmp2;
+    float tmp12 = tmp1 - tmp2;
+    d[0 * step] = tmp10 + tmp11;
+    d[4 * step] = tmp10 - tmp11;
+    float z1 = (tmp12 + tmp13) * 0.707106781f;
+    d[2 * step] = tmp13 + z1;
+    d[6 * step] = tmp13 - z1;
+
+    // Odd part.
+    tmp10 = tmp4 + tmp5;
+    tmp11 = tmp5 + tmp6;
+    tmp12 = tmp6 + tmp7;
+    float z5 = (tmp10 - tmp12) * 0.382683433f;
+    float z2 = (0.541196100f * tmp10) + z5;
+    float z4 = (1.306562965f * tmp12) + z5;
+    float z3 = tmp11 * 0.707106781f;
+    float z11 = tmp7 + z3;
+    float z13 = tmp7 - z3;
+    d[5 * step] = z13 + z2;
+    d[3 * step] = z13 - z2;
+    d[1 * step] = z11 + z4;
+    d[7 * step] = z11 - z4;
+}
+
+static void jpeg_encode_block(jpeg_enc_t *enc, const uint8_t *p, int stride, int t, int *dc_pred)
+{
+    float d[64];
+    for (int y = 0; y < 8; y++)
+    {
+        for (int x = 0; x < 8; x++)
+        {
+            d[(y * 8) + x] = p[(y * stride) + x] - 128.0f;
+        }
+    }
+
+    for (int i = 0; i < 8; i++)
+    {
+        jpeg_fdct8(d + (i * 8), 1);
+    }
+    for (int i = 0; i < 8; i++)
+    {
+        jpeg_fdct8(d + i, 8);
+    }
+
+    int q[64];
+    int last = 0;
+    for (int k = 0; k < 64; k++)
+    {
+        int z = jpeg_zigzag[k];
+        float v = d[z] * enc->fdtbl[t][z];
+        q[k] = (int) (v + ((v >= 0) ? 0.5f : -0.5f));
+        if (q[k])
+        {
+            last = k;
+        }
+    }
+
+    const jpeg_ehuff_t *dc = &jpeg_std_ehuff[t];
+    const jpeg_ehuff_t *ac = &jpeg_std_ehuff[2 + t];
+
+    // Values are sent as a magnitude category followed by that many bits, negative ones minus one.
+    int diff = q[0] - *dc_pred;
+    *dc_pred = q[0];
+    int size = diff ? (32 - __builtin_clz(abs(diff))) : 0;
+    jpeg_put_bits(enc, dc->code[size], dc->size[size]);
+    if (size)
+    {
+        jpeg_put_bits(enc, (diff < 0) ? (diff - 1) : diff, size);
+    }
+
+    int run = 0;
+    for (int k = 1; k <= last; k++)
+    {
+        if (q[k] == 0)
+        {
+            run++;
+            continue;
+        }
+
+        for (; run >= 16; run -= 16)
+        {
+            jpeg_put_bits(enc, ac->code[0xF0], ac->size[0xF0]);
+        }
+
+        size = 32 - __builtin_clz(abs(q[k]));
+        int rs = (run << 4) | size;
+        jpeg_put_bits(enc, ac->code[rs], ac->size[rs]);
+        jpeg_put_bits(enc, (q[k] < 0) ? (q[k] - 1) : q[k], size);
+        run = 0;
+    }
+
+    if (last < 63)
+    {
+        jpeg_put_bits(enc, ac->code[0x00], ac->size[0x00]);
+    }
+}
+
+/**
+ * Fill the planes of one MCU row from src rows y0 onwards. The right and bottom edges are
+ * extended by repeating the last column and row.
+ * @param pw: padded width of the Y plane, the chroma planes are pw >> hs wide.
+ */
+static void jpeg_fill_strip(const image_t *src, int y0, int mcu_h, int pw, int hs, int vs, uint8_t *py, uint8_t *pcb, uint8_t *pcr)
+{
+    int last_x = src->w - 1;
+
+    for (int r = 0; r < mcu_h; r++)
+    {
+        int y = IM_MIN(y0 + r, src->h - 1);
+        uint8_t *dy = py + (r * pw);
+        switch (src->pixfmt)
+        {
+            case PIXFORMAT_GRAYSCALE:
+                {
+                    const uint8_t *s = IMAGE_COMPUTE_GRAYSCALE_PIXEL_ROW_PTR(src, y);
+                    memcpy(dy, s, src->w);
+                    memset(dy + src->w, s[last_x], pw - src->w);
+                    break;
+                }
+            case PIXFORMAT_RGB565:
+                {
+                    const uint16_t *s = IMAGE_COMPUTE_RGB565_PIXEL_ROW_PTR(src, y);
+                    for (int x = 0; x < pw; x++)
+                    {
+                        uint16_t p = s[IM_MIN(x, last_x)];
+                        int r8 = COLOR_RGB565_TO_R8(p), g8 = COLOR_RGB565_TO_G8(p), b8 = COLOR_RGB565_TO_B8(p);
+                        dy[x] = ((19595 * r8) + (38470 * g8) + (7471 * b8) + 32768) >> 16;
+                    }
+                    break;
+                }
+            default:
+                {
+                    const uint16_t *s = IMAGE_COMPUTE_YUV_PIXEL_ROW_PTR(src, y);
+                    for (int x = 0; x < pw; x++)
+                    {
+                        dy[x] = s[IM_MIN(x, last_x)] & 0xFF;
+                    }
+                    break;
+                }
+        }
+    }
+
+    if (pcb == NULL)
+    {
+        return;
+    }
+
+    int cw = pw >> hs;
+    for (int r = 0; r < (mcu_h >> vs); r++)
+    {
+        uint8_t *db = pcb + (r * cw), *dr = pcr + (r * cw);
+        if (src->pixfmt == PIXFORMAT_RGB565)
+        {
+            // Chroma of the average of a 2x2 square, computed from the sums of its four pixels.
+            const uint16_t *s0 = IMAGE_COMPUTE_RGB565_PIXEL_ROW_PTR(src, IM_MIN(y0 + (2 * r), src->h - 1));
+            const uint16_t *s1 = IMAGE_COMPUTE_RGB565_PIXEL_ROW_PTR(src, IM_MIN(y0 + (2 * r) + 1, src->h - 1));
+            for (int x = 0; x < cw; x++)
+            {
+                int xa = IM_MIN(2 * x, last_x), xb = IM_MIN((2 * x) + 1, last_x);
+                uint16_t p[4] = {s0[xa], s0[xb], s1[xa], s1[xb]};
+                int r4 = 0, g4 = 0, b4 = 0;
+                for (int i = 0; i < 4; i++)
+                {
+                    r4 += COLOR_RGB565_TO_R8(p[i]);
+                    g4 += COLOR_RGB565_TO_G8(p[i]);
+                    b4 += COLOR_RGB565_TO_B8(p[i]);
+                }
+                db[x] = ((-11059 * r4) - (21709 * g4) + (32768 * b4) + (128 << 18) + (1 << 17)) >> 18;
+                dr[x] = ((32768 * r4) - (27439 * g4) - (5329 * b4) + (128 << 18) + (1 << 17)) >> 18;
+            }
+        }
+        else
+        {
+            // YUV422 already has one chroma pair per two pixels, an odd last pixel has a neutral V.
+            const uint16_t *s = IMAGE_COMPUTE_YUV_PIXEL_ROW_PTR(src, IM_MIN(y0 + r, src->h - 1));
+            bool yvu = src->pixfmt == PIXFORMAT_YVU422;
+            for (int x = 0; x < cw; x++)
+            {
+                int xe = 2 * IM_MIN(x, last_x / 2);
+                uint8_t c0 = s[xe] >> 8;
+                uint8_t c1 = ((xe + 1) <= last_x) ? (s[xe + 1] >> 8) : 128;
+                db[x] = yvu ? c1 : c0;
+                dr[x] = yvu ? c0 : c1;
+            }
+        }
+    }
+}
+
+/**
+ * Encode an image as a baseline JPEG, an MCU row at a time. Compressed data goes to the write
+ * callback in chunks of a few KB, so the bitstream is never held in memory. RGB565 is encoded
+ * with 4:2:0 chroma, YUV422 and YVU422 with their own 4:2:2 chroma and GRAYSCALE as one component.
+ * The fixed Huffman tables of the standard are used, so there is no statistics pass.
+ * @param src: image to encode.
+ * @param quality: 1 - 100, as in libjpeg.
+ * @param write: callback that writes len bytes from buf and returns how many it wrote.
+ * @param ctx: passed to write.
+ * @return: false if the format is not supported, memory ran out or a write failed.
+ */
+bool imlib_jpeg_encode(const image_t *src, int quality, imlib_jpeg_write_t write, void *ctx)
+{
+    int ncomp, h, v;
+    switch (src->pixfmt)
+    {
+        case PIXFORMAT_GRAYSCALE:
+            {
+                ncomp = 1, h = 1, v = 1;
+                break;
+            }
+        case PIXFORMAT_RGB565:
+            {
+                ncomp = 3, h = 2, v = 2;
+                break;
+            }
+        case PIXFORMAT_YUV422:
+        case PIXFORMAT_YVU422:
+            {
+                ncomp = 3, h = 2, v = 1;
+                break;
+            }
+        default:
+            {
+                return false;
+            }
+    }
+
+    if ((src->w <= 0) || (src->h <= 0) || (src->w > 65535) || (src->h > 65535))
+    {
+        return false;
+    }
+
+    int mcu_w = h * 8, mcu_h = v * 8;
+    int mcus_x = (src->w + mcu_w - 1) / mcu_w;
+    int pw = mcus_x * mcu_w;
+    int cw = (ncomp == 3) ? (pw / h) : 0;
+    int ch = 8;
+
+    jpeg_enc_t *enc = (jpeg_enc_t *) malloc(sizeof(jpeg_enc_t) + (pw * mcu_h) + (2 * cw * ch));
+    if (enc == NULL)
+    {
+        return false;
+    }
+
+    uint8_t *py = (uint8_t *) (enc + 1);
+    uint8_t *pcb = (ncomp == 3) ? (py + (pw * mcu_h)) : NULL;
+    uint8_t *pcr = (ncomp == 3) ? (pcb + (cw * ch)) : NULL;
+
+    enc->write = write;
+    enc->ctx = ctx;
+    enc->out_len = 0;
+    enc->failed = false;
+    enc->bits = 0;
+    enc->nbits = 0;
+    jpeg_ehuff_init();
+    jpeg_set_quality(enc, quality);
+    jpeg_write_headers(enc, src, ncomp, h, v);
+
+    int dc_pred[3] = {0, 0, 0};
+    for (int y0 = 0; (y0 < src->h) && !enc->failed; y0 += mcu_h)
+    {
+        jpeg_fill_strip(src, y0, mcu_h, pw, h - 1, v - 1, py, pcb, pcr);
+
+        for (int mx = 0; mx < mcus_x; mx++)
+        {
+            for (int by = 0; by < v; by++)
+            {
+                for (int bx = 0; bx < h; bx++)
+                {
+                    jpeg_encode_block(enc, py + (by * 8 * pw) + (mx * mcu_w) + (bx * 8), pw, 0, &dc_pred[0]);
+                }
+            }
+
+            if (ncomp == 3)
+            {
+                jpeg_encode_block(enc, pcb + (mx * 8), cw, 1, &dc_pred[1]);
+                jpeg_encode_block(enc, pcr + (mx * 8), cw, 1, &dc_pred[2]);
+            }
+        }
+    }
+
+    // Pad the last byte with ones and end the image.
+    jpeg_put_bits(enc, 0x7F, 7);
+    jpeg_put_u16(enc, 0xFFD9);
+    jpeg_flush_out(enc);
+
+    bool ok = !enc->failed;
+    free(enc);
+    return ok;
+}
@@ -0,0 +1,128 @@
+/*****************************************************************************
+ lab table
+
+ RGB565 to CIE L*a*b* conversion. The 96 KB lookup table is generated into
+ PSRAM the first time it is needed instead of being stored in flash.
+ Like the OpenMV table it drops the least significant bit of blue, so it is
+ indexed with (pixel >> 1).
+
+*****************************************************************************/
+#include "imlib.h"
+#include <math.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "esp_heap_caps.h"
+
+#define LAB_TABLE_ENTRIES 32768
+
+int8_t *lab_table = NULL;
+
+static pthread_once_t lab_table_once = PTHREAD_ONCE_INIT;
+
+/**
+ * sRGB gamma expansion of an 8-bit channel, scaled to 0 - 100.
+ */
+static float lab_linearise(int c8)
+{
+    float c = c8 / 255.0f;
+    return 100.0f * ((c <= 0.04045f) ? (c / 12.92f) : powf((c + 0.055f) / 1.055f, 2.4f));
+}
+
+static inline float lab_f(float t)
+{
+    return (t > 0.008856f) ? cbrtf(t) : ((t * 7.787037f) + 0.137931f);
+}
+
+/**
+ * Convert linear RGB (0 - 100) to L*a*b*, clamped to the ranges of the int8_t table.
+ */
+static void lab_from_linear(float r, float g, float b, int8_t *lab)
+{
+    float x = lab_f(((r * 0.4124f) + (g * 0.3576f) + (b * 0.1805f)) / 95.047f);
+    float y = lab_f(((r * 0.2126f) + (g * 0.7152f) + (b * 0.0722f)) / 100.0f);
+    float z = lab_f(((r * 0.0193f) + (g * 0.1192f) + (b * 0.9505f)) / 108.883f);
+
+    lab[0] = IM_MAX(IM_MIN((int) lroundf((116 * y) - 16), COLOR_L_MAX), COLOR_L_MIN);
+    lab[1] = IM_MAX(IM_MIN((int) lroundf(500 * (x - y)), COLOR_A_MAX), COLOR_A_MIN);
+    lab[2] = IM_MAX(IM_MIN((int) lroundf(200 * (y - z)), COLOR_B_MAX), COLOR_B_MIN);
+}
+
+static void lab_table_generate(void)
+{
+    int8_t *table = (int8_t *) heap_caps_malloc(LAB_TABLE_ENTRIES * 3, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (table == NULL)
+    {
+        table = (int8_t *) malloc(LAB_TABLE_ENTRIES * 3);
+        if (table == NULL)
+        {
+            return;
+        }
+    }
+
+    // Gamma expansion only depends on one channel, so it is computed once per channel value.
+    float r_lin[32], g_lin[64], b_lin[32];
+    for (int i = 0; i < 64; i++)
+    {
+        g_lin[i] = lab_linearise((i << 2) | (i >> 4));
+        if (i < 32)
+        {
+            r_lin[i] = b_lin[i] = lab_linearise((i << 3) | (i >> 2));
+        }
+    }
+
+    for (int i = 0; i < LAB_TABLE_ENTRIES; i++)
+    {
+        // i is the pixel shifted right by one: RRRRRGGGGGGBBBB. The dropped blue bit is
+        // replaced by the top one so that the blue range still ends at 0 and 31.
+        lab_from_linear(r_lin[i >> 10], g_lin[(i >> 4) & 0x3F], b_lin[((i & 0xF) << 1) | ((i >> 3) & 1)], table + (i * 3));
+    }
+
+    lab_table = table;
+}
+
+/**
+ * Generate the RGB565 to LAB table if it does not exist yet. Safe to call from several threads.
+ * Needed before the COLOR_RGB565_TO_L/A/B macros are used with IMLIB_ENABLE_LAB_LUT defined.
+ * @return: false if there was not enough memory for the table.
+ */
+bool imlib_lab_table_init(void)
+{
+    pthread_once(&lab_table_once, lab_table_generate);
+    return lab_table != NULL;
+}
+
+int8_t imlib_rgb565_to_l(uint16_t pixel)
+{
+    if (imlib_lab_table_init())
+    {
+        return lab_table[((pixel >> 1) * 3) + 0];
+    }
+
+    int8_t lab[3];
+    lab_from_linear(lab_linearise(COLOR_RGB565_TO_R8(pixel)), lab_linearise(COLOR_RGB565_TO_G8(pixel)), lab_linearise(COLOR_RGB565_TO_B8(pixel)), lab);
+    return lab[0];
+}
+
+int8_t imlib_rgb565_to_a(uint16_t pixel)
+{
+    if (imlib_lab_table_init())
+    {
+        return lab_table[((pixel >> 1) * 3) + 1];
+    }
+
+    int8_t lab[3];
+    lab_from_linear(lab_linearise(COLOR_RGB565_TO_R8(pixel)), lab_linearise(COLOR_RGB565_TO_G8(pixel)), lab_linearise(COLOR_RGB565_TO_B8(pixel)), lab);
+    return lab[1];
+}
+
+int8_t imlib_rgb565_to_b(uint16_t pixel)
+{
+    if (imlib_lab_table_init())
+    {
+        return lab_table[((pixel >> 1) * 3) + 2];
+    }
+
+    int8_t lab[3];
+    lab_from_linear(lab_linearise(COLOR_RGB565_TO_R8(pixel)), lab_linearise(COLOR_RGB565_TO_G8(pixel)), lab_linearise(COLOR_RGB565_TO_B8(pixel)), lab);
+    return lab[2];
+}
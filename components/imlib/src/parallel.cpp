@@ -0,0 +1,263 @@
+/*****************************************************************************
+ parallel
+
+ Multi-core execution of display lists. The tiles of the image are dealt out
+ round-robin to one worker per core, every worker draws into its own copy of
+ the image_t header (so that it has its own clip) and the caller joins them.
+ Tiles never share pixels, so the result is identical to imlib_dlist_execute().
+
+ Row kernels such as resizing use imlib_parallel_bands() instead, which gives
+ every thread one contiguous band of output rows.
+
+ Built on pthreads so that it also runs, and can be benchmarked, on a host.
+ On the ESP32-P4 the workers are pinned to the cores with esp_pthread. A
+ worker that cannot be created, or its bookkeeping allocated, is not an
+ error: its share of the work is done on the calling thread instead.
+
+*****************************************************************************/
+#include "imlib.h"
+#include <algorithm>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#ifdef ESP_PLATFORM
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "esp_cpu.h"
+#include "esp_pthread.h"
+#else
+#include <unistd.h>
+#endif
+
+// Stack of a worker thread, in bytes. The deepest display list command, scaled text, needs about
+// 4 KB on a 64-bit host, less on the 32-bit cores.
+#define IMLIB_PARALLEL_STACK_SIZE 8192
+
+/**
+ * Start a thread on another core than the caller, at the priority of the caller. The esp_pthread
+ * configuration of the caller is left as it was.
+ * @param i: 1 for the first worker, 2 for the second...
+ * @return: false if the thread could not be created.
+ */
+static bool parallel_start(pthread_t *thread, int i, void *(*run)(void *), void *arg)
+{
+    size_t stack_size = IMLIB_PARALLEL_STACK_SIZE;
+#ifdef ESP_PLATFORM
+    // Spread the workers over the other cores first.
+    esp_pthread_cfg_t saved;
+    bool restore = esp_pthread_get_cfg(&saved) == ESP_OK;
+    esp_pthread_cfg_t cfg = esp_pthread_get_default_config();
+    cfg.stack_size = stack_size;
+    cfg.prio = uxTaskPriorityGet(NULL);
+    cfg.pin_to_core = (esp_cpu_get_core_id() + i) % CONFIG_FREERTOS_NUMBER_OF_CORES;
+    esp_pthread_set_cfg(&cfg);
+#else
+    (void) i;
+    stack_size = std::max(stack_size, (size_t) PTHREAD_STACK_MIN);
+#endif
+
+    pthread_attr_t attr;
+    bool ok = pthread_attr_init(&attr) == 0;
+    if (ok)
+    {
+        ok = (pthread_attr_setstacksize(&attr, stack_size) == 0) && (pthread_create(thread, &attr, run, arg) == 0);
+        pthread_attr_destroy(&attr);
+    }
+
+#ifdef ESP_PLATFORM
+    // A caller without a configuration of its own was using the defaults.
+    if (!restore)
+    {
+        saved = esp_pthread_get_default_config();
+    }
+    esp_pthread_set_cfg(&saved);
+#endif
+    return ok;
+}
+
+/**
+ * Get the number of threads to use when the caller asks for all cores.
+ */
+static int parallel_cores(void)
+{
+#ifdef ESP_PLATFORM
+    return CONFIG_FREERTOS_NUMBER_OF_CORES;
+#else
+    return std::max((int) sysconf(_SC_NPROCESSORS_ONLN), 1);
+#endif
+}
+
+typedef struct parallel_tiles
+{
+    pthread_t thread;
+    bool started;
+    const imlib_dlist_t *list;
+    const imlib_dlist_bins_t *bins;
+    image_t img;         // Private copy of the target image header.
+    imlib_dirty_t dirty; // Private damage tracking, used if the target is tracked.
+    int first;           // Tiles first, first + step, ... are drawn.
+    int step;
+} parallel_tiles_t;
+
+/**
+ * Draw the tiles of one worker.
+ */
+static void *parallel_tiles_run(void *arg)
+{
+    parallel_tiles_t *w = (parallel_tiles_t *) arg;
+    bool tracked = w->img.dirty != NULL;
+    w->img.dirty = NULL;
+    if (tracked)
+    {
+        // Private damage stays in the coordinates of img, the merge moves it into the parent of a view.
+        w->img.origin = point_t {0, 0};
+        imlib_dirty_enable(&w->img, &w->dirty);
+    }
+
+    for (int t = w->first; t < w->bins->tiles; t += w->step)
+    {
+        imlib_dlist_execute_tile(w->list, w->bins, &w->img, t);
+    }
+
+    return NULL;
+}
+
+/**
+ * Draw all recorded commands into an image using several threads. The calling thread is one of
+ * them. The output, including the dirty areas, does not depend on the thread timing.
+ * @param list: recorded commands.
+ * @param img: target image, an existing img->clip is respected.
+ * @param threads: number of threads to draw with, 1 or less draws on the calling thread only.
+ */
+extern "C" void imlib_dlist_execute_parallel(const imlib_dlist_t *list, image_t *img, int threads)
+{
+    if ((threads <= 1) || (list->count == 0) || (img->w <= 0) || (img->h <= 0))
+    {
+        imlib_dlist_execute(list, img);
+        return;
+    }
+
+    imlib_dlist_bins_t bins;
+    if (!imlib_dlist_bin(list, img, &bins))
+    {
+        imlib_dlist_execute(list, img);
+        return;
+    }
+
+    threads = std::min(threads, bins.tiles);
+    parallel_tiles_t *workers = (parallel_tiles_t *) calloc(threads, sizeof(parallel_tiles_t));
+    if (workers == NULL)
+    {
+        imlib_dlist_bins_free(&bins);
+        imlib_dlist_execute(list, img);
+        return;
+    }
+
+    for (int i = 0; i < threads; i++)
+    {
+        workers[i].list = list;
+        workers[i].bins = &bins;
+        workers[i].img = *img;
+        workers[i].first = i;
+        workers[i].step = threads;
+    }
+
+    for (int i = 1; i < threads; i++)
+    {
+        workers[i].started = parallel_start(&workers[i].thread, i, parallel_tiles_run, &workers[i]);
+    }
+
+    parallel_tiles_run(&workers[0]);
+
+    for (int i = 1; i < threads; i++)
+    {
+        if (workers[i].started)
+        {
+            pthread_join(workers[i].thread, NULL);
+        }
+        else
+        {
+            parallel_tiles_run(&workers[i]);
+        }
+    }
+
+    // Merge the damage of the workers in a fixed order.
+    for (int i = 0; (img->dirty != NULL) && (i < threads); i++)
+    {
+        const imlib_dirty_t *d = &workers[i].dirty;
+        for (int j = 0; j < d->count; j++)
+        {
+            imlib_dirty_add(img, d->rects[j].x, d->rects[j].y, d->rects[j].w, d->rects[j].h);
+        }
+    }
+
+    free(workers);
+    imlib_dlist_bins_free(&bins);
+}
+
+typedef struct parallel_band
+{
+    pthread_t thread;
+    bool started;
+    imlib_band_fn_t fn;
+    void *ctx;
+    int y0, y1;
+    bool ok;
+} parallel_band_t;
+
+static void *parallel_band_run(void *arg)
+{
+    parallel_band_t *b = (parallel_band_t *) arg;
+    b->ok = b->fn(b->ctx, b->y0, b->y1);
+    return NULL;
+}
+
+/**
+ * Split the rows [0, rows) into one contiguous band per thread and run fn on every band. The
+ * calling thread takes the first band.
+ * @param threads: number of threads, 0 or less for one per core.
+ * @param fn: called as fn(ctx, y0, y1) for the rows [y0, y1), it returns false on failure.
+ * @return: false if any band failed.
+ */
+extern "C" bool imlib_parallel_bands(int rows, int threads, imlib_band_fn_t fn, void *ctx)
+{
+    threads = std::min((threads <= 0) ? parallel_cores() : threads, rows);
+    parallel_band_t *bands = (threads > 1) ? (parallel_band_t *) calloc(threads, sizeof(parallel_band_t)) : NULL;
+    if (bands == NULL)
+    {
+        return fn(ctx, 0, std::max(rows, 0));
+    }
+
+    for (int i = 0; i < threads; i++)
+    {
+        bands[i].fn = fn;
+        bands[i].ctx = ctx;
+        bands[i].y0 = (rows * i) / threads;
+        bands[i].y1 = (rows * (i + 1)) / threads;
+    }
+
+    for (int i = 1; i < threads; i++)
+    {
+        bands[i].started = parallel_start(&bands[i].thread, i, parallel_band_run, &bands[i]);
+    }
+
+    parallel_band_run(&bands[0]);
+
+    bool ok = bands[0].ok;
+    for (int i = 1; i < threads; i++)
+    {
+        if (bands[i].started)
+        {
+            pthread_join(bands[i].thread, NULL);
+        }
+        else
+        {
+            parallel_band_run(&bands[i]);
+        }
+        ok = ok && bands[i].ok;
+    }
+
+    free(bands);
+    return ok;
+}
@@ -0,0 +1,542 @@
+/*****************************************************************************
+ resize
+
+ Nearest, bilinear and area average scaling of GRAYSCALE, RGB565 and
+ YUV422/YVU422 images. Source positions are stepped in 16.16 fixed point
+ once per output column and row into tables, so the row kernels are plain
+ table lookups. Bilinear filters every needed source row horizontally once
+ and blends pairs of those rows vertically. Large outputs are split into
+ bands of rows that run on all cores.
+
+*****************************************************************************/
+#include "imlib.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define RESIZE_FRAC_BITS 8 // Precision of the bilinear weights.
+#define RESIZE_FRAC_ONE (1 << RESIZE_FRAC_BITS)
+
+typedef struct resize_ctx
+{
+    const image_t *src;
+    image_t *dst;
+    imlib_resize_t mode;
+    int channels; // 1 for GRAYSCALE, 2 for Y and chroma, 3 for RGB565.
+    // Per output column. Nearest: source column. Bilinear: left column and weight of the right one.
+    // Area: first source column, x0[x + 1] is the end.
+    int *x0;
+    uint8_t *fx;
+    // The same per output row.
+    int *y0;
+    uint8_t *fy;
+} resize_ctx_t;
+
+/**
+ * Step source positions for n output pixels in 16.16 fixed point. Pixel centres are aligned:
+ * output pixel i samples source position (i + 0.5) * src_n / n - 0.5.
+ * @param pos: source pixel per output pixel, clamped to the source.
+ * @param frac: weight of the next source pixel, NULL rounds to the nearest pixel instead.
+ */
+static void resize_step(int src_n, int n, int *pos, uint8_t *frac)
+{
+    // The remainder of the step is carried like a Bresenham error term so that the positions
+    // do not drift on long rows.
+    int32_t step = (int32_t) (((int64_t) src_n << 16) / n);
+    int32_t rem = (int32_t) (((int64_t) src_n << 16) % n);
+    int32_t p = (int32_t) (((int64_t) src_n << 15) / n) - ((frac != NULL) ? 0x8000 : 0);
+    int32_t err = (int32_t) (((int64_t) src_n << 15) % n);
+
+    for (int i = 0; i < n; i++, p += step, err += rem)
+    {
+        if (err >= n)
+        {
+            p++;
+            err -= n;
+        }
+
+        if (frac == NULL)
+        {
+            pos[i] = IM_MIN(IM_MAX(p, 0) >> 16, src_n - 1);
+            continue;
+        }
+
+        // Round to the nearest weight step rather than truncating.
+        int32_t q = (IM_MAX(p, 0) + (1 << (15 - RESIZE_FRAC_BITS))) >> (16 - RESIZE_FRAC_BITS);
+        int s = q >> RESIZE_FRAC_BITS;
+        if (s >= (src_n - 1))
+        {
+            pos[i] = src_n - 1;
+            frac[i] = 0;
+        }
+        else
+        {
+            pos[i] = s;
+            frac[i] = q & (RESIZE_FRAC_ONE - 1);
+        }
+    }
+}
+
+/**
+ * Box boundaries of an area downscale, n + 1 entries. Output pixel i averages [pos[i], pos[i + 1]).
+ * These are exact so that integer downscales get boxes of exactly the same size.
+ */
+static void resize_boxes(int src_n, int n, int *pos)
+{
+    for (int i = 0; i <= n; i++)
+    {
+        pos[i] = (int) (((int64_t) i * src_n) / n);
+    }
+}
+
+/**
+ * Chroma of source pixel x of a YUV422 row for an output pixel that stores the chroma of the
+ * even or odd pixel of a pair. YVU422 only swaps which of U and V that is, so both orders
+ * take the chroma from the pixel of the same parity. An odd last pixel has no pair, it is neutral.
+ */
+static inline int resize_yuv_chroma(const uint16_t *s, int w, int x, bool odd)
+{
+    int i = odd ? (x | 1) : (x & ~1);
+    return (i < w) ? (s[i] >> 8) : 128;
+}
+
+//=======================================================================================
+// Nearest
+//=======================================================================================
+static bool resize_nearest(resize_ctx_t *c, int y0, int y1)
+{
+    const image_t *src = c->src;
+    image_t *dst = c->dst;
+
+    for (int y = y0; y < y1; y++)
+    {
+        int sy = c->y0[y];
+        switch (src->pixfmt)
+        {
+            case PIXFORMAT_GRAYSCALE:
+                {
+                    const uint8_t *s = IMAGE_COMPUTE_GRAYSCALE_PIXEL_ROW_PTR(src, sy);
+                    uint8_t *d = IMAGE_COMPUTE_GRAYSCALE_PIXEL_ROW_PTR(dst, y);
+                    for (int x = 0; x < dst->w; x++)
+                    {
+                        d[x] = s[c->x0[x]];
+                    }
+                    break;
+                }
+            case PIXFORMAT_RGB565:
+                {
+                    const uint16_t *s = IMAGE_COMPUTE_RGB565_PIXEL_ROW_PTR(src, sy);
+                    uint16_t *d = IMAGE_COMPUTE_RGB565_PIXEL_ROW_PTR(dst, y);
+                    for (int x = 0; x < dst->w; x++)
+                    {
+                        d[x] = s[c->x0[x]];
+                    }
+                    break;
+                }
+            default:
+                {
+                    const uint16_t *s = IMAGE_COMPUTE_YUV_PIXEL_ROW_PTR(src, sy);
+                    uint16_t *d = IMAGE_COMPUTE_YUV_PIXEL_ROW_PTR(dst, y);
+                    for (int x = 0; x < dst->w; x++)
+                    {
+                        int sx = c->x0[x];
+                        d[x] = (s[sx] & 0xFF) | (resize_yuv_chroma(s, src->w, sx, x & 1) << 8);
+                    }
+                    break;
+                }
+        }
+    }
+
+    return true;
+}
+
+//=======================================================================================
+// Bilinear
+//=======================================================================================
+/**
+ * Filter source row sy horizontally into h, channels values per output pixel scaled by
+ * RESIZE_FRAC_ONE.
+ */
+static void resize_bilinear_row(const resize_ctx_t *c, int sy, uint16_t *restrict h)
+{
+    const image_t *src = c->src;
+    int w = c->dst->w;
+    int last = src->w - 1;
+
+    switch (src->pixfmt)
+    {
+        case PIXFORMAT_GRAYSCALE:
+            {
+                const uint8_t *s = IMAGE_COMPUTE_GRAYSCALE_PIXEL_ROW_PTR(src, sy);
+                for (int x = 0; x < w; x++)
+                {
+                    int sx = c->x0[x], f = c->fx[x];
+                    int a = s[sx], b = s[IM_MIN(sx + 1, last)];
+                    h[x] = (a << RESIZE_FRAC_BITS) + ((b - a) * f);
+                }
+                break;
+            }
+        case PIXFORMAT_RGB565:
+            {
+                const uint16_t *s = IMAGE_COMPUTE_RGB565_PIXEL_ROW_PTR(src, sy);
+                for (int x = 0; x < w; x++, h += 3)
+                {
+                    int sx = c->x0[x], f = c->fx[x];
+                    int a = s[sx], b = s[IM_MIN(sx + 1, last)];
+                    int ar = a >> 11, ag = (a >> 5) & 0x3F, ab = a & 0x1F;
+                    h[0] = (ar << RESIZE_FRAC_BITS) + (((b >> 11) - ar) * f);
+                    h[1] = (ag << RESIZE_FRAC_BITS) + ((((b >> 5) & 0x3F) - ag) * f);
+                    h[2] = (ab << RESIZE_FRAC_BITS) + (((b & 0x1F) - ab) * f);
+                }
+                break;
+            }
+        default:
+            {
+                const uint16_t *s = IMAGE_COMPUTE_YUV_PIXEL_ROW_PTR(src, sy);
+                for (int x = 0; x < w; x++, h += 2)
+                {
+                    int sx = c->x0[x], sx1 = IM_MIN(sx + 1, last), f = c->fx[x];
+                    int ay = s[sx] & 0xFF, by = s[sx1] & 0xFF;
+                    int ac = resize_yuv_chroma(s, src->w, sx, x & 1);
+                    int bc = resize_yuv_chroma(s, src->w, sx1, x & 1);
+                    h[0] = (ay << RESIZE_FRAC_BITS) + ((by - ay) * f);
+                    h[1] = (ac << RESIZE_FRAC_BITS) + ((bc - ac) * f);
+                }
+                break;
+            }
+    }
+}
+
+static bool resize_bilinear(resize_ctx_t *c, int y0, int y1)
+{
+    image_t *dst = c->dst;
+    int n = dst->w * c->channels;
+
+    // The two horizontally filtered source rows the current output row lies between.
+    uint16_t *rows = (uint16_t *) malloc(2 * n * sizeof(uint16_t));
+    if (rows == NULL)
+    {
+        return false;
+    }
+    uint16_t *top = rows, *bottom = rows + n;
+    int top_y = -1, bottom_y = -1;
+
+    for (int y = y0; y < y1; y++)
+    {
+        int sy = c->y0[y], sy1 = IM_MIN(sy + 1, c->src->h - 1);
+        int fy = c->fy[y];
+
+        if (top_y != sy)
+        {
+            if (bottom_y == sy)
+            {
+                uint16_t *t = top;
+                top = bottom;
+                bottom = t;
+                bottom_y = -1;
+            }
+            else
+            {
+                resize_bilinear_row(c, sy, top);
+            }
+            top_y = sy;
+        }
+
+        if ((bottom_y != sy1) && (fy != 0))
+        {
+            resize_bilinear_row(c, sy1, bottom);
+            bottom_y = sy1;
+        }
+
+        // With fy 0 the bottom row does not contribute and may be stale.
+        const uint16_t *b = (fy != 0) ? bottom : top;
+        int round = 1 << ((2 * RESIZE_FRAC_BITS) - 1);
+        switch (dst->pixfmt)
+        {
+            case PIXFORMAT_GRAYSCALE:
+                {
+                    uint8_t *d = IMAGE_COMPUTE_GRAYSCALE_PIXEL_ROW_PTR(dst, y);
+                    for (int x = 0; x < dst->w; x++)
+                    {
+                        d[x] = ((top[x] << RESIZE_FRAC_BITS) + ((b[x] - top[x]) * fy) + round) >> (2 * RESIZE_FRAC_BITS);
+                    }
+                    break;
+                }
+            case PIXFORMAT_RGB565:
+                {
+                    uint16_t *d = IMAGE_COMPUTE_RGB565_PIXEL_ROW_PTR(dst, y);
+                    for (int x = 0, i = 0; x < dst->w; x++, i += 3)
+                    {
+                        int r = ((top[i] << RESIZE_FRAC_BITS) + ((b[i] - top[i]) * fy) + round) >> (2 * RESIZE_FRAC_BITS);
+                        int g = ((top[i + 1] << RESIZE_FRAC_BITS) + ((b[i + 1] - top[i + 1]) * fy) + round) >> (2 * RESIZE_FRAC_BITS);
+                        int bl = ((top[i + 2] << RESIZE_FRAC_BITS) + ((b[i + 2] - top[i + 2]) * fy) + round) >> (2 * RESIZE_FRAC_BITS);
+                        d[x] = (r << 11) | (g << 5) | bl;
+                    }
+                    break;
+                }
+            default:
+                {
+                    uint16_t *d = IMAGE_COMPUTE_YUV_PIXEL_ROW_PTR(dst, y);
+                    for (int x = 0, i = 0; x < dst->w; x++, i += 2)
+                    {
+                        int l = ((top[i] << RESIZE_FRAC_BITS) + ((b[i] - top[i]) * fy) + round) >> (2 * RESIZE_FRAC_BITS);
+                        int ch = ((top[i + 1] << RESIZE_FRAC_BITS) + ((b[i + 1] - top[i + 1]) * fy) + round) >> (2 * RESIZE_FRAC_BITS);
+                        d[x] = l | (ch << 8);
+                    }
+                    break;
+                }
+        }
+    }
+
+    free(rows);
+    return true;
+}
+
+//=======================================================================================
+// Area
+//=======================================================================================
+/**
+ * Add the boxes of source row sy to the sums, channels per output pixel.
+ */
+static void resize_area_row(const resize_ctx_t *c, int sy, uint32_t *restrict sum)
+{
+    const image_t *src = c->src;
+    int w = c->dst->w;
+
+    switch (src->pixfmt)
+    {
+        case PIXFORMAT_GRAYSCALE:
+            {
+                const uint8_t *s = IMAGE_COMPUTE_GRAYSCALE_PIXEL_ROW_PTR(src, sy);
+                for (int x = 0; x < w; x++)
+                {
+                    uint32_t v = 0;
+                    for (int sx = c->x0[x]; sx < c->x0[x + 1]; sx++)
+                    {
+                        v += s[sx];
+                    }
+                    sum[x] += v;
+                }
+                break;
+            }
+        case PIXFORMAT_RGB565:
+            {
+                const uint16_t *s = IMAGE_COMPUTE_RGB565_PIXEL_ROW_PTR(src, sy);
+                for (int x = 0; x < w; x++, sum += 3)
+                {
+                    uint32_t r = 0, g = 0, b = 0;
+                    for (int sx = c->x0[x]; sx < c->x0[x + 1]; sx++)
+                    {
+                        r += s[sx] >> 11;
+                        g += (s[sx] >> 5) & 0x3F;
+                        b += s[sx] & 0x1F;
+                    }
+                    sum[0] += r;
+                    sum[1] += g;
+                    sum[2] += b;
+                }
+                break;
+            }
+        default:
+            {
+                const uint16_t *s = IMAGE_COMPUTE_YUV_PIXEL_ROW_PTR(src, sy);
+                for (int x = 0; x < w; x++, sum += 2)
+                {
+                    uint32_t l = 0, ch = 0;
+                    for (int sx = c->x0[x]; sx < c->x0[x + 1]; sx++)
+                    {
+                        l += s[sx] & 0xFF;
+                        ch += resize_yuv_chroma(s, src->w, sx, x & 1);
+                    }
+                    sum[0] += l;
+                    sum[1] += ch;
+                }
+                break;
+            }
+    }
+}
+
+static inline int resize_area_div(uint32_t sum, uint32_t count, uint64_t inv)
+{
+    return ((sum + (count >> 1)) * inv) >> 32;
+}
+
+static bool resize_area(resize_ctx_t *c, int y0, int y1)
+{
+    image_t *dst = c->dst;
+    int n = dst->w * c->channels;
+
+    // Per output column the reciprocal of the box size and the box size, then the sums of the
+    // current output row. The 64 bit table comes first to stay aligned whatever n is.
+    uint64_t *inv = (uint64_t *) malloc((dst->w * (sizeof(uint64_t) + sizeof(uint32_t))) + (n * sizeof(uint32_t)));
+    if (inv == NULL)
+    {
+        return false;
+    }
+    uint32_t *count = (uint32_t *) (inv + dst->w);
+    uint32_t *sum = count + dst->w;
+    int table_rows = 0;
+
+    for (int y = y0; y < y1; y++)
+    {
+        memset(sum, 0, n * sizeof(uint32_t));
+        for (int sy = c->y0[y]; sy < c->y0[y + 1]; sy++)
+        {
+            resize_area_row(c, sy, sum);
+        }
+
+        // Box heights take at most two values, the table only changes with them. The reciprocal
+        // makes the division exact for boxes of up to 4096 pixels.
+        int rows = c->y0[y + 1] - c->y0[y];
+        if (rows != table_rows)
+        {
+            for (int x = 0; x < dst->w; x++)
+            {
+                count[x] = (c->x0[x + 1] - c->x0[x]) * rows;
+                inv[x] = (UINT64_C(0xFFFFFFFF) / count[x]) + 1;
+            }
+            table_rows = rows;
+        }
+
+        switch (dst->pixfmt)
+        {
+            case PIXFORMAT_GRAYSCALE:
+                {
+                    uint8_t *d = IMAGE_COMPUTE_GRAYSCALE_PIXEL_ROW_PTR(dst, y);
+                    for (int x = 0; x < dst->w; x++)
+                    {
+                        d[x] = resize_area_div(sum[x], count[x], inv[x]);
+                    }
+                    break;
+                }
+            case PIXFORMAT_RGB565:
+                {
+                    uint16_t *d = IMAGE_COMPUTE_RGB565_PIXEL_ROW_PTR(dst, y);
+                    for (int x = 0, i = 0; x < dst->w; x++, i += 3)
+                    {
+                        int r = resize_area_div(sum[i], count[x], inv[x]);
+                        int g = resize_area_div(sum[i + 1], count[x], inv[x]);
+                        int b = resize_area_div(sum[i + 2], count[x], inv[x]);
+                        d[x] = (r << 11) | (g << 5) | b;
+                    }
+                    break;
+                }
+            default:
+                {
+                    uint16_t *d = IMAGE_COMPUTE_YUV_PIXEL_ROW_PTR(dst, y);
+                    for (int x = 0, i = 0; x < dst->w; x++, i += 2)
+                    {
+                        d[x] = resize_area_div(sum[i], count[x], inv[x]) | (resize_area_div(sum[i + 1], count[x], inv[x]) << 8);
+                    }
+                    break;
+                }
+        }
+    }
+
+    free(inv);
+    return true;
+}
+
+static bool resize_band(void *ctx, int y0, int y1)
+{
+    resize_ctx_t *c = (resize_ctx_t *) ctx;
+    switch (c->mode)
+    {
+        case IMLIB_RESIZE_NEAREST:
+            {
+                return resize_nearest(c, y0, y1);
+            }
+        case IMLIB_RESIZE_BILINEAR:
+            {
+                return resize_bilinear(c, y0, y1);
+            }
+        default:
+            {
+                return resize_area(c, y0, y1);
+            }
+    }
+}
+
+/**
+ * Scale an image to the size of another. Outputs of IMLIB_PARALLEL_MIN_PIXELS or more are
+ * computed on all cores.
+ * @param src: GRAYSCALE, RGB565, YUV422 or YVU422 image.
+ * @param dst: destination with its buffer allocated, its w and h set the output size. It must
+ *             have the format of src and must not overlap it.
+ * @param mode: filter. IMLIB_RESIZE_AREA only downscales, the boxes are all the same size when
+ *              the sizes are integer multiples.
+ * @return: false if the formats are not supported or differ, AREA would upscale or there is not
+ *          enough memory.
+ */
+bool imlib_resize(const image_t *src, image_t *dst, imlib_resize_t mode)
+{
+    int channels;
+    switch (src->pixfmt)
+    {
+        case PIXFORMAT_GRAYSCALE:
+            {
+                channels = 1;
+                break;
+            }
+        case PIXFORMAT_RGB565:
+            {
+                channels = 3;
+                break;
+            }
+        case PIXFORMAT_YUV422:
+        case PIXFORMAT_YVU422:
+            {
+                channels = 2;
+                break;
+            }
+        default:
+            {
+                return false;
+            }
+    }
+
+    if ((dst->pixfmt != src->pixfmt) || ((mode == IMLIB_RESIZE_AREA) && ((dst->w > src->w) || (dst->h > src->h))))
+    {
+        return false;
+    }
+
+    if ((src->w <= 0) || (src->h <= 0) || (dst->w <= 0) || (dst->h <= 0))
+    {
+        return true;
+    }
+
+    // One allocation for all tables: x0 and y0 with one spare entry each, then fx and fy.
+    int *x0 = (int *) malloc(((dst->w + dst->h + 2) * sizeof(int)) + dst->w + dst->h);
+    if (x0 == NULL)
+    {
+        return false;
+    }
+
+    resize_ctx_t c = {
+        .src = src,
+        .dst = dst,
+        .mode = mode,
+        .channels = channels,
+        .x0 = x0,
+        .y0 = x0 + dst->w + 1,
+    };
+    c.fx = (uint8_t *) (c.y0 + dst->h + 1);
+    c.fy = c.fx + dst->w;
+
+    if (mode == IMLIB_RESIZE_AREA)
+    {
+        resize_boxes(src->w, dst->w, c.x0);
+        resize_boxes(src->h, dst->h, c.y0);
+    }
+    else
+    {
+        bool bilinear = mode == IMLIB_RESIZE_BILINEAR;
+        resize_step(src->w, dst->w, c.x0, bilinear ? c.fx : NULL);
+        resize_step(src->h, dst->h, c.y0, bilinear ? c.fy : NULL);
+    }
+
+    bool ok = imlib_parallel_bands(dst->h, ((dst->w * dst->h) >= IMLIB_PARALLEL_MIN_PIXELS) ? 0 : 1, resize_band, &c);
+
+    free(x0);
+    imlib_dirty_add_all(dst);
+    return ok;
+}
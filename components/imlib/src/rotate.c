@@ -0,0 +1,153 @@
+/*****************************************************************************
+ rotate
+
+ Rotation by multiples of 90 degrees and mirroring of GRAYSCALE and RGB565
+ images. Every output pixel is a copy of one source pixel, so the transform
+ reduces to a start address and one address step per output column and per
+ output row. Rotating by 90 or 270 degrees walks the source down a column
+ for every output row, which touches a new cache line per pixel. The output
+ is therefore written in square tiles so that the source lines of a tile are
+ still cached when the next output row of the tile needs them.
+
+*****************************************************************************/
+#include "imlib.h"
+#include <stddef.h>
+#include <string.h>
+
+#define ROTATE_TILE 32 // Tile edge in pixels. The 32 source lines a tile reads stay cached until it is done.
+
+typedef struct rotate_ctx
+{
+    const uint8_t *origin; // Source pixel of output pixel (0, 0).
+    ptrdiff_t step_x;      // Source address step per output column, in bytes.
+    ptrdiff_t step_y;      // Source address step per output row, in bytes.
+    image_t *dst;
+} rotate_ctx_t;
+
+static bool rotate_band(void *ctx, int y0, int y1)
+{
+    const rotate_ctx_t *c = (const rotate_ctx_t *) ctx;
+    image_t *dst = c->dst;
+    int bpp = dst->bpp;
+
+    // Rows are plain copies when the source is walked forwards along its rows.
+    if (c->step_x == bpp)
+    {
+        for (int y = y0; y < y1; y++)
+        {
+            memcpy(IMAGE_COMPUTE_GRAYSCALE_PIXEL_ROW_PTR(dst, y), c->origin + (y * c->step_y), dst->w * bpp);
+        }
+        return true;
+    }
+
+    for (int ty = y0; ty < y1; ty += ROTATE_TILE)
+    {
+        int ty1 = IM_MIN(ty + ROTATE_TILE, y1);
+        for (int tx = 0; tx < dst->w; tx += ROTATE_TILE)
+        {
+            int n = IM_MIN(ROTATE_TILE, dst->w - tx);
+            for (int y = ty; y < ty1; y++)
+            {
+                const uint8_t *s = c->origin + (y * c->step_y) + (tx * c->step_x);
+                if (bpp == 1)
+                {
+                    uint8_t *d = IMAGE_COMPUTE_GRAYSCALE_PIXEL_ROW_PTR(dst, y) + tx;
+                    for (int x = 0; x < n; x++, s += c->step_x)
+                    {
+                        d[x] = *s;
+                    }
+                }
+                else
+                {
+                    uint16_t *d = IMAGE_COMPUTE_RGB565_PIXEL_ROW_PTR(dst, y) + tx;
+                    for (int x = 0; x < n; x++, s += c->step_x)
+                    {
+                        d[x] = *((const uint16_t *) s);
+                    }
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Rotate an image clockwise by a multiple of 90 degrees, e.g. to show a landscape frame on a
+ * portrait panel. Outputs of IMLIB_PARALLEL_MIN_PIXELS or more are computed on all cores.
+ * @param src: GRAYSCALE or RGB565 image.
+ * @param dst: destination with its buffer allocated. It must have the format of src and must
+ *             not overlap it. It is src->h wide and src->w high for 90 and 270 degrees, else
+ *             the size of src.
+ * @param rotation: 0, 90, 180 or 270.
+ * @param hmirror, vflip: mirror the image before rotating it.
+ * @return: false if the format, rotation or destination size is not supported.
+ */
+bool imlib_rotate(const image_t *src, image_t *dst, int rotation, bool hmirror, bool vflip)
+{
+    if (((src->pixfmt != PIXFORMAT_GRAYSCALE) && (src->pixfmt != PIXFORMAT_RGB565)) || (dst->pixfmt != src->pixfmt))
+    {
+        return false;
+    }
+
+    bool transpose = (rotation == 90) || (rotation == 270);
+    if (((rotation % 90) != 0) || ((unsigned) rotation >= 360) || (dst->w != (transpose ? src->h : src->w)) || (dst->h != (transpose ? src->w : src->h)))
+    {
+        return false;
+    }
+
+    if ((dst->w <= 0) || (dst->h <= 0))
+    {
+        return true;
+    }
+
+    // Source position of output pixel (0, 0) and the source directions of the output x and y axes.
+    int ox, oy, ux, uy, vx, vy;
+    switch (rotation)
+    {
+        case 90:
+            {
+                ox = 0, oy = src->h - 1, ux = 0, uy = -1, vx = 1, vy = 0;
+                break;
+            }
+        case 180:
+            {
+                ox = src->w - 1, oy = src->h - 1, ux = -1, uy = 0, vx = 0, vy = -1;
+                break;
+            }
+        case 270:
+            {
+                ox = src->w - 1, oy = 0, ux = 0, uy = 1, vx = -1, vy = 0;
+                break;
+            }
+        default:
+            {
+                ox = 0, oy = 0, ux = 1, uy = 0, vx = 0, vy = 1;
+                break;
+            }
+    }
+
+    // Mirroring first is the same as mirroring the source coordinates afterwards.
+    if (hmirror)
+    {
+        ox = src->w - 1 - ox, ux = -ux, vx = -vx;
+    }
+
+    if (vflip)
+    {
+        oy = src->h - 1 - oy, uy = -uy, vy = -vy;
+    }
+
+    int32_t stride = IMAGE_STRIDE(src);
+    rotate_ctx_t c = {
+        .origin = src->data + (oy * stride) + (ox * src->bpp),
+        .step_x = (ux * src->bpp) + (uy * stride),
+        .step_y = (vx * src->bpp) + (vy * stride),
+        .dst = dst,
+    };
+
+    bool ok = imlib_parallel_bands(dst->h, ((dst->w * dst->h) >= IMLIB_PARALLEL_MIN_PIXELS) ? 0 : 1, rotate_band, &c);
+
+    imlib_dirty_add_all(dst);
+    return ok;
+}
@@ -0,0 +1,263 @@
+/*****************************************************************************
+ stats
+
+ Histograms and statistics of a region of an image for auto exposure and
+ scene change detection. The pixels are read once, row by row, into
+ histograms; the mean, deviation and percentiles are then derived from the
+ bins alone. Every band of rows counts into a private histogram that is
+ added to the result when the band is done, so large regions are counted
+ on all cores.
+
+*****************************************************************************/
+#include "imlib.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STATS_BINS 256
+#define STATS_SPLIT 4 // Y counts go into interleaved histograms so that repeated values do not serialise the increments.
+
+typedef struct stats_ctx
+{
+    const image_t *img;
+    rectangle_t roi;
+    bool have_table;
+    imlib_statistics_t *out;
+} stats_ctx_t;
+
+static void stats_count_y(const uint8_t *s, int step, int n, uint32_t *restrict h)
+{
+    uint32_t *h0 = h, *h1 = h + STATS_BINS, *h2 = h + (2 * STATS_BINS), *h3 = h + (3 * STATS_BINS);
+    int x = 0;
+    for (; x <= (n - 4); x += 4, s += 4 * step)
+    {
+        h0[s[0]]++;
+        h1[s[step]]++;
+        h2[s[2 * step]]++;
+        h3[s[3 * step]]++;
+    }
+
+    for (; x < n; x++, s += step)
+    {
+        h0[*s]++;
+    }
+}
+
+static void stats_count_lab(const uint16_t *s, int n, bool have_table, uint32_t *restrict h)
+{
+    uint32_t *hl = h, *ha = h + STATS_BINS, *hb = h + (2 * STATS_BINS);
+    for (int x = 0; x < n; x++)
+    {
+        uint16_t p = s[x];
+        if (have_table)
+        {
+            const int8_t *lab = lab_table + ((p >> 1) * 3);
+            hl[lab[0] - COLOR_L_MIN]++;
+            ha[lab[1] - COLOR_A_MIN]++;
+            hb[lab[2] - COLOR_B_MIN]++;
+        }
+        else
+        {
+            hl[imlib_rgb565_to_l(p) - COLOR_L_MIN]++;
+            ha[imlib_rgb565_to_a(p) - COLOR_A_MIN]++;
+            hb[imlib_rgb565_to_b(p) - COLOR_B_MIN]++;
+        }
+    }
+}
+
+static bool stats_band(void *ctx, int y0, int y1)
+{
+    const stats_ctx_t *c = (const stats_ctx_t *) ctx;
+    const image_t *img = c->img;
+    const rectangle_t *r = &c->roi;
+
+    uint32_t *h = (uint32_t *) calloc(STATS_SPLIT * STATS_BINS, sizeof(uint32_t));
+    if (h == NULL)
+    {
+        return false;
+    }
+
+    for (int y = r->y + y0; y < (r->y + y1); y++)
+    {
+        switch (img->pixfmt)
+        {
+            case PIXFORMAT_GRAYSCALE:
+                {
+                    stats_count_y(IMAGE_COMPUTE_GRAYSCALE_PIXEL_ROW_PTR(img, y) + r->x, 1, r->w, h);
+                    break;
+                }
+            case PIXFORMAT_RGB565:
+                {
+                    stats_count_lab(IMAGE_COMPUTE_RGB565_PIXEL_ROW_PTR(img, y) + r->x, r->w, c->have_table, h);
+                    break;
+                }
+            default:
+                {
+                    // Y is the low byte of every YUV422 pixel.
+                    stats_count_y((const uint8_t *) (IMAGE_COMPUTE_YUV_PIXEL_ROW_PTR(img, y) + r->x), 2, r->w, h);
+                    break;
+                }
+        }
+    }
+
+    // The Y histograms are folded into the first one, LAB uses the first three as L, A and B.
+    if (c->out->channels == 1)
+    {
+        for (int i = 0; i < STATS_BINS; i++)
+        {
+            h[i] += h[STATS_BINS + i] + h[(2 * STATS_BINS) + i] + h[(3 * STATS_BINS) + i];
+        }
+    }
+
+    for (int ch = 0; ch < c->out->channels; ch++)
+    {
+        for (int i = 0; i < STATS_BINS; i++)
+        {
+            uint32_t n = h[(ch * STATS_BINS) + i];
+            if (n != 0)
+            {
+                __atomic_fetch_add(&c->out->bins[ch][i], n, __ATOMIC_RELAXED);
+            }
+        }
+    }
+
+    free(h);
+    return true;
+}
+
+/**
+ * Get the value at or below which a fraction of the pixels of a channel lie.
+ * @param stats: statistics from imlib_get_statistics().
+ * @param channel: 0 for Y or L, 1 for A, 2 for B.
+ * @param percentile: 0.0 - 1.0, 0.5 is the median.
+ * @return: the value, the channel minimum if there are no pixels.
+ */
+int imlib_statistics_percentile(const imlib_statistics_t *stats, int channel, float percentile)
+{
+    const uint32_t *bins = stats->bins[channel];
+    // The first value is returned for 0, like for the smallest non zero percentile.
+    uint64_t target = IM_MAX((uint64_t) ceilf(IM_MAX(IM_MIN(percentile, 1.0f), 0.0f) * stats->count), (uint64_t) 1);
+    uint64_t acc = 0;
+    int last = 0;
+
+    for (int i = 0; i < STATS_BINS; i++)
+    {
+        if (bins[i] != 0)
+        {
+            acc += bins[i];
+            last = i;
+            if (acc >= target)
+            {
+                break;
+            }
+        }
+    }
+
+    return last + stats->bin_min[channel];
+}
+
+/**
+ * Derive the summary of one channel from its histogram.
+ */
+static void stats_summarise(imlib_statistics_t *stats, int channel)
+{
+    const uint32_t *bins = stats->bins[channel];
+    imlib_channel_stats_t *s = &stats->stats[channel];
+    int offset = stats->bin_min[channel];
+    int64_t sum = 0, sum_sq = 0;
+    int min = -1, max = -1, mode = 0;
+
+    for (int i = 0; i < STATS_BINS; i++)
+    {
+        if (bins[i] != 0)
+        {
+            int v = i + offset;
+            sum += (int64_t) v * bins[i];
+            sum_sq += (int64_t) v * v * bins[i];
+            min = (min < 0) ? i : min;
+            max = i;
+            mode = (bins[i] > bins[mode]) ? i : mode;
+        }
+    }
+
+    if (stats->count == 0)
+    {
+        memset(s, 0, sizeof(*s));
+        s->min = s->max = s->median = s->lq = s->uq = s->mode = offset;
+        return;
+    }
+
+    s->mean = (float) sum / stats->count;
+    s->stdev = sqrtf(IM_MAX(((float) sum_sq / stats->count) - (s->mean * s->mean), 0.0f));
+    s->min = min + offset;
+    s->max = max + offset;
+    s->mode = mode + offset;
+    s->median = imlib_statistics_percentile(stats, channel, 0.5f);
+    s->lq = imlib_statistics_percentile(stats, channel, 0.25f);
+    s->uq = imlib_statistics_percentile(stats, channel, 0.75f);
+}
+
+/**
+ * Count the histograms of a region in one pass and summarise them. GRAYSCALE and YUV422 images
+ * have one Y channel, RGB565 images have L, A and B channels through the LAB table. Regions of
+ * IMLIB_PARALLEL_MIN_PIXELS or more are counted on all cores.
+ * @param roi: region to count, clipped to the image. NULL for the whole image.
+ * @param stats: filled in, including the histograms.
+ * @return: false if the format is not supported or there is not enough memory.
+ */
+bool imlib_get_statistics(const image_t *img, const rectangle_t *roi, imlib_statistics_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+
+    switch (img->pixfmt)
+    {
+        case PIXFORMAT_GRAYSCALE:
+        case PIXFORMAT_YUV422:
+        case PIXFORMAT_YVU422:
+            {
+                stats->channels = 1;
+                stats->bin_min[0] = COLOR_Y_MIN;
+                break;
+            }
+        case PIXFORMAT_RGB565:
+            {
+                stats->channels = 3;
+                stats->bin_min[0] = COLOR_L_MIN;
+                stats->bin_min[1] = COLOR_A_MIN;
+                stats->bin_min[2] = COLOR_B_MIN;
+                break;
+            }
+        default:
+            {
+                return false;
+            }
+    }
+
+    stats_ctx_t c = {
+        .img = img,
+        .roi = {0, 0, img->w, img->h},
+        .have_table = (img->pixfmt == PIXFORMAT_RGB565) && imlib_lab_table_init(),
+        .out = stats,
+    };
+
+    if (roi != NULL)
+    {
+        int x0 = IM_MAX(roi->x, 0), y0 = IM_MAX(roi->y, 0);
+        int x1 = IM_MIN(roi->x + roi->w, img->w), y1 = IM_MIN(roi->y + roi->h, img->h);
+        c.roi = (rectangle_t) {x0, y0, IM_MAX(x1 - x0, 0), IM_MAX(y1 - y0, 0)};
+    }
+
+    bool ok = true;
+    if ((c.roi.w > 0) && (c.roi.h > 0))
+    {
+        stats->count = c.roi.w * c.roi.h;
+        ok = imlib_parallel_bands(c.roi.h, ((c.roi.w * c.roi.h) >= IMLIB_PARALLEL_MIN_PIXELS) ? 0 : 1, stats_band, &c);
+    }
+
+    for (int ch = 0; ch < stats->channels; ch++)
+    {
+        stats_summarise(stats, ch);
+    }
+
+    return ok;
+}
@@ -1,18 +1,15 @@
 #include "utils.h"
+#include <assert.h>
 #include <stdint.h>
 #include <string.h>
 #include <stdio.h>
-#include <math.h>
-#include "driver/ppa.h"
-#include "driver/jpeg_decode.h"
-#include "driver/jpeg_encode.h"
 
 /**
  * Get the byte length of a utf-8 character
  * @param input_byte: the first byte of the input utf-8 character
  * @return: the byte length of the character
  */
-static int get_utf8_byte_size(const char input_byte)
+static int get_utf8_byte_size(const uint8_t input_byte)
 {
     // Determine the length of the character based on the first byte of the utf-8 encoding
     if (input_byte < 0x80)
@@ -91,12 +88,21 @@ int utf8_to_unicode(const char *utf8_input, uint64_t *unicode_output)
     return utf_bytes;
 }
 
+static int jpg_file_read(void *ctx, uint8_t *buf, int len)
+{
+    return fread(buf, 1, len, (FILE *) ctx);
+}
+
 /**
- *
+ * Decode a JPEG file into a new RGB565 image, streaming it from the file a chunk at a time.
+ * @param img_out: the decoded image, free it with image_jpg_free().
+ * @param path: file to read.
+ * @param scale: 0 - 3, decode at 1 / (1 << scale) of the full size.
+ * @return: 0 on success, -1 on failure.
  */
-int image_jpg_read(image_t **img_out, char *path)
+int image_jpg_read_scaled(image_t **img_out, const char *path, int scale)
 {
-    // uint32_t last_time = esp_timer_get_time();
+    *img_out = NULL;
     FILE *fp = fopen(path, "rb");
     if (fp == NULL)
     {
@@ -104,25 +110,85 @@ int image_jpg_read(image_t **img_out, char *path)
         return -1;
     }
 
-    image_t *img_jpg = (image_t *) malloc(sizeof(image_t));
-    fseek(fp, 0, SEEK_END);
-    img_jpg->size = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
-    img_jpg->pixfmt = PIXFORMAT_JPEG;
-    img_jpg->data = (uint8_t *) heap_caps_malloc(img_jpg->size, MALLOC_CAP_8BIT | MALLOC_CAP_SPIRAM);
-    if (img_jpg->data == NULL)
+    // The decoder reads large chunks itself, stdio buffering would only add a copy.
+    setvbuf(fp, NULL, _IONBF, 0);
+
+    imlib_jpeg_dec_t dec;
+    if (!imlib_jpeg_dec_init(&dec, jpg_file_read, fp))
     {
-        ESP_LOGE(TAG, "alloc memory for img_jpg->data failed");
+        printf("%s is not a supported jpeg\n", path);
+        fclose(fp);
+        return -1;
     }
-    fread(img_jpg->data, 1, img_jpg->size, fp);
+
+    image_t *img = (image_t *) calloc(1, sizeof(image_t));
+    bool ok = (img != NULL) && imlib_image_alloc(img, IMLIB_JPEG_SCALED_SIZE(dec.w, scale), IMLIB_JPEG_SCALED_SIZE(dec.h, scale), PIXFORMAT_RGB565, IMLIB_ALLOC_SPIRAM);
+    ok = ok && imlib_jpeg_dec_run(&dec, img, scale);
+    imlib_jpeg_dec_free(&dec);
     fclose(fp);
 
-    // ESP_LOGI(TAG, "jpeg read spend time %lld ms.", (esp_timer_get_time() - last_time) / 1000);
-    // last_time = esp_timer_get_time();
-    *img_out = app_jpeg_decode(img_jpg, img_jpg->size); // img memory allocated internally by app_jpeg_decode()
-    // ESP_LOGI(TAG, "jpeg decode spend time %lld ms.", (esp_timer_get_time() - last_time) / 1000);
+    if (!ok)
+    {
+        printf("decode %s fail\n", path);
+        image_jpg_free(img);
+        return -1;
+    }
 
-    heap_caps_free(img_jpg->data);
+    *img_out = img;
+    return 0;
+}
+
+/**
+ * Decode a JPEG file at full size, see image_jpg_read_scaled().
+ */
+int image_jpg_read(image_t **img_out, char *path)
+{
+    return image_jpg_read_scaled(img_out, path, 0);
+}
+
+static int jpg_file_write(void *ctx, const uint8_t *buf, int len)
+{
+    return fwrite(buf, 1, len, (FILE *) ctx);
+}
+
+/**
+ * Encode an image into a JPEG file, writing the compressed data a chunk at a time.
+ * @param img: GRAYSCALE, RGB565, YUV422 or YVU422 image.
+ * @param path: file to write.
+ * @param quality: 1 - 100.
+ * @return: 0 on success, -1 on failure.
+ */
+int image_jpg_write(const image_t *img, const char *path, int quality)
+{
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL)
+    {
+        printf("open %s to write fail\n", path);
+        return -1;
+    }
+
+    // The encoder writes large chunks itself, stdio buffering would only add a copy.
+    setvbuf(fp, NULL, _IONBF, 0);
+
+    bool ok = imlib_jpeg_encode(img, quality, jpg_file_write, fp);
+    ok = (fclose(fp) == 0) && ok;
+    if (!ok)
+    {
+        printf("encode %s fail\n", path);
+        return -1;
+    }
 
     return 0;
 }
+
+/**
+ * Free an image returned by image_jpg_read() or image_jpg_read_scaled(), NULL is ignored.
+ */
+void image_jpg_free(image_t *img)
+{
+    if (img != NULL)
+    {
+        imlib_image_free(img);
+        free(img);
+    }
+}
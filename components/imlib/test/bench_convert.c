@@ -0,0 +1,156 @@
+/**
+ * imlib_convert(), which runs a row kernel of imlib_convert_strided() per row, against a per-pixel
+ * loop with the pixel macros and the COLOR_* conversions, on a random 1280x720 frame.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "imlib.h"
+
+#define W 1280
+#define H 720
+#define REPEAT 10
+
+static double now_ms(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+/**
+ * Demosaic pixel (x, y) from its 2x2 cell: R and B are the samples of their color, G is the mean
+ * of the two G samples.
+ */
+static void bayer_pixel(const image_t *img, int x, int y, int *r, int *g, int *b)
+{
+    static const char *const patterns[] = {"BGGR", "GBRG", "GRBG", "RGGB"};
+    const char *pattern = patterns[(img->pixfmt >> 8) & 3];
+    int cx = x & ~1, cy = y & ~1, g_sum = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        int v = IMAGE_GET_BAYER_PIXEL(img, IM_MIN(cx + (i & 1), img->w - 1), IM_MIN(cy + (i >> 1), img->h - 1));
+        switch (pattern[i])
+        {
+            case 'R':
+                {
+                    *r = v;
+                    break;
+                }
+            case 'B':
+                {
+                    *b = v;
+                    break;
+                }
+            default:
+                {
+                    g_sum += v;
+                    break;
+                }
+        }
+    }
+    *g = g_sum >> 1;
+}
+
+static void convert_per_pixel(const image_t *src, image_t *dst)
+{
+    for (int y = 0; y < src->h; y++)
+    {
+        for (int x = 0; x < src->w; x++)
+        {
+            if (src->pixfmt == PIXFORMAT_RGB565)
+            {
+                IMAGE_PUT_GRAYSCALE_PIXEL(dst, x, y, COLOR_RGB565_TO_Y(IMAGE_GET_RGB565_PIXEL(src, x, y)));
+            }
+            else if (src->pixfmt == PIXFORMAT_GRAYSCALE)
+            {
+                IMAGE_PUT_RGB565_PIXEL(dst, x, y, COLOR_Y_TO_RGB565(IMAGE_GET_GRAYSCALE_PIXEL(src, x, y)));
+            }
+            else if (src->pixfmt == PIXFORMAT_YUV422)
+            {
+                // U is on the even pixel of a pair and V on the odd one, the width is even.
+                int p = IMAGE_GET_YUV_PIXEL(src, x, y);
+                int u = IMAGE_GET_YUV_PIXEL(src, x & ~1, y) >> 8;
+                int v = IMAGE_GET_YUV_PIXEL(src, x | 1, y) >> 8;
+                IMAGE_PUT_RGB565_PIXEL(dst, x, y, imlib_yuv_to_rgb(p & 0xFF, u - 128, v - 128));
+            }
+            else
+            {
+                int r, g, b;
+                bayer_pixel(src, x, y, &r, &g, &b);
+                if (dst->pixfmt == PIXFORMAT_RGB565)
+                {
+                    IMAGE_PUT_RGB565_PIXEL(dst, x, y, COLOR_R8_G8_B8_TO_RGB565(r, g, b));
+                }
+                else
+                {
+                    IMAGE_PUT_GRAYSCALE_PIXEL(dst, x, y, COLOR_RGB888_TO_Y(r, g, b));
+                }
+            }
+        }
+    }
+}
+
+static bool same_pixels(const image_t *a, const image_t *b)
+{
+    for (int y = 0; y < a->h; y++)
+    {
+        if (memcmp(a->data + (y * IMAGE_STRIDE(a)), b->data + (y * IMAGE_STRIDE(b)), a->w * a->bpp) != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool bench(const char *name, pixformat_t src_pixfmt, pixformat_t dst_pixfmt)
+{
+    image_t src, kernel, ref;
+    if (!imlib_image_alloc(&src, W, H, src_pixfmt, IMLIB_ALLOC_AUTO) || !imlib_image_alloc(&kernel, W, H, dst_pixfmt, IMLIB_ALLOC_AUTO) || !imlib_image_alloc(&ref, W, H, dst_pixfmt, IMLIB_ALLOC_AUTO))
+    {
+        return false;
+    }
+    for (int y = 0; y < H; y++)
+    {
+        for (int x = 0; x < W * src.bpp; x++)
+        {
+            src.data[(y * IMAGE_STRIDE(&src)) + x] = rand();
+        }
+    }
+
+    bool ok = imlib_convert(&src, &kernel); // Warm up.
+    double t0 = now_ms();
+    for (int i = 0; i < REPEAT; i++)
+    {
+        imlib_convert(&src, &kernel);
+    }
+    double t_kernel = (now_ms() - t0) / REPEAT;
+
+    convert_per_pixel(&src, &ref);
+    t0 = now_ms();
+    for (int i = 0; i < REPEAT; i++)
+    {
+        convert_per_pixel(&src, &ref);
+    }
+    double t_ref = (now_ms() - t0) / REPEAT;
+
+    ok &= same_pixels(&kernel, &ref);
+    printf("%-16s %8.3f ms kernel %8.3f ms per pixel%s\n", name, t_kernel, t_ref, ok ? "" : " MISMATCH");
+    imlib_image_free(&src);
+    imlib_image_free(&kernel);
+    imlib_image_free(&ref);
+    return ok;
+}
+
+int main(void)
+{
+    srand(1);
+    bool ok = bench("RGB565 > GRAY", PIXFORMAT_RGB565, PIXFORMAT_GRAYSCALE);
+    ok &= bench("GRAY > RGB565", PIXFORMAT_GRAYSCALE, PIXFORMAT_RGB565);
+    ok &= bench("YUV422 > RGB565", PIXFORMAT_YUV422, PIXFORMAT_RGB565);
+    ok &= bench("BGGR > RGB565", PIXFORMAT_BAYER_BGGR, PIXFORMAT_RGB565);
+    ok &= bench("GRBG > GRAY", PIXFORMAT_BAYER_GRBG, PIXFORMAT_GRAYSCALE);
+    return ok ? 0 : 1;
+}
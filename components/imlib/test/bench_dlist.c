@@ -0,0 +1,131 @@
+/**
+ * imlib_dlist_execute_parallel() at 1, 2 and 4 threads against imlib_dlist_execute(), on a batch
+ * of lines, rectangles, circles, ellipses and captions spread over a 1280x720 frame. Every thread
+ * count must give the serial output byte for byte.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "imlib.h"
+
+#define W 1280
+#define H 720
+#define REPEAT 20
+#define SHAPES 400
+
+static uint32_t seed = 7;
+
+static double now_ms(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+static int rnd(int n)
+{
+    seed = (seed * 1103515245u) + 12345u;
+    return (seed >> 8) % n;
+}
+
+/**
+ * Record shapes of every kind, some of them crossing the frame edges.
+ */
+static bool record(imlib_dlist_t *list)
+{
+    bool ok = true;
+    for (int i = 0; i < SHAPES; i++)
+    {
+        int x = rnd(W + 100) - 50, y = rnd(H + 100) - 50, c = rnd(0x10000), th = 1 + rnd(4);
+        char caption[16];
+        switch (i % 5)
+        {
+            case 0:
+                {
+                    ok &= imlib_dlist_line(list, x, y, x + rnd(400) - 200, y + rnd(400) - 200, c, th);
+                    break;
+                }
+            case 1:
+                {
+                    ok &= imlib_dlist_rectangle(list, x, y, 10 + rnd(200), 10 + rnd(200), c, th, rnd(2));
+                    break;
+                }
+            case 2:
+                {
+                    ok &= imlib_dlist_circle(list, x, y, 5 + rnd(100), c, th, rnd(2));
+                    break;
+                }
+            case 3:
+                {
+                    ok &= imlib_dlist_ellipse(list, x, y, 5 + rnd(150), 5 + rnd(80), rnd(360), c, th, rnd(2));
+                    break;
+                }
+            default:
+                {
+                    snprintf(caption, sizeof(caption), "box %d", i);
+                    ok &= imlib_dlist_string(list, x, y, caption, c, 1 + rnd(2), 0, 0, true, 0, false, false, 0, false, false);
+                    break;
+                }
+        }
+    }
+    return ok;
+}
+
+static bool bench(const char *name, pixformat_t pixfmt, const imlib_dlist_t *list)
+{
+    static const int threads[] = {1, 2, 4};
+    image_t serial, parallel;
+    if (!imlib_image_alloc(&serial, W, H, pixfmt, IMLIB_ALLOC_AUTO) || !imlib_image_alloc(&parallel, W, H, pixfmt, IMLIB_ALLOC_AUTO))
+    {
+        return false;
+    }
+    size_t size = H * IMAGE_STRIDE(&serial);
+
+    // Antialiased edges blend with what is below them, so every run starts from a cleared frame.
+    // The clear is part of every timing.
+    imlib_dlist_execute(list, &serial); // Warm up.
+    double t0 = now_ms();
+    for (int r = 0; r < REPEAT; r++)
+    {
+        memset(serial.data, 0, size);
+        imlib_dlist_execute(list, &serial);
+    }
+    printf("%-7s serial    %8.3f ms\n", name, (now_ms() - t0) / REPEAT);
+
+    bool ok = true;
+    for (size_t i = 0; i < sizeof(threads) / sizeof(threads[0]); i++)
+    {
+        t0 = now_ms();
+        for (int r = 0; r < REPEAT; r++)
+        {
+            memset(parallel.data, 0, size);
+            imlib_dlist_execute_parallel(list, &parallel, threads[i]);
+        }
+        double t = (now_ms() - t0) / REPEAT;
+        bool same = memcmp(serial.data, parallel.data, size) == 0;
+        ok &= same;
+        printf("%-7s %d threads %8.3f ms%s\n", name, threads[i], t, same ? "" : " MISMATCH");
+    }
+
+    imlib_image_free(&serial);
+    imlib_image_free(&parallel);
+    return ok;
+}
+
+int main(void)
+{
+    imlib_dlist_t list;
+    imlib_dlist_init(&list);
+    if (!record(&list))
+    {
+        imlib_dlist_free(&list);
+        return 1;
+    }
+
+    bool ok = bench("RGB565", PIXFORMAT_RGB565, &list);
+    ok &= bench("GRAY", PIXFORMAT_GRAYSCALE, &list);
+    imlib_dlist_free(&list);
+    return ok ? 0 : 1;
+}
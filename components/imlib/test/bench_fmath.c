@@ -0,0 +1,277 @@
+/**
+ * Speed and accuracy of the fast math functions: ns/element of libm, the scalar function and its
+ * array variant, and the largest and mean error of both against the double precision libm result.
+ */
+#include <float.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "fmath.h"
+
+#define N 4096
+#define REPEAT 500
+
+typedef enum
+{
+    ERROR_ABS,   // Absolute error.
+    ERROR_REL,   // Error relative to the reference.
+    ERROR_ANGLE, // Absolute error of an angle, wrapped to [-pi, pi].
+} error_kind_t;
+
+typedef struct
+{
+    const char *name;
+    error_kind_t error;
+    double (*ref)(const float *a, const float *b, size_t i);
+    void (*libm)(void);
+    void (*scalar)(void);
+    void (*array)(void);
+} bench_t;
+
+static float in_a[N], in_b[N], out[N];
+static float pow_exp = 2.2f;
+static volatile float sink;
+
+static double now_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+static double ns_per_element(void (*run)(void))
+{
+    run(); // Warm up.
+    double t0 = now_ns();
+    for (int r = 0; r < REPEAT; r++)
+    {
+        run();
+        sink = out[r % N];
+    }
+    return (now_ns() - t0) / REPEAT / N;
+}
+
+static void report_error(const char *label, const bench_t *b, void (*run)(void))
+{
+    run();
+    double max = 0, sum = 0;
+    for (size_t i = 0; i < N; i++)
+    {
+        double ref = b->ref(in_a, in_b, i);
+        double e = out[i] - ref;
+        if (b->error == ERROR_ANGLE)
+        {
+            e = fmod(e + 3 * M_PI, 2 * M_PI) - M_PI;
+        }
+        else if (b->error == ERROR_REL)
+        {
+            e /= fabs(ref) > DBL_MIN ? fabs(ref) : 1;
+        }
+        e = fabs(e);
+        max = e > max ? e : max;
+        sum += e;
+    }
+    printf("  %-14s max %9.3g mean %9.3g %s\n", label, max, sum / N, b->error == ERROR_REL ? "relative" : "absolute");
+}
+
+static double ref_atan2(const float *a, const float *b, size_t i)
+{
+    return atan2(a[i], b[i]);
+}
+
+static void libm_atan2(void)
+{
+    for (size_t i = 0; i < N; i++)
+    {
+        out[i] = atan2f(in_a[i], in_b[i]);
+    }
+}
+
+static void scalar_atan2(void)
+{
+    for (size_t i = 0; i < N; i++)
+    {
+        out[i] = fast_atan2f(in_a[i], in_b[i]);
+    }
+}
+
+static void array_atan2(void)
+{
+    fast_atan2f_n(in_a, in_b, out, N);
+}
+
+static double ref_exp(const float *a, const float *b, size_t i)
+{
+    (void)b;
+    return exp(a[i]);
+}
+
+static void libm_exp(void)
+{
+    for (size_t i = 0; i < N; i++)
+    {
+        out[i] = expf(in_a[i]);
+    }
+}
+
+static void scalar_exp(void)
+{
+    for (size_t i = 0; i < N; i++)
+    {
+        out[i] = fast_expf(in_a[i]);
+    }
+}
+
+static void array_exp(void)
+{
+    fast_expf_n(in_a, out, N);
+}
+
+static double ref_log2(const float *a, const float *b, size_t i)
+{
+    (void)b;
+    return log2(a[i]);
+}
+
+static void libm_log2(void)
+{
+    for (size_t i = 0; i < N; i++)
+    {
+        out[i] = log2f(in_a[i]);
+    }
+}
+
+static void scalar_log2(void)
+{
+    for (size_t i = 0; i < N; i++)
+    {
+        out[i] = fast_log2(in_a[i]);
+    }
+}
+
+static void array_log2(void)
+{
+    fast_log2_n(in_a, out, N);
+}
+
+static double ref_pow(const float *a, const float *b, size_t i)
+{
+    (void)b;
+    return pow(a[i], pow_exp);
+}
+
+static void libm_pow(void)
+{
+    for (size_t i = 0; i < N; i++)
+    {
+        out[i] = powf(in_a[i], pow_exp);
+    }
+}
+
+static void scalar_pow(void)
+{
+    for (size_t i = 0; i < N; i++)
+    {
+        out[i] = fast_powf(in_a[i], pow_exp);
+    }
+}
+
+static void array_pow(void)
+{
+    fast_powf_n(in_a, pow_exp, out, N);
+}
+
+static float uniform(float lo, float hi)
+{
+    return lo + (hi - lo) * (rand() / (float)RAND_MAX);
+}
+
+static void run_bench(const bench_t *b)
+{
+    printf("%s\n", b->name);
+    printf("  %-14s %6.2f ns/element\n", "libm", ns_per_element(b->libm));
+    printf("  %-14s %6.2f ns/element\n", "scalar", ns_per_element(b->scalar));
+    printf("  %-14s %6.2f ns/element\n", "array", ns_per_element(b->array));
+    report_error("scalar", b, b->scalar);
+    report_error("array", b, b->array);
+}
+
+/**
+ * The min/max scans have no error to measure, they must match a plain loop exactly.
+ */
+static int bench_min_max(void)
+{
+    static int16_t s[N];
+    float lo = FLT_MAX, hi = -FLT_MAX, fmin, fmax;
+    int16_t slo = INT16_MAX, shi = INT16_MIN, smin, smax;
+    for (size_t i = 0; i < N; i++)
+    {
+        in_a[i] = uniform(-1000, 1000);
+        s[i] = (int16_t)(rand() % 65536 - 32768);
+        lo = fminf(lo, in_a[i]);
+        hi = fmaxf(hi, in_a[i]);
+        slo = s[i] < slo ? s[i] : slo;
+        shi = s[i] > shi ? s[i] : shi;
+    }
+
+    double t0 = now_ns();
+    for (int r = 0; r < REPEAT; r++)
+    {
+        fast_get_min_max(in_a, N, &fmin, &fmax);
+    }
+    double t_float = (now_ns() - t0) / REPEAT / N;
+    t0 = now_ns();
+    for (int r = 0; r < REPEAT; r++)
+    {
+        fast_get_min_max_i16(s, N, &smin, &smax);
+    }
+    double t_i16 = (now_ns() - t0) / REPEAT / N;
+
+    bool ok = fmin == lo && fmax == hi && smin == slo && smax == shi;
+    printf("min/max\n");
+    printf("  %-14s %6.2f ns/element\n", "float", t_float);
+    printf("  %-14s %6.2f ns/element\n", "int16", t_i16);
+    printf("  %-14s %s\n", "result", ok ? "exact" : "WRONG");
+    return ok ? 0 : 1;
+}
+
+int main(void)
+{
+    static const bench_t benches[] = {
+        {"atan2f, y and x in [-1, 1]", ERROR_ANGLE, ref_atan2, libm_atan2, scalar_atan2, array_atan2},
+        {"expf, x in [-20, 20]", ERROR_REL, ref_exp, libm_exp, scalar_exp, array_exp},
+        {"log2, x in [1e-13, 1e13]", ERROR_ABS, ref_log2, libm_log2, scalar_log2, array_log2},
+        {"powf, x^2.2 with x in (0, 1]", ERROR_REL, ref_pow, libm_pow, scalar_pow, array_pow},
+    };
+
+    srand(1);
+    for (size_t i = 0; i < N; i++)
+    {
+        in_a[i] = uniform(-1, 1);
+        in_b[i] = uniform(-1, 1);
+    }
+    run_bench(&benches[0]);
+
+    for (size_t i = 0; i < N; i++)
+    {
+        in_a[i] = uniform(-20, 20);
+    }
+    run_bench(&benches[1]);
+
+    for (size_t i = 0; i < N; i++)
+    {
+        in_a[i] = expf(uniform(-30, 30));
+    }
+    run_bench(&benches[2]);
+
+    for (size_t i = 0; i < N; i++)
+    {
+        in_a[i] = uniform(1e-3f, 1);
+    }
+    run_bench(&benches[3]);
+
+    return bench_min_max();
+}
@@ -0,0 +1,202 @@
+/**
+ * imlib_nms() against pairwise greedy suppression, and imlib_draw_boxes() against drawing every box
+ * and caption immediately, on synthetic detector output for a 1280x720 frame: jittered clusters of
+ * candidates around each object plus low score noise.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "imlib.h"
+
+#define W 1280
+#define H 720
+#define MAX_BOXES 20000
+#define REPEAT 20
+#define MIN_SCORE 0.3f
+#define IOU 0.45f
+
+static const char *const labels[] = {"face", "person", "cat"};
+static const int colors[] = {0xF800, 0x07E0, 0x001F};
+static uint32_t seed = 11;
+
+static double now_ms(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+static int rnd(int n)
+{
+    seed = (seed * 1103515245u) + 12345u;
+    return (seed >> 8) % n;
+}
+
+/**
+ * @param objects: number of objects, each gets per_object candidates of the same label.
+ * @param noise: number of small candidates with a score below 0.4 anywhere in the frame.
+ * @return: the number of candidates.
+ */
+static int make_candidates(bounding_box_lnk_data_t *b, int objects, int per_object, int noise)
+{
+    int n = 0;
+    for (int o = 0; o < objects; o++)
+    {
+        int w = 20 + rnd(200), h = 20 + rnd(200);
+        int x = rnd(W - w), y = rnd(H - h), label = rnd(3);
+        for (int k = 0; k < per_object; k++, n++)
+        {
+            b[n].rect.x = x + rnd((w / 4) + 1) - (w / 8);
+            b[n].rect.y = y + rnd((h / 4) + 1) - (h / 8);
+            b[n].rect.w = w + rnd((w / 4) + 1) - (w / 8);
+            b[n].rect.h = h + rnd((h / 4) + 1) - (h / 8);
+            b[n].score = 0.3f + (rnd(70000) / 100000.0f);
+            b[n].label_index = label;
+        }
+    }
+    for (int k = 0; k < noise; k++, n++)
+    {
+        b[n].rect.w = 8 + rnd(100);
+        b[n].rect.h = 8 + rnd(100);
+        b[n].rect.x = rnd(W);
+        b[n].rect.y = rnd(H);
+        b[n].score = rnd(40000) / 100000.0f;
+        b[n].label_index = rnd(3);
+    }
+    return n;
+}
+
+static int compare_score(const void *a, const void *b)
+{
+    float sa = ((const bounding_box_lnk_data_t *) a)->score;
+    float sb = ((const bounding_box_lnk_data_t *) b)->score;
+    return (sa < sb) - (sa > sb);
+}
+
+static float iou(const rectangle_t *a, const rectangle_t *b)
+{
+    int w = IM_MIN(a->x + a->w, b->x + b->w) - IM_MAX(a->x, b->x);
+    int h = IM_MIN(a->y + a->h, b->y + b->h) - IM_MAX(a->y, b->y);
+    if ((w <= 0) || (h <= 0))
+    {
+        return 0;
+    }
+    float i = w * h;
+    return i / ((a->w * a->h) + (b->w * b->h) - i);
+}
+
+/**
+ * Greedy suppression that compares every candidate with every kept box, same contract as imlib_nms().
+ */
+static int nms_pairwise(bounding_box_lnk_data_t *b, int count, float min_score, float iou_threshold, bool per_label)
+{
+    int n = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if ((b[i].score >= min_score) && (b[i].rect.w > 0) && (b[i].rect.h > 0))
+        {
+            b[n++] = b[i];
+        }
+    }
+
+    // qsort is not stable, so tied scores may be ordered differently than by imlib_nms(). The fixed
+    // seed of the candidates gives no tie that changes the result.
+    qsort(b, n, sizeof(bounding_box_lnk_data_t), compare_score);
+    int kept = 0;
+    for (int i = 0; i < n; i++)
+    {
+        bool suppressed = false;
+        for (int j = 0; (j < kept) && !suppressed; j++)
+        {
+            suppressed = (!per_label || (b[j].label_index == b[i].label_index)) && (iou(&b[j].rect, &b[i].rect) > iou_threshold);
+        }
+        if (!suppressed)
+        {
+            b[kept++] = b[i];
+        }
+    }
+    return kept;
+}
+
+static void draw_immediate(image_t *img, const bounding_box_lnk_data_t *b, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        char caption[32];
+        int c = colors[b[i].label_index];
+        snprintf(caption, sizeof(caption), "%s %d%%", labels[b[i].label_index], (int) ((b[i].score * 100) + 0.5f));
+        imlib_draw_rectangle(img, b[i].rect.x, b[i].rect.y, b[i].rect.w, b[i].rect.h, c, 2, false);
+        imlib_draw_string(img, b[i].rect.x, (b[i].rect.y >= 16) ? (b[i].rect.y - 16) : b[i].rect.y, caption, c, 1, 0, 0, true, 0, false, false, 0, false, false);
+    }
+}
+
+int main(void)
+{
+    static bounding_box_lnk_data_t candidates[MAX_BOXES], grid[MAX_BOXES], pairwise[MAX_BOXES];
+    static const int sets[][3] = {{20, 50, 1000}, {100, 40, 4000}, {50, 200, 10000}};
+    bool ok = true;
+
+    for (size_t s = 0; s < sizeof(sets) / sizeof(sets[0]); s++)
+    {
+        int n = make_candidates(candidates, sets[s][0], sets[s][1], sets[s][2]);
+        int kept = 0, kept_pairwise = 0;
+
+        double t0 = now_ms();
+        for (int r = 0; r < REPEAT; r++)
+        {
+            memcpy(grid, candidates, n * sizeof(bounding_box_lnk_data_t));
+            kept = imlib_nms(grid, n, MIN_SCORE, IOU, true);
+        }
+        double t_grid = (now_ms() - t0) / REPEAT;
+
+        t0 = now_ms();
+        for (int r = 0; r < REPEAT; r++)
+        {
+            memcpy(pairwise, candidates, n * sizeof(bounding_box_lnk_data_t));
+            kept_pairwise = nms_pairwise(pairwise, n, MIN_SCORE, IOU, true);
+        }
+        double t_pairwise = (now_ms() - t0) / REPEAT;
+
+        bool same = (kept == kept_pairwise) && (memcmp(grid, pairwise, kept * sizeof(bounding_box_lnk_data_t)) == 0);
+        ok &= same;
+        printf("%5d candidates, %4d kept: %7.3f ms grid %7.3f ms pairwise%s\n", n, kept, t_grid, t_pairwise, same ? "" : " MISMATCH");
+    }
+
+    image_t batched, immediate;
+    if (!imlib_image_alloc(&batched, W, H, PIXFORMAT_RGB565, IMLIB_ALLOC_AUTO) || !imlib_image_alloc(&immediate, W, H, PIXFORMAT_RGB565, IMLIB_ALLOC_AUTO))
+    {
+        return 1;
+    }
+    memset(batched.data, 0, H * IMAGE_STRIDE(&batched));
+    memset(immediate.data, 0, H * IMAGE_STRIDE(&immediate));
+
+    int n = make_candidates(candidates, 100, 40, 4000);
+    int kept = imlib_nms(candidates, n, MIN_SCORE, IOU, true);
+    if (!imlib_draw_boxes(&batched, candidates, kept, 0xFFFF, 2, labels, colors, 3, 1))
+    {
+        return 1;
+    }
+    draw_immediate(&immediate, candidates, kept);
+    bool same = memcmp(batched.data, immediate.data, H * IMAGE_STRIDE(&batched)) == 0;
+    ok &= same;
+
+    double t0 = now_ms();
+    for (int r = 0; r < REPEAT; r++)
+    {
+        imlib_draw_boxes(&batched, candidates, kept, 0xFFFF, 2, labels, colors, 3, 1);
+    }
+    double t_batched = (now_ms() - t0) / REPEAT;
+    t0 = now_ms();
+    for (int r = 0; r < REPEAT; r++)
+    {
+        draw_immediate(&immediate, candidates, kept);
+    }
+    double t_immediate = (now_ms() - t0) / REPEAT;
+    printf("%5d boxes drawn: %7.3f ms batched %7.3f ms immediate%s\n", kept, t_batched, t_immediate, same ? "" : " MISMATCH");
+
+    imlib_image_free(&batched);
+    imlib_image_free(&immediate);
+    return ok ? 0 : 1;
+}
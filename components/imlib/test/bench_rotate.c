@@ -0,0 +1,101 @@
+/**
+ * imlib_rotate() by 90 degrees against a per-pixel loop with the pixel macros, which walks a source
+ * column for every output row without tiling. The large frame does not fit the host caches, which
+ * is closer to a frame in the PSRAM of the ESP32-P4.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "imlib.h"
+
+#define REPEAT 5
+
+static double now_ms(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+/**
+ * Rotate clockwise by 90 degrees, output pixel (x, y) is source pixel (y, h - 1 - x).
+ */
+static void rotate_90_per_pixel(const image_t *src, image_t *dst)
+{
+    for (int y = 0; y < dst->h; y++)
+    {
+        for (int x = 0; x < dst->w; x++)
+        {
+            if (src->pixfmt == PIXFORMAT_RGB565)
+            {
+                IMAGE_PUT_RGB565_PIXEL(dst, x, y, IMAGE_GET_RGB565_PIXEL(src, y, src->h - 1 - x));
+            }
+            else
+            {
+                IMAGE_PUT_GRAYSCALE_PIXEL(dst, x, y, IMAGE_GET_GRAYSCALE_PIXEL(src, y, src->h - 1 - x));
+            }
+        }
+    }
+}
+
+static bool same_pixels(const image_t *a, const image_t *b)
+{
+    for (int y = 0; y < a->h; y++)
+    {
+        if (memcmp(a->data + (y * IMAGE_STRIDE(a)), b->data + (y * IMAGE_STRIDE(b)), a->w * a->bpp) != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool bench(const char *name, int w, int h, pixformat_t pixfmt)
+{
+    image_t src, tiled, ref;
+    if (!imlib_image_alloc(&src, w, h, pixfmt, IMLIB_ALLOC_AUTO) || !imlib_image_alloc(&tiled, h, w, pixfmt, IMLIB_ALLOC_AUTO) || !imlib_image_alloc(&ref, h, w, pixfmt, IMLIB_ALLOC_AUTO))
+    {
+        return false;
+    }
+    for (int y = 0; y < h; y++)
+    {
+        for (int x = 0; x < w * src.bpp; x++)
+        {
+            src.data[(y * IMAGE_STRIDE(&src)) + x] = rand();
+        }
+    }
+
+    imlib_rotate(&src, &tiled, 90, false, false); // Warm up.
+    double t0 = now_ms();
+    for (int i = 0; i < REPEAT; i++)
+    {
+        imlib_rotate(&src, &tiled, 90, false, false);
+    }
+    double t_tiled = (now_ms() - t0) / REPEAT;
+
+    rotate_90_per_pixel(&src, &ref);
+    t0 = now_ms();
+    for (int i = 0; i < REPEAT; i++)
+    {
+        rotate_90_per_pixel(&src, &ref);
+    }
+    double t_ref = (now_ms() - t0) / REPEAT;
+
+    bool ok = same_pixels(&tiled, &ref);
+    printf("%-7s %5dx%-5d %8.2f ms tiled %8.2f ms per pixel%s\n", name, w, h, t_tiled, t_ref, ok ? "" : " MISMATCH");
+    imlib_image_free(&src);
+    imlib_image_free(&tiled);
+    imlib_image_free(&ref);
+    return ok;
+}
+
+int main(void)
+{
+    srand(1);
+    bool ok = bench("RGB565", 720, 1280, PIXFORMAT_RGB565);
+    ok &= bench("GRAY", 720, 1280, PIXFORMAT_GRAYSCALE);
+    ok &= bench("RGB565", 2880, 5120, PIXFORMAT_RGB565);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,12 @@
+// Host stand-in for the ESP-IDF header, just enough to build imlib outside ESP-IDF. It includes
+// the same standard headers as the real one, so that missing includes show up on the host too.
+#pragma once
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
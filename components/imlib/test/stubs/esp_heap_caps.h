@@ -0,0 +1,32 @@
+// Host stand-in for the ESP-IDF header, just enough to build imlib outside ESP-IDF. Every
+// capability maps to the C heap.
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_SPIRAM (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+
+static inline void *heap_caps_malloc(size_t size, uint32_t caps)
+{
+    (void) caps;
+    return malloc(size);
+}
+
+static inline void *heap_caps_calloc(size_t n, size_t size, uint32_t caps)
+{
+    (void) caps;
+    return calloc(n, size);
+}
+
+static inline void *heap_caps_aligned_alloc(size_t alignment, size_t size, uint32_t caps)
+{
+    (void) caps;
+    return aligned_alloc(alignment, ((size + alignment - 1) / alignment) * alignment);
+}
+
+static inline void heap_caps_free(void *ptr)
+{
+    free(ptr);
+}
@@ -0,0 +1,153 @@
+#!/usr/bin/env python3
+"""
+font_pack
+
+Pack the glyphs of the dense 16x16 Unicode font that the application needs
+into the sparse font store read by src/font_store.c.
+
+The dense font holds 32 bytes for every code point of the Basic
+Multilingual Plane. The store keeps only the requested glyphs that are not
+blank, found through a two level index:
+
+    header      "IMFS", version, flags, page count, glyph count, data size (16 bytes)
+    page map    256 x uint16, block of the code points U+xx00 - U+xxFF or 0xFFFF
+    blocks      page count x 256 x uint16, glyph number or 0xFFFF
+    offsets     (glyph count + 1) x uint32, start of every glyph in the data,
+                only if the store is compressed (flags bit 0)
+    data        glyphs
+
+Uncompressed glyphs are 32 bytes each. In a compressed store a glyph of
+exactly 32 bytes is stored as it is, anything shorter is PackBits
+compressed. The offsets cost 4 bytes per glyph, which is more than
+PackBits saves on most CJK glyphs, so a store is only compressed when
+that makes it smaller. All values are little endian.
+
+Glyphs are requested as code point ranges and by scanning source files for
+the non ASCII characters they contain.
+"""
+
+import argparse
+import os
+import struct
+import sys
+
+GLYPH_SIZE = 32
+FIRST = 0x80  # ASCII comes from the built in 8x16 font.
+LAST = 0xFFFF
+ABSENT = 0xFFFF
+SCAN_EXTENSIONS = (".c", ".cc", ".cpp", ".h", ".hpp", ".txt", ".json")
+
+
+def parse_ranges(text):
+    """Parse "0x3000-0x30FF;0x4E00" style ranges, separated by ';' or ','."""
+    codes = set()
+    for part in text.replace(",", ";").split(";"):
+        part = part.strip()
+        if not part:
+            continue
+        lo, _, hi = part.partition("-")
+        lo = int(lo, 0)
+        hi = int(hi, 0) if hi else lo
+        codes.update(range(max(lo, FIRST), min(hi, LAST) + 1))
+    return codes
+
+
+def scan_sources(paths):
+    """Collect the non ASCII characters of the source files under paths."""
+    codes = set()
+    for path in paths:
+        if os.path.isfile(path):
+            files = [path]
+        else:
+            files = [os.path.join(root, name) for root, _, names in os.walk(path) for name in names if name.endswith(SCAN_EXTENSIONS)]
+        for name in files:
+            with open(name, "r", encoding="utf-8", errors="ignore") as f:
+                codes.update(ord(c) for c in f.read() if FIRST <= ord(c) <= LAST)
+    return codes
+
+
+def packbits(data):
+    """PackBits: a count n of 0 - 127 is followed by n + 1 literal bytes, -1 - -127 by a byte repeated 1 - n times."""
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        run = 1
+        while (i + run < len(data)) and (run < 128) and (data[i + run] == data[i]):
+            run += 1
+        if run >= 2:
+            out += struct.pack("<bB", 1 - run, data[i])
+            i += run
+            continue
+
+        # Literals run up to the next repeat of three bytes, which is worth a run of its own.
+        start = i
+        while (i < len(data)) and (i - start < 128):
+            if (i + 2 < len(data)) and (data[i] == data[i + 1] == data[i + 2]):
+                break
+            i += 1
+        out += struct.pack("<b", i - start - 1) + data[start:i]
+    return bytes(out)
+
+
+def pack(font, codes, compress):
+    glyphs = {}
+    for code in sorted(codes):
+        glyph = font[code * GLYPH_SIZE:(code + 1) * GLYPH_SIZE]
+        if any(glyph):
+            glyphs[code] = glyph
+
+    pages = sorted({code >> 8 for code in glyphs})
+    page_map = [ABSENT] * 256
+    for i, page in enumerate(pages):
+        page_map[page] = i
+
+    blocks = [ABSENT] * (len(pages) * 256)
+    offsets = []
+    raw = bytearray()
+    data = bytearray()
+    for number, code in enumerate(sorted(glyphs)):
+        blocks[(page_map[code >> 8] * 256) + (code & 0xFF)] = number
+        glyph = glyphs[code]
+        packed = packbits(glyph)
+        offsets.append(len(data))
+        data += packed if len(packed) < GLYPH_SIZE else glyph
+        raw += glyph
+    offsets.append(len(data))
+
+    compress = compress and ((len(data) + (4 * len(offsets))) < len(raw))
+    out = bytearray(b"IMFS")
+    out += struct.pack("<BBHII", 1, 1 if compress else 0, len(pages), len(glyphs), len(data) if compress else len(raw))
+    out += struct.pack("<256H", *page_map)
+    out += struct.pack("<%dH" % len(blocks), *blocks)
+    if compress:
+        out += struct.pack("<%dI" % len(offsets), *offsets)
+        out += data
+    else:
+        out += raw
+    return bytes(out), len(glyphs), len(pages), compress
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Pack the used glyphs of the 16x16 Unicode font into a sparse font store.")
+    parser.add_argument("font", help="dense 16x16 font, 32 bytes per code point")
+    parser.add_argument("output", help="sparse font store to write")
+    parser.add_argument("--ranges", default="", help="code point ranges to keep, e.g. 0x3000-0x30FF;0x4E00-0x9FFF")
+    parser.add_argument("--scan", nargs="*", default=[], help="files or directories whose non ASCII characters are kept")
+    parser.add_argument("--no-compress", action="store_true", help="store every glyph as 32 bytes, even if compressing would be smaller")
+    args = parser.parse_args()
+
+    with open(args.font, "rb") as f:
+        font = f.read()
+    if len(font) != (LAST + 1) * GLYPH_SIZE:
+        sys.exit("font_pack: %s is not a dense 16x16 font" % args.font)
+
+    codes = parse_ranges(args.ranges) | scan_sources(args.scan)
+    store, glyphs, pages, compressed = pack(font, codes, not args.no_compress)
+
+    with open(args.output, "wb") as f:
+        f.write(store)
+    print("font_pack: %d glyphs in %d pages, %s, %d bytes (dense font %d bytes)" % (glyphs, pages, "compressed" if compressed else "uncompressed", len(store), len(font)))
+
+
+if __name__ == "__main__":
+    main()